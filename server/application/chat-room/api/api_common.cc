@@ -1,5 +1,10 @@
 #include "api_common.h"
+#include "async_db_conn.h"
+#include "session_cache.h"
+#include "monitoring/metrics_collector.h"
 
+#include <algorithm>
+#include <ctype.h>
 #include <openssl/rand.h>
 #include <uuid/uuid.h>
 
@@ -41,21 +46,26 @@ int GetUserIdByUsername(int32_t &userid,string &username) {
     CDBManager *db_manager = CDBManager::getInstance();
     CDBConn *db_conn = db_manager->GetDBConn("chatroom_slave");
     AUTO_REL_DBCONN(db_manager, db_conn);   //析构时自动归还连接
+    if (!db_conn) {
+        LOG_ERROR << "get db conn failed";
+        return -1;
+    }
 
    //获取用户id
-    string strSql = FormatString("select id from users where username='%s'", username.c_str());
-    CResultSet *result_set = db_conn->ExecuteQuery(strSql.c_str());
-    if (result_set && result_set->Next()) {  
+    CPrepareStatement *stmt = db_conn->GetStatement("select id from users where username=?");
+    if (!stmt) {
+        return -1;
+    }
+    stmt->SetParam(0, username);
+    if (stmt->ExecuteQuery() && stmt->Fetch()) {
         // 存在在返回
-        userid = result_set->GetInt("id");
+        userid = stmt->GetInt(0);
         LOG_INFO <<"username: " << username <<", userid: " << userid;
         ret = 0;
     } else {                        // 说明用户不存在
         ret = -1;
     }
 
-    delete result_set;
-
     return ret;
 }
  
@@ -64,21 +74,26 @@ int GetUsernameByEmail(string &email,string &username) {
     CDBManager *db_manager = CDBManager::getInstance();
     CDBConn *db_conn = db_manager->GetDBConn("chatroom_slave");
     AUTO_REL_DBCONN(db_manager, db_conn);   //析构时自动归还连接
+    if (!db_conn) {
+        LOG_ERROR << "get db conn failed";
+        return -1;
+    }
 
    //获取用户id
-    string strSql = FormatString("select username from users where email='%s'", email.c_str());
-    CResultSet *result_set = db_conn->ExecuteQuery(strSql.c_str());
-    if (result_set && result_set->Next()) {  
+    CPrepareStatement *stmt = db_conn->GetStatement("select username from users where email=?");
+    if (!stmt) {
+        return -1;
+    }
+    stmt->SetParam(0, email);
+    if (stmt->ExecuteQuery() && stmt->Fetch()) {
         // 存在在返回
-        username = result_set->GetString("username");
+        username = stmt->GetString(0);
         LOG_INFO <<"username: " << username;
         ret = 0;
     } else {                        // 说明用户不存在
         ret = -1;
     }
 
-    delete result_set;
-
     return ret;
 }
  
@@ -129,14 +144,21 @@ int GetUsernameAndUseridByEmail(string email, string &username, int32_t &userid)
     CDBManager *db_manager = CDBManager::getInstance();
     CDBConn *db_conn = db_manager->GetDBConn("chatroom_slave");
     AUTO_REL_DBCONN(db_manager, db_conn);   //析构时自动归还连接
+    if (!db_conn) {
+        LOG_ERROR << "get db conn failed";
+        return -1;
+    }
 
    //获取用户id, 用户名
-    string strSql = FormatString("select id, username from users where email='%s'", email.c_str());
-    CResultSet *result_set = db_conn->ExecuteQuery(strSql.c_str());
-    if (result_set && result_set->Next()) {  
+    CPrepareStatement *stmt = db_conn->GetStatement("select id, username from users where email=?");
+    if (!stmt) {
+        return -1;
+    }
+    stmt->SetParam(0, email);
+    if (stmt->ExecuteQuery() && stmt->Fetch()) {
         // 存在在返回
-        username = result_set->GetString("username");
-        userid = result_set->GetInt("id");
+        userid = stmt->GetInt(0);
+        username = stmt->GetString(1);
         
         LOG_INFO <<"username: " << username;
         ret = 0;
@@ -144,13 +166,22 @@ int GetUsernameAndUseridByEmail(string email, string &username, int32_t &userid)
         ret = -1;
     }
 
-    delete result_set;
-
     return ret;
 }
 
 
 int ApiGetUserInfoByCookie(string &username, int32_t &userid, string  &email, string cookie) {
+    // 本地缓存命中时不访问 Redis 和 MySQL，token 被删除或过期时由 Redis 的失效消息清掉
+    SessionCache &session_cache = SessionCache::GetInstance();
+    SessionInfo session;
+    if (session_cache.Get(cookie, session)) {
+        email = session.email;
+        username = session.username;
+        userid = session.userid;
+        return 0;
+    }
+    uint64_t epoch = session_cache.GetEpoch();
+
     CacheManager *cache_manager = CacheManager::getInstance();
     CacheConn *cache_conn = cache_manager->GetCacheConn("token");
     AUTO_REL_CACHECONN(cache_manager, cache_conn);
@@ -160,7 +191,14 @@ int ApiGetUserInfoByCookie(string &username, int32_t &userid, string  &email, st
         if(email.empty()) {
             return -1;
         } else {
-            return GetUsernameAndUseridByEmail(email, username, userid);
+            int ret = GetUsernameAndUseridByEmail(email, username, userid);
+            if (ret == 0) {
+                session.email = email;
+                session.username = username;
+                session.userid = userid;
+                session_cache.Put(cookie, session, epoch, cache_conn);
+            }
+            return ret;
         }
     } else {
         return -1;
@@ -172,14 +210,21 @@ int ApiGetUserInfoById(const string &userid, string &username, string &avatar) {
     CDBManager *db_manager = CDBManager::getInstance();
     CDBConn *db_conn = db_manager->GetDBConn("user_centre");
     AUTO_REL_DBCONN(db_manager, db_conn);   //析构时自动归还连接
+    if (!db_conn) {
+        LOG_ERROR << "get db conn failed";
+        return -1;
+    }
 
     //根据userid获取用户名和头像
-    string strSql = FormatString("select * from user where id='%s'", userid.c_str());
-    CResultSet *result_set = db_conn->ExecuteQuery(strSql.c_str());
-    if (result_set && result_set->Next()) {  
+    CPrepareStatement *stmt = db_conn->GetStatement("select userName, avatarUrl from user where id=?");
+    if (!stmt) {
+        return -1;
+    }
+    stmt->SetParam(0, userid);
+    if (stmt->ExecuteQuery() && stmt->Fetch()) {
         // 用户存在，获取用户名
-        username = result_set->GetString("userName");
-        avatar = result_set->GetString("avatarUrl");
+        username = stmt->GetString(0);
+        avatar = stmt->GetString(1);
         ret = 0;
     } else {                        
         // 用户不存在
@@ -187,8 +232,111 @@ int ApiGetUserInfoById(const string &userid, string &username, string &avatar) {
         ret = -1;
     }
 
+    return ret;
+}
+
+// id 是数值列，纯数字的 userid 可以直接拼进 SQL，不需要转义
+static bool IsNumericUserId(const string &userid) {
+    return !userid.empty() && userid.size() <= 20 &&
+           std::all_of(userid.begin(), userid.end(), [](char c) { return isdigit(static_cast<unsigned char>(c)); });
+}
+
+void ApiGetUserInfoByIdAsync(const string &userid, UserInfoCallback callback) {
+    // 只有纯数字的 userid 才走异步连接
+    AsyncDBConn *async_conn = IsNumericUserId(userid) ? AsyncDBConn::ForCurrentLoop("user_centre", userid) : nullptr;
+    if (!async_conn) {
+        string username;
+        string avatar;
+        int ret = ApiGetUserInfoById(userid, username, avatar);
+        callback(ret, username, avatar);
+        return;
+    }
+
+    string sql = "select userName, avatarUrl from user where id=" + userid;
+    async_conn->Query(sql, [userid, callback = std::move(callback)](int ret, CResultSet *result_set) {
+        if (ret != 0) {
+            // 异步连接断开或语句出错时直接失败，不在 loop 线程上改走同步连接池：
+            // 数据库故障时同步查询会一直卡住 loop，调用方按未知用户处理
+            MetricsCollector::GetInstance().IncrementCounter("db_async", "failed");
+            callback(-1, "", "");
+            return;
+        }
+        MetricsCollector::GetInstance().IncrementCounter("db_async", "ok");
+        if (result_set && result_set->Next()) {
+            callback(0, string(result_set->GetStringView(0)), string(result_set->GetStringView(1)));
+        } else {
+            // 用户不存在
+            LOG_WARN << "User not found for userid: " << userid;
+            callback(-1, "", "");
+        }
+    });
+}
+
+// 拼出批量查询的 SQL；不是数字的 userid 不可能匹配数值列，直接跳过，没有可查的返回空串
+static string BuildUserInfosSql(const std::vector<string> &userids) {
+    string id_list;
+    for (const string &userid : userids) {
+        if (IsNumericUserId(userid)) {
+            id_list += (id_list.empty() ? "" : ",") + userid;
+        }
+    }
+    if (id_list.empty()) {
+        return "";
+    }
+    return "select id, userName, avatarUrl from user where id in (" + id_list + ")";
+}
+
+static void ReadUserInfos(CResultSet *result_set, UserInfoMap &users) {
+    while (result_set->Next()) {
+        UserInfo &user = users[string(result_set->GetStringView(0))];
+        user.username = string(result_set->GetStringView(1));
+        user.avatar = string(result_set->GetStringView(2));
+    }
+}
+
+int ApiGetUserInfosByIds(const std::vector<string> &userids, UserInfoMap &users) {
+    string sql = BuildUserInfosSql(userids);
+    if (sql.empty()) {
+        return 0;
+    }
+    CDBManager *db_manager = CDBManager::getInstance();
+    CDBConn *db_conn = db_manager->GetDBConn("user_centre");
+    AUTO_REL_DBCONN(db_manager, db_conn);   //析构时自动归还连接
+    if (!db_conn) {
+        LOG_ERROR << "get db conn failed";
+        return -1;
+    }
+    CResultSet *result_set = db_conn->ExecuteQuery(sql.c_str());
+    if (!result_set) {
+        return -1;
+    }
+    ReadUserInfos(result_set, users);
     delete result_set;
+    return 0;
+}
 
-    return ret;
+void ApiGetUserInfosByIdsAsync(const string &order_key, const std::vector<string> &userids, UserInfosCallback callback) {
+    AsyncDBConn *async_conn = AsyncDBConn::ForCurrentLoop("user_centre", order_key);
+    string sql = BuildUserInfosSql(userids);
+    if (!async_conn || sql.empty()) {
+        UserInfoMap users;
+        int ret = ApiGetUserInfosByIds(userids, users);
+        callback(ret, users);
+        return;
+    }
+
+    async_conn->Query(sql, [callback = std::move(callback)](int ret, CResultSet *result_set) {
+        UserInfoMap users;
+        if (ret != 0) {
+            // 和单个查询一样直接失败，不在 loop 线程上改走同步连接池
+            MetricsCollector::GetInstance().IncrementCounter("db_async", "failed");
+            callback(-1, users);
+            return;
+        }
+        MetricsCollector::GetInstance().IncrementCounter("db_async", "ok");
+        if (result_set) {
+            ReadUserInfos(result_set, users);
+        }
+        callback(0, users);
+    });
 }
- 
\ No newline at end of file
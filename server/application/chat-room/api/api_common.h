@@ -4,7 +4,10 @@
 #include "db_pool.h"    //MySQL操作头文件
 #include <jsoncpp/json/json.h> // jsoncpp头文件
 #include "muduo/base/Logging.h" // Logger日志头文件
+#include <functional>
 #include <string>
+#include <unordered_map>
+#include <vector>
 #include "base64.h" 
 #include "md5.h"
 
@@ -75,6 +78,24 @@ int GetUserIdByUsername(int32_t &userid,string &username);
 
 int ApiGetUserInfoByCookie(string &username, int32_t &userid, string  &email, string cookie);
 int ApiGetUserInfoById(const string &userid, string &username, string &avatar);
+// ret 含义同 ApiGetUserInfoById
+typedef std::function<void(int ret, const string &username, const string &avatar)> UserInfoCallback;
+// 在 IO loop 线程上用本 loop 的 MySQL 非阻塞连接查询，回调在同一个 loop 线程执行，同一个 userid 的回调按调用顺序执行
+// 没有开启 db_async_enable 或不在 IO loop 线程时改用同步的 ApiGetUserInfoById（此时在调用线程内回调）；
+// 异步查询失败（断线、超时）时直接以 -1 回调，不退回同步连接池阻塞 loop
+void ApiGetUserInfoByIdAsync(const string &userid, UserInfoCallback callback);
+
+// 用户名和头像，批量查询（如历史消息的发送者）时使用
+struct UserInfo {
+    string username;
+    string avatar;
+};
+typedef std::unordered_map<string, UserInfo> UserInfoMap;  // userid -> 用户信息
+// 一条 IN 查询取一批用户的信息，查不到的 userid 不在结果中；拿不到连接或查询出错返回-1
+int ApiGetUserInfosByIds(const std::vector<string> &userids, UserInfoMap &users);
+typedef std::function<void(int ret, const UserInfoMap &users)> UserInfosCallback;
+// 异步版本，规则同 ApiGetUserInfoByIdAsync；order_key 相同的查询按调用顺序回调（一般传当前连接的 userid）
+void ApiGetUserInfosByIdsAsync(const string &order_key, const std::vector<string> &userids, UserInfosCallback callback);
 
 string RandomString(const int len);
 #endif
\ No newline at end of file
@@ -40,6 +40,8 @@ int encodeLoginJson(api_error_id input, string message, string &str_json) {
 }
 
 
+// 同步查询 MySQL。num_threads=0（默认）时登录请求直接在 IO loop 线程处理，查询期间这个 loop 上的其他连接都要等；
+// 登录量大或数据库可能变慢时配置 num_threads，把 HTTP 请求交给业务线程池
 int verifyUserPassword(string &email, string &password) {
     int ret = -1;
     // 只能使用email
@@ -51,30 +53,16 @@ int verifyUserPassword(string &email, string &password) {
         return -1;
     }
 
-    // 打印当前数据库的所有表
-    LOG_INFO << "=== 查询数据库表信息 ===";
-    string showTablesSQL = "SHOW TABLES";
-    CResultSet *tables_result = db_conn->ExecuteQuery(showTablesSQL.c_str());
-    if (tables_result) {
-        LOG_INFO << "当前数据库中的表：";
-        while (tables_result->Next()) {
-            string table_name = tables_result->GetString(0);  // SHOW TABLES 返回的第一列是表名
-            LOG_INFO << "  - " << table_name;
-        }
-        delete tables_result;
-    } else {
-        LOG_ERROR << "查询数据库表失败";
+    //根据email查询密码，email 作为参数绑定，不拼进 SQL
+    CPrepareStatement *stmt = db_conn->GetStatement("select username, password_hash, salt from users where email=?");
+    if (!stmt) {
+        return -1;
     }
-    LOG_INFO << "=== 表信息查询完成 ===";
-
-    //根据email查询密码
-    string strSql = FormatString("select username, password_hash, salt from users where email='%s'", email.c_str());
-    LOG_INFO << "执行:" << strSql;
-    CResultSet *result_set = db_conn->ExecuteQuery(strSql.c_str());
-    if (result_set && result_set->Next()) { //如果存在则读取密码 
-        string username = result_set->GetString("username");
-        string db_password_hash = result_set->GetString("password_hash");
-        string salt = result_set->GetString("salt");
+    stmt->SetParam(0, email);
+    if (stmt->ExecuteQuery() && stmt->Fetch()) { //如果存在则读取密码 
+        string username = stmt->GetString(0);
+        string db_password_hash = stmt->GetString(1);
+        string salt = stmt->GetString(2);
         MD5 md5(password + salt);  // 计算出新的密码
         string client_password_hash = md5.toString();  //  计算出新的密码
         if(db_password_hash == client_password_hash) {
@@ -88,9 +76,6 @@ int verifyUserPassword(string &email, string &password) {
         ret = -1;
     }
 
-    if(result_set)
-        delete result_set;
-
     return ret;
 }
 
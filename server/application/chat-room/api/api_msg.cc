@@ -1,63 +1,102 @@
 #include "api_msg.h"
+#include <chrono>
+#include <cinttypes>
+#include <set>
 #include "muduo/base/Logging.h"
 
 using namespace std;
 
-int ApiGetRoomHistory(Room &room, MessageBatch &message_batch, const int msg_count) 
+// 消息ID形如 "1635724800123-0"，前半部分是写入时的毫秒时间戳
+static uint64_t StreamIdMs(const string &id)
 {
-    CacheManager *cache_manager = CacheManager::getInstance();
-    CacheConn *cache_conn = cache_manager->GetCacheConn("msg");
-    AUTO_REL_CACHECONN(cache_manager, cache_conn);
+    return strtoull(id.c_str(), NULL, 10);
+}
 
-    std::string stream_ref =   "+";
-    if (!room.history_last_message_id.empty()) {
-        stream_ref = "(" + room.history_last_message_id;
-    }
-    std::vector<std::pair<string, string>> msgs;
-    if(cache_conn->GetXrevrange(room.room_id, stream_ref, "-", msg_count, msgs)) {
-        //封装
-        for(size_t i = 0; i < msgs.size(); i++) {
-            // msgs[i].first = "1635724800123-0" (消息ID)
-            // msgs[i].second = "{\"content\":\"Hello World\",\"timestamp\":1635724800,\"user_id\":123}"
+// MySQL 层的游标前缀，后面是 "timestamp:id"；Redis 层的游标就是 stream 消息ID
+static const char *kDbCursorPrefix = "db:";
 
-            Message msg;
-            msg.id = msgs[i].first;   //这里保存的是消息id
-            room.history_last_message_id = msg.id;  // 保存最后一个消息的id
+bool DecodeStreamMessage(const StreamEntry &entry, Message &msg, string *room_id)
+{
+    msg.id = entry.id;
+    msg.timestamp = 0;
+    bool has_content = false;
+    bool has_user_id = false;
+    for (const auto &field : entry.fields) {
+        if (field.first == "content") {
+            msg.content = field.second;
+            has_content = true;
+        } else if (field.first == "user_id") {
+            msg.user_id = field.second;
+            has_user_id = true;
+        } else if (field.first == "timestamp") {
+            msg.timestamp = strtoull(field.second.c_str(), NULL, 10);
+        } else if (field.first == "room_id") {
+            if (room_id) {
+                *room_id = field.second;
+            }
+        } else if (field.first == "payload") {
+            // 旧格式：整条消息是一个 JSON 字段，裁剪掉之前 stream 里还会有
             Json::Value root;
             Json::Reader jsonReader;
-            bool res = jsonReader.parse(msgs[i].second, root);
-            if (!res) {
-                LOG_ERROR << "parse redis msg failed ";
-                return -1;
-            }
-            if (!root.isObject()) {
-                LOG_ERROR << "parsed JSON is not an object"; //增强处理
-                return -1;
-            }
-            if (root["content"].isNull()) {
-                LOG_ERROR << "content null";
-                return -1;
+            if (!jsonReader.parse(field.second, root) || !root.isObject()) {
+                return false;
             }
             msg.content = root["content"].asString();
-
-            if (root["user_id"].isNull()) {
-                LOG_ERROR << "content null";
-                return -1;
-            }
             msg.user_id = root["user_id"].asString();
-
-            if (root["timestamp"].isNull()) {
-                LOG_ERROR << "timestamp null";
-                return -1;
-            }
             msg.timestamp = root["timestamp"].asUInt64();
-            message_batch.messages.push_back(msg);
+            has_content = !root["content"].isNull();
+            has_user_id = !root["user_id"].isNull();
         }
-        if(msgs.size() < static_cast<size_t>(msg_count))
-            message_batch.has_more = false;     //读取到消息数量 比要求的少了，所以判定为没有更多数据可以读取了
-        else
-            message_batch.has_more = true;
-        return 0;
+    }
+    return has_content && has_user_id;
+}
+
+bool GetRoomHistoryStreamStart(const Room &room, string &start)
+{
+    if (room.history_last_message_id.compare(0, strlen(kDbCursorPrefix), kDbCursorPrefix) == 0) {
+        return false;   // 已经翻到 MySQL 层
+    }
+    start = room.history_last_message_id.empty() ? "+" : "(" + room.history_last_message_id;
+    return true;
+}
+
+int FillRoomHistoryFromStream(Room &room, std::vector<StreamEntry> &entries, MessageBatch &message_batch,
+                              const int msg_count)
+{
+    //按字段直接填充 Message
+    message_batch.messages.reserve(message_batch.messages.size() + entries.size());
+    for(size_t i = 0; i < entries.size(); i++) {
+        Message msg;
+        room.history_last_message_id = entries[i].id;  // 保存最后一个消息的id
+        if (!DecodeStreamMessage(entries[i], msg)) {
+            LOG_ERROR << "decode redis msg failed, id: " << entries[i].id;
+            return -1;
+        }
+        message_batch.messages.push_back(std::move(msg));
+    }
+    if(entries.size() < static_cast<size_t>(msg_count))
+        message_batch.has_more = false;     //读取到消息数量 比要求的少了，所以判定为没有更多数据可以读取了
+    else
+        message_batch.has_more = true;
+    return 0;
+}
+
+int ApiGetRoomHistory(Room &room, MessageBatch &message_batch, const int msg_count) 
+{
+    CacheManager *cache_manager = CacheManager::getInstance();
+    CacheConn *cache_conn = cache_manager->GetCacheConn("msg", room.room_id);
+    AUTO_REL_CACHECONN(cache_manager, cache_conn);
+    if (!cache_conn) {
+        return -1;
+    }
+
+    std::string stream_ref;
+    if (!GetRoomHistoryStreamStart(room, stream_ref)) {
+        return -1;
+    }
+    std::vector<StreamEntry> entries;
+    if(cache_conn->GetXrevrange(room.room_id, stream_ref, "-", msg_count, entries)) {
+        return FillRoomHistoryFromStream(room, entries, message_batch, msg_count);
     } else {
         return -1;
     }
@@ -85,212 +124,522 @@ string SerializeMessagesToJson(const std::vector<Message>& msgs) {
     return Json::writeString(writer, root);
 }
 
-// 将 std::vector<Message> 序列化为 JSON 字符串
-string SerializeMessageToJson(const Message msg) {
-    Json::Value root; // JSON 根节点
-    Json::StreamWriterBuilder writer; // JSON 写入器
-    writer.settings_["indentation"] = "";  // 禁用缩进和换行
-    // 填充消息字段
-    root["content"] = msg.content;
-    root["timestamp"] = (Json::UInt64) msg.timestamp;
-    root["user_id"] = msg.user_id;
-
-    // 将 JSON 树转换为字符串
-    return Json::writeString(writer, root);
-}
-
 int ApiStoreMessage(string room_name, std::vector<Message> &msgs)
 {
     CacheManager *cache_manager = CacheManager::getInstance();
-    CacheConn *cache_conn = cache_manager->GetCacheConn("msg");
+    CacheConn *cache_conn = cache_manager->GetCacheConn("msg", room_name);
     AUTO_REL_CACHECONN(cache_manager, cache_conn);
+    if (!cache_conn) {
+        return -1;
+    }
 
+    // 每个字段单独存，不再包一层 JSON；全部 XADD 放在一个管道里
+    CacheBatch batch;
+    for(size_t i = 0; i < msgs.size(); i++) {
+        string timestamp = std::to_string(msgs[i].timestamp);
+        batch.Xadd(room_name, msgs[i].id.empty() ? "*" : msgs[i].id,
+                   {{"user_id", msgs[i].user_id}, {"content", msgs[i].content},
+                    {"timestamp", timestamp}, {"room_id", room_name}});
+    }
+    if (!cache_conn->Execute(batch)) {
+        LOG_ERROR << "ApiStoreMessage room_name: " << room_name << " failed" ;
+        return -1;
+    }
     for(size_t i = 0; i < msgs.size(); i++) {
-        //先将msgs做序列化
-        string json_msg = SerializeMessageToJson(msgs[i]);
-        std::vector<std::pair<string, string>>  field_value_pairs;
-        LOG_INFO << "payload: " << json_msg;
-        field_value_pairs.push_back({"payload", json_msg});
-        string id = "*";
-        bool ret = cache_conn->Xadd(room_name, id, field_value_pairs);
-        if(!ret) {
+        if (!batch.Ok(i)) {
             LOG_ERROR << "ApiStoreMessage room_name: " << room_name << " failed" ;
             return -1;
         }
-        LOG_INFO << "msgs id: " << id;
-        msgs[i].id = id;
+        msgs[i].id = batch.GetString(i);
     }
     return 0;
 }
 
-// 分级存储：实时存Redis，标记待持久化
-int ApiStoreMessageTiered(string room_name, std::vector<Message> &msgs)
+// XADD 和持久化标记放在一个脚本里原子执行，一条消息一次往返，不再额外写一份持久化队列：
+// 持久化线程通过消费组直接读取房间 stream。stream 第一次写入时登记并创建消费组（从0开始，包含本条消息），
+// 之后每次写入只把 stream 加入待持久化集合
+// 消息带着本地生成的ID（MsgIdGenerator）写入；多个节点写同一个房间时显式ID可能不大于 stream 的最后一个ID，
+// 只有这种冲突改用 '*' 由 Redis 分配，返回值就是最终的消息ID，调用方发现和原ID不同时要通知客户端；
+// 其他错误（WRONGTYPE、OOM 等）原样返回，不改写ID
+// 消息字段直接作为 stream 字段存储（user_id、content、timestamp、room_id），读取时不需要解析 JSON
+// 每条消息都会调用，用 EVALSHA 只发送 SHA1
+// KEYS[1]: 房间stream  KEYS[2]: stream登记集合  KEYS[3]: 待持久化集合
+// ARGV[1]: user_id  ARGV[2]: content  ARGV[3]: timestamp  ARGV[4]: room_id  ARGV[5]: 消费组  ARGV[6]: 消息ID或 '*'
+static const CacheScript kStoreMessageScript(
+    "local id = redis.pcall('XADD', KEYS[1], ARGV[6], 'user_id', ARGV[1], 'content', ARGV[2], "
+    "'timestamp', ARGV[3], 'room_id', ARGV[4]) "
+    "if type(id) == 'table' and id.err then "
+    "if ARGV[6] == '*' or not string.find(id.err, 'equal or smaller', 1, true) then "
+    "return redis.error_reply(id.err) "
+    "end "
+    "id = redis.call('XADD', KEYS[1], '*', 'user_id', ARGV[1], 'content', ARGV[2], "
+    "'timestamp', ARGV[3], 'room_id', ARGV[4]) "
+    "end "
+    "if redis.call('SADD', KEYS[2], KEYS[1]) == 1 then "
+    "redis.pcall('XGROUP', 'CREATE', KEYS[1], ARGV[5], '0') "
+    "end "
+    "redis.call('SADD', KEYS[3], KEYS[1]) "
+    "return id");
+
+size_t AppendStoreMessageCommand(const string &room_id, const Message &msg, CacheBatch &batch)
+{
+    string timestamp = std::to_string(msg.timestamp);
+    return batch.EvalSha(kStoreMessageScript, {room_id, k_persist_streams_key, k_persist_dirty_key},
+                         {msg.user_id, msg.content, timestamp, room_id, k_persist_group,
+                          msg.id.empty() ? "*" : msg.id});
+}
+
+// 节点号租约的 key 为 k_msg_id_node_key_prefix + 节点号，值为租用者
+// 从 ARGV[3] 开始依次尝试，占到第一个空闲的节点号
+// ARGV[1]: key 前缀  ARGV[2]: 租用者  ARGV[3]: 起始节点号  ARGV[4]: 节点号个数  ARGV[5]: 租约秒数
+static const CacheScript kAcquireMsgIdNodeScript(
+    "local count = tonumber(ARGV[4]) "
+    "for i = 0, count - 1 do "
+    "local node = (tonumber(ARGV[3]) + i) % count "
+    "if redis.call('SET', ARGV[1] .. node, ARGV[2], 'NX', 'EX', ARGV[5]) then return node end "
+    "end "
+    "return -1");
+
+// 还是自己的租约就延期；已经过期且没有被占用时重新占上；被其他节点占用返回1
+// KEYS[1]: 节点号 key  ARGV[1]: 租用者  ARGV[2]: 租约秒数
+static const CacheScript kRenewMsgIdNodeScript(
+    "local owner = redis.call('GET', KEYS[1]) "
+    "if owner == ARGV[1] then redis.call('EXPIRE', KEYS[1], ARGV[2]) return 0 end "
+    "if not owner then redis.call('SET', KEYS[1], ARGV[1], 'EX', ARGV[2]) return 0 end "
+    "return 1");
+
+int ApiAcquireMsgIdNode(const string &owner, int node_count, int ttl_seconds)
 {
-    // 1. 实时存储到Redis（快速响应用户）
     CacheManager *cache_manager = CacheManager::getInstance();
-    CacheConn *cache_conn = cache_manager->GetCacheConn("msg");
+    // 租约 key 都按同一个分片 key 路由，配置 msg_shards 时租用和续约也落在同一个节点
+    CacheConn *cache_conn = cache_manager->GetCacheConn("msg", k_msg_id_node_key_prefix);
     AUTO_REL_CACHECONN(cache_manager, cache_conn);
-
     if (!cache_conn) {
-        LOG_ERROR << "Get Cache connection failed";
+        LOG_ERROR << "Get cache connection failed";
         return -1;
     }
-
-    for(size_t i = 0; i < msgs.size(); i++) {
-        // 存储到Redis Stream
-        string json_msg = SerializeMessageToJson(msgs[i]);
-        std::vector<std::pair<string, string>> field_value_pairs;
-        field_value_pairs.push_back({"payload", json_msg});
-        field_value_pairs.push_back({"room_id", room_name}); // 添加room_id便于批量处理
-        string redis_id = "*";
-        
-        bool redis_ret = cache_conn->Xadd(room_name, redis_id, field_value_pairs);
-        if (!redis_ret) {
-            LOG_ERROR << "Store message to Redis failed for room: " << room_name;
-            return -1;
-        }
-        
-        LOG_INFO << "Message stored to Redis with id: " << redis_id;
-        msgs[i].id = redis_id;
-
-        // 2. 添加到待持久化队列（用Redis List作为队列）
-        Json::Value persist_msg;
-        persist_msg["redis_id"] = redis_id;
-        persist_msg["room_id"] = room_name;
-        persist_msg["user_id"] = msgs[i].user_id;
-        persist_msg["content"] = msgs[i].content;
-        persist_msg["timestamp"] = (Json::UInt64)msgs[i].timestamp;
-        
-        Json::StreamWriterBuilder writer_builder;
-        writer_builder.settings_["indentation"] = "";
-        string persist_json = Json::writeString(writer_builder, persist_msg);
-
-        // 推入持久化队列
-        long queue_len = cache_conn->Lpush("msg_persist_queue", persist_json);
-        if (queue_len > 0) {
-            LOG_DEBUG << "Added message to persist queue, queue length: " << queue_len;
-        }
+    // 按租用者散开起点，多个节点同时启动时不会都从 0 开始争抢
+    string start = std::to_string(std::hash<string>()(owner) % node_count);
+    string count = std::to_string(node_count);
+    string ttl = std::to_string(ttl_seconds);
+    CacheBatch batch;
+    size_t index = batch.EvalSha(kAcquireMsgIdNodeScript, {}, {k_msg_id_node_key_prefix, owner, start, count, ttl});
+    if (!cache_conn->Execute(batch) || !batch.Ok(index)) {
+        LOG_ERROR << "acquire msg id node failed";
+        return -1;
     }
-    
-    return 0;
+    return static_cast<int>(batch.GetInteger(index));
 }
 
-// 批量持久化函数（定时调用）
-int ApiBatchPersistMessages(int batch_size)
+int ApiRenewMsgIdNode(int node_id, const string &owner, int ttl_seconds)
 {
     CacheManager *cache_manager = CacheManager::getInstance();
-    CacheConn *cache_conn = cache_manager->GetCacheConn("msg");
+    // 和 ApiAcquireMsgIdNode 使用同一个分片
+    CacheConn *cache_conn = cache_manager->GetCacheConn("msg", k_msg_id_node_key_prefix);
     AUTO_REL_CACHECONN(cache_manager, cache_conn);
+    if (!cache_conn) {
+        LOG_ERROR << "Get cache connection failed";
+        return -1;
+    }
+    string key = k_msg_id_node_key_prefix + std::to_string(node_id);
+    string ttl = std::to_string(ttl_seconds);
+    CacheBatch batch;
+    size_t index = batch.EvalSha(kRenewMsgIdNodeScript, {key}, {owner, ttl});
+    if (!cache_conn->Execute(batch) || !batch.Ok(index)) {
+        return -1;
+    }
+    return batch.GetInteger(index) == 0 ? 0 : 1;
+}
 
-    CDBManager *db_manager = CDBManager::getInstance();
-    CDBConn *db_conn = db_manager->GetDBConn("chatroom_master");
-    AUTO_REL_DBCONN(db_manager, db_conn);
+static StreamRetention s_default_retention;
+static std::unordered_map<string, StreamRetention> s_room_retentions;
 
-    if (!cache_conn || !db_conn) {
-        LOG_ERROR << "Get connection failed";
-        return -1;
+bool ParseStreamRetention(const string &spec, StreamRetention &retention)
+{
+    size_t colon = spec.find(':');
+    if (colon == string::npos) {
+        return false;
+    }
+    string type = spec.substr(0, colon);
+    int value = atoi(spec.c_str() + colon + 1);
+    if (value < 0) {
+        return false;
+    }
+    retention = StreamRetention();
+    if (type == "count") {
+        retention.max_len = value;
+    } else if (type == "age") {
+        retention.max_age_seconds = value;
+    } else {
+        return false;
     }
+    return true;
+}
+
+void SetDefaultStreamRetention(const StreamRetention &retention)
+{
+    s_default_retention = retention;
+}
 
-    // 从队列中批量获取待持久化的消息
-    list<string> msg_list;
-    bool ret = cache_conn->Lrange("msg_persist_queue", 0, batch_size - 1, msg_list);
-    if (!ret || msg_list.empty()) {
-        LOG_DEBUG << "No messages to persist";
+void SetRoomStreamRetention(const string &room_id, const StreamRetention &retention)
+{
+    s_room_retentions[room_id] = retention;
+}
+
+const StreamRetention &GetStreamRetention(const string &room_id)
+{
+    auto it = s_room_retentions.find(room_id);
+    return it != s_room_retentions.end() ? it->second : s_default_retention;
+}
+
+// 按保留策略裁剪房间 stream，但不越过持久化水位：
+// 水位是消费组中最早的待确认消息，没有待确认消息时是消费组最后投递的消息，水位之前的消息都已经入库
+// XADD 时带 MAXLEN 看不到水位，所以裁剪放在持久化线程确认之后用 XTRIM MINID ~ 执行（需要 Redis 6.2+）
+// KEYS[1]: 房间stream  ARGV[1]: 消费组  ARGV[2]: 最多保留条数  ARGV[3]: 早于这个毫秒时间戳的消息可以裁剪
+// 每批持久化都会对每个 stream 调一次，用 EVALSHA 只发送 SHA1
+static const CacheScript kTrimStreamScript(
+    "local function id_less(a, b) "
+    "  local ams, aseq = string.match(a, '(%d+)-(%d+)') "
+    "  local bms, bseq = string.match(b, '(%d+)-(%d+)') "
+    "  if tonumber(ams) ~= tonumber(bms) then return tonumber(ams) < tonumber(bms) end "
+    "  return tonumber(aseq) < tonumber(bseq) "
+    "end "
+    "local len = redis.call('XLEN', KEYS[1]) "
+    "local bound = nil "
+    "local max_len = tonumber(ARGV[2]) "
+    "if max_len > 0 and len > max_len then "
+    "  local excess = math.min(len - max_len, 1000) "
+    "  local r = redis.call('XRANGE', KEYS[1], '-', '+', 'COUNT', excess + 1) "
+    "  bound = r[#r][1] "
+    "end "
+    "local min_ms = tonumber(ARGV[3]) "
+    "if min_ms > 0 then "
+    "  local age_bound = min_ms .. '-0' "
+    "  local first = redis.call('XRANGE', KEYS[1], '-', '+', 'COUNT', 1) "
+    "  if first[1] and id_less(first[1][1], age_bound) and (bound == nil or id_less(bound, age_bound)) then "
+    "    bound = age_bound "
+    "  end "
+    "end "
+    "if bound == nil then return '0,' .. len end "
+    "local watermark = nil "
+    "local pending = redis.call('XPENDING', KEYS[1], ARGV[1]) "
+    "if pending[1] > 0 then "
+    "  watermark = pending[2] "
+    "else "
+    "  for _, group in ipairs(redis.call('XINFO', 'GROUPS', KEYS[1])) do "
+    "    local name, last_id "
+    "    for i = 1, #group, 2 do "
+    "      if group[i] == 'name' then name = group[i + 1] elseif group[i] == 'last-delivered-id' then last_id = group[i + 1] end "
+    "    end "
+    "    if name == ARGV[1] then watermark = last_id end "
+    "  end "
+    "end "
+    "if watermark == nil then return '0,' .. len end "
+    "if id_less(watermark, bound) then bound = watermark end "
+    "local trimmed = redis.call('XTRIM', KEYS[1], 'MINID', '~', bound) "
+    "return trimmed .. ',' .. (len - trimmed)");
+
+bool AppendTrimStreamCommand(const string &room_id, CacheBatch &batch)
+{
+    const StreamRetention &retention = GetStreamRetention(room_id);
+    if (retention.max_len <= 0 && retention.max_age_seconds <= 0) {
+        return false;
+    }
+    uint64_t min_ms = 0;
+    if (retention.max_age_seconds > 0) {
+        uint64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        min_ms = now_ms - static_cast<uint64_t>(retention.max_age_seconds) * 1000;
+    }
+    string max_len = std::to_string(retention.max_len);
+    string min_ms_str = std::to_string(min_ms);
+    batch.EvalSha(kTrimStreamScript, {room_id}, {k_persist_group, max_len, min_ms_str});
+    return true;
+}
+
+// 分级存储：实时存Redis，标记待持久化
+// 每条消息只序列化一次；所有消息的存储脚本通过一个管道发出，整批只有一次网络往返
+int ApiStoreMessageTiered(string room_name, std::vector<Message> &msgs)
+{
+    if (msgs.empty()) {
         return 0;
     }
 
-    LOG_INFO << "Batch persisting " << msg_list.size() << " messages to MySQL";
+    CacheManager *cache_manager = CacheManager::getInstance();
+    CacheConn *cache_conn = cache_manager->GetCacheConn("msg", room_name);
+    AUTO_REL_CACHECONN(cache_manager, cache_conn);
 
-    // 构建批量插入SQL
-    string sql = "INSERT INTO messages (redis_id, room_id, user_id, content, timestamp) VALUES ";
-    bool first = true;
-    
-    for (const auto& msg_json : msg_list) {
-        Json::Value msg;
-        Json::Reader reader;
-        if (!reader.parse(msg_json, msg)) {
-            LOG_ERROR << "Parse persist message failed: " << msg_json;
-            continue;
-        }
+    if (!cache_conn) {
+        LOG_ERROR << "Get Cache connection failed";
+        return -1;
+    }
 
-        if (!first) sql += ",";
-        sql += FormatString("('%s', '%s', '%s', '%s', %lu)",
-            msg["redis_id"].asString().c_str(),
-            msg["room_id"].asString().c_str(),
-            msg["user_id"].asString().c_str(),
-            msg["content"].asString().c_str(),
-            msg["timestamp"].asUInt64()
-        );
-        first = false;
-    }
-
-    // 执行批量插入
-    bool insert_ret = db_conn->ExecuteUpdate(sql.c_str());
-    if (insert_ret) {
-        // 成功后清空已处理的消息队列（简单方案：删除整个队列）
-        // TODO: 后续可以优化为只删除已处理的部分
-        cache_conn->Del("msg_persist_queue");
-        LOG_INFO << "Successfully persisted " << msg_list.size() << " messages to MySQL";
-        return msg_list.size();
-    } else {
-        LOG_ERROR << "Batch persist to MySQL failed: " << sql;
+    CacheBatch batch;
+    for (size_t i = 0; i < msgs.size(); i++) {
+        AppendStoreMessageCommand(room_name, msgs[i], batch);
+    }
+
+    if (!cache_conn->Execute(batch)) {
+        LOG_ERROR << "Store message to Redis failed for room: " << room_name;
+        return -1;
+    }
+    bool ret = true;
+    for (size_t i = 0; i < msgs.size(); i++) {
+        msgs[i].id = batch.GetString(i);    // 失败的消息ID为空
+        ret = ret && batch.Ok(i);
+    }
+    if (!ret) {
+        LOG_ERROR << "Store message to Redis partially failed for room: " << room_name;
         return -1;
     }
+
+    LOG_DEBUG << "Stored " << msgs.size() << " messages to Redis, last id: " << msgs.back().id;
+    return 0;
+}
+
+// redis_boundary 是从 Redis 层切换过来时 Redis 读到的最早一条消息ID，比它新的消息已经从 Redis 发过，
+// MySQL 层的每一页都要跳过，所以跟着游标一直带下去
+static string MakeDbCursor(uint64_t timestamp, uint64_t id, const string &redis_boundary)
+{
+    string cursor = kDbCursorPrefix + std::to_string(timestamp) + ":" + std::to_string(id);
+    if (!redis_boundary.empty()) {
+        cursor += ":" + redis_boundary;
+    }
+    return cursor;
+}
+
+static bool ParseDbCursor(const string &cursor, uint64_t &timestamp, uint64_t &id, string &redis_boundary)
+{
+    if (cursor.compare(0, strlen(kDbCursorPrefix), kDbCursorPrefix) != 0) {
+        return false;
+    }
+    const char *p = cursor.c_str() + strlen(kDbCursorPrefix);
+    char *end = NULL;
+    timestamp = strtoull(p, &end, 10);
+    if (*end != ':') {
+        return false;
+    }
+    id = strtoull(end + 1, &end, 10);
+    redis_boundary = *end == ':' ? string(end + 1) : "";
+    return true;
+}
+
+// 排除 redis_id 不早于 boundary 的行（这些消息已经从 Redis 层发过），没有 redis_id 的行只在 MySQL 里，保留
+// 只有从 Redis 层切换过来的分页才带这个条件
+static string RedisBoundaryCondition(const string &boundary)
+{
+    uint64_t boundary_ms = StreamIdMs(boundary);
+    size_t dash = boundary.find('-');
+    uint64_t boundary_seq = dash == string::npos ? 0 : strtoull(boundary.c_str() + dash + 1, NULL, 10);
+    return FormatString(
+        " AND (redis_id IS NULL OR redis_id = '' "
+        "OR CAST(SUBSTRING_INDEX(redis_id, '-', 1) AS UNSIGNED) < %" PRIu64 " "
+        "OR (CAST(SUBSTRING_INDEX(redis_id, '-', 1) AS UNSIGNED) = %" PRIu64 " "
+        "AND CAST(SUBSTRING_INDEX(redis_id, '-', -1) AS UNSIGNED) < %" PRIu64 "))",
+        boundary_ms, boundary_ms, boundary_seq);
+}
+
+// MySQL 历史消息的一行，字符串字段指向结果集的行缓冲区
+struct HistoryRow {
+    uint64_t id = 0;
+    std::string_view user_id;
+    std::string_view content;
+    uint64_t timestamp = 0;
+    std::string_view redis_id;
+};
+
+// 一次从 MySQL 取的行数达到这个值时流式读取
+static const int kHistoryStreamRows = 1000;
+
+static string EscapeSql(CDBConn *db_conn, const string &value)
+{
+    string escaped(value.size() * 2 + 1, '\0');
+    escaped.resize(mysql_real_escape_string(db_conn->GetMysql(), &escaped[0], value.data(), value.size()));
+    return escaped;
 }
 
 // 分级读取：先从Redis读取近期消息，不足时从MySQL补充
+// 游标 room.history_last_message_id 跨两层保持稳定：
+//  - 空：从最新一条开始，先读 Redis
+//  - stream 消息ID：在 Redis 中从这条往前读，不够时换到 MySQL，把这条消息换算成 MySQL 的 (timestamp, id) 位置
+//  - "db:timestamp:id[:redis_id]"：已经翻到 MySQL 层，直接按 (room_id, timestamp, id) 键集分页，不再读 Redis；
+//    redis_id 是切换时 Redis 层的边界，比它新的行已经从 Redis 发过，每一页都跳过
+// MySQL 用 idx_room_ts_id(room_id, timestamp, id) 做键集分页，翻页深度不影响每页的耗时
 int ApiGetRoomHistoryTiered(Room &room, MessageBatch &message_batch, const int msg_count)
 {
     // 1. 先尝试从Redis获取消息（快速访问）
     Room temp_room = room; // 创建副本避免修改原始room
-    int redis_result = ApiGetRoomHistory(temp_room, message_batch, msg_count);
-    
-    // 如果Redis中的消息足够，直接返回
-    if (redis_result == 0 && message_batch.messages.size() >= static_cast<size_t>(msg_count)) {
-        LOG_INFO << "Got " << message_batch.messages.size() << " messages from Redis";
-        return 0;
+    int redis_result = 0;
+    string stream_start;
+    if (GetRoomHistoryStreamStart(room, stream_start)) {
+        redis_result = ApiGetRoomHistory(temp_room, message_batch, msg_count);
+        // 如果Redis中的消息足够，直接返回
+        if (redis_result == 0 && message_batch.messages.size() >= static_cast<size_t>(msg_count)) {
+            LOG_DEBUG << "Got " << message_batch.messages.size() << " messages from Redis";
+            room.history_last_message_id = temp_room.history_last_message_id;
+            return 0;
+        }
     }
 
     // 2. Redis中消息不足，从MySQL补充历史消息
-    // LOG_INFO << "Redis messages insufficient, fetching from MySQL";
-    
+    int db_result = ApiGetRoomHistoryFromDb(temp_room, message_batch, msg_count);
+    room.history_last_message_id = temp_room.history_last_message_id;   // 下一页从两层合并后的最早一条接着读
+    return db_result == 0 ? 0 : redis_result; // MySQL 不可用时返回Redis的结果
+}
+
+int ApiGetRoomHistoryFromDb(Room &room, MessageBatch &message_batch, const int msg_count)
+{
+    uint64_t cursor_ts = 0;
+    uint64_t cursor_id = 0;
+    string redis_boundary;
+    bool has_db_cursor = ParseDbCursor(room.history_last_message_id, cursor_ts, cursor_id, redis_boundary);
+
     CDBManager *db_manager = CDBManager::getInstance();
     CDBConn *db_conn = db_manager->GetDBConn("chatroom_slave"); // 使用从库读取
     AUTO_REL_DBCONN(db_manager, db_conn);
 
     if (!db_conn) {
         LOG_ERROR << "Get DB connection failed";
-        return redis_result; // 返回Redis的结果
+        return -1;
     }
 
+    string escaped_room_id = EscapeSql(db_conn, room.room_id);
+
+    // 从 Redis 层切换到 MySQL 层，边界是 Redis 读到的最早一条（或调用方的 Redis 游标）：
+    // Redis 只裁剪已经入库的消息，边界消息一般已经在 MySQL 里，用它的 (timestamp, id) 作为起点；
+    // 还没入库时用它的 timestamp 作为起点（包含同一秒）。
+    // 两种情况都记下边界消息ID，这一页和之后的每一页都跳过比它新的行，不只是本页从 Redis 拿到的那些
+    bool inclusive_ts = false;
+    const string boundary_id = room.history_last_message_id;
+    if (!has_db_cursor && !boundary_id.empty()) {
+        redis_boundary = boundary_id;
+        string sql = FormatString("SELECT id, timestamp FROM messages WHERE redis_id='%s' LIMIT 1",
+                                  EscapeSql(db_conn, boundary_id).c_str());
+        CResultSet *result_set = db_conn->ExecuteQuery(sql.c_str());
+        if (result_set && result_set->Next()) {
+            cursor_id = result_set->GetUInt64(0);
+            cursor_ts = result_set->GetUInt64(1);
+            has_db_cursor = true;
+        } else if (!message_batch.messages.empty()) {
+            cursor_ts = message_batch.messages.back().timestamp;
+            inclusive_ts = true;
+        } else {
+            cursor_ts = StreamIdMs(boundary_id) / 1000;
+            inclusive_ts = true;
+        }
+        delete result_set;
+    }
+    string boundary_condition = redis_boundary.empty() ? "" : RedisBoundaryCondition(redis_boundary);
+
     // 计算还需要多少条消息
     int needed_count = msg_count - message_batch.messages.size();
-    
-    // 从MySQL获取更多历史消息
-    string sql = FormatString(
-        "SELECT id, room_id, user_id, content, timestamp, redis_id FROM messages "
-        "WHERE room_id='%s' ORDER BY timestamp DESC LIMIT %d",
-        room.room_id.c_str(), needed_count
-    );
-
-    CResultSet *result_set = db_conn->ExecuteQuery(sql.c_str());
+
+    string sql;
+    if (has_db_cursor) {
+        sql = FormatString(
+            "SELECT id, user_id, content, timestamp, redis_id FROM messages "
+            "WHERE room_id='%s' AND (timestamp < %" PRIu64 " OR (timestamp = %" PRIu64 " AND id < %" PRIu64 "))%s "
+            "ORDER BY timestamp DESC, id DESC LIMIT %d",
+            escaped_room_id.c_str(), cursor_ts, cursor_ts, cursor_id, boundary_condition.c_str(), needed_count);
+    } else if (inclusive_ts) {
+        sql = FormatString(
+            "SELECT id, user_id, content, timestamp, redis_id FROM messages "
+            "WHERE room_id='%s' AND timestamp <= %" PRIu64 "%s ORDER BY timestamp DESC, id DESC LIMIT %d",
+            escaped_room_id.c_str(), cursor_ts, boundary_condition.c_str(), needed_count);
+    } else {
+        sql = FormatString(
+            "SELECT id, user_id, content, timestamp, redis_id FROM messages "
+            "WHERE room_id='%s' ORDER BY timestamp DESC, id DESC LIMIT %d",
+            escaped_room_id.c_str(), needed_count);
+    }
+
+    int db_count = 0;
+    uint64_t last_row_id = 0;
+    uint64_t last_row_ts = 0;
+    // 一页很大时（如导出历史）流式读取，不把整页先放进客户端内存
+    CResultSet *result_set = needed_count >= kHistoryStreamRows ? db_conn->ExecuteQueryStream(sql.c_str())
+                                                                : db_conn->ExecuteQuery(sql.c_str());
     if (result_set) {
-        while (result_set->Next()) {
+        CRowBinder<HistoryRow> binder;
+        binder.Bind("id", &HistoryRow::id)
+              .Bind("user_id", &HistoryRow::user_id)
+              .Bind("content", &HistoryRow::content)
+              .Bind("timestamp", &HistoryRow::timestamp)
+              .Bind("redis_id", &HistoryRow::redis_id);
+        HistoryRow row;
+        message_batch.messages.reserve(message_batch.messages.size() + needed_count);
+        while (db_count < needed_count && binder.Next(result_set, row)) {
+            last_row_id = row.id;
+            last_row_ts = row.timestamp;
             Message msg;
-            msg.id = result_set->GetString("redis_id") ? result_set->GetString("redis_id") : 
-                     std::to_string(result_set->GetInt("id")); // 优先使用redis_id
-            msg.content = result_set->GetString("content");
-            msg.user_id = result_set->GetString("user_id");
-            msg.timestamp = static_cast<uint64_t>(result_set->GetInt("timestamp"));
-            
-            message_batch.messages.push_back(msg);
+            msg.id = !row.redis_id.empty() ? string(row.redis_id) : std::to_string(row.id); // 优先使用redis_id
+            msg.content.assign(row.content.data(), row.content.size());
+            msg.user_id.assign(row.user_id.data(), row.user_id.size());
+            msg.timestamp = row.timestamp;
+            message_batch.messages.push_back(std::move(msg));
+            db_count++;
+        }
+        if (result_set->HasError()) {
+            LOG_ERROR << "read history rows failed, room: " << room.room_id << ", rows: " << db_count;
         }
-        // LOG_INFO << "Got additional " << message_batch.messages.size() - (redis_result == 0 ? message_batch.messages.size() : 0) 
-        //          << " messages from MySQL";
+        delete result_set;
+    }
+    if (last_row_id != 0) {
+        room.history_last_message_id = MakeDbCursor(last_row_ts, last_row_id, redis_boundary);
     }
 
     // 设置是否还有更多消息
-    message_batch.has_more = (message_batch.messages.size() >= static_cast<size_t>(msg_count));
-    
+    message_batch.has_more = (db_count >= needed_count);
+
     return 0;
-}
\ No newline at end of file
+}
+
+// 启动时检查 messages 表的索引：持久化依赖 redis_id 唯一索引去重，历史分页依赖 (room_id, timestamp, id) 联合索引
+int ApiCheckMessageIndexes()
+{
+    CDBManager *db_manager = CDBManager::getInstance();
+    CDBConn *db_conn = db_manager->GetDBConn("chatroom_slave");
+    AUTO_REL_DBCONN(db_manager, db_conn);
+    if (!db_conn) {
+        LOG_ERROR << "Get DB connection failed";
+        return -1;
+    }
+
+    CResultSet *result_set = db_conn->ExecuteQuery(
+        "SELECT INDEX_NAME, NON_UNIQUE, COLUMN_NAME FROM information_schema.STATISTICS "
+        "WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = 'messages' ORDER BY INDEX_NAME, SEQ_IN_INDEX");
+    if (!result_set) {
+        return -1;
+    }
+    std::map<string, string> index_columns;    // 索引名 -> "列1,列2,..."
+    std::set<string> unique_indexes;
+    while (result_set->Next()) {
+        string name = result_set->GetString("INDEX_NAME");
+        string &columns = index_columns[name];
+        columns += (columns.empty() ? "" : ",") + string(result_set->GetString("COLUMN_NAME"));
+        if (result_set->GetInt("NON_UNIQUE") == 0) {
+            unique_indexes.insert(name);
+        }
+    }
+    delete result_set;
+
+    bool has_room_ts_id = false;
+    bool has_unique_redis_id = false;
+    for (const auto &it : index_columns) {
+        if (it.first == "idx_room_ts_id" && it.second == "room_id,timestamp,id") {
+            has_room_ts_id = true;
+        }
+        if (it.second == "redis_id" && unique_indexes.count(it.first)) {
+            has_unique_redis_id = true;
+        }
+    }
+    if (!has_room_ts_id) {
+        LOG_WARN << "messages 缺少历史分页索引，请执行: "
+                    "ALTER TABLE messages ADD INDEX idx_room_ts_id (room_id, timestamp, id)";
+    }
+    if (!has_unique_redis_id) {
+        LOG_WARN << "messages 缺少 redis_id 唯一索引，重复投递会重复入库，请执行: "
+                    "ALTER TABLE messages ADD UNIQUE INDEX uk_redis_id (redis_id)";
+    }
+    return (has_room_ts_id && has_unique_redis_id) ? 0 : 1;
+}
@@ -5,10 +5,57 @@
 
 const constexpr int k_message_batch_size = 30;
 
+// 持久化用到的 redis key 和消费组
+// 房间 stream 第一次写入时登记到 k_persist_streams_key 并创建消费组，每次写入都把 stream 标记到 k_persist_dirty_key，
+// 持久化线程只读取被标记过的 stream
+const constexpr char *k_persist_streams_key = "msg_persist_streams";
+const constexpr char *k_persist_dirty_key = "msg_persist_dirty";
+const constexpr char *k_persist_group = "chatroom_persist";
+// 消息ID节点号租约的 key 前缀，后面是节点号
+const constexpr char *k_msg_id_node_key_prefix = "msg_id_node:";
+
+// 房间 stream 的保留策略：按条数或按时间，0 表示不限制
+// 裁剪由持久化线程在确认后执行，裁剪点不会越过持久化水位，未入库的消息不会被裁掉
+struct StreamRetention {
+    int max_len = 0;            // 最多保留的条数（近似，MAXLEN ~）
+    int max_age_seconds = 0;    // 最长保留时间（秒）
+};
+
+// 解析 "count:1000" 或 "age:86400"，格式错误返回false
+bool ParseStreamRetention(const string &spec, StreamRetention &retention);
+// 设置默认/单个房间的保留策略，需要在持久化线程启动前调用
+void SetDefaultStreamRetention(const StreamRetention &retention);
+void SetRoomStreamRetention(const string &room_id, const StreamRetention &retention);
+const StreamRetention &GetStreamRetention(const string &room_id);
+// 生成一个房间 stream 的裁剪命令，追加到批量命令，回复为 "裁剪条数,剩余长度"；没有保留策略时不生成，返回false
+bool AppendTrimStreamCommand(const string &room_id, CacheBatch &batch);
+
+// 把 stream 中的一条消息解析为 Message：字段直接对应，旧格式（payload 字段里的 JSON）也能解析
+// room_id 非空时同时取出消息所在的房间；缺少 content 或 user_id 返回false
+bool DecodeStreamMessage(const StreamEntry &entry, Message &msg, string *room_id = NULL);
+// Redis 层历史读取：起点（XREVRANGE 的 start）和解析，异步读取时分开调用
+// 游标为空从最新一条开始，否则从游标之前一条开始；游标已经翻到 MySQL 层时返回false
+bool GetRoomHistoryStreamStart(const Room &room, string &start);
+// 把读到的消息填充到 message_batch 并更新 room 的游标，读满 msg_count 条时 has_more 为true
+int FillRoomHistoryFromStream(Room &room, std::vector<StreamEntry> &entries, MessageBatch &message_batch,
+                              const int msg_count);
 int ApiGetRoomHistory(Room &room, MessageBatch &message_batch, const int msg_count = k_message_batch_size);
 int ApiStoreMessage(string room_name, std::vector<Message> &msgs);
 int ApiStoreMessageTiered(string room_name, std::vector<Message> &msgs);
-int ApiBatchPersistMessages(int batch_size = 100);
+// 生成一条消息的分级存储命令（XADD + 标记待持久化），追加到批量命令，返回回复下标
+// msg.id 非空时作为显式ID写入，为空时由 Redis 分配；回复是最终的消息ID，
+// 显式ID不大于 stream 最后一个ID时由 Redis 重新分配，其他错误以错误回复返回
+size_t AppendStoreMessageCommand(const string &room_id, const Message &msg, CacheBatch &batch);
+// 在 msg Redis 中租用一个空闲的消息ID节点号（0 ~ node_count-1），租约 ttl_seconds 秒，需要定时续约
+// 成功返回节点号，全部被占用或 Redis 出错返回-1
+int ApiAcquireMsgIdNode(const string &owner, int node_count, int ttl_seconds);
+// 续约节点号：仍由 owner 持有（或已过期且空闲，重新占上）返回0，被其他节点占用返回1，Redis 出错返回-1
+int ApiRenewMsgIdNode(int node_id, const string &owner, int ttl_seconds);
 int ApiGetRoomHistoryTiered(Room &room, MessageBatch &message_batch, const int msg_count = k_message_batch_size);
+// 只读 MySQL 层：从 room 的游标（空、Redis 层读到的最早一条消息ID或 "db:" 游标）接着读，
+// 补到 message_batch 中（已有 Redis 读到的消息时只补差额），room 的游标随之前进；拿不到连接返回-1
+int ApiGetRoomHistoryFromDb(Room &room, MessageBatch &message_batch, const int msg_count = k_message_batch_size);
+// 检查 messages 表的索引，缺少时打印需要执行的 DDL；齐全返回0，缺少返回1，失败返回-1
+int ApiCheckMessageIndexes();
 
 #endif
\ No newline at end of file
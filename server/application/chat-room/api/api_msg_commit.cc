@@ -0,0 +1,143 @@
+#include "api_msg_commit.h"
+
+#include <chrono>
+
+#include "api_msg.h"
+#include "muduo/base/Logging.h"
+#include "monitoring/metrics_collector.h"
+
+void MsgGroupCommit::Start(int max_batch_size, int flush_interval_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) {
+        return;
+    }
+    max_batch_size_ = max_batch_size > 0 ? max_batch_size : 64;
+    flush_interval_us_ = flush_interval_us > 0 ? flush_interval_us : 1000;
+    pending_.reserve(max_batch_size_);
+    running_ = true;
+    flush_thread_ = std::thread(&MsgGroupCommit::FlushLoop, this);
+
+    MetricsCollector::GetInstance().SetGroupCommitSettings(max_batch_size_, flush_interval_us_);
+    LOG_INFO << "msg group commit started, max_batch_size: " << max_batch_size_
+             << ", flush_interval_us: " << flush_interval_us_;
+}
+
+void MsgGroupCommit::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+    }
+    cond_var_.notify_one();
+    if (flush_thread_.joinable()) {
+        flush_thread_.join();
+    }
+}
+
+void MsgGroupCommit::StoreMessage(const string &room_id, const Message &msg, const StoreCallback &callback) {
+    bool running = false;
+    bool notify = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running = running_;
+        if (running) {
+            pending_.push_back({room_id, msg, callback});
+            // 队列由空变为非空时唤醒空闲的写线程，攒够一批时提前唤醒正在等待的写线程
+            notify = pending_.size() == 1 || pending_.size() >= static_cast<size_t>(max_batch_size_);
+        }
+    }
+
+    if (!running) {
+        // 没有启动组提交时退化为同步写
+        std::vector<Message> msgs = {msg};
+        int ret = ApiStoreMessageTiered(room_id, msgs);
+        callback(ret, msgs[0].id);
+    } else if (notify) {
+        cond_var_.notify_one();
+    }
+}
+
+void MsgGroupCommit::FlushLoop() {
+    std::vector<PendingMessage> batch;
+    batch.reserve(max_batch_size_);
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            // 空闲时不带超时地等待，直到有消息入队或者停止，避免按刷新间隔空转
+            cond_var_.wait(lock, [this] {
+                return !running_ || !pending_.empty();
+            });
+            // 有消息后再等到攒够一批、超过刷新间隔或者停止
+            cond_var_.wait_for(lock, std::chrono::microseconds(flush_interval_us_), [this] {
+                return !running_ || pending_.size() >= static_cast<size_t>(max_batch_size_);
+            });
+            if (pending_.empty()) {
+                if (!running_) {
+                    break;
+                }
+                continue;
+            }
+            if (pending_.size() <= static_cast<size_t>(max_batch_size_)) {
+                batch.swap(pending_);
+            } else {
+                // 超过一批的部分留到下一轮
+                batch.assign(std::make_move_iterator(pending_.begin()),
+                             std::make_move_iterator(pending_.begin() + max_batch_size_));
+                pending_.erase(pending_.begin(), pending_.begin() + max_batch_size_);
+            }
+        }
+
+        Flush(batch);
+        batch.clear();
+    }
+    LOG_INFO << "msg group commit stopped";
+}
+
+void MsgGroupCommit::Flush(std::vector<PendingMessage> &batch) {
+    auto start_time = std::chrono::steady_clock::now();
+
+    // 按房间所在的分片拆成多个管道，每个分片一次网络往返；记下每条消息的分片和回复下标
+    CacheManager *cache_manager = CacheManager::getInstance();
+    std::vector<CachePool *> shard_pools;
+    cache_manager->GetShardPools("msg", shard_pools);
+    std::vector<CacheBatch> shard_commands(shard_pools.size());
+    std::vector<std::pair<int, size_t>> reply_indexes(batch.size(), {-1, 0});
+    for (size_t i = 0; i < batch.size(); i++) {
+        int shard = cache_manager->GetShardIndex("msg", batch[i].room_id);
+        if (shard >= 0) {
+            reply_indexes[i] = {shard, AppendStoreMessageCommand(batch[i].room_id, batch[i].msg, shard_commands[shard])};
+        }
+    }
+
+    for (size_t shard = 0; shard < shard_pools.size(); shard++) {
+        if (shard_commands[shard].Empty()) {
+            continue;
+        }
+        CacheConn *cache_conn = shard_pools[shard]->GetCacheConn();
+        AUTO_REL_CACHECONN(cache_manager, cache_conn);
+        if (cache_conn) {
+            cache_conn->Execute(shard_commands[shard]);
+        } else {
+            LOG_ERROR << "Get Cache connection failed, pool: " << shard_pools[shard]->GetPoolName();
+        }
+    }
+
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start_time);
+    MetricsCollector::GetInstance().ObserveGroupCommit(batch.size(), static_cast<double>(duration.count()));
+
+    // 按顺序回调，回复缺失、出错或为空的消息视为失败
+    for (size_t i = 0; i < batch.size(); i++) {
+        int shard = reply_indexes[i].first;
+        size_t index = reply_indexes[i].second;
+        string msg_id = shard >= 0 ? shard_commands[shard].GetString(index) : "";
+        if (shard >= 0 && shard_commands[shard].Ok(index) && !msg_id.empty()) {
+            batch[i].callback(0, msg_id);
+        } else {
+            batch[i].callback(-1, "");
+        }
+    }
+}
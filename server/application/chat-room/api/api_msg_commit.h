@@ -0,0 +1,58 @@
+#ifndef _API_MSG_COMMIT_H_
+#define _API_MSG_COMMIT_H_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "api_types.h"
+
+// 消息写入的组提交（group commit）
+// 所有连接的消息先进入队列，由一个写线程每隔 flush_interval_us 或攒够 max_batch_size 条时，
+// 用一个管道把整批消息写入 Redis（一次网络往返；msg 分片时每个分片一个管道），再把分配到的消息ID回调给各自的调用方
+// 写线程在执行一批的时候，新消息继续排队，负载越高每批越大
+class MsgGroupCommit
+{
+public:
+    // ret: 0 成功，-1 失败；msg_id: 最终写入 stream 的消息ID（一般就是 msg.id，冲突时由 Redis 重新分配）
+    // 回调在写线程执行，调用方需要自己切回所在的 EventLoop
+    using StoreCallback = std::function<void(int ret, const string &msg_id)>;
+
+    static MsgGroupCommit &GetInstance() {
+        static MsgGroupCommit instance;
+        return instance;
+    }
+
+    void Start(int max_batch_size, int flush_interval_us);
+    // 停止写线程，队列里剩余的消息会先写完
+    void Stop();
+
+    // 异步存储一条消息，可以在任意线程调用
+    void StoreMessage(const string &room_id, const Message &msg, const StoreCallback &callback);
+
+private:
+    struct PendingMessage {
+        string room_id;
+        Message msg;
+        StoreCallback callback;
+    };
+
+    MsgGroupCommit() {}
+    ~MsgGroupCommit() { Stop(); }
+
+    void FlushLoop();
+    void Flush(std::vector<PendingMessage> &batch);
+
+    int max_batch_size_ = 64;
+    int flush_interval_us_ = 1000;
+
+    std::vector<PendingMessage> pending_;
+    std::mutex mutex_;
+    std::condition_variable cond_var_;
+    bool running_ = false;
+    std::thread flush_thread_;
+};
+
+#endif
@@ -0,0 +1,582 @@
+#include "api_msg_persist.h"
+
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+
+#include "api_msg.h"
+#include "muduo/base/Logging.h"
+#include "monitoring/metrics_collector.h"
+
+static const int kMinIdleWaitMs = 10;      // 没有待持久化的 stream 时的等待时间，连续空闲时倍增
+static const int kMaxIdleWaitMs = 1000;
+static const int kRetryWaitMs = 1000;      // 写库失败后的等待时间
+static const int kMinEntriesPerStream = 10;
+static const int kEntriesPerStreamStep = 20;   // AIMD 的加性增量
+static const int kMemoryCheckIntervalS = 10;   // 第一个工作线程每隔这么久采集一次 Redis 内存
+static const int kClaimIntervalS = 30;         // 第一个工作线程每隔这么久认领一次其他消费者的待确认消息
+
+// 消息ID形如 "1635724800123-0"，前半部分是写入时的毫秒时间戳
+static uint64_t StreamIdMs(const string &id) {
+    return strtoull(id.c_str(), NULL, 10);
+}
+
+void MsgPersistWorkers::Start(const MsgPersistOptions &options) {
+    if (running_.exchange(true)) {
+        return;
+    }
+    options_ = options;
+    if (options_.worker_count <= 0) {
+        options_.worker_count = 2;
+    }
+    if (options_.streams_per_batch <= 0) {
+        options_.streams_per_batch = 64;
+    }
+    options_.max_entries_per_stream = std::max(options_.max_entries_per_stream, kMinEntriesPerStream);
+    entries_per_stream_ = std::min(std::max(options_.entries_per_stream, kMinEntriesPerStream),
+                                   options_.max_entries_per_stream);
+    stopping_ = false;
+    MetricsCollector::GetInstance().SetPersistBatchEntries(entries_per_stream_);
+
+    // msg 分片时每个分片各有一份待持久化集合，工作线程轮流领取
+    std::vector<CachePool *> pools;
+    CacheManager::getInstance()->GetShardPools("msg", pools);
+    shard_pools_.clear();
+    for (CachePool *pool : pools) {
+        shard_pools_.push_back(pool->GetPoolName());
+    }
+    if (shard_pools_.empty()) {
+        LOG_ERROR << "msg cache pool not configured";
+        shard_pools_.push_back("msg");
+    }
+    shard_backlog_.assign(shard_pools_.size(), 0);
+
+    // 消费者名在重启后保持不变，才能找回自己之前领取但未确认的消息；
+    // 带上监听端口而不是 pid，同一主机上的多个进程互不冲突，重启后名字也不变
+    char hostname[64] = {0};
+    gethostname(hostname, sizeof(hostname) - 1);
+    consumer_prefix_ = string("comet-") + hostname + "-" + std::to_string(options_.instance_port);
+
+    for (int i = 0; i < options_.worker_count; i++) {
+        workers_.emplace_back(&MsgPersistWorkers::WorkerLoop, this, i);
+    }
+    LOG_INFO << "msg persist workers started, workers: " << options_.worker_count
+             << ", shards: " << shard_pools_.size()
+             << ", streams_per_batch: " << options_.streams_per_batch
+             << ", entries_per_stream: " << entries_per_stream_ << "~" << options_.max_entries_per_stream
+             << ", target_insert_ms: " << options_.target_insert_ms
+             << ", load_data_min_rows: " << options_.load_data_min_rows
+             << ", claim_min_idle_seconds: " << options_.claim_min_idle_seconds;
+}
+
+void MsgPersistWorkers::Stop() {
+    if (!running_ || stopping_.exchange(true)) {
+        return;
+    }
+    drain_deadline_ = std::chrono::steady_clock::now() + std::chrono::seconds(options_.drain_timeout_seconds);
+    LOG_INFO << "msg persist workers draining, timeout: " << options_.drain_timeout_seconds << "s";
+    cond_var_.notify_all();
+    for (auto &worker : workers_) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+    workers_.clear();
+    running_ = false;
+    LOG_INFO << "msg persist workers stopped";
+}
+
+bool MsgPersistWorkers::DrainExpired() {
+    return stopping_ && std::chrono::steady_clock::now() >= drain_deadline_;
+}
+
+void MsgPersistWorkers::WorkerLoop(int index) {
+    string consumer = consumer_prefix_ + "-" + std::to_string(index);
+    RecoverPending(consumer);
+
+    std::vector<string> retry_streams;     // 写库失败的 stream，消息还在本消费者的待确认列表里
+    string retry_pool;                     // retry_streams 所在的分片
+    std::vector<string> requeue_streams;   // 领取后没有读出消息的 stream，要放回待持久化集合
+    string requeue_pool;
+    size_t shard = index % shard_pools_.size();    // 各线程从不同的分片开始轮流领取
+    size_t empty_shards = 0;               // 连续领取为空的分片数，一整轮都为空才等待
+    int idle_wait_ms = kMinIdleWaitMs;
+    auto next_memory_check = std::chrono::steady_clock::now();
+    auto next_claim = std::chrono::steady_clock::now();
+    while (!DrainExpired()) {
+        if (index == 0 && std::chrono::steady_clock::now() >= next_memory_check) {
+            RefreshRedisMemory();
+            next_memory_check = std::chrono::steady_clock::now() + std::chrono::seconds(kMemoryCheckIntervalS);
+        }
+        if (index == 0 && !stopping_ && std::chrono::steady_clock::now() >= next_claim) {
+            int claimed = ClaimStalePending(consumer);
+            if (claimed > 0) {
+                LOG_INFO << consumer << " claimed " << claimed << " stale pending messages";
+            }
+            next_claim = std::chrono::steady_clock::now() + std::chrono::seconds(kClaimIntervalS);
+        }
+        int wait_ms = 0;
+        if (!requeue_streams.empty()) {
+            if (RequeueStreams(requeue_pool, requeue_streams)) {
+                requeue_streams.clear();
+            } else {
+                wait_ms = kRetryWaitMs;
+            }
+        } else if (!retry_streams.empty()) {
+            int ret = PersistBatch(consumer, retry_pool, retry_streams, "0");
+            if (ret >= 0) {
+                retry_streams.clear();
+            } else {
+                // 重试时 stream 被删除或消费组丢失会一直读失败，先去掉这些 stream
+                if (ret == kPersistReadFailed) {
+                    RepairStreams(retry_pool, retry_streams);
+                }
+                wait_ms = retry_streams.empty() ? 0 : kRetryWaitMs;
+            }
+        } else {
+            size_t pool_shard = shard;
+            const string pool = shard_pools_[pool_shard];
+            shard = (shard + 1) % shard_pools_.size();
+            std::vector<string> streams;
+            {
+                CacheManager *cache_manager = CacheManager::getInstance();
+                CacheConn *cache_conn = cache_manager->GetCacheConn(pool.c_str());
+                AUTO_REL_CACHECONN(cache_manager, cache_conn);
+                if (cache_conn) {
+                    // 领取 stream 和统计剩余积压放在一次往返里
+                    CacheBatch batch;
+                    size_t spop_index = batch.Spop(k_persist_dirty_key, options_.streams_per_batch);
+                    size_t scard_index = batch.Scard(k_persist_dirty_key);
+                    if (cache_conn->Execute(batch)) {
+                        batch.GetArray(spop_index, streams);
+                        SetShardBacklog(pool_shard, batch.GetInteger(scard_index));
+                    }
+                }
+            }
+
+            if (streams.empty()) {
+                if (++empty_shards < shard_pools_.size()) {
+                    continue;   // 换下一个分片
+                }
+                empty_shards = 0;
+                if (stopping_) {
+                    break;      // 所有分片的积压都已经写完
+                }
+                UpdateLag(0);
+                wait_ms = idle_wait_ms;
+                idle_wait_ms = std::min(idle_wait_ms * 2, kMaxIdleWaitMs);
+            } else {
+                empty_shards = 0;
+                idle_wait_ms = kMinIdleWaitMs;
+                int ret = PersistBatch(consumer, pool, streams, ">");
+                if (ret == kPersistReadFailed) {
+                    // 消息没有投递给本消费者，用 "0" 重试读不到，放回待持久化集合
+                    requeue_streams.swap(streams);
+                    requeue_pool = pool;
+                    if (!RequeueStreams(requeue_pool, requeue_streams)) {
+                        wait_ms = kRetryWaitMs;
+                    } else {
+                        requeue_streams.clear();
+                    }
+                } else if (ret < 0) {
+                    retry_streams.swap(streams);
+                    retry_pool = pool;
+                    wait_ms = kRetryWaitMs;
+                }
+            }
+        }
+
+        if (wait_ms > 0) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (stopping_) {
+                // 停止时不再等空闲，只在失败重试前等待，但不超过截止时间
+                if (!retry_streams.empty()) {
+                    cond_var_.wait_until(lock, std::min(drain_deadline_,
+                        std::chrono::steady_clock::now() + std::chrono::milliseconds(wait_ms)));
+                }
+            } else {
+                cond_var_.wait_for(lock, std::chrono::milliseconds(wait_ms), [this] { return stopping_.load(); });
+            }
+        }
+    }
+    if (!retry_streams.empty()) {
+        LOG_WARN << consumer << " stopped with " << retry_streams.size()
+                 << " streams unpersisted, they will be recovered on next start";
+    }
+    if (!requeue_streams.empty()) {
+        LOG_WARN << consumer << " stopped with " << requeue_streams.size()
+                 << " streams not returned to " << k_persist_dirty_key << ", they are persisted with the next message";
+    }
+}
+
+void MsgPersistWorkers::AdjustBatchSize(double insert_ms, bool has_more, bool failed) {
+    int current = entries_per_stream_;
+    int next = current;
+    if (failed || (options_.target_insert_ms > 0 && insert_ms > options_.target_insert_ms)) {
+        next = std::max(current / 2, kMinEntriesPerStream);
+    } else if (has_more) {
+        next = std::min(current + kEntriesPerStreamStep, options_.max_entries_per_stream);
+    }
+    if (next != current && entries_per_stream_.compare_exchange_strong(current, next)) {
+        MetricsCollector::GetInstance().SetPersistBatchEntries(next);
+        LOG_DEBUG << "persist entries_per_stream " << current << " -> " << next << ", insert_ms: " << insert_ms;
+    }
+}
+
+void MsgPersistWorkers::RefreshRedisMemory() {
+    // 分片时为所有分片之和
+    double used_memory = 0;
+    for (const string &pool : shard_pools_) {
+        CacheManager *cache_manager = CacheManager::getInstance();
+        CacheConn *cache_conn = cache_manager->GetCacheConn(pool.c_str());
+        AUTO_REL_CACHECONN(cache_manager, cache_conn);
+        std::map<string, string> fields;
+        if (!cache_conn || !cache_conn->Info("memory", fields)) {
+            return;     // 少一个分片的值不准确，这一轮不更新
+        }
+        used_memory += atof(fields["used_memory"].c_str());
+    }
+    MetricsCollector::GetInstance().SetRedisUsedMemory(used_memory);
+}
+
+void MsgPersistWorkers::SetShardBacklog(size_t shard, long long streams) {
+    long long total = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        shard_backlog_[shard] = streams;
+        for (long long backlog : shard_backlog_) {
+            total += backlog;
+        }
+    }
+    MetricsCollector::GetInstance().SetPersistBacklogStreams(total);
+}
+
+void MsgPersistWorkers::UpdateLag(double lag_seconds) {
+    MetricsCollector::GetInstance().SetPersistLag(lag_seconds);
+    bool over = options_.lag_alert_seconds > 0 && lag_seconds > options_.lag_alert_seconds;
+    if (backpressure_.exchange(over) != over) {
+        MetricsCollector::GetInstance().SetPersistBackpressure(over);
+        if (over) {
+            LOG_WARN << "msg persist lag " << lag_seconds << "s exceeds " << options_.lag_alert_seconds << "s";
+        } else {
+            LOG_INFO << "msg persist lag recovered: " << lag_seconds << "s";
+        }
+    }
+}
+
+void MsgPersistWorkers::RecoverPending(const string &consumer) {
+    int recovered = 0;
+    for (const string &pool : shard_pools_) {
+        recovered += RecoverShardPending(consumer, pool);
+    }
+    if (recovered > 0) {
+        LOG_INFO << consumer << " recovered " << recovered << " pending messages";
+    }
+}
+
+int MsgPersistWorkers::RecoverShardPending(const string &consumer, const string &pool) {
+    std::vector<string> all_streams;
+    {
+        CacheManager *cache_manager = CacheManager::getInstance();
+        CacheConn *cache_conn = cache_manager->GetCacheConn(pool.c_str());
+        AUTO_REL_CACHECONN(cache_manager, cache_conn);
+        if (!cache_conn || !cache_conn->Smembers(k_persist_streams_key, all_streams)) {
+            return 0;
+        }
+    }
+
+    int recovered = 0;
+    size_t streams_per_batch = options_.streams_per_batch;
+    for (size_t i = 0; i < all_streams.size() && !DrainExpired(); i += streams_per_batch) {
+        size_t end = std::min(all_streams.size(), i + streams_per_batch);
+        std::vector<string> streams(all_streams.begin() + i, all_streams.begin() + end);
+        // 待确认消息可能多于一批，读到没有为止
+        int count = 0;
+        bool repaired = false;
+        while (!DrainExpired()) {
+            count = PersistBatch(consumer, pool, streams, "0");
+            if (count == kPersistReadFailed && !repaired) {
+                // 一个 stream 被删除或丢了消费组会让整批读取失败，去掉它再读一次
+                repaired = true;
+                if (RepairStreams(pool, streams) && !streams.empty()) {
+                    continue;
+                }
+            }
+            if (count <= 0) {
+                break;
+            }
+            recovered += count;
+        }
+    }
+    return recovered;
+}
+
+bool MsgPersistWorkers::RepairStreams(const string &pool, std::vector<string> &streams) {
+    CacheManager *cache_manager = CacheManager::getInstance();
+    CacheConn *cache_conn = cache_manager->GetCacheConn(pool.c_str());
+    AUTO_REL_CACHECONN(cache_manager, cache_conn);
+    if (!cache_conn) {
+        return false;
+    }
+
+    // 消费组已经存在时返回 BUSYGROUP；key 不存在时返回错误（不带 MKSTREAM，不会把已删除的房间建回来）
+    CacheBatch batch;
+    for (const string &stream : streams) {
+        batch.Command({"XGROUP", "CREATE", stream, k_persist_group, "0"});
+    }
+    if (!cache_conn->Execute(batch)) {
+        return false;
+    }
+
+    std::vector<string> kept_streams;
+    std::vector<std::string_view> recreated = {"SADD", k_persist_dirty_key};
+    std::vector<std::string_view> removed = {"SREM", k_persist_streams_key};
+    for (size_t i = 0; i < streams.size(); i++) {
+        if (batch.Ok(i)) {
+            // key 被淘汰后又由新消息重建，旧的消费组和待确认列表已经没有了，从头重新持久化
+            LOG_WARN << "persist group of " << streams[i] << " was missing, recreated";
+            recreated.push_back(streams[i]);
+            kept_streams.push_back(streams[i]);
+        } else if (batch.GetReply(i).str.compare(0, 9, "BUSYGROUP") == 0) {
+            kept_streams.push_back(streams[i]);
+        } else {
+            LOG_WARN << "persist stream " << streams[i] << " no longer exists: " << batch.GetReply(i).str;
+            removed.push_back(streams[i]);
+        }
+    }
+
+    batch.Clear();
+    if (recreated.size() > 2) {
+        batch.Command(recreated);
+    }
+    if (removed.size() > 2) {
+        batch.Command(removed);
+    }
+    if (!batch.Empty() && !cache_conn->Execute(batch)) {
+        return false;
+    }
+    streams.swap(kept_streams);
+    return true;
+}
+
+bool MsgPersistWorkers::RequeueStreams(const string &pool, std::vector<string> &streams) {
+    if (!RepairStreams(pool, streams)) {
+        return false;
+    }
+    if (streams.empty()) {
+        return true;
+    }
+
+    CacheManager *cache_manager = CacheManager::getInstance();
+    CacheConn *cache_conn = cache_manager->GetCacheConn(pool.c_str());
+    AUTO_REL_CACHECONN(cache_manager, cache_conn);
+    if (!cache_conn) {
+        return false;
+    }
+    CacheBatch batch;
+    std::vector<std::string_view> args = {"SADD", k_persist_dirty_key};
+    args.insert(args.end(), streams.begin(), streams.end());
+    batch.Command(args);
+    return cache_conn->Execute(batch) && batch.Ok(0);
+}
+
+int MsgPersistWorkers::ClaimStalePending(const string &consumer) {
+    if (options_.claim_min_idle_seconds <= 0) {
+        return 0;
+    }
+    int claimed = 0;
+    for (const string &pool : shard_pools_) {
+        claimed += ClaimShardStalePending(consumer, pool);
+    }
+    return claimed;
+}
+
+int MsgPersistWorkers::ClaimShardStalePending(const string &consumer, const string &pool) {
+    std::vector<string> all_streams;
+    {
+        CacheManager *cache_manager = CacheManager::getInstance();
+        CacheConn *cache_conn = cache_manager->GetCacheConn(pool.c_str());
+        AUTO_REL_CACHECONN(cache_manager, cache_conn);
+        if (!cache_conn || !cache_conn->Smembers(k_persist_streams_key, all_streams)) {
+            return 0;
+        }
+    }
+
+    string min_idle_ms = std::to_string(options_.claim_min_idle_seconds * 1000LL);
+    string count = std::to_string(entries_per_stream_.load());
+    int claimed = 0;
+    size_t streams_per_batch = options_.streams_per_batch;
+    for (size_t i = 0; i < all_streams.size() && !stopping_; i += streams_per_batch) {
+        size_t end = std::min(all_streams.size(), i + streams_per_batch);
+        std::vector<string> streams(all_streams.begin() + i, all_streams.begin() + end);
+        std::vector<string> cursors(streams.size(), "0-0");
+        while (!streams.empty() && !stopping_) {
+            // 一批 stream 的 XAUTOCLAIM 放在一次往返里，只取ID，消息内容由下面的 "0" 读取
+            CacheBatch batch;
+            for (size_t j = 0; j < streams.size(); j++) {
+                batch.Command({"XAUTOCLAIM", streams[j], k_persist_group, consumer, min_idle_ms, cursors[j],
+                               "COUNT", count, "JUSTID"});
+            }
+            {
+                CacheManager *cache_manager = CacheManager::getInstance();
+                CacheConn *cache_conn = cache_manager->GetCacheConn(pool.c_str());
+                AUTO_REL_CACHECONN(cache_manager, cache_conn);
+                if (!cache_conn || !cache_conn->Execute(batch)) {
+                    return claimed;
+                }
+            }
+
+            // 回复是 [下一个游标, [认领的ID...], [已删除的ID...]]，游标为 0-0 表示扫描完
+            std::vector<string> claimed_streams;
+            std::vector<string> next_streams;
+            std::vector<string> next_cursors;
+            for (size_t j = 0; j < streams.size(); j++) {
+                const CacheReply &reply = batch.GetReply(j);
+                if (!batch.Ok(j) || reply.type != REDIS_REPLY_ARRAY || reply.elements.size() < 2) {
+                    continue;   // 消费组丢失等错误在持久化读取失败时处理
+                }
+                if (!reply.elements[1].elements.empty()) {
+                    claimed += static_cast<int>(reply.elements[1].elements.size());
+                    claimed_streams.push_back(streams[j]);
+                }
+                if (reply.elements[0].str != "0-0") {
+                    next_streams.push_back(streams[j]);
+                    next_cursors.push_back(reply.elements[0].str);
+                }
+            }
+            // 认领的消息已经在本消费者的待确认列表里，读到没有为止；写库失败的留到下一次认领
+            while (!claimed_streams.empty() && !DrainExpired() &&
+                   PersistBatch(consumer, pool, claimed_streams, "0") > 0) {
+            }
+            streams.swap(next_streams);
+            cursors.swap(next_cursors);
+        }
+    }
+    return claimed;
+}
+
+int MsgPersistWorkers::PersistBatch(const string &consumer, const string &pool, const std::vector<string> &streams,
+                                    const string &start_id) {
+    CacheManager *cache_manager = CacheManager::getInstance();
+    CacheConn *cache_conn = cache_manager->GetCacheConn(pool.c_str());
+    AUTO_REL_CACHECONN(cache_manager, cache_conn);
+    if (!cache_conn) {
+        LOG_ERROR << "Get Cache connection failed";
+        return kPersistReadFailed;
+    }
+
+    int entries_per_stream = entries_per_stream_;
+    std::map<string, std::vector<StreamEntry>> entries;
+    if (!cache_conn->XreadGroup(k_persist_group, consumer, streams, start_id, entries_per_stream, entries)) {
+        return kPersistReadFailed;
+    }
+    if (entries.empty()) {
+        return 0;
+    }
+
+    CDBManager *db_manager = CDBManager::getInstance();
+    CDBConn *db_conn = db_manager->GetDBConn("chatroom_master");
+    AUTO_REL_DBCONN(db_manager, db_conn);
+    if (!db_conn) {
+        LOG_ERROR << "Get DB connection failed";
+        return -1;
+    }
+
+    static const std::vector<string> kColumns = {"redis_id", "room_id", "user_id", "content", "timestamp"};
+    std::vector<std::vector<string>> rows;
+    uint64_t oldest_ms = 0;
+    for (const auto &stream : entries) {
+        for (const StreamEntry &entry : stream.second) {
+            string room_id = stream.first;
+            Message msg;
+            if (!DecodeStreamMessage(entry, msg, &room_id)) {
+                LOG_ERROR << "Parse persist message failed, id: " << entry.id;   // 无法解析的消息直接确认掉
+                continue;
+            }
+
+            rows.push_back({entry.id, room_id, msg.user_id, msg.content, std::to_string(msg.timestamp)});
+
+            uint64_t entry_ms = StreamIdMs(entry.id);
+            if (oldest_ms == 0 || entry_ms < oldest_ms) {
+                oldest_ms = entry_ms;
+            }
+        }
+    }
+
+    // 积压大的批次用 LOAD DATA 导入；服务端没开 local_infile 时退回预处理语句，之后不再尝试
+    double insert_ms = 0;
+    if (!rows.empty()) {
+        auto insert_start = std::chrono::steady_clock::now();
+        BulkInsertMode mode = BULK_INSERT_PREPARED;
+        if (options_.load_data_min_rows > 0 && rows.size() >= static_cast<size_t>(options_.load_data_min_rows) &&
+            load_data_enabled_) {
+            mode = BULK_INSERT_LOAD_DATA;
+        }
+        int ret = db_conn->BulkInsert("messages", kColumns, rows, mode);
+        if (ret < 0 && mode == BULK_INSERT_LOAD_DATA) {
+            LOG_WARN << "LOAD DATA persist failed, fall back to prepared statement";
+            load_data_enabled_ = false;
+            ret = db_conn->BulkInsert("messages", kColumns, rows, BULK_INSERT_PREPARED);
+        }
+        insert_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - insert_start).count();
+        MetricsCollector::GetInstance().ObservePersistInsert(insert_ms);
+        if (ret < 0) {
+            LOG_ERROR << "Batch persist to MySQL failed, rows: " << rows.size();
+            AdjustBatchSize(insert_ms, false, true);
+            return -1;
+        }
+    }
+    int row_count = static_cast<int>(rows.size());
+
+    // 写库成功后确认；读满一批的 stream 可能还有消息，重新放回待持久化集合
+    CacheBatch batch;
+    std::vector<std::string_view> more_streams = {"SADD", k_persist_dirty_key};
+    bool has_more = false;
+    for (const auto &stream : entries) {
+        std::vector<std::string_view> xack = {"XACK", stream.first, k_persist_group};
+        for (const StreamEntry &entry : stream.second) {
+            xack.push_back(entry.id);
+        }
+        batch.Command(xack);
+        if (stream.second.size() >= static_cast<size_t>(entries_per_stream)) {
+            more_streams.push_back(stream.first);
+        }
+    }
+    if (more_streams.size() > 2) {
+        has_more = true;
+        batch.Command(more_streams);
+    }
+    // 确认之后按保留策略裁剪，裁剪点不越过持久化水位
+    std::vector<size_t> trim_replies;    // 裁剪命令的回复下标
+    for (const auto &stream : entries) {
+        size_t index = batch.Size();
+        if (AppendTrimStreamCommand(stream.first, batch)) {
+            trim_replies.push_back(index);
+        }
+    }
+    if (!cache_conn->Execute(batch)) {
+        // 已经入库，下次重新读到时 INSERT IGNORE 会跳过
+        LOG_WARN << "XACK persisted messages failed";
+    }
+    for (size_t trim_reply : trim_replies) {
+        // 回复是 "裁剪条数,剩余长度"
+        string reply = batch.GetString(trim_reply);
+        size_t comma = reply.find(',');
+        if (comma == string::npos) {
+            continue;
+        }
+        MetricsCollector::GetInstance().IncrementStreamTrimmed(atol(reply.c_str()));
+        MetricsCollector::GetInstance().ObserveStreamLength(atof(reply.c_str() + comma + 1));
+    }
+
+    if (oldest_ms > 0) {
+        uint64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        UpdateLag(now_ms > oldest_ms ? (now_ms - oldest_ms) / 1000.0 : 0);
+    }
+    AdjustBatchSize(insert_ms, has_more);
+    MetricsCollector::GetInstance().IncrementMessagesPersisted(row_count);
+    LOG_DEBUG << consumer << " persisted " << row_count << " messages from " << entries.size() << " streams";
+    return row_count;
+}
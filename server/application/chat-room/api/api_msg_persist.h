@@ -0,0 +1,98 @@
+#ifndef _API_MSG_PERSIST_H_
+#define _API_MSG_PERSIST_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "api_types.h"
+
+// 消息持久化：多个工作线程以消费组（XREADGROUP/XACK）方式直接读取房间 stream 写入 MySQL
+//  - 每个线程从待持久化集合里弹出一批 stream，一次 XREADGROUP 读取这些 stream 的新消息
+//  - 写入 MySQL 成功后才 XACK；失败的消息留在本消费者的待确认列表里，下一轮用 "0" 重新读取，不会丢
+//  - 读取失败时把领取的 stream 放回待持久化集合；消费组丢失（key 被淘汰后重建）的 stream 重新建组，key 已经不存在的移出持久化集合
+//  - 第一个工作线程定期用 XAUTOCLAIM 认领其他消费者空闲超过 claim_min_idle_seconds 的待确认消息（节点宕机、主机名变化、
+//    调小 worker 数后不再使用的消费者），认领后按本消费者的待确认消息写库（需要 Redis 6.2+）
+//  - 读满一批的 stream 重新放回待持久化集合，积压越多各线程空转越少，吞吐随积压自动提高
+//  - 每个 stream 每次读取的条数按 AIMD 调整：还有积压且写库耗时低于目标时加性增大，写库超过目标耗时或失败时减半
+//  - 空闲时等待时间从 10ms 倍增到 1s，有消息时立即回到 10ms
+//  - 确认之后按房间保留策略裁剪 stream（见 StreamRetention），未入库的消息不会被裁剪
+//  - 写入使用 CDBConn::BulkInsert 并跳过重复键，依赖 messages.redis_id 唯一索引，重复投递不会重复入库
+//  - msg 配置了分片（msg_shards）时，每个分片有自己的待持久化集合，工作线程轮流从各分片领取
+struct MsgPersistOptions {
+    int worker_count = 4;                   // 工作线程数
+    int streams_per_batch = 64;             // 每次弹出的 stream 数
+    int entries_per_stream = 100;           // 每个 stream 每次读取的初始条数
+    int max_entries_per_stream = 1000;      // AIMD 调整的上限
+    int target_insert_ms = 200;             // 一批写库的目标耗时，超过就减小批量
+    int lag_alert_seconds = 30;             // 持久化延迟超过这个值进入背压状态
+    int drain_timeout_seconds = 30;         // 停止时最多等待多久把积压写完
+    int load_data_min_rows = 0;             // 一批达到这个行数时改用 LOAD DATA 导入，0 表示只用预处理语句
+    int claim_min_idle_seconds = 60;        // 认领其他消费者空闲超过这个时间的待确认消息，0 表示不认领
+    int instance_port = 0;                  // 本进程监听的端口，拼进消费者名，区分同一主机上的多个进程
+};
+
+class MsgPersistWorkers
+{
+public:
+    static const int kPersistReadFailed = -2;
+
+    static MsgPersistWorkers &GetInstance() {
+        static MsgPersistWorkers instance;
+        return instance;
+    }
+
+    void Start(const MsgPersistOptions &options);
+    // 停止所有工作线程：先把待持久化的 stream 写完（最多 drain_timeout_seconds 秒）再退出
+    void Stop();
+
+private:
+    MsgPersistWorkers() {}
+    ~MsgPersistWorkers() { Stop(); }
+
+    void WorkerLoop(int index);
+    // 重新读取本消费者之前领取但没有确认的消息（进程重启或写库失败后）
+    void RecoverPending(const string &consumer);
+    int RecoverShardPending(const string &consumer, const string &pool);
+    // 认领其他消费者长时间未确认的消息并写库，返回认领的条数
+    int ClaimStalePending(const string &consumer);
+    int ClaimShardStalePending(const string &consumer, const string &pool);
+    // 从分片连接池 pool 读取一批 stream 并写入 MySQL，返回持久化的条数；
+    // XREADGROUP 失败返回 kPersistReadFailed（消息没有读出来），读出后写库或确认前失败返回-1（消息在本消费者的待确认列表里）
+    int PersistBatch(const string &consumer, const string &pool, const std::vector<string> &streams,
+                     const string &start_id);
+    // 读取失败后逐个检查 stream：消费组不存在时从头重建并标记为待持久化，key 不存在时移出 streams 和持久化集合
+    // Redis 不可用时返回false，streams 不变
+    bool RepairStreams(const string &pool, std::vector<string> &streams);
+    // 修复后把 stream 放回待持久化集合，成功返回true
+    bool RequeueStreams(const string &pool, std::vector<string> &streams);
+    // 根据一批的写库耗时和是否还有积压调整每个 stream 的读取条数，写库失败（failed）时直接减半
+    void AdjustBatchSize(double insert_ms, bool has_more, bool failed = false);
+    // 根据持久化延迟更新背压状态
+    void UpdateLag(double lag_seconds);
+    bool DrainExpired();
+    // 采集 Redis 已用内存
+    void RefreshRedisMemory();
+    // 更新一个分片的待持久化 stream 数，导出所有分片之和
+    void SetShardBacklog(size_t shard, long long streams);
+
+    MsgPersistOptions options_;
+    std::atomic<int> entries_per_stream_{100};
+    std::atomic<bool> load_data_enabled_{true};
+    std::atomic<bool> backpressure_{false};
+    string consumer_prefix_;
+    std::vector<string> shard_pools_;       // msg 的分片连接池名，没有分片时只有 "msg"
+    std::vector<long long> shard_backlog_;  // 各分片待持久化的 stream 数，mutex_ 保护
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable cond_var_;
+    std::atomic<bool> running_{false};
+    std::atomic<bool> stopping_{false};                 // 正在停止，写完积压后退出
+    std::chrono::steady_clock::time_point drain_deadline_;
+};
+
+#endif
@@ -62,25 +62,25 @@ int registerUser(string &username, string &email, string &password, api_error_id
         return 1;
     }
     // 先查询 用户名  邮箱是否存在 如果存在就报错
-    string str_sql = FormatString("select id, username, email from users where username='%s' or email='%s' ", username.c_str(), email.c_str());
-
-    CResultSet *result_set = db_conn->ExecuteQuery(str_sql.c_str());
-    if(result_set && result_set->Next()) {
-        if(result_set->GetString("username")) {
-            if(result_set->GetString("username") == username)  {
-                error_id = api_error_id::username_exists;
-                LOG_WARN << "id: " << result_set->GetInt("id") << ", username: " <<  username <<  "  已经存在";
-            }
-           
+    CPrepareStatement *stmt = db_conn->GetStatement("select id, username, email from users where username=? or email=?");
+    if (!stmt) {
+        return 1;
+    }
+    stmt->SetParam(0, username);
+    stmt->SetParam(1, email);
+    if (!stmt->ExecuteQuery()) {
+        return 1;
+    }
+    if(stmt->Fetch()) {
+        if(stmt->GetString(1) == username)  {
+            error_id = api_error_id::username_exists;
+            LOG_WARN << "id: " << stmt->GetInt(0) << ", username: " <<  username <<  "  已经存在";
         }
 
-        if(result_set->GetString("email")) {
-            if(result_set->GetString("email") == email) {
-                error_id = api_error_id::email_exists;
-                LOG_WARN << "id: " << result_set->GetInt("id") << ", email: " <<  email <<  "  已经存在";
-            }
+        if(stmt->GetString(2) == email) {
+            error_id = api_error_id::email_exists;
+            LOG_WARN << "id: " << stmt->GetInt(0) << ", email: " <<  email <<  "  已经存在";
         }
-        delete result_set;
         return -1;
     }
 
@@ -92,11 +92,11 @@ int registerUser(string &username, string &email, string &password, api_error_id
     LOG_INFO << "salt: " << salt;
 
     //插入语句
-    str_sql = "insert into users  (`username`,`email`,`password_hash`,`salt`) values(?,?,?,?)";
+    string str_sql = "insert into users  (`username`,`email`,`password_hash`,`salt`) values(?,?,?,?)";
     LOG_INFO << "执行: " <<  str_sql;
-    // 预处理方式写入数据
-    CPrepareStatement *stmt = new CPrepareStatement();
-    if (stmt->Init(db_conn->GetMysql(), str_sql)) {
+    // 预处理方式写入数据，语句缓存在连接上
+    stmt = db_conn->GetStatement(str_sql);
+    if (stmt) {
         uint32_t index = 0;
         stmt->SetParam(index++, username);
         stmt->SetParam(index++, email);
@@ -105,13 +105,12 @@ int registerUser(string &username, string &email, string &password, api_error_id
         bool bRet = stmt->ExecuteUpdate(); //真正提交要写入的数据
         if (bRet) {     //提交正常返回 true
             ret = 0;
-            LOG_INFO << "insert user_id: " <<  db_conn->GetInsertId() <<  ", username: " <<  username ;
+            LOG_INFO << "insert user_id: " <<  stmt->GetInsertId() <<  ", username: " <<  username ;
         } else {
             LOG_ERROR << "insert users failed. " <<  str_sql;
             ret = 1;
         }
     }
-    delete stmt;
 
     return ret;
 }
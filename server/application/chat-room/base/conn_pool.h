@@ -0,0 +1,291 @@
+#ifndef __CONN_POOL_H__
+#define __CONN_POOL_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// redis 和 mysql 连接池共用的实现，连接类继承 PooledConn
+// 取连接的顺序：
+//  1. 本线程的缓存槽（无锁，同一线程反复取还几乎不碰共享状态）
+//  2. 共享空闲栈（一把锁，O(1) 出入栈）
+//  3. 没到上限时新建连接（建连不持锁）
+//  4. 到上限时从其他线程的缓存槽里借空闲连接，还借不到就限时等待，超时返回NULL
+// 归还时有线程在等待则放回共享栈并唤醒，否则放进本线程的缓存槽，槽已占用时放回共享栈
+// 连接空闲超过 idle_check_seconds 后再取出时先做一次健康检查，不通过的连接关掉重建，不再每条命令前检查
+
+// 连接在池中的状态
+struct PooledConn {
+    std::atomic<bool> pool_in_use{false};   // 已被取出，重复归还时据此发现
+    time_t pool_idle_since = 0;             // 最近一次归还的时间
+};
+
+struct ConnPoolOptions {
+    int min_idle = 2;               // 启动时预先建立的连接数
+    int max_conn = 16;              // 最大连接数
+    int acquire_timeout_ms = 1000;  // 取连接默认最长等待时间，0 表示一直等
+    int idle_check_seconds = 30;    // 空闲超过这个时间的连接取出时做健康检查
+};
+
+// 连接池当前状态，定时导出为监控指标
+struct ConnPoolStats {
+    std::string name;
+    int total = 0;                  // 已建立的连接数
+    int in_use = 0;                 // 已取出的连接数
+    uint64_t acquires = 0;          // 成功取出次数
+    uint64_t exhausted = 0;         // 取连接时已到上限、需要等待的次数
+    uint64_t timeouts = 0;          // 等待超时次数
+};
+
+// 每次取连接结束时调用：池名、等待毫秒数、是否遇到连接耗尽、是否取到
+typedef std::function<void(const std::string &pool_name, double wait_ms, bool exhausted, bool ok)>
+    ConnPoolAcquireObserver;
+
+inline ConnPoolAcquireObserver &GetConnPoolAcquireObserver() {
+    static ConnPoolAcquireObserver observer;
+    return observer;
+}
+
+// 在启动连接池之前设置
+inline void SetConnPoolAcquireObserver(ConnPoolAcquireObserver observer) {
+    GetConnPoolAcquireObserver() = std::move(observer);
+}
+
+template <typename Conn>
+class ConnPool {
+  public:
+    // 新建并连上一个连接，失败返回NULL
+    typedef std::function<Conn *()> CreateFunc;
+    // 健康检查：idle_expired 为 true 表示空闲超时；连接不可用返回false
+    typedef std::function<bool(Conn *, bool idle_expired)> CheckFunc;
+
+    ConnPool(const std::string &name, const ConnPoolOptions &options, CreateFunc create, CheckFunc check)
+        : name_(name), options_(options), create_(std::move(create)), check_(std::move(check)) {}
+
+    ~ConnPool() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        abort_ = true;
+        cond_var_.notify_all();
+        for (Conn *conn : free_list_) {
+            delete conn;
+        }
+        free_list_.clear();
+        for (auto &slot : slots_) {
+            delete slot->conn.exchange(nullptr);
+        }
+    }
+
+    // 预先建立 min_idle 个连接，失败返回非0
+    int Init() {
+        for (int i = 0; i < options_.min_idle && i < options_.max_conn; i++) {
+            Conn *conn = create_();
+            if (!conn) {
+                return 1;
+            }
+            conn->pool_idle_since = time(NULL);
+            std::lock_guard<std::mutex> lock(mutex_);
+            free_list_.push_back(conn);
+            total_++;
+        }
+        return 0;
+    }
+
+    // timeout_ms <= 0 时使用默认的 acquire_timeout_ms
+    Conn *Acquire(int timeout_ms) {
+        if (timeout_ms <= 0) {
+            timeout_ms = options_.acquire_timeout_ms;
+        }
+        auto start = std::chrono::steady_clock::now();
+        bool exhausted = false;
+        bool created = false;
+
+        Conn *conn = ThreadSlot()->conn.exchange(nullptr);
+        if (!conn) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto deadline = start + std::chrono::milliseconds(timeout_ms);
+            while (!conn) {
+                if (abort_) {
+                    return NULL;
+                }
+                if (!free_list_.empty()) {
+                    conn = free_list_.back();
+                    free_list_.pop_back();
+                    break;
+                }
+                if (total_ < options_.max_conn) {
+                    total_++;
+                    lock.unlock();
+                    conn = create_();
+                    if (!conn) {
+                        lock.lock();
+                        total_--;
+                        cond_var_.notify_one();
+                        lock.unlock();
+                        Observe(start, exhausted, false);
+                        return NULL;
+                    }
+                    created = true;
+                    break;
+                }
+                conn = StealFromSlots();
+                if (conn) {
+                    break;
+                }
+                if (!exhausted) {
+                    exhausted = true;
+                    exhausted_++;
+                }
+                if (timeout_ms > 0 && std::chrono::steady_clock::now() >= deadline) {
+                    timeouts_++;
+                    lock.unlock();
+                    Observe(start, exhausted, false);
+                    return NULL;
+                }
+                // 按小片等待：归还到缓存槽的连接不会唤醒等待者，醒来后重新检查并尝试借用
+                waiters_++;
+                cond_var_.wait_for(lock, std::chrono::milliseconds(10));
+                waiters_--;
+            }
+        }
+
+        if (!created && check_ && !check_(conn, time(NULL) - conn->pool_idle_since >= options_.idle_check_seconds)) {
+            // 连接已经不可用，关掉重建
+            delete conn;
+            conn = create_();
+            if (!conn) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    total_--;
+                    cond_var_.notify_one();
+                }
+                Observe(start, exhausted, false);
+                return NULL;
+            }
+        }
+
+        conn->pool_in_use.store(true, std::memory_order_relaxed);
+        in_use_++;
+        acquires_++;
+        Observe(start, exhausted, true);
+        return conn;
+    }
+
+    // 重复归还返回false，连接不会被放回两次
+    bool Release(Conn *conn) {
+        if (!conn->pool_in_use.exchange(false)) {
+            return false;
+        }
+        in_use_--;
+        conn->pool_idle_since = time(NULL);
+        if (waiters_.load() == 0) {
+            Conn *expected = nullptr;
+            if (ThreadSlot()->conn.compare_exchange_strong(expected, conn)) {
+                return true;
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_list_.push_back(conn);
+        cond_var_.notify_one();
+        return true;
+    }
+
+    ConnPoolStats GetStats() {
+        ConnPoolStats stats;
+        stats.name = name_;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats.total = total_;
+        }
+        stats.in_use = in_use_.load();
+        stats.acquires = acquires_.load();
+        stats.exhausted = exhausted_.load();
+        stats.timeouts = timeouts_.load();
+        return stats;
+    }
+
+    const ConnPoolOptions &GetOptions() const { return options_; }
+
+  private:
+    // 线程缓存槽，只放空闲连接；其他线程在连接耗尽时可以借走
+    struct Slot {
+        std::atomic<Conn *> conn{nullptr};
+    };
+
+    // 线程退出时把缓存的连接放回共享栈（连接池和进程同寿命）
+    struct ThreadSlots {
+        std::vector<std::pair<ConnPool *, Slot *>> slots;
+        ~ThreadSlots() {
+            for (auto &item : slots) {
+                Conn *conn = item.second->conn.exchange(nullptr);
+                if (conn) {
+                    std::lock_guard<std::mutex> lock(item.first->mutex_);
+                    item.first->free_list_.push_back(conn);
+                    item.first->cond_var_.notify_one();
+                }
+            }
+        }
+    };
+
+    Slot *ThreadSlot() {
+        static thread_local ThreadSlots t_slots;
+        for (auto &item : t_slots.slots) {
+            if (item.first == this) {
+                return item.second;
+            }
+        }
+        Slot *slot = new Slot();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            slots_.emplace_back(slot);
+        }
+        t_slots.slots.push_back({this, slot});
+        return slot;
+    }
+
+    // 持有 mutex_ 时调用
+    Conn *StealFromSlots() {
+        for (auto &slot : slots_) {
+            Conn *conn = slot->conn.exchange(nullptr);
+            if (conn) {
+                return conn;
+            }
+        }
+        return NULL;
+    }
+
+    void Observe(std::chrono::steady_clock::time_point start, bool exhausted, bool ok) {
+        const ConnPoolAcquireObserver &observer = GetConnPoolAcquireObserver();
+        if (observer) {
+            double wait_ms =
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            observer(name_, wait_ms, exhausted, ok);
+        }
+    }
+
+    std::string name_;
+    ConnPoolOptions options_;
+    CreateFunc create_;
+    CheckFunc check_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_var_;
+    std::vector<Conn *> free_list_;             // 共享空闲栈，后进先出，最近用过的连接先被取到
+    std::vector<std::unique_ptr<Slot>> slots_;  // 所有线程的缓存槽
+    int total_ = 0;
+    bool abort_ = false;
+
+    std::atomic<int> waiters_{0};
+    std::atomic<int> in_use_{0};
+    std::atomic<uint64_t> acquires_{0};
+    std::atomic<uint64_t> exhausted_{0};
+    std::atomic<uint64_t> timeouts_{0};
+};
+
+#endif
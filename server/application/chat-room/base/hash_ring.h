@@ -0,0 +1,66 @@
+#ifndef __HASH_RING_H__
+#define __HASH_RING_H__
+
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// 带虚拟节点的一致性哈希环，key 落到顺时针方向第一个虚拟节点所属的节点
+// 虚拟节点的位置只由节点名（如 "host:port"）决定，和节点加入的顺序无关：
+// 增加一个节点只有约 1/N 的 key 换到新节点，去掉一个节点只影响原来落在它上面的 key
+class HashRing {
+  public:
+    explicit HashRing(int virtual_nodes = 160) : virtual_nodes_(virtual_nodes) {}
+
+    // 返回节点下标，GetNode 返回的就是这个下标
+    int AddNode(const std::string &node) {
+        int index = static_cast<int>(nodes_.size());
+        nodes_.push_back(node);
+        for (int i = 0; i < virtual_nodes_; i++) {
+            points_.push_back({Hash(node + "#" + std::to_string(i)), index});
+        }
+        std::sort(points_.begin(), points_.end());
+        return index;
+    }
+
+    // 没有节点时返回-1
+    int GetNode(std::string_view key) const {
+        if (points_.empty()) {
+            return -1;
+        }
+        uint64_t hash = Hash(key);
+        auto it = std::lower_bound(points_.begin(), points_.end(), std::make_pair(hash, -1));
+        if (it == points_.end()) {
+            it = points_.begin();   // 绕回环的起点
+        }
+        return it->second;
+    }
+
+    size_t NodeCount() const { return nodes_.size(); }
+    const std::string &GetNodeName(int index) const { return nodes_[index]; }
+
+    // FNV-1a 再做一次 murmur3 的 fmix64，短 key 也能均匀分布
+    static uint64_t Hash(std::string_view key) {
+        uint64_t hash = 14695981039346656037ULL;
+        for (unsigned char c : key) {
+            hash ^= c;
+            hash *= 1099511628211ULL;
+        }
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ULL;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+  private:
+    int virtual_nodes_;
+    std::vector<std::string> nodes_;
+    std::vector<std::pair<uint64_t, int>> points_;     // (虚拟节点位置, 节点下标)，按位置排序
+};
+
+#endif
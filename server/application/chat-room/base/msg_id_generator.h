@@ -0,0 +1,78 @@
+#ifndef __MSG_ID_GENERATOR_H__
+#define __MSG_ID_GENERATOR_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <chrono>
+#include <mutex>
+#include <string>
+
+// 本地生成消息ID，格式和 Redis stream ID 一样是 "毫秒-序号"，可以直接作为 XADD 的显式ID
+//  - 序号 = 毫秒内计数 * 1024 + 节点号，不同节点同一毫秒生成的ID不会重复
+//  - 同一节点严格递增：时钟回拨时沿用上一次的毫秒，一毫秒内计数用完时借用下一毫秒，不会阻塞等待
+// comet 生成ID后立即广播，再带着这个ID写入 Redis；Logic、Job、MySQL 使用同一个ID
+// 只有头文件，logic 服务也直接包含
+class MsgIdGenerator
+{
+public:
+    static const int kNodeBits = 10;
+    static const int kMaxNodeId = (1 << kNodeBits) - 1;
+    static const uint64_t kMaxSequence = 4095;     // 每个节点每毫秒最多 4096 个ID
+
+    static MsgIdGenerator &GetInstance() {
+        static MsgIdGenerator instance;
+        return instance;
+    }
+
+    // 节点号 0~1023，需要在生成ID之前设置
+    void SetNodeId(int node_id) {
+        std::lock_guard<std::mutex> lck(mutex_);
+        node_id_ = node_id & kMaxNodeId;
+    }
+    int GetNodeId() {
+        std::lock_guard<std::mutex> lck(mutex_);
+        return node_id_;
+    }
+
+    std::string NextId() {
+        uint64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        uint64_t ms;
+        uint64_t seq;
+        {
+            std::lock_guard<std::mutex> lck(mutex_);
+            if (now_ms > last_ms_) {
+                last_ms_ = now_ms;
+                sequence_ = 0;
+            } else if (++sequence_ > kMaxSequence) {
+                last_ms_++;
+                sequence_ = 0;
+            }
+            ms = last_ms_;
+            seq = (sequence_ << kNodeBits) | static_cast<uint64_t>(node_id_);
+        }
+        return std::to_string(ms) + "-" + std::to_string(seq);
+    }
+
+    // 解析 "毫秒-序号"，格式错误返回false
+    static bool Parse(const std::string &id, uint64_t &ms, uint64_t &seq) {
+        char *end = NULL;
+        ms = strtoull(id.c_str(), &end, 10);
+        if (end == id.c_str() || *end != '-') {
+            return false;
+        }
+        const char *seq_begin = end + 1;
+        seq = strtoull(seq_begin, &end, 10);
+        return end != seq_begin && *end == '\0';
+    }
+
+private:
+    MsgIdGenerator() {}
+
+    std::mutex mutex_;
+    int node_id_ = 0;
+    uint64_t last_ms_ = 0;
+    uint64_t sequence_ = 0;
+};
+
+#endif
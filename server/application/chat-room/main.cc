@@ -1,8 +1,10 @@
 #include <iostream>
 #include <signal.h>
+#include <unistd.h>
 #include <mutex>
 #include <atomic>
 #include <thread>
+#include <sstream>
 
 #include "muduo/net/EventLoop.h"
 #include "muduo/net/TcpServer.h"
@@ -12,8 +14,18 @@
 #include "config_file_reader.h"
 #include "db_pool.h"
 #include "cache_pool.h"
+#include "async_cache_conn.h"
+#include "async_db_conn.h"
 #include "pub_sub_service.h"
+#include "loop_fanout.h"
+#include "room_catalog.h"
+#include "history_loader.h"
+#include "room_bus.h"
 #include "api_msg.h"
+#include "api_msg_commit.h"
+#include "api_msg_persist.h"
+#include "msg_id_generator.h"
+#include "session_cache.h"
 #include "monitoring/metrics_collector.h"
 
 #ifdef ENABLE_RPC
@@ -37,6 +49,12 @@ public:
         server_.setMessageCallback(
             std::bind(&HttpServer::onMessage, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
         server_.setWriteCompleteCallback(std::bind(&HttpServer::onWriteComplete, this, std::placeholders::_1));
+        // 每个 IO loop 启动时注册到房间广播，num_event_loops=0 时注册的是 base loop
+        server_.setThreadInitCallback([](muduo::net::EventLoop *io_loop) {
+            LoopFanout::GetInstance().RegisterLoop(io_loop);
+            AsyncCacheConn::InitForLoop(io_loop);   // 没有开启 redis_async_enable 时不创建
+            AsyncDBConn::InitForLoop(io_loop);      // 没有开启 db_async_enable 时不创建
+        });
    
         server_.setThreadNum(num_event_loops);
     }
@@ -80,8 +98,18 @@ void HttpServer::onConnection(const muduo::net::TcpConnectionPtr& conn)
             if (!conn->getContext().empty()) {
                 uint32_t uuid = std::any_cast<uint32_t>(conn->getContext());
                 LOG_INFO << "onConnection中" << "uuid: " << uuid << ", onConnection dis conn" << conn.get();
-                std::lock_guard<std::mutex> ulock(mtx_); 
-                s_http_handler_map.erase(uuid);  //自动释放对应http_handler
+                HttpHandlerPtr http_conn;
+                {
+                    std::lock_guard<std::mutex> ulock(mtx_); 
+                    auto it = s_http_handler_map.find(uuid);
+                    if (it != s_http_handler_map.end()) {
+                        http_conn = it->second;
+                        s_http_handler_map.erase(it);  //自动释放对应http_handler
+                    }
+                }
+                if (http_conn) {
+                    http_conn->OnClose();   //退订房间、移出连接映射表
+                }
             } else {
                 LOG_WARN << "Connection context is empty during disconnect";
             }
@@ -155,16 +183,8 @@ void HttpServer::onWriteComplete(const muduo::net::TcpConnectionPtr& /*conn*/)
 }
 
 int load_room_list() {
-    PubSubService& pubSubService = PubSubService::GetInstance();
-
-    std::vector<Room> &all_rooms = PubSubService::GetRoomList(); //获取缺省的聊天室列表
-     
-    for (const auto& room : all_rooms) {
-        pubSubService.AddRoomTopic(room.room_id, room.room_name, "1");
-        LOG_INFO << "Added room to PubSubService: " << room.room_id << " - " << room.room_name;
-    }
-    
-    return 0;
+    // 只加载默认房间目录，RoomTopic 在第一次有人订阅时才创建
+    return RoomCatalog::GetInstance().LoadDefaultRooms();
 }
 
 void check_redis_ready(CacheManager *cache_manager){
@@ -215,35 +235,54 @@ void check_redis_ready(CacheManager *cache_manager){
     // 因为我机器上有两套环境,防止混淆，加入这个check
 }
 
-// 定时持久化消息的回调函数
-void on_persist_messages_timer(muduo::net::EventLoop* loop) {
-    static int persist_counter = 0;
-    persist_counter++;
-    
-    LOG_DEBUG << "开始第 " << persist_counter << " 次定时持久化消息";
-    
-    try {
-        int persisted_count = ApiBatchPersistMessages(100); // 每次最多处理100条消息
-        if (persisted_count > 0) {
-            LOG_INFO << "成功持久化 " << persisted_count << " 条消息到MySQL";
-        } else if (persisted_count == 0) {
-            LOG_DEBUG << "没有待持久化的消息";
-        } else {
-            LOG_ERROR << "持久化消息失败";
+// 定时回收空闲房间：房间空了超过 grace_seconds 秒才释放，避免成员频繁进出时反复创建
+void on_reclaim_rooms_timer(muduo::net::EventLoop* loop, int grace_seconds) {
+    std::vector<string> reclaimed_room_ids;
+    size_t reclaimed_count = PubSubService::GetInstance().ReclaimIdleRoomTopics(grace_seconds, &reclaimed_room_ids);
+    // 按需加载的房间目录条目跟着 RoomTopic 一起释放，下次有人加入时重新加载
+    for (const string &room_id : reclaimed_room_ids) {
+        RoomCatalog::GetInstance().EvictRoom(room_id);
+    }
+    if (reclaimed_count > 0) {
+        LOG_INFO << "回收空闲房间 " << reclaimed_count << " 个，剩余 " << PubSubService::GetInstance().GetRoomTopicCount();
+    }
+    loop->runAfter(10.0, std::bind(&on_reclaim_rooms_timer, loop, grace_seconds));
+}
+
+// 消息ID节点号租约的有效期（秒），每 1/3 有效期续约一次
+static const int kMsgIdNodeLeaseSeconds = 60;
+
+// 定时续约消息ID节点号；Redis 长时间不可用期间租约过期并被其他节点占用时，换一个空闲的节点号
+void on_msg_id_node_timer(muduo::net::EventLoop* loop, const string &owner) {
+    int node_id = MsgIdGenerator::GetInstance().GetNodeId();
+    int ret = ApiRenewMsgIdNode(node_id, owner, kMsgIdNodeLeaseSeconds);
+    if (ret == 1) {
+        int new_node_id = ApiAcquireMsgIdNode(owner, MsgIdGenerator::kMaxNodeId, kMsgIdNodeLeaseSeconds);
+        LOG_ERROR << "msg id node " << node_id << " is held by another node, switch to " << new_node_id;
+        MetricsCollector::GetInstance().IncrementCounter("msg_id", "node_lease_lost");
+        if (new_node_id >= 0) {
+            MsgIdGenerator::GetInstance().SetNodeId(new_node_id);
         }
-    } catch (const std::exception& e) {
-        LOG_ERROR << "持久化消息异常: " << e.what();
+    } else if (ret < 0) {
+        LOG_WARN << "renew msg id node " << node_id << " failed";
     }
-    
-    // 设置下次定时器（10秒后再次执行）
-    loop->runAfter(10.0, std::bind(&on_persist_messages_timer, loop));
+    loop->runAfter(kMsgIdNodeLeaseSeconds / 3.0, std::bind(&on_msg_id_node_timer, loop, owner));
 }
 
-// 启动消息持久化定时器
-void start_message_persistence_timer(muduo::net::EventLoop* loop) {
-    LOG_INFO << "启动消息持久化定时器，每10秒执行一次";
-    // 延迟5秒开始第一次执行，给系统一些启动时间
-    loop->runAfter(5.0, std::bind(&on_persist_messages_timer, loop));
+// 定时导出 redis/mysql 连接池的连接数
+void on_pool_stats_timer(muduo::net::EventLoop* loop) {
+    std::vector<ConnPoolStats> pool_stats;
+    CacheManager::getInstance()->GetPoolStats(pool_stats);
+    CDBManager::getInstance()->GetPoolStats(pool_stats);
+    for (const ConnPoolStats &stats : pool_stats) {
+        MetricsCollector::GetInstance().SetPoolConnections(stats.name, stats.total, stats.in_use);
+    }
+    std::vector<DBStmtStats> stmt_stats;
+    CDBManager::getInstance()->GetStmtStats(stmt_stats);
+    for (const DBStmtStats &stats : stmt_stats) {
+        MetricsCollector::GetInstance().SetDBStmtCache(stats.name, stats.lookups - stats.prepares, stats.prepares);
+    }
+    loop->runAfter(5.0, std::bind(&on_pool_stats_timer, loop));
 }
 
 void check_mysql_ready(CDBManager *db_manager){
@@ -307,8 +346,6 @@ int main(int argc, char* argv[])
         str_conf = (char *)"conf.conf";
     }
 
-    load_room_list();
-    
     CConfigFileReader config_file(str_conf); 
 
     char *str_log_level =  config_file.GetConfigName("log_level");
@@ -349,6 +386,23 @@ int main(int argc, char* argv[])
 
     // check_mysql_ready(db_manager);
 
+    load_room_list();
+    // 加入不在目录里的房间时在这些线程查库，0 表示在 IO 线程内同步查询
+    int room_load_threads = 2;
+    char *str_room_load_threads = config_file.GetConfigName("room_load_threads");
+    if (str_room_load_threads && strlen(str_room_load_threads) > 0) {
+        room_load_threads = atoi(str_room_load_threads);
+    }
+    RoomCatalog::GetInstance().StartLoader(room_load_threads);
+    // 历史消息 Redis 层不够一页时在这些线程查 MySQL，0 表示在 IO 线程内同步查询
+    int history_load_threads = 2;
+    char *str_history_load_threads = config_file.GetConfigName("history_load_threads");
+    if (str_history_load_threads && strlen(str_history_load_threads) > 0) {
+        history_load_threads = atoi(str_history_load_threads);
+    }
+    HistoryLoader::GetInstance().Start(history_load_threads);
+    ApiCheckMessageIndexes();   // 缺少持久化/历史分页依赖的索引时打印需要执行的 DDL
+
     // 初始化监控系统
     uint16_t metrics_port = 9091;  // Comet metrics 端口
     char *str_metrics_port = config_file.GetConfigName("metrics_port");
@@ -356,12 +410,108 @@ int main(int argc, char* argv[])
         metrics_port = atoi(str_metrics_port);
     }
     
+    // 慢查询阈值和保留条数，慢查询在 metrics 端口的 /slow_queries 查看
+    double db_slow_query_ms = 200;
+    size_t db_slow_query_log_size = 100;
+    char *str_db_slow_query_ms = config_file.GetConfigName("db_slow_query_ms");
+    if (str_db_slow_query_ms && strlen(str_db_slow_query_ms) > 0) {
+        db_slow_query_ms = atof(str_db_slow_query_ms);
+    }
+    char *str_db_slow_query_log_size = config_file.GetConfigName("db_slow_query_log_size");
+    if (str_db_slow_query_log_size && strlen(str_db_slow_query_log_size) > 0) {
+        db_slow_query_log_size = atoi(str_db_slow_query_log_size);
+    }
+    MetricsCollector::GetInstance().SetSlowQueryOptions(db_slow_query_ms, db_slow_query_log_size);
+
     std::string metrics_bind_address = std::string("0.0.0.0:") + std::to_string(metrics_port);
     MetricsCollector::GetInstance().Initialize(metrics_bind_address, "comet");
     LOG_INFO << "Metrics endpoint initialized at http://" << metrics_bind_address << "/metrics";
 
+    // 连接池取连接的等待时间、耗尽和超时次数
+    std::vector<ConnPoolStats> pool_stats;
+    cache_manager->GetPoolStats(pool_stats);
+    db_manager->GetPoolStats(pool_stats);
+    for (const ConnPoolStats &stats : pool_stats) {
+        MetricsCollector::GetInstance().RegisterConnPool(stats.name);
+    }
+    SetConnPoolAcquireObserver([](const string &pool_name, double wait_ms, bool exhausted, bool ok) {
+        MetricsCollector::GetInstance().ObservePoolAcquire(pool_name, wait_ms, exhausted, ok);
+    });
+    // 每条 MySQL 语句按指纹统计执行耗时（不含上面的取连接等待），超过 db_slow_query_ms 的记入慢查询
+    SetDBStatementObserver([](const string &pool_name, const string &fingerprint, double exec_ms,
+                              uint64_t rows_returned, uint64_t rows_affected, bool ok) {
+        MetricsCollector::GetInstance().ObserveDBStatement(pool_name, fingerprint, exec_ms, rows_returned,
+                                                           rows_affected, ok);
+    });
+
     int num_event_loops = 0; 
     int num_threads = 0;
+    char *str_num_event_loops = config_file.GetConfigName("num_event_loops");
+    if (str_num_event_loops && strlen(str_num_event_loops) > 0) {
+        num_event_loops = atoi(str_num_event_loops);
+    }
+    char *str_num_threads = config_file.GetConfigName("num_threads");
+    if (str_num_threads && strlen(str_num_threads) > 0) {
+        num_threads = atoi(str_num_threads);
+    }
+    LoopFanout::GetInstance().SetDeliverCallback(&CWebSocketConn::DeliverBatch);
+
+    // 跨节点房间广播总线（可选）
+    char *str_room_bus_enable = config_file.GetConfigName("room_bus_enable");
+    if (str_room_bus_enable && atoi(str_room_bus_enable) == 1) {
+        string room_bus_host = "127.0.0.1";
+        int room_bus_port = 6379;
+        char *str_room_bus_host = config_file.GetConfigName("room_bus_host");
+        if (str_room_bus_host && strlen(str_room_bus_host) > 0) {
+            room_bus_host = str_room_bus_host;
+        }
+        char *str_room_bus_port = config_file.GetConfigName("room_bus_port");
+        if (str_room_bus_port && strlen(str_room_bus_port) > 0) {
+            room_bus_port = atoi(str_room_bus_port);
+        }
+        RoomBus::GetInstance().Init(room_bus_host, room_bus_port);
+        // 本地有房间时才订阅该房间的频道
+        PubSubService::GetInstance().SetRoomTopicListener([](const string &room_id, bool created) {
+            if (created) {
+                RoomBus::GetInstance().SubscribeRoom(room_id);
+            } else {
+                RoomBus::GetInstance().UnsubscribeRoom(room_id);
+            }
+        });
+    }
+    // 每个 IO loop 一个 Redis 异步连接（和 msg 连接池同一个实例，分片时每个分片一个），loop 线程上的 Redis 读取不再阻塞
+    char *str_redis_async_enable = config_file.GetConfigName("redis_async_enable");
+    if (str_redis_async_enable && atoi(str_redis_async_enable) == 1) {
+        if (cache_manager->GetShardIndex("msg", "") >= 0) {
+            AsyncCacheConn::Configure("msg");
+        } else {
+            LOG_ERROR << "redis_async_enable needs the msg cache pool";
+        }
+    }
+    // 每个 IO loop 若干个 MySQL 非阻塞连接（user_centre 库），发消息时查询发送者信息不阻塞 loop 线程
+    char *str_db_async_enable = config_file.GetConfigName("db_async_enable");
+    if (str_db_async_enable && atoi(str_db_async_enable) == 1) {
+        int db_async_conns_per_loop = 2;
+        char *str_db_async_conns_per_loop = config_file.GetConfigName("db_async_conns_per_loop");
+        if (str_db_async_conns_per_loop && strlen(str_db_async_conns_per_loop) > 0) {
+            db_async_conns_per_loop = atoi(str_db_async_conns_per_loop);
+        }
+        AsyncDBConn::Configure("user_centre", db_async_conns_per_loop);
+    }
+    // token 校验结果的本地缓存（可选），token 变化时由 Redis CLIENT TRACKING 通知失效
+    char *str_token_cache_enable = config_file.GetConfigName("token_cache_enable");
+    if (str_token_cache_enable && atoi(str_token_cache_enable) == 1) {
+        SessionCacheOptions session_cache_options;
+        char *str_token_cache_max_entries = config_file.GetConfigName("token_cache_max_entries");
+        if (str_token_cache_max_entries && strlen(str_token_cache_max_entries) > 0) {
+            session_cache_options.max_entries = atoi(str_token_cache_max_entries);
+        }
+        char *str_token_cache_fallback_ttl = config_file.GetConfigName("token_cache_fallback_ttl_seconds");
+        if (str_token_cache_fallback_ttl && strlen(str_token_cache_fallback_ttl) > 0) {
+            session_cache_options.fallback_ttl_seconds = atoi(str_token_cache_fallback_ttl);
+        }
+        SessionCache::GetInstance().Init(cache_manager->GetCachePool("token"), session_cache_options);
+    }
     // int timeout_ms = 10;
 
     muduo::net::EventLoop loop; 
@@ -369,8 +519,119 @@ int main(int argc, char* argv[])
 
     HttpServer server(&loop, addr, "HttpServer", num_event_loops, num_threads);
 
-    // 启动消息持久化定时器
-    start_message_persistence_timer(&loop);
+    // 消息ID生成器的节点号，多个 comet 节点需要各不相同：配置了 msg_id_node_id 时直接使用（由部署保证不重复），
+    // 没有配置时在 msg Redis 中租用一个空闲的节点号并定时续约。1023 留给 logic 服务
+    int msg_id_node_id = -1;
+    char *str_msg_id_node_id = config_file.GetConfigName("msg_id_node_id");
+    if (str_msg_id_node_id && strlen(str_msg_id_node_id) > 0) {
+        msg_id_node_id = atoi(str_msg_id_node_id);
+        if (msg_id_node_id < 0 || msg_id_node_id >= MsgIdGenerator::kMaxNodeId) {
+            LOG_ERROR << "msg_id_node_id must be in [0, " << MsgIdGenerator::kMaxNodeId - 1 << "]: " << msg_id_node_id;
+            return -1;
+        }
+    } else {
+        char hostname[64] = {0};
+        gethostname(hostname, sizeof(hostname) - 1);
+        string owner = string(hostname) + ":" + std::to_string(http_bind_port) + ":" + std::to_string(getpid());
+        msg_id_node_id = ApiAcquireMsgIdNode(owner, MsgIdGenerator::kMaxNodeId, kMsgIdNodeLeaseSeconds);
+        if (msg_id_node_id < 0) {
+            LOG_ERROR << "allocate msg id node id failed, configure msg_id_node_id or check the msg redis";
+            return -1;
+        }
+        loop.runAfter(kMsgIdNodeLeaseSeconds / 3.0, std::bind(&on_msg_id_node_timer, &loop, owner));
+    }
+    MsgIdGenerator::GetInstance().SetNodeId(msg_id_node_id);
+    LOG_INFO << "msg id node id: " << msg_id_node_id;
+
+    // 启动消息写入的组提交：攒够 msg_commit_batch_size 条或每隔 msg_commit_interval_us 微秒批量写一次 Redis
+    int msg_commit_batch_size = 64;
+    int msg_commit_interval_us = 1000;
+    char *str_msg_commit_batch_size = config_file.GetConfigName("msg_commit_batch_size");
+    if (str_msg_commit_batch_size && strlen(str_msg_commit_batch_size) > 0) {
+        msg_commit_batch_size = atoi(str_msg_commit_batch_size);
+    }
+    char *str_msg_commit_interval_us = config_file.GetConfigName("msg_commit_interval_us");
+    if (str_msg_commit_interval_us && strlen(str_msg_commit_interval_us) > 0) {
+        msg_commit_interval_us = atoi(str_msg_commit_interval_us);
+    }
+    MsgGroupCommit::GetInstance().Start(msg_commit_batch_size, msg_commit_interval_us);
+
+    // 房间 stream 保留策略：默认策略 + 单个房间覆盖，持久化线程确认之后按策略裁剪
+    char *str_msg_stream_retention = config_file.GetConfigName("msg_stream_retention");
+    if (str_msg_stream_retention && strlen(str_msg_stream_retention) > 0) {
+        StreamRetention retention;
+        if (ParseStreamRetention(str_msg_stream_retention, retention)) {
+            SetDefaultStreamRetention(retention);
+        } else {
+            LOG_ERROR << "invalid msg_stream_retention: " << str_msg_stream_retention;
+        }
+    }
+    char *str_msg_stream_retention_rooms = config_file.GetConfigName("msg_stream_retention_rooms");
+    if (str_msg_stream_retention_rooms && strlen(str_msg_stream_retention_rooms) > 0) {
+        // 格式: 房间id=策略,房间id=策略
+        std::stringstream room_specs(str_msg_stream_retention_rooms);
+        string room_spec;
+        while (std::getline(room_specs, room_spec, ',')) {
+            size_t eq = room_spec.find('=');
+            StreamRetention retention;
+            if (eq == string::npos || !ParseStreamRetention(room_spec.substr(eq + 1), retention)) {
+                LOG_ERROR << "invalid msg_stream_retention_rooms entry: " << room_spec;
+                continue;
+            }
+            SetRoomStreamRetention(room_spec.substr(0, eq), retention);
+        }
+    }
+
+    // 启动消息持久化工作线程：以 Redis Stream 消费组方式读取消息，写入 MySQL 成功后才确认
+    MsgPersistOptions persist_options;
+    persist_options.load_data_min_rows = 2000;
+    persist_options.instance_port = http_bind_port;
+    char *str_persist_workers = config_file.GetConfigName("persist_workers");
+    if (str_persist_workers && strlen(str_persist_workers) > 0) {
+        persist_options.worker_count = atoi(str_persist_workers);
+    }
+    char *str_persist_streams_per_batch = config_file.GetConfigName("persist_streams_per_batch");
+    if (str_persist_streams_per_batch && strlen(str_persist_streams_per_batch) > 0) {
+        persist_options.streams_per_batch = atoi(str_persist_streams_per_batch);
+    }
+    char *str_persist_entries_per_stream = config_file.GetConfigName("persist_entries_per_stream");
+    if (str_persist_entries_per_stream && strlen(str_persist_entries_per_stream) > 0) {
+        persist_options.entries_per_stream = atoi(str_persist_entries_per_stream);
+    }
+    char *str_persist_entries_per_stream_max = config_file.GetConfigName("persist_entries_per_stream_max");
+    if (str_persist_entries_per_stream_max && strlen(str_persist_entries_per_stream_max) > 0) {
+        persist_options.max_entries_per_stream = atoi(str_persist_entries_per_stream_max);
+    }
+    char *str_persist_target_insert_ms = config_file.GetConfigName("persist_target_insert_ms");
+    if (str_persist_target_insert_ms && strlen(str_persist_target_insert_ms) > 0) {
+        persist_options.target_insert_ms = atoi(str_persist_target_insert_ms);
+    }
+    char *str_persist_lag_alert_seconds = config_file.GetConfigName("persist_lag_alert_seconds");
+    if (str_persist_lag_alert_seconds && strlen(str_persist_lag_alert_seconds) > 0) {
+        persist_options.lag_alert_seconds = atoi(str_persist_lag_alert_seconds);
+    }
+    char *str_persist_drain_timeout_seconds = config_file.GetConfigName("persist_drain_timeout_seconds");
+    if (str_persist_drain_timeout_seconds && strlen(str_persist_drain_timeout_seconds) > 0) {
+        persist_options.drain_timeout_seconds = atoi(str_persist_drain_timeout_seconds);
+    }
+    char *str_persist_load_data_min_rows = config_file.GetConfigName("persist_load_data_min_rows");
+    if (str_persist_load_data_min_rows && strlen(str_persist_load_data_min_rows) > 0) {
+        persist_options.load_data_min_rows = atoi(str_persist_load_data_min_rows);
+    }
+    char *str_persist_claim_min_idle_seconds = config_file.GetConfigName("persist_claim_min_idle_seconds");
+    if (str_persist_claim_min_idle_seconds && strlen(str_persist_claim_min_idle_seconds) > 0) {
+        persist_options.claim_min_idle_seconds = atoi(str_persist_claim_min_idle_seconds);
+    }
+    MsgPersistWorkers::GetInstance().Start(persist_options);
+
+    // 启动空闲房间回收定时器
+    int room_idle_grace_seconds = 60;
+    char *str_room_idle_grace_seconds = config_file.GetConfigName("room_idle_grace_seconds");
+    if (str_room_idle_grace_seconds && strlen(str_room_idle_grace_seconds) > 0) {
+        room_idle_grace_seconds = atoi(str_room_idle_grace_seconds);
+    }
+    loop.runAfter(10.0, std::bind(&on_reclaim_rooms_timer, &loop, room_idle_grace_seconds));
+    loop.runAfter(5.0, std::bind(&on_pool_stats_timer, &loop));
     
 #ifdef ENABLE_RPC
     // 启动 gRPC 服务器
@@ -398,10 +659,15 @@ int main(int argc, char* argv[])
     
     server.start();
     LOG_INFO << "服务器启动完成，监听地址: " << http_bind_ip << ":" << http_bind_port;
-    LOG_INFO << "消息持久化定时器已启动";
+    LOG_INFO << "消息持久化工作线程已启动";
     
     loop.loop(); 
 
+    RoomCatalog::GetInstance().StopLoader();
+    HistoryLoader::GetInstance().Stop();
+    MsgGroupCommit::GetInstance().Stop();   // 写完队列里剩余的消息
+    MsgPersistWorkers::GetInstance().Stop();   // 写完积压再退出，超时未写完的下次启动时找回
+
 #ifdef ENABLE_RPC
     // 关闭 gRPC 服务器
     grpc_server->Shutdown();
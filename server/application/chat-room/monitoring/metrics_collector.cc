@@ -23,7 +23,33 @@ MetricsCollector::MetricsCollector()
       kafka_consumed_family_(nullptr),
       grpc_calls_family_(nullptr),
       websocket_push_family_(nullptr),
-      redis_ops_family_(nullptr) {
+      room_subscribers_family_(nullptr),
+      room_topics_gauge_(nullptr),
+      group_commit_batch_histogram_(nullptr),
+      group_commit_latency_histogram_(nullptr),
+      group_commit_settings_family_(nullptr),
+      messages_persisted_counter_(nullptr),
+      persist_lag_gauge_(nullptr),
+      persist_backlog_gauge_(nullptr),
+      persist_insert_histogram_(nullptr),
+      persist_batch_entries_gauge_(nullptr),
+      persist_backpressure_gauge_(nullptr),
+      stream_length_histogram_(nullptr),
+      stream_length_max_gauge_(nullptr),
+      stream_length_window_max_(0),
+      stream_trimmed_counter_(nullptr),
+      redis_used_memory_gauge_(nullptr),
+      redis_ops_family_(nullptr),
+      pool_acquire_wait_family_(nullptr),
+      pool_exhausted_family_(nullptr),
+      pool_acquire_timeout_family_(nullptr),
+      pool_connections_family_(nullptr),
+      db_stmt_cache_family_(nullptr),
+      db_statement_duration_family_(nullptr),
+      db_statement_rows_family_(nullptr),
+      db_statement_errors_family_(nullptr),
+      slow_query_threshold_ms_(200),
+      slow_query_log_size_(100) {
 }
 
 MetricsCollector::~MetricsCollector() {
@@ -40,6 +66,8 @@ void MetricsCollector::Initialize(const std::string& bind_address, const std::st
     try {
         exposer_ = std::make_unique<Exposer>(bind_address);
         exposer_->RegisterCollectable(registry_);
+        slow_query_log_ = std::make_shared<SlowQueryLog>(slow_query_log_size_);
+        exposer_->RegisterCollectable(slow_query_log_, "/slow_queries");
         LOG_INFO << "Metrics endpoint started at http://" << bind_address << "/metrics";
     } catch (const std::exception& e) {
         LOG_ERROR << "Failed to start metrics exposer: " << e.what();
@@ -105,13 +133,160 @@ void MetricsCollector::Initialize(const std::string& bind_address, const std::st
         .Labels({{"service", service_name_}})
         .Register(*registry_);
 
-    // 8. Redis 指标
+    // 8. 房间订阅人数指标
+    room_subscribers_family_ = &BuildGauge()
+        .Name("room_subscribers")
+        .Help("Number of subscribers in each room")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+    auto& room_topics_family = BuildGauge()
+        .Name("room_topics_active")
+        .Help("Number of room topics currently held in memory")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+    room_topics_gauge_ = &room_topics_family.Add({});
+
+    // 消息组提交: 每批大小、每批写入耗时、配置
+    auto& group_commit_batch_family = BuildHistogram()
+        .Name("msg_group_commit_batch_size")
+        .Help("Number of messages written to Redis per group commit")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+    group_commit_batch_histogram_ = &group_commit_batch_family.Add(
+        {}, Histogram::BucketBoundaries{1, 2, 4, 8, 16, 32, 64, 128, 256, 512});
+    auto& group_commit_latency_family = BuildHistogram()
+        .Name("msg_group_commit_flush_duration_microseconds")
+        .Help("Time spent writing one group commit batch to Redis in microseconds")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+    group_commit_latency_histogram_ = &group_commit_latency_family.Add(
+        {}, Histogram::BucketBoundaries{100, 250, 500, 1000, 2000, 5000, 10000, 50000, 100000});
+    group_commit_settings_family_ = &BuildGauge()
+        .Name("msg_group_commit_settings")
+        .Help("Group commit tuning: max_batch_size and flush_interval_us")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+
+    // 消息持久化: 入库条数、延迟、积压
+    auto& messages_persisted_family = BuildCounter()
+        .Name("messages_persisted_total")
+        .Help("Total number of messages persisted from Redis streams to MySQL")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+    messages_persisted_counter_ = &messages_persisted_family.Add({});
+    auto& persist_lag_family = BuildGauge()
+        .Name("msg_persist_lag_seconds")
+        .Help("Age of the oldest message in the latest persisted batch in seconds")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+    persist_lag_gauge_ = &persist_lag_family.Add({});
+    auto& persist_backlog_family = BuildGauge()
+        .Name("msg_persist_backlog_streams")
+        .Help("Number of room streams waiting to be persisted")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+    persist_backlog_gauge_ = &persist_backlog_family.Add({});
+    auto& persist_insert_family = BuildHistogram()
+        .Name("msg_persist_insert_duration_milliseconds")
+        .Help("Time spent inserting one persist batch into MySQL in milliseconds")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+    persist_insert_histogram_ = &persist_insert_family.Add(
+        {}, Histogram::BucketBoundaries{1, 5, 10, 25, 50, 100, 200, 500, 1000, 5000});
+    auto& persist_batch_entries_family = BuildGauge()
+        .Name("msg_persist_batch_entries")
+        .Help("Current number of entries read per stream in one persist batch")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+    persist_batch_entries_gauge_ = &persist_batch_entries_family.Add({});
+    auto& persist_backpressure_family = BuildGauge()
+        .Name("msg_persist_backpressure")
+        .Help("1 when persist lag exceeds persist_lag_alert_seconds, otherwise 0")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+    persist_backpressure_gauge_ = &persist_backpressure_family.Add({});
+
+    // Redis stream 内存: stream 长度分布和最大值、裁剪条数、Redis 已用内存
+    // 房间数不受限，长度不按 room_id 打标签
+    auto& stream_length_family = BuildHistogram()
+        .Name("msg_stream_length")
+        .Help("Number of entries left in a room stream after each persist trim")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+    stream_length_histogram_ = &stream_length_family.Add(
+        {}, Histogram::BucketBoundaries{100, 500, 1000, 2000, 5000, 10000, 50000, 100000});
+    auto& stream_length_max_family = BuildGauge()
+        .Name("msg_stream_length_max")
+        .Help("Longest room stream observed after persist trims in the last 60 seconds")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+    stream_length_max_gauge_ = &stream_length_max_family.Add({});
+    auto& stream_trimmed_family = BuildCounter()
+        .Name("msg_stream_trimmed_total")
+        .Help("Total number of persisted stream entries trimmed by retention policy")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+    stream_trimmed_counter_ = &stream_trimmed_family.Add({});
+    auto& redis_used_memory_family = BuildGauge()
+        .Name("redis_used_memory_bytes")
+        .Help("Memory used by the msg Redis instance in bytes")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+    redis_used_memory_gauge_ = &redis_used_memory_family.Add({});
+
+    // 9. Redis 指标
     redis_ops_family_ = &BuildCounter()
         .Name("redis_operations_total")
         .Help("Total number of Redis operations")
         .Labels({{"service", service_name_}})
         .Register(*registry_);
 
+    // 10. 连接池指标
+    pool_acquire_wait_family_ = &BuildHistogram()
+        .Name("pool_acquire_wait_milliseconds")
+        .Help("Time spent acquiring a connection from the Redis/MySQL pool")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+    pool_exhausted_family_ = &BuildCounter()
+        .Name("pool_exhausted_total")
+        .Help("Total number of acquires that found the pool at max connections")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+    pool_acquire_timeout_family_ = &BuildCounter()
+        .Name("pool_acquire_timeout_total")
+        .Help("Total number of acquires that failed or timed out")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+    pool_connections_family_ = &BuildGauge()
+        .Name("pool_connections")
+        .Help("Connections held by the pool, by state (total / in_use)")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+
+    // 11. MySQL 预处理语句缓存指标
+    db_stmt_cache_family_ = &BuildCounter()
+        .Name("db_stmt_cache_total")
+        .Help("Prepared statement cache lookups (hit = server-side parse avoided, miss = statement prepared)")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+
+    // 12. MySQL 语句耗时（按语句指纹），取连接的等待见 pool_acquire_wait_milliseconds
+    db_statement_duration_family_ = &BuildHistogram()
+        .Name("db_statement_duration_milliseconds")
+        .Help("MySQL statement execution time by statement fingerprint, excluding pool acquire wait")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+    db_statement_rows_family_ = &BuildCounter()
+        .Name("db_statement_rows_total")
+        .Help("Rows returned / affected by MySQL statements, by statement fingerprint")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+    db_statement_errors_family_ = &BuildCounter()
+        .Name("db_statement_errors_total")
+        .Help("Failed MySQL statements by statement fingerprint")
+        .Labels({{"service", service_name_}})
+        .Register(*registry_);
+
     LOG_INFO << "MetricsCollector initialized successfully";
 }
 
@@ -251,8 +426,8 @@ void MetricsCollector::IncrementGrpcCall(const std::string& method, bool success
     }
 }
 
-void MetricsCollector::IncrementWebSocketPush(const std::string& room_id) {
-    if (!websocket_push_family_) return;
+void MetricsCollector::IncrementWebSocketPush(const std::string& room_id, int count) {
+    if (!websocket_push_family_ || count <= 0) return;
 
     std::lock_guard<std::mutex> lock(websocket_mutex_);
     std::string key = room_id;
@@ -260,9 +435,119 @@ void MetricsCollector::IncrementWebSocketPush(const std::string& room_id) {
     if (it == websocket_push_counters_.end()) {
         auto& counter = websocket_push_family_->Add({{"room_id", room_id}});
         websocket_push_counters_[key] = &counter;
-        counter.Increment();
+        counter.Increment(count);
     } else {
-        it->second->Increment();
+        it->second->Increment(count);
+    }
+}
+
+void MetricsCollector::SetRoomSubscribers(const std::string& room_id, double count) {
+    if (!room_subscribers_family_) return;
+
+    auto& gauge = GetOrCreateGauge(
+        room_subscribers_family_,
+        room_subscribers_gauges_,
+        room_subscribers_mutex_,
+        {{"room_id", room_id}}
+    );
+    gauge.Set(count);
+}
+
+void MetricsCollector::RemoveRoomSubscribers(const std::string& room_id) {
+    if (!room_subscribers_family_) return;
+
+    std::lock_guard<std::mutex> lock(room_subscribers_mutex_);
+    std::string cache_key = "room_id:" + room_id + ";";    // 和 GetOrCreateGauge 的缓存 key 一致
+    auto it = room_subscribers_gauges_.find(cache_key);
+    if (it != room_subscribers_gauges_.end()) {
+        room_subscribers_family_->Remove(it->second);
+        room_subscribers_gauges_.erase(it);
+    }
+}
+
+void MetricsCollector::ObserveGroupCommit(size_t batch_size, double flush_latency_us) {
+    if (group_commit_batch_histogram_) {
+        group_commit_batch_histogram_->Observe(static_cast<double>(batch_size));
+    }
+    if (group_commit_latency_histogram_) {
+        group_commit_latency_histogram_->Observe(flush_latency_us);
+    }
+}
+
+void MetricsCollector::SetGroupCommitSettings(int max_batch_size, int flush_interval_us) {
+    if (!group_commit_settings_family_) return;
+    group_commit_settings_family_->Add({{"param", "max_batch_size"}}).Set(max_batch_size);
+    group_commit_settings_family_->Add({{"param", "flush_interval_us"}}).Set(flush_interval_us);
+}
+
+void MetricsCollector::IncrementMessagesPersisted(int count) {
+    if (messages_persisted_counter_ && count > 0) {
+        messages_persisted_counter_->Increment(count);
+    }
+}
+
+void MetricsCollector::SetPersistLag(double seconds) {
+    if (persist_lag_gauge_) {
+        persist_lag_gauge_->Set(seconds);
+    }
+}
+
+void MetricsCollector::SetPersistBacklogStreams(double count) {
+    if (persist_backlog_gauge_) {
+        persist_backlog_gauge_->Set(count);
+    }
+}
+
+void MetricsCollector::ObservePersistInsert(double insert_ms) {
+    if (persist_insert_histogram_) {
+        persist_insert_histogram_->Observe(insert_ms);
+    }
+}
+
+void MetricsCollector::SetPersistBatchEntries(int entries) {
+    if (persist_batch_entries_gauge_) {
+        persist_batch_entries_gauge_->Set(entries);
+    }
+}
+
+void MetricsCollector::SetPersistBackpressure(bool active) {
+    if (persist_backpressure_gauge_) {
+        persist_backpressure_gauge_->Set(active ? 1 : 0);
+    }
+}
+
+void MetricsCollector::ObserveStreamLength(double length) {
+    if (!stream_length_histogram_) return;
+
+    stream_length_histogram_->Observe(length);
+
+    // 最大值按 60 秒窗口统计，窗口结束后从新的观测值重新开始，裁剪后变短的 stream 不会一直占着最大值
+    std::lock_guard<std::mutex> lock(stream_length_mutex_);
+    auto now = std::chrono::steady_clock::now();
+    if (now - stream_length_window_start_ >= std::chrono::seconds(60)) {
+        stream_length_window_start_ = now;
+        stream_length_window_max_ = length;
+    } else if (length > stream_length_window_max_) {
+        stream_length_window_max_ = length;
+    }
+    stream_length_max_gauge_->Set(stream_length_window_max_);
+}
+
+void MetricsCollector::IncrementStreamTrimmed(long count) {
+    if (stream_trimmed_counter_ && count > 0) {
+        stream_trimmed_counter_->Increment(count);
+    }
+}
+
+void MetricsCollector::SetRedisUsedMemory(double bytes) {
+    if (redis_used_memory_gauge_) {
+        redis_used_memory_gauge_->Set(bytes);
+    }
+}
+
+void MetricsCollector::SetRoomTopics(double count) {
+    if (room_topics_gauge_) {
+        room_topics_gauge_->Set(count);
     }
 }
 
@@ -284,6 +569,119 @@ void MetricsCollector::IncrementRedisOp(const std::string& operation, bool succe
     }
 }
 
+void MetricsCollector::RegisterConnPool(const std::string& pool) {
+    if (!pool_acquire_wait_family_ || pool_metrics_.count(pool)) return;
+
+    PoolMetrics metrics;
+    metrics.acquire_wait = &pool_acquire_wait_family_->Add(
+        {{"pool", pool}}, Histogram::BucketBoundaries{0.05, 0.1, 0.5, 1, 5, 10, 50, 100, 500, 1000});
+    metrics.exhausted = &pool_exhausted_family_->Add({{"pool", pool}});
+    metrics.timeouts = &pool_acquire_timeout_family_->Add({{"pool", pool}});
+    metrics.connections_total = &pool_connections_family_->Add({{"pool", pool}, {"state", "total"}});
+    metrics.connections_in_use = &pool_connections_family_->Add({{"pool", pool}, {"state", "in_use"}});
+    pool_metrics_[pool] = metrics;
+}
+
+void MetricsCollector::ObservePoolAcquire(const std::string& pool, double wait_ms, bool exhausted, bool ok) {
+    auto it = pool_metrics_.find(pool);
+    if (it == pool_metrics_.end()) return;
+
+    it->second.acquire_wait->Observe(wait_ms);
+    if (exhausted) {
+        it->second.exhausted->Increment();
+    }
+    if (!ok) {
+        it->second.timeouts->Increment();
+    }
+}
+
+void MetricsCollector::SetPoolConnections(const std::string& pool, int total, int in_use) {
+    auto it = pool_metrics_.find(pool);
+    if (it == pool_metrics_.end()) return;
+
+    it->second.connections_total->Set(total);
+    it->second.connections_in_use->Set(in_use);
+}
+
+void MetricsCollector::SetDBStmtCache(const std::string& pool, uint64_t hits, uint64_t misses) {
+    if (!db_stmt_cache_family_) return;
+
+    // 连接池里是累计值，计数器只补上增量
+    auto& hit_counter = GetOrCreateCounter(db_stmt_cache_family_, db_stmt_cache_counters_, db_stmt_cache_mutex_,
+                                           {{"pool", pool}, {"result", "hit"}});
+    auto& miss_counter = GetOrCreateCounter(db_stmt_cache_family_, db_stmt_cache_counters_, db_stmt_cache_mutex_,
+                                            {{"pool", pool}, {"result", "miss"}});
+    if (hits > hit_counter.Value()) {
+        hit_counter.Increment(hits - hit_counter.Value());
+    }
+    if (misses > miss_counter.Value()) {
+        miss_counter.Increment(misses - miss_counter.Value());
+    }
+}
+
+void MetricsCollector::SetSlowQueryOptions(double threshold_ms, size_t log_size) {
+    slow_query_threshold_ms_ = threshold_ms;
+    slow_query_log_size_ = log_size;
+}
+
+// 语句指纹的个数上限（所有连接池合计），防止拼接 SQL 的写法让时间序列无限增长
+static const size_t kMaxDBStatementSeries = 500;
+
+void MetricsCollector::ObserveDBStatement(const std::string& pool, const std::string& fingerprint, double exec_ms,
+                                          uint64_t rows_returned, uint64_t rows_affected, bool ok) {
+    if (!db_statement_duration_family_) return;
+
+    DBStatementMetrics metrics;
+    {
+        std::lock_guard<std::mutex> lock(db_statement_mutex_);
+        std::string key = pool + '\n' + fingerprint;
+        auto it = db_statement_metrics_.find(key);
+        if (it == db_statement_metrics_.end() && db_statement_metrics_.size() >= kMaxDBStatementSeries) {
+            key = pool + "\nother";
+            it = db_statement_metrics_.find(key);
+        }
+        if (it == db_statement_metrics_.end()) {
+            std::string statement = key.substr(pool.size() + 1);
+            metrics.duration = &db_statement_duration_family_->Add(
+                {{"pool", pool}, {"statement", statement}},
+                Histogram::BucketBoundaries{0.5, 1, 2, 5, 10, 25, 50, 100, 250, 500, 1000, 5000});
+            metrics.rows_returned = &db_statement_rows_family_->Add(
+                {{"pool", pool}, {"statement", statement}, {"kind", "returned"}});
+            metrics.rows_affected = &db_statement_rows_family_->Add(
+                {{"pool", pool}, {"statement", statement}, {"kind", "affected"}});
+            metrics.errors = &db_statement_errors_family_->Add({{"pool", pool}, {"statement", statement}});
+            it = db_statement_metrics_.emplace(key, metrics).first;
+        }
+        metrics = it->second;
+    }
+
+    metrics.duration->Observe(exec_ms);
+    if (rows_returned > 0) {
+        metrics.rows_returned->Increment(rows_returned);
+    }
+    if (rows_affected > 0) {
+        metrics.rows_affected->Increment(rows_affected);
+    }
+    if (!ok) {
+        metrics.errors->Increment();
+    }
+
+    if (exec_ms >= slow_query_threshold_ms_ && slow_query_log_) {
+        LOG_WARN << "slow query " << exec_ms << "ms, pool: " << pool << ", rows: " << rows_returned << "/"
+                 << rows_affected << ", statement: " << fingerprint;
+        SlowQueryLog::Entry entry;
+        entry.pool = pool;
+        entry.statement = fingerprint;
+        entry.exec_ms = exec_ms;
+        entry.rows_returned = rows_returned;
+        entry.rows_affected = rows_affected;
+        entry.ok = ok;
+        entry.timestamp_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        slow_query_log_->Add(std::move(entry));
+    }
+}
+
 // ==================== 辅助函数 ====================
 
 Counter& MetricsCollector::GetOrCreateCounter(
@@ -308,6 +706,28 @@ Counter& MetricsCollector::GetOrCreateCounter(
     return *it->second;
 }
 
+Gauge& MetricsCollector::GetOrCreateGauge(
+    Family<Gauge>* family,
+    std::map<std::string, Gauge*>& cache,
+    std::mutex& mutex,
+    const std::map<std::string, std::string>& labels) {
+    
+    // 构造缓存 key
+    std::string cache_key;
+    for (const auto& label : labels) {
+        cache_key += label.first + ":" + label.second + ";";
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = cache.find(cache_key);
+    if (it == cache.end()) {
+        auto& gauge = family->Add(labels);
+        cache[cache_key] = &gauge;
+        return gauge;
+    }
+    return *it->second;
+}
+
 Histogram& MetricsCollector::GetOrCreateHistogram(
     Family<Histogram>* family,
     std::map<std::string, Histogram*>& cache,
@@ -10,7 +10,9 @@
 #include <memory>
 #include <string>
 #include <map>
+#include <chrono>
 #include <mutex>
+#include "slow_query_log.h"
 
 /**
  * @brief 监控指标收集器
@@ -117,14 +119,126 @@ public:
 
     /**
      * @brief 记录 WebSocket 消息推送
+     * @param room_id 房间ID
+     * @param count 本次推送的连接数，一次广播只查一次计数器
      */
-    void IncrementWebSocketPush(const std::string& room_id);
+    void IncrementWebSocketPush(const std::string& room_id, int count = 1);
+
+    /**
+     * @brief 设置房间当前订阅人数（Gauge）
+     * @param room_id 房间ID
+     * @param count 订阅人数
+     */
+    void SetRoomSubscribers(const std::string& room_id, double count);
+
+    /**
+     * @brief 删除房间订阅人数的时间序列（房间被回收时调用，避免 room_id 标签无限增长）
+     * @param room_id 房间ID
+     */
+    void RemoveRoomSubscribers(const std::string& room_id);
+
+    /**
+     * @brief 设置当前内存中的房间数（Gauge）
+     */
+    void SetRoomTopics(double count);
+
+    /**
+     * @brief 记录一次消息组提交
+     * @param batch_size 本批消息数
+     * @param flush_latency_us 本批写入 Redis 的耗时（微秒）
+     */
+    void ObserveGroupCommit(size_t batch_size, double flush_latency_us);
+
+    /**
+     * @brief 导出组提交的配置（最大批量、刷新间隔）
+     */
+    void SetGroupCommitSettings(int max_batch_size, int flush_interval_us);
+
+    /**
+     * @brief 记录持久化到 MySQL 的消息数
+     */
+    void IncrementMessagesPersisted(int count);
+
+    /**
+     * @brief 设置持久化延迟：当前时间减去本批最早一条消息的写入时间（秒）
+     */
+    void SetPersistLag(double seconds);
+
+    /**
+     * @brief 设置等待持久化的房间 stream 数
+     */
+    void SetPersistBacklogStreams(double count);
+
+    /**
+     * @brief 记录一批消息写入 MySQL 的耗时（毫秒）
+     */
+    void ObservePersistInsert(double insert_ms);
+
+    /**
+     * @brief 设置当前每个 stream 每次读取的条数（AIMD 调整后的值）
+     */
+    void SetPersistBatchEntries(int entries);
+
+    /**
+     * @brief 设置持久化背压状态：延迟超过阈值为 true
+     */
+    void SetPersistBackpressure(bool active);
+
+    /**
+     * @brief 记录一个房间 stream 裁剪后的长度
+     *
+     * 不按 room_id 打标签（房间数不受限），只导出长度分布和最近 60 秒内的最大长度
+     */
+    void ObserveStreamLength(double length);
+
+    /**
+     * @brief 记录按保留策略裁剪掉的 stream 消息数
+     */
+    void IncrementStreamTrimmed(long count);
+
+    /**
+     * @brief 设置 Redis 已用内存（INFO memory 的 used_memory）
+     */
+    void SetRedisUsedMemory(double bytes);
 
     /**
      * @brief 记录 Redis 操作
      */
     void IncrementRedisOp(const std::string& operation, bool success);
 
+    /**
+     * @brief 为连接池创建取连接等待、耗尽、超时和连接数指标，在取连接开始前调用
+     */
+    void RegisterConnPool(const std::string& pool);
+
+    /**
+     * @brief 记录一次取连接：等待毫秒数、是否遇到连接耗尽、是否取到
+     */
+    void ObservePoolAcquire(const std::string& pool, double wait_ms, bool exhausted, bool ok);
+
+    /**
+     * @brief 设置连接池已建立的连接数和已取出的连接数
+     */
+    void SetPoolConnections(const std::string& pool, int total, int in_use);
+
+    /**
+     * @brief 同步 MySQL 预处理语句缓存的累计命中/未命中次数（未命中即服务端 prepare 一次）
+     */
+    void SetDBStmtCache(const std::string& pool, uint64_t hits, uint64_t misses);
+
+    /**
+     * @brief 设置慢查询阈值（毫秒）和慢查询缓冲区保留的条数，在 Initialize 之前调用
+     */
+    void SetSlowQueryOptions(double threshold_ms, size_t log_size);
+
+    /**
+     * @brief 记录一条 MySQL 语句：按语句指纹统计执行耗时、返回/影响行数，超过阈值的记入慢查询缓冲区
+     * @param fingerprint 语句指纹，不同指纹数超过上限后新的指纹合并为 "other"
+     * @param exec_ms 执行耗时（毫秒），不包含从连接池取连接的等待
+     */
+    void ObserveDBStatement(const std::string& pool, const std::string& fingerprint, double exec_ms,
+                            uint64_t rows_returned, uint64_t rows_affected, bool ok);
+
     /**
      * @brief 通用计数器（用于自定义指标）
      * @param name 指标名称（如 "logic_forward"）
@@ -182,11 +296,75 @@ private:
     std::map<std::string, prometheus::Counter*> websocket_push_counters_;
     std::mutex websocket_mutex_;
 
+    // 业务指标: 房间订阅人数
+    prometheus::Family<prometheus::Gauge>* room_subscribers_family_;
+    std::map<std::string, prometheus::Gauge*> room_subscribers_gauges_;
+    std::mutex room_subscribers_mutex_;
+    prometheus::Gauge* room_topics_gauge_;
+
+    // 业务指标: 消息组提交
+    prometheus::Histogram* group_commit_batch_histogram_;
+    prometheus::Histogram* group_commit_latency_histogram_;
+    prometheus::Family<prometheus::Gauge>* group_commit_settings_family_;
+
+    // 业务指标: 消息持久化
+    prometheus::Counter* messages_persisted_counter_;
+    prometheus::Gauge* persist_lag_gauge_;
+    prometheus::Gauge* persist_backlog_gauge_;
+    prometheus::Histogram* persist_insert_histogram_;
+    prometheus::Gauge* persist_batch_entries_gauge_;
+    prometheus::Gauge* persist_backpressure_gauge_;
+
+    // 业务指标: Redis stream 内存
+    prometheus::Histogram* stream_length_histogram_;
+    prometheus::Gauge* stream_length_max_gauge_;
+    std::chrono::steady_clock::time_point stream_length_window_start_;
+    double stream_length_window_max_;
+    std::mutex stream_length_mutex_;
+    prometheus::Counter* stream_trimmed_counter_;
+    prometheus::Gauge* redis_used_memory_gauge_;
+
     // 业务指标: Redis
     prometheus::Family<prometheus::Counter>* redis_ops_family_;
     std::map<std::string, prometheus::Counter*> redis_op_counters_;
     std::mutex redis_mutex_;
 
+    // 业务指标: 连接池
+    struct PoolMetrics {
+        prometheus::Histogram* acquire_wait;
+        prometheus::Counter* exhausted;
+        prometheus::Counter* timeouts;
+        prometheus::Gauge* connections_total;
+        prometheus::Gauge* connections_in_use;
+    };
+    prometheus::Family<prometheus::Histogram>* pool_acquire_wait_family_;
+    prometheus::Family<prometheus::Counter>* pool_exhausted_family_;
+    prometheus::Family<prometheus::Counter>* pool_acquire_timeout_family_;
+    prometheus::Family<prometheus::Gauge>* pool_connections_family_;
+    // 启动时注册完，之后只读，取连接时查找不加锁
+    std::map<std::string, PoolMetrics> pool_metrics_;
+
+    // 业务指标: MySQL 预处理语句缓存
+    prometheus::Family<prometheus::Counter>* db_stmt_cache_family_;
+    std::map<std::string, prometheus::Counter*> db_stmt_cache_counters_;
+    std::mutex db_stmt_cache_mutex_;
+
+    // 业务指标: MySQL 语句耗时和慢查询
+    struct DBStatementMetrics {
+        prometheus::Histogram* duration;
+        prometheus::Counter* rows_returned;
+        prometheus::Counter* rows_affected;
+        prometheus::Counter* errors;
+    };
+    prometheus::Family<prometheus::Histogram>* db_statement_duration_family_;
+    prometheus::Family<prometheus::Counter>* db_statement_rows_family_;
+    prometheus::Family<prometheus::Counter>* db_statement_errors_family_;
+    std::map<std::string, DBStatementMetrics> db_statement_metrics_;   // key: 池名 + '\n' + 指纹
+    std::mutex db_statement_mutex_;
+    std::shared_ptr<SlowQueryLog> slow_query_log_;      // 在 metrics 端口的 /slow_queries 导出
+    double slow_query_threshold_ms_;
+    size_t slow_query_log_size_;
+
     // 辅助函数
     prometheus::Counter& GetOrCreateCounter(
         prometheus::Family<prometheus::Counter>* family,
@@ -194,6 +372,12 @@ private:
         std::mutex& mutex,
         const std::map<std::string, std::string>& labels);
 
+    prometheus::Gauge& GetOrCreateGauge(
+        prometheus::Family<prometheus::Gauge>* family,
+        std::map<std::string, prometheus::Gauge*>& cache,
+        std::mutex& mutex,
+        const std::map<std::string, std::string>& labels);
+
     prometheus::Histogram& GetOrCreateHistogram(
         prometheus::Family<prometheus::Histogram>* family,
         std::map<std::string, prometheus::Histogram*>& cache,
@@ -0,0 +1,47 @@
+#include "slow_query_log.h"
+
+#include <algorithm>
+
+using namespace prometheus;
+
+SlowQueryLog::SlowQueryLog(size_t capacity) : capacity_(std::max<size_t>(capacity, 1)) {
+    entries_.reserve(capacity_);
+}
+
+void SlowQueryLog::Add(Entry entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entry.seq = ++seq_;
+    if (entries_.size() < capacity_) {
+        entries_.push_back(std::move(entry));
+        return;
+    }
+    entries_[next_] = std::move(entry);
+    next_ = (next_ + 1) % capacity_;
+}
+
+std::vector<MetricFamily> SlowQueryLog::Collect() const {
+    MetricFamily family;
+    family.name = "db_slow_query_milliseconds";
+    family.help = "Most recent MySQL statements over the slow query threshold (value = execution time)";
+    family.type = MetricType::Gauge;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    family.metric.reserve(entries_.size());
+    // 没写满时 next_ 为0，从头导出；写满后 next_ 指向最旧的一条
+    for (size_t i = 0; i < entries_.size(); i++) {
+        const Entry &entry = entries_[(next_ + i) % entries_.size()];
+        ClientMetric metric;
+        metric.label = {
+            {"pool", entry.pool},
+            {"statement", entry.statement},
+            {"seq", std::to_string(entry.seq)},
+            {"rows_returned", std::to_string(entry.rows_returned)},
+            {"rows_affected", std::to_string(entry.rows_affected)},
+            {"status", entry.ok ? "success" : "failure"},
+        };
+        metric.gauge.value = entry.exec_ms;
+        metric.timestamp_ms = entry.timestamp_ms;
+        family.metric.push_back(std::move(metric));
+    }
+    return {family};
+}
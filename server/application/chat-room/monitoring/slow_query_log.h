@@ -0,0 +1,52 @@
+#ifndef SLOW_QUERY_LOG_H
+#define SLOW_QUERY_LOG_H
+
+#include <prometheus/collectable.h>
+#include <prometheus/metric_family.h>
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @brief 慢查询环形缓冲区
+ *
+ * 保留最近 capacity 条超过阈值的 MySQL 语句，写满后覆盖最旧的一条。
+ * 作为 Collectable 注册在 metrics 端口的 /slow_queries 路径上，每条记录导出为一个样本：
+ *   db_slow_query_milliseconds{pool, statement, seq, rows_returned, rows_affected, status} 执行毫秒数 发生时间
+ * statement 是语句指纹（字面量已换成 ?），不包含参数，避免把消息内容等数据带出去
+ */
+class SlowQueryLog : public prometheus::Collectable {
+public:
+    struct Entry {
+        std::string pool;
+        std::string statement;
+        double exec_ms = 0;
+        uint64_t rows_returned = 0;
+        uint64_t rows_affected = 0;
+        bool ok = true;
+        int64_t timestamp_ms = 0;   // 语句结束的时间（Unix 毫秒）
+        uint64_t seq = 0;           // 进程内递增序号，Add 时分配
+    };
+
+    explicit SlowQueryLog(size_t capacity);
+
+    /**
+     * @brief 记录一条慢查询
+     */
+    void Add(Entry entry);
+
+    /**
+     * @brief 按发生顺序导出当前保留的慢查询
+     */
+    std::vector<prometheus::MetricFamily> Collect() const override;
+
+private:
+    mutable std::mutex mutex_;
+    std::vector<Entry> entries_;
+    size_t capacity_;
+    size_t next_ = 0;               // 写满后下一条覆盖的位置
+    uint64_t seq_ = 0;
+};
+
+#endif // SLOW_QUERY_LOG_H
@@ -0,0 +1,385 @@
+#include "async_db_conn.h"
+
+#include <algorithm>
+#include <map>
+
+#include <mysql/errmsg.h>
+
+#include "muduo/base/Logging.h"
+
+// 非阻塞接口只有 MariaDB Connector/C（以及 MariaDB 自带的 libmysqlclient）提供
+#if defined(LIBMARIADB) || defined(MARIADB_BASE_VERSION)
+#define HAVE_MYSQL_NONBLOCK 1
+#endif
+
+// Configure 设置的连接池
+struct AsyncDBEndpoint {
+    string pool_name;
+    CDBPool *db_pool;
+    int conns_per_loop;
+};
+static vector<AsyncDBEndpoint> s_async_db_endpoints;
+
+// 连接池名 -> 本 loop 的连接
+static thread_local std::map<string, vector<AsyncDBConn *>> t_async_db_conns;
+
+int AsyncDBConn::Configure(const string &pool_name, int conns_per_loop) {
+#ifdef HAVE_MYSQL_NONBLOCK
+    CDBPool *db_pool = CDBManager::getInstance()->GetDBPool(pool_name.c_str());
+    if (!db_pool) {
+        LOG_ERROR << "async mysql: no db pool " << pool_name;
+        return -1;
+    }
+    s_async_db_endpoints.push_back({pool_name, db_pool, std::max(conns_per_loop, 1)});
+    return 0;
+#else
+    LOG_ERROR << "async mysql needs MariaDB Connector/C (mysql_real_query_start), pool " << pool_name
+              << " uses the sync pool only";
+    return -1;
+#endif
+}
+
+void AsyncDBConn::InitForLoop(muduo::net::EventLoop *loop) {
+    // 连接和 loop 一样存活到进程退出
+    for (const AsyncDBEndpoint &endpoint : s_async_db_endpoints) {
+        vector<AsyncDBConn *> &conns = t_async_db_conns[endpoint.pool_name];
+        for (int i = 0; i < endpoint.conns_per_loop; i++) {
+            conns.push_back(new AsyncDBConn(loop, endpoint.db_pool));
+        }
+    }
+}
+
+AsyncDBConn *AsyncDBConn::ForCurrentLoop(const string &pool_name, std::string_view key) {
+    auto it = t_async_db_conns.find(pool_name);
+    if (it == t_async_db_conns.end() || it->second.empty()) {
+        return nullptr;
+    }
+    const vector<AsyncDBConn *> &conns = it->second;
+    return conns[std::hash<std::string_view>()(key) % conns.size()];
+}
+
+#ifdef HAVE_MYSQL_NONBLOCK
+
+static const double kMinReconnectDelaySeconds = 0.1;
+static const double kMaxReconnectDelaySeconds = 5.0;
+static const unsigned int kConnectTimeoutSeconds = 3;
+static const unsigned int kReadWriteTimeoutSeconds = 5;    // 等待服务器超过这个时间按断线处理
+static const size_t kMaxPendingTasks = 1024;               // 每个连接排队的上限，超过直接回调失败
+
+AsyncDBConn::AsyncDBConn(muduo::net::EventLoop *loop, CDBPool *db_pool)
+    : loop_(loop), db_pool_(db_pool), reconnect_delay_(kMinReconnectDelaySeconds) {
+    loop_->runInLoop([this]() { Connect(); });
+}
+
+AsyncDBConn::~AsyncDBConn() {
+    Close();
+}
+
+void AsyncDBConn::Connect() {
+    mysql_ = mysql_init(NULL);
+    if (!mysql_) {
+        LOG_ERROR << "async mysql: mysql_init failed";
+        ScheduleReconnect();
+        return;
+    }
+    mysql_options(mysql_, MYSQL_OPT_NONBLOCK, 0);
+    mysql_options(mysql_, MYSQL_SET_CHARSET_NAME, "utf8mb4");
+    mysql_options(mysql_, MYSQL_OPT_CONNECT_TIMEOUT, &kConnectTimeoutSeconds);
+    mysql_options(mysql_, MYSQL_OPT_READ_TIMEOUT, &kReadWriteTimeoutSeconds);
+    mysql_options(mysql_, MYSQL_OPT_WRITE_TIMEOUT, &kReadWriteTimeoutSeconds);
+
+    state_ = STATE_CONNECTING;
+    MYSQL *ret = NULL;
+    int status = mysql_real_connect_start(&ret, mysql_, db_pool_->GetDBServerIP(), db_pool_->GetUsername(),
+                                          db_pool_->GetPasswrod(), db_pool_->GetDBName(),
+                                          db_pool_->GetDBServerPort(), NULL, 0);
+    if (status) {
+        Wait(status);
+        return;
+    }
+    OnConnectDone(ret);
+}
+
+void AsyncDBConn::Close() {
+    if (timer_active_) {
+        loop_->cancel(timer_id_);
+        timer_active_ = false;
+    }
+    if (channel_) {
+        // 先从 epoll 摘掉再由 mysql_close 关闭 fd；可能在本 Channel 的事件回调里，延后到事件处理完再释放
+        channel_->disableAll();
+        channel_->remove();
+        muduo::net::Channel *channel = channel_.release();
+        loop_->queueInLoop([channel]() { delete channel; });
+    }
+    if (mysql_) {
+        // mysql_close 会发一个 COM_QUIT，连接已经出错时不会等待
+        mysql_close(mysql_);
+        mysql_ = nullptr;
+    }
+    state_ = STATE_DISCONNECTED;
+    FailAll();
+}
+
+void AsyncDBConn::ScheduleReconnect() {
+    if (reconnect_pending_) {
+        return;
+    }
+    reconnect_pending_ = true;
+    double delay = reconnect_delay_;
+    reconnect_delay_ = std::min(reconnect_delay_ * 2, kMaxReconnectDelaySeconds);
+    loop_->runAfter(delay, [this]() {
+        reconnect_pending_ = false;
+        if (!mysql_) {
+            Connect();
+        }
+    });
+}
+
+void AsyncDBConn::FailAll() {
+    // 回调里可能再提交语句（此时直接失败），先把队列换出来
+    std::deque<Task> tasks;
+    tasks.swap(tasks_);
+    for (Task &task : tasks) {
+        if (task.on_query) {
+            task.on_query(-1, NULL);
+        } else {
+            task.on_update(-1, 0, 0);
+        }
+    }
+}
+
+void AsyncDBConn::Enqueue(Task task) {
+    if (state_ == STATE_DISCONNECTED || tasks_.size() >= kMaxPendingTasks) {
+        if (state_ != STATE_DISCONNECTED) {
+            LOG_WARN << "async mysql queue full, pool: " << db_pool_->GetPoolName();
+        }
+        if (task.on_query) {
+            task.on_query(-1, NULL);
+        } else {
+            task.on_update(-1, 0, 0);
+        }
+        return;
+    }
+    tasks_.push_back(std::move(task));
+    StartNext();
+}
+
+void AsyncDBConn::Query(std::string_view sql, QueryCallback callback) {
+    Task task{string(sql), std::move(callback), nullptr, DBStatementTimer()};
+    if (loop_->isInLoopThread()) {
+        Enqueue(std::move(task));
+    } else {
+        loop_->queueInLoop([this, task = std::move(task)]() mutable { Enqueue(std::move(task)); });
+    }
+}
+
+void AsyncDBConn::Update(std::string_view sql, UpdateCallback callback) {
+    Task task{string(sql), nullptr, std::move(callback), DBStatementTimer()};
+    if (loop_->isInLoopThread()) {
+        Enqueue(std::move(task));
+    } else {
+        loop_->queueInLoop([this, task = std::move(task)]() mutable { Enqueue(std::move(task)); });
+    }
+}
+
+void AsyncDBConn::StartNext() {
+    if (state_ != STATE_IDLE) {
+        return;
+    }
+    if (tasks_.empty()) {
+        // 空闲时只监听读事件：服务器主动断开（wait_timeout、重启）时立即发现并重连
+        Wait(MYSQL_WAIT_READ);
+        return;
+    }
+    state_ = STATE_QUERYING;
+    tasks_.front().timer = DBStatementTimer();
+    const string &sql = tasks_.front().sql;
+    int err = 0;
+    int status = mysql_real_query_start(&err, mysql_, sql.data(), sql.size());
+    if (status) {
+        Wait(status);
+        return;
+    }
+    OnQueryDone(err);
+}
+
+void AsyncDBConn::OnConnectDone(MYSQL *ret) {
+    if (!ret) {
+        LOG_ERROR << "async mysql connect failed: " << mysql_error(mysql_) << ", pool: " << db_pool_->GetPoolName();
+        Close();
+        ScheduleReconnect();
+        return;
+    }
+    state_ = STATE_IDLE;
+    reconnect_delay_ = kMinReconnectDelaySeconds;
+    LOG_INFO << "async mysql connected, pool: " << db_pool_->GetPoolName();
+    StartNext();
+}
+
+void AsyncDBConn::OnQueryDone(int err) {
+    if (err) {
+        HandleError("query");
+        return;
+    }
+    if (mysql_field_count(mysql_) == 0) {
+        FinishTask(0, NULL);     // INSERT、UPDATE 等没有结果集的语句
+        return;
+    }
+    state_ = STATE_STORING;
+    MYSQL_RES *res = NULL;
+    int status = mysql_store_result_start(&res, mysql_);
+    if (status) {
+        Wait(status);
+        return;
+    }
+    OnStoreDone(res);
+}
+
+void AsyncDBConn::OnStoreDone(MYSQL_RES *res) {
+    if (!res) {
+        HandleError("store result");
+        return;
+    }
+    uint64_t rows_returned = mysql_num_rows(res);
+    CResultSet result_set(res, mysql_);     // 析构时释放 res
+    FinishTask(0, &result_set, rows_returned);
+}
+
+void AsyncDBConn::FinishTask(int ret, CResultSet *result_set, uint64_t rows_returned) {
+    Task task = std::move(tasks_.front());
+    tasks_.pop_front();
+    state_ = STATE_IDLE;
+    task.timer.Finish(db_pool_->GetPoolName(), task.sql, NULL, rows_returned,
+                      ret == 0 && !result_set ? mysql_affected_rows(mysql_) : 0, ret == 0);
+    if (task.on_query) {
+        task.on_query(ret, result_set);
+    } else {
+        uint64_t affected_rows = ret == 0 ? mysql_affected_rows(mysql_) : 0;
+        uint64_t insert_id = ret == 0 ? mysql_insert_id(mysql_) : 0;
+        task.on_update(ret, affected_rows, insert_id);
+    }
+    StartNext();
+}
+
+void AsyncDBConn::HandleError(const char *step) {
+    unsigned int err = mysql_errno(mysql_);
+    LOG_ERROR << "async mysql " << step << " failed: " << mysql_error(mysql_) << ", pool: " << db_pool_->GetPoolName();
+    // 客户端错误（断线、超时等）之后连接不能再用，排队的语句一起失败；服务器返回的语句错误只影响这一条
+    if (err >= CR_MIN_ERROR && err <= CR_MAX_ERROR) {
+        // 读超时也走这里，这条语句同样记入语句统计（和慢查询）
+        tasks_.front().timer.Finish(db_pool_->GetPoolName(), tasks_.front().sql, NULL, 0, 0, false);
+        Close();
+        ScheduleReconnect();
+        return;
+    }
+    FinishTask(-1, NULL);
+}
+
+void AsyncDBConn::Wait(int status) {
+    if (!channel_) {
+        channel_.reset(new muduo::net::Channel(loop_, mysql_get_socket(mysql_)));
+        channel_->setReadCallback(std::bind(&AsyncDBConn::HandleRead, this));
+        channel_->setWriteCallback(std::bind(&AsyncDBConn::HandleWrite, this));
+        // 对端关闭或出错时按可读处理，由客户端库自己读到错误
+        channel_->setCloseCallback(std::bind(&AsyncDBConn::HandleRead, this));
+        channel_->setErrorCallback(std::bind(&AsyncDBConn::HandleRead, this));
+    }
+    if ((status & MYSQL_WAIT_READ) && !channel_->isReading()) {
+        channel_->enableReading();
+    } else if (!(status & MYSQL_WAIT_READ) && channel_->isReading()) {
+        channel_->disableReading();
+    }
+    if ((status & MYSQL_WAIT_WRITE) && !channel_->isWriting()) {
+        channel_->enableWriting();
+    } else if (!(status & MYSQL_WAIT_WRITE) && channel_->isWriting()) {
+        channel_->disableWriting();
+    }
+    if (status & MYSQL_WAIT_TIMEOUT) {
+        timer_active_ = true;
+        timer_id_ = loop_->runAfter(mysql_get_timeout_value_ms(mysql_) / 1000.0, [this]() { HandleTimeout(); });
+    }
+}
+
+void AsyncDBConn::Resume(int status) {
+    if (!mysql_) {
+        return;     // 同一轮事件里连接已经关闭
+    }
+    if (timer_active_) {
+        loop_->cancel(timer_id_);
+        timer_active_ = false;
+    }
+    switch (state_) {
+    case STATE_CONNECTING: {
+        MYSQL *ret = NULL;
+        status = mysql_real_connect_cont(&ret, mysql_, status);
+        if (status) {
+            Wait(status);
+            return;
+        }
+        OnConnectDone(ret);
+        break;
+    }
+    case STATE_QUERYING: {
+        int err = 0;
+        status = mysql_real_query_cont(&err, mysql_, status);
+        if (status) {
+            Wait(status);
+            return;
+        }
+        OnQueryDone(err);
+        break;
+    }
+    case STATE_STORING: {
+        MYSQL_RES *res = NULL;
+        status = mysql_store_result_cont(&res, mysql_, status);
+        if (status) {
+            Wait(status);
+            return;
+        }
+        OnStoreDone(res);
+        break;
+    }
+    case STATE_IDLE:
+        // 空闲时没有请求在等回复，可读只能是服务器断开了连接
+        LOG_WARN << "async mysql connection closed by server, pool: " << db_pool_->GetPoolName();
+        Close();
+        ScheduleReconnect();
+        break;
+    default:
+        break;
+    }
+}
+
+void AsyncDBConn::HandleRead() {
+    Resume(MYSQL_WAIT_READ);
+}
+
+void AsyncDBConn::HandleWrite() {
+    Resume(MYSQL_WAIT_WRITE);
+}
+
+void AsyncDBConn::HandleTimeout() {
+    timer_active_ = false;      // 定时器已经触发，不用再取消
+    Resume(MYSQL_WAIT_TIMEOUT);
+}
+
+#else   // HAVE_MYSQL_NONBLOCK
+
+// 没有非阻塞接口时 Configure 失败，不会创建连接；以下实现只为链接通过
+AsyncDBConn::AsyncDBConn(muduo::net::EventLoop *loop, CDBPool *db_pool)
+    : loop_(loop), db_pool_(db_pool), reconnect_delay_(0) {}
+
+AsyncDBConn::~AsyncDBConn() {}
+
+void AsyncDBConn::Query(std::string_view sql, QueryCallback callback) {
+    (void)sql;
+    callback(-1, NULL);
+}
+
+void AsyncDBConn::Update(std::string_view sql, UpdateCallback callback) {
+    (void)sql;
+    callback(-1, 0, 0);
+}
+
+#endif  // HAVE_MYSQL_NONBLOCK
@@ -0,0 +1,98 @@
+#ifndef ASYNC_DB_CONN_H_
+#define ASYNC_DB_CONN_H_
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "db_pool.h"
+#include "muduo/net/Channel.h"
+#include "muduo/net/EventLoop.h"
+#include "muduo/net/TimerId.h"
+
+// 挂在 muduo EventLoop 上的 MySQL 非阻塞连接，每个 IO loop 若干个（db_async_conns_per_loop）：
+//  - 用 MariaDB Connector/C 的非阻塞接口（mysql_real_query_start/cont 等），连接的 socket 注册为 loop 上的 Channel，
+//    等待网络时把控制权交还 loop，loop 线程不再阻塞在数据库上
+//  - 一个连接同一时刻只能执行一条语句，其余按顺序排队；同一个 key 总是落到同一个连接，回调顺序和提交顺序一致，
+//    不同 key 分散到不同连接上并发执行
+//  - 语句只在 loop 线程执行，回调也在 loop 线程执行
+//  - 断线后按 0.1s、0.2s … 最长 5s 退避重连；断线期间和断线时排队中的语句按顺序回调失败，调用方可以改走同步连接池
+// 链接的客户端库不是 MariaDB Connector/C（没有非阻塞接口）时 Configure 返回失败，不创建连接
+class AsyncDBConn {
+  public:
+    // 成功时 ret 为0，result_set 只在回调内有效；失败时 ret 为-1，result_set 为NULL
+    typedef std::function<void(int ret, CResultSet *result_set)> QueryCallback;
+    typedef std::function<void(int ret, uint64_t affected_rows, uint64_t insert_id)> UpdateCallback;
+
+    AsyncDBConn(muduo::net::EventLoop *loop, CDBPool *db_pool);
+    ~AsyncDBConn();
+
+    // 使用同步连接池 pool_name 的数据库地址和账号，每个 loop 建 conns_per_loop 个连接；设置后 InitForLoop 才会创建连接
+    // 可以对多个连接池分别调用，成功返回0
+    static int Configure(const string &pool_name, int conns_per_loop);
+    // 在 IO loop 线程启动时调用（TcpServer 的 threadInitCallback），为该 loop 创建连接
+    static void InitForLoop(muduo::net::EventLoop *loop);
+    // 当前 loop 线程上连接池 pool_name 中 key 对应的连接；没有配置或不是 IO loop 线程时返回NULL
+    static AsyncDBConn *ForCurrentLoop(const string &pool_name, std::string_view key);
+
+    // 已经连上，可以执行语句；只在 loop 线程调用
+    bool IsConnected() const { return state_ != STATE_DISCONNECTED && state_ != STATE_CONNECTING; }
+
+    // 以下可以在任意线程调用，不在 loop 线程时转到 loop 线程执行；sql 在调用时拷贝，其中的参数由调用方转义
+    void Query(std::string_view sql, QueryCallback callback);
+    void Update(std::string_view sql, UpdateCallback callback);
+
+  private:
+    enum State {
+        STATE_DISCONNECTED = 0,
+        STATE_CONNECTING,
+        STATE_IDLE,
+        STATE_QUERYING,     // mysql_real_query 进行中
+        STATE_STORING,      // mysql_store_result 进行中
+    };
+
+    struct Task {
+        string sql;
+        QueryCallback on_query;     // 两者只有一个非空
+        UpdateCallback on_update;
+        DBStatementTimer timer;     // 开始执行时计时，不包含排队时间
+    };
+
+    void Enqueue(Task task);
+    void Connect();
+    void Close();
+    void ScheduleReconnect();
+    void FailAll();
+
+    void StartNext();
+    void OnConnectDone(MYSQL *ret);
+    void OnQueryDone(int err);
+    void OnStoreDone(MYSQL_RES *res);
+    void FinishTask(int ret, CResultSet *result_set, uint64_t rows_returned = 0);
+    void HandleError(const char *step);
+
+    // status 为非阻塞接口返回的 MYSQL_WAIT_* 组合：按需打开读写事件、设置超时定时器
+    void Wait(int status);
+    // 事件或超时到来，继续当前步骤
+    void Resume(int status);
+    void HandleRead();
+    void HandleWrite();
+    void HandleTimeout();
+
+    muduo::net::EventLoop *loop_;
+    CDBPool *db_pool_;
+    MYSQL *mysql_ = nullptr;
+    State state_ = STATE_DISCONNECTED;
+    std::unique_ptr<muduo::net::Channel> channel_;  // 连接的 socket，断线后销毁
+    muduo::net::TimerId timer_id_;
+    bool timer_active_ = false;
+
+    std::deque<Task> tasks_;        // 队首是正在执行的语句
+    double reconnect_delay_;        // 下次重连前等待的秒数，连上后复位
+    bool reconnect_pending_ = false;
+};
+
+#endif /* ASYNC_DB_CONN_H_ */
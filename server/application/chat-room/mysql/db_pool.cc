@@ -1,27 +1,173 @@
 #include "db_pool.h"
 #include <string.h>
+#include <mysql/errmsg.h>
+#include <algorithm>
+#include <charconv>
+#include <ctype.h>
 #include "muduo/base/Logging.h"
 #include "config_file_reader.h"
 
-#define MIN_DB_CONN_CNT 1
 #define MAX_DB_CONN_FAIL_NUM 10
 
 CDBManager *CDBManager::s_db_manager = NULL;
 std::string CDBManager::conf_path_ = "conf.conf";
-CResultSet::CResultSet(MYSQL_RES *res) {
-    res_ = res;
-    // map table field key to index in the result array
-    int num_fields = mysql_num_fields(res_); // 返回结果集中的行数。
-    MYSQL_FIELD *fields = mysql_fetch_fields(res_); // 关于结果集所有列的MYSQL_FIELD结构的数组
-    for (int i = 0; i < num_fields; i++) {
-        // 多行
-        key_map_.insert(make_pair(fields[i].name, i)); // 每个结构提供了结果集中1列的字段定义
-        LOG_DEBUG << " num_fields fields["<< i << "].name: " <<  fields[i].name;
+
+// 指纹的最大长度，超过的部分截掉（作为监控标签使用）
+#define SQL_FINGERPRINT_MAX_LEN 512
+
+static DBStatementObserver s_db_statement_observer;
+
+void SetDBStatementObserver(DBStatementObserver observer) {
+    s_db_statement_observer = std::move(observer);
+}
+
+static bool IsSqlWordChar(char c) {
+    return isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '?' || c == '`' || c == '$' || c == '@' ||
+           (c & 0x80);
+}
+
+// 把只有 ? 和逗号的括号合并成 (?+)，紧挨着的多个 (?+) 只留一个：IN (?,?,?)、VALUES (?,?),(?,?) 都归成一类
+static string CollapseSqlLists(const string &sql) {
+    string out;
+    out.reserve(sql.size());
+    size_t i = 0;
+    while (i < sql.size()) {
+        if (sql[i] == '(' && i + 1 < sql.size() && sql[i + 1] == '?') {
+            size_t j = i + 2;
+            while (j + 1 < sql.size() && sql[j] == ',' && sql[j + 1] == '?') {
+                j += 2;
+            }
+            if (j < sql.size() && sql[j] == ')') {
+                if (out.size() >= 5 && out.compare(out.size() - 5, 5, "(?+),") == 0) {
+                    out.pop_back();
+                } else {
+                    out += "(?+)";
+                }
+                i = j + 1;
+                continue;
+            }
+        }
+        out += sql[i++];
     }
+    return out;
+}
+
+string FingerprintSql(std::string_view sql) {
+    string out;
+    out.reserve(std::min(sql.size(), (size_t)SQL_FINGERPRINT_MAX_LEN * 2));
+    bool pending_space = false;
+    size_t i = 0;
+    size_t n = sql.size();
+    while (i < n) {
+        char c = sql[i];
+        if (isspace(static_cast<unsigned char>(c))) {
+            pending_space = !out.empty();
+            i++;
+            continue;
+        }
+        // 注释当作空白
+        if (c == '/' && i + 1 < n && sql[i + 1] == '*') {
+            size_t end = sql.find("*/", i + 2);
+            i = end == std::string_view::npos ? n : end + 2;
+            pending_space = !out.empty();
+            continue;
+        }
+        if ((c == '-' && i + 1 < n && sql[i + 1] == '-') || c == '#') {
+            size_t end = sql.find('\n', i);
+            i = end == std::string_view::npos ? n : end + 1;
+            pending_space = !out.empty();
+            continue;
+        }
+
+        // 只在两个词之间保留一个空格，运算符和括号两边的空格都去掉
+        bool is_literal = c == '\'' || c == '"' ||
+                          (isdigit(static_cast<unsigned char>(c)) &&
+                           (pending_space || out.empty() || !IsSqlWordChar(out.back())));
+        char first = is_literal ? '?' : c;
+        if (pending_space && !out.empty() && IsSqlWordChar(out.back()) && IsSqlWordChar(first)) {
+            out += ' ';
+        }
+        pending_space = false;
+
+        if (c == '\'' || c == '"') {
+            // 字符串字面量，支持反斜杠转义和两个引号连写
+            i++;
+            while (i < n) {
+                if (sql[i] == '\\') {
+                    i += 2;
+                } else if (sql[i] == c) {
+                    if (i + 1 < n && sql[i + 1] == c) {
+                        i += 2;
+                    } else {
+                        i++;
+                        break;
+                    }
+                } else {
+                    i++;
+                }
+            }
+            out += '?';
+        } else if (is_literal) {
+            // 数字字面量：整数、小数、科学计数法、0x 十六进制
+            i++;
+            while (i < n && (isalnum(static_cast<unsigned char>(sql[i])) || sql[i] == '.' ||
+                             ((sql[i] == '+' || sql[i] == '-') && (sql[i - 1] == 'e' || sql[i - 1] == 'E')))) {
+                i++;
+            }
+            out += '?';
+        } else if (c == '`') {
+            // 反引号里的标识符原样保留
+            size_t end = sql.find('`', i + 1);
+            end = end == std::string_view::npos ? n : end + 1;
+            out.append(sql.data() + i, end - i);
+            i = end;
+        } else {
+            out += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+            i++;
+        }
+    }
+
+    out = CollapseSqlLists(out);
+    if (out.size() > SQL_FINGERPRINT_MAX_LEN) {
+        out.resize(SQL_FINGERPRINT_MAX_LEN);
+    }
+    return out;
+}
+
+DBStatementTimer::DBStatementTimer() : enabled_(static_cast<bool>(s_db_statement_observer)) {
+    if (enabled_) {
+        start_ = std::chrono::steady_clock::now();
+    }
+}
+
+void DBStatementTimer::Finish(const char *pool_name, std::string_view sql, string *fingerprint,
+                              uint64_t rows_returned, uint64_t rows_affected, bool ok) {
+    if (!enabled_) {
+        return;
+    }
+    double exec_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count();
+    if (!fingerprint) {
+        s_db_statement_observer(pool_name, FingerprintSql(sql), exec_ms, rows_returned, rows_affected, ok);
+        return;
+    }
+    if (fingerprint->empty()) {
+        *fingerprint = FingerprintSql(sql);
+    }
+    s_db_statement_observer(pool_name, *fingerprint, exec_ms, rows_returned, rows_affected, ok);
+}
+CResultSet::CResultSet(MYSQL_RES *res, MYSQL *mysql) {
+    res_ = res;
+    mysql_ = mysql;
+    row_ = NULL;
+    lengths_ = NULL;
+    // 列名和下标的对应直接用结果集自带的字段定义，不再为每个结果集建 map
+    num_fields_ = mysql_num_fields(res_); // 返回结果集中的列数
+    fields_ = mysql_fetch_fields(res_); // 关于结果集所有列的MYSQL_FIELD结构的数组
 }
 
 CResultSet::~CResultSet() {
     if (res_) {
+        // 流式结果集没读完时会把剩下的行读掉，连接才能继续使用
         mysql_free_result(res_);
         res_ = NULL;
     }
@@ -30,47 +176,83 @@ CResultSet::~CResultSet() {
 bool CResultSet::Next() {
     row_ = mysql_fetch_row(res_); // 检索结果集的下一行,行内值的数目由mysql_num_fields(result)给出
     if (row_) {
+        lengths_ = mysql_fetch_lengths(res_);
         return true;
     } else {
+        lengths_ = NULL;
         return false;
     }
 }
 
-int CResultSet::_GetIndex(const char *key) {
-    map<string, int>::iterator it = key_map_.find(key);
-    if (it == key_map_.end()) {
-        return -1;
-    } else {
-        return it->second;
+bool CResultSet::HasError() const {
+    return mysql_ && mysql_errno(mysql_) != 0;
+}
+
+int CResultSet::GetIndex(std::string_view key) const {
+    for (int i = 0; i < num_fields_; i++) {
+        if (key == fields_[i].name) {
+            return i;
+        }
     }
+    return -1;
 }
 
 int CResultSet::GetInt(const char *key) {
-    int idx = _GetIndex(key); // 查找列的索引
+    int idx = GetIndex(key); // 查找列的索引
     if (idx == -1) {
         return 0;
     } else {
-        return atoi(row_[idx]); // 有索引
+        return (int)GetInt64(idx); // 有索引
     }
 }
 
 char *CResultSet::GetString(const char *key) {
-    int idx = _GetIndex(key);
-    if (idx == -1) {
+    int idx = GetIndex(key);
+    if (idx == -1 || !row_) {
         return NULL;
     } else {
         return row_[idx]; // 列
     }
 }
 
+bool CResultSet::IsNull(int idx) const {
+    return !row_ || idx < 0 || idx >= num_fields_ || !row_[idx];
+}
+
+std::string_view CResultSet::GetStringView(int idx) const {
+    if (IsNull(idx)) {
+        return std::string_view();
+    }
+    return std::string_view(row_[idx], lengths_[idx]);
+}
+
+int64_t CResultSet::GetInt64(int idx) const {
+    std::string_view value = GetStringView(idx);
+    int64_t result = 0;
+    std::from_chars(value.data(), value.data() + value.size(), result);
+    return result;
+}
+
+uint64_t CResultSet::GetUInt64(int idx) const {
+    std::string_view value = GetStringView(idx);
+    uint64_t result = 0;
+    std::from_chars(value.data(), value.data() + value.size(), result);
+    return result;
+}
+
 /////////////////////////////////////////
+// 字符串列的初始缓冲区大小，取到更长的值时按实际长度扩大，之后一直沿用
+#define STMT_STRING_BUFFER_INIT 256
+
 CPrepareStatement::CPrepareStatement() {
+    mysql_ = NULL;
     stmt_ = NULL;
     param_bind_ = NULL;
     param_cnt_ = 0;
 }
 
 CPrepareStatement::~CPrepareStatement() {
+    FreeResult();
     if (stmt_) {
         mysql_stmt_close(stmt_);
         stmt_ = NULL;
@@ -82,19 +264,11 @@ CPrepareStatement::~CPrepareStatement() {
     }
 }
 
-bool CPrepareStatement::Init(MYSQL *mysql, string &sql) {
-    mysql_ping(mysql); // 当mysql连接丢失的时候，使用mysql_ping能够自动重连数据库
-
-    // g_master_conn_fail_num ++;
-    stmt_ = mysql_stmt_init(mysql);
-    if (!stmt_) {
-        LOG_ERROR << "mysql_stmt_init failed";
-        return false;
-    }
-
-    if (mysql_stmt_prepare(stmt_, sql.c_str(), sql.size())) {
-        LOG_ERROR << "mysql_stmt_prepare failed: " <<  mysql_stmt_error(stmt_);
-
+bool CPrepareStatement::Init(MYSQL *mysql, string &sql, const char *pool_name) {
+    mysql_ = mysql;
+    sql_ = sql;
+    pool_name_ = pool_name;
+    if (!Prepare()) {
         return false;
     }
 
@@ -107,70 +281,167 @@ bool CPrepareStatement::Init(MYSQL *mysql, string &sql) {
         }
 
         memset(param_bind_, 0, sizeof(MYSQL_BIND) * param_cnt_);
+        param_values_.resize(param_cnt_);
     }
 
     return true;
 }
 
-void CPrepareStatement::SetParam(uint32_t index, int &value) {
+// 创建语句句柄并 prepare，重新 prepare 时保留参数绑定，结果列按新的元数据重新绑定
+bool CPrepareStatement::Prepare() {
+    FreeResult();
+    if (stmt_) {
+        mysql_stmt_close(stmt_);
+    }
+    result_bind_.clear();
+    result_columns_.clear();
+
+    stmt_ = mysql_stmt_init(mysql_);
+    if (!stmt_) {
+        LOG_ERROR << "mysql_stmt_init failed";
+        return false;
+    }
+
+    if (mysql_stmt_prepare(stmt_, sql_.c_str(), sql_.size())) {
+        LOG_ERROR << "mysql_stmt_prepare failed: " << mysql_stmt_error(stmt_) << ", sql: " << sql_;
+        mysql_stmt_close(stmt_);
+        stmt_ = NULL;
+        return false;
+    }
+    return true;
+}
+
+MYSQL_BIND *CPrepareStatement::GetParamBind(uint32_t index) {
     if (index >= param_cnt_) {
         LOG_ERROR << "index too large: " <<  index;
+        return NULL;
+    }
+    MYSQL_BIND *bind = &param_bind_[index];
+    memset(bind, 0, sizeof(MYSQL_BIND));
+    return bind;
+}
+
+void CPrepareStatement::SetParam(uint32_t index, int &value) {
+    MYSQL_BIND *bind = GetParamBind(index);
+    if (!bind) {
         return;
     }
 
-    param_bind_[index].buffer_type = MYSQL_TYPE_LONG;
-    param_bind_[index].buffer = &value;
+    bind->buffer_type = MYSQL_TYPE_LONG;
+    bind->buffer = &value;
 }
 
 void CPrepareStatement::SetParam(uint32_t index, uint32_t &value) {
-    if (index >= param_cnt_) {
-        LOG_ERROR << "index too large: " <<  index;
+    MYSQL_BIND *bind = GetParamBind(index);
+    if (!bind) {
         return;
     }
 
-    param_bind_[index].buffer_type = MYSQL_TYPE_LONG;
-    param_bind_[index].buffer = &value;
+    bind->buffer_type = MYSQL_TYPE_LONG;
+    bind->buffer = &value;
+    bind->is_unsigned = 1;
 }
 
 void CPrepareStatement::SetParam(uint32_t index, string &value) {
-    if (index >= param_cnt_) {
-        LOG_ERROR << "index too large: " <<  index;
+    SetParam(index, (const string &)value);
+}
+
+void CPrepareStatement::SetParam(uint32_t index, const string &value) {
+    MYSQL_BIND *bind = GetParamBind(index);
+    if (!bind) {
         return;
     }
 
-    param_bind_[index].buffer_type = MYSQL_TYPE_STRING;
-    param_bind_[index].buffer = (char *)value.c_str();
-    param_bind_[index].buffer_length = value.size();
+    bind->buffer_type = MYSQL_TYPE_STRING;
+    bind->buffer = (char *)value.c_str();
+    bind->buffer_length = value.size();
 }
 
-void CPrepareStatement::SetParam(uint32_t index, const string &value) {
-    if (index >= param_cnt_) {
-        LOG_ERROR << "index too large: " <<  index;
+void CPrepareStatement::SetInt64(uint32_t index, int64_t value) {
+    MYSQL_BIND *bind = GetParamBind(index);
+    if (!bind) {
         return;
     }
 
-    param_bind_[index].buffer_type = MYSQL_TYPE_STRING;
-    param_bind_[index].buffer = (char *)value.c_str();
-    param_bind_[index].buffer_length = value.size();
+    param_values_[index].int_value = value;
+    bind->buffer_type = MYSQL_TYPE_LONGLONG;
+    bind->buffer = &param_values_[index].int_value;
 }
 
-bool CPrepareStatement::ExecuteUpdate() {
-    if (!stmt_) {
-        LOG_ERROR << "no m_stmt"; 
+void CPrepareStatement::SetUInt64(uint32_t index, uint64_t value) {
+    MYSQL_BIND *bind = GetParamBind(index);
+    if (!bind) {
+        return;
+    }
+
+    param_values_[index].int_value = (long long)value;
+    bind->buffer_type = MYSQL_TYPE_LONGLONG;
+    bind->buffer = &param_values_[index].int_value;
+    bind->is_unsigned = 1;
+}
+
+void CPrepareStatement::SetDouble(uint32_t index, double value) {
+    MYSQL_BIND *bind = GetParamBind(index);
+    if (!bind) {
+        return;
+    }
+
+    param_values_[index].double_value = value;
+    bind->buffer_type = MYSQL_TYPE_DOUBLE;
+    bind->buffer = &param_values_[index].double_value;
+}
+
+void CPrepareStatement::SetNull(uint32_t index) {
+    MYSQL_BIND *bind = GetParamBind(index);
+    if (!bind) {
+        return;
+    }
+
+    param_values_[index].is_null = 1;
+    bind->buffer_type = MYSQL_TYPE_NULL;
+    bind->is_null = &param_values_[index].is_null;
+}
+
+// 服务端丢了语句（ER_UNKNOWN_STMT_HANDLER）或者表结构变化需要重新 prepare（ER_NEED_REPREPARE）时，
+// 在同一个连接上重新 prepare 再执行一次；断线类错误不重试，由连接池重建连接
+bool CPrepareStatement::Execute() {
+    if (!stmt_ && !Prepare()) {
         return false;
     }
+    FreeResult();
 
-    if (mysql_stmt_bind_param(stmt_, param_bind_)) {
-        LOG_ERROR << "mysql_stmt_bind_param failed: " <<  mysql_stmt_error(stmt_);
+    for (int attempt = 0; ; attempt++) {
+        if (param_cnt_ > 0 && mysql_stmt_bind_param(stmt_, param_bind_)) {
+            LOG_ERROR << "mysql_stmt_bind_param failed: " <<  mysql_stmt_error(stmt_);
+            return false;
+        }
+
+        if (mysql_stmt_execute(stmt_) == 0) {
+            return true;
+        }
+
+        unsigned int err = mysql_stmt_errno(stmt_);
+        if (attempt == 0 && (err == ER_UNKNOWN_STMT_HANDLER || err == ER_NEED_REPREPARE)) {
+            LOG_WARN << "statement needs re-prepare (" << err << "): " << sql_;
+            if (Prepare()) {
+                continue;
+            }
+            return false;
+        }
+        LOG_ERROR << "mysql_stmt_execute failed: " <<  mysql_stmt_error(stmt_) << ", sql: " << sql_;
         return false;
     }
+}
 
-    if (mysql_stmt_execute(stmt_)) {
-        LOG_ERROR << "mysql_stmt_execute failed: " <<  mysql_stmt_error(stmt_);
+bool CPrepareStatement::ExecuteUpdate(bool care_affected_rows) {
+    DBStatementTimer timer;
+    if (!Execute()) {
+        timer.Finish(pool_name_, sql_, &fingerprint_, 0, 0, false);
         return false;
     }
+    timer.Finish(pool_name_, sql_, &fingerprint_, 0, mysql_stmt_affected_rows(stmt_), true);
 
-    if (mysql_stmt_affected_rows(stmt_) == 0) {
+    if (care_affected_rows && mysql_stmt_affected_rows(stmt_) == 0) {
         LOG_ERROR << "ExecuteUpdate have no effect"; 
         return false;
     }
@@ -182,6 +453,197 @@ uint32_t CPrepareStatement::GetInsertId() {
     return mysql_stmt_insert_id(stmt_);
 }
 
+uint64_t CPrepareStatement::GetAffectedRows() {
+    return mysql_stmt_affected_rows(stmt_);
+}
+
+// 按结果集元数据绑定接收缓冲区，只在第一次查询（或重新 prepare）后做一次
+bool CPrepareStatement::BindResult() {
+    if (!result_bind_.empty()) {
+        return true;
+    }
+    MYSQL_RES *meta = mysql_stmt_result_metadata(stmt_);
+    if (!meta) {
+        LOG_ERROR << "statement has no result set: " << sql_;
+        return false;
+    }
+    unsigned int num_fields = mysql_num_fields(meta);
+    MYSQL_FIELD *fields = mysql_fetch_fields(meta);
+    result_bind_.assign(num_fields, MYSQL_BIND());
+    result_columns_.resize(num_fields);
+    for (unsigned int i = 0; i < num_fields; i++) {
+        MYSQL_BIND &bind = result_bind_[i];
+        ResultColumn &column = result_columns_[i];
+        memset(&bind, 0, sizeof(MYSQL_BIND));
+        switch (fields[i].type) {
+        case MYSQL_TYPE_TINY:
+        case MYSQL_TYPE_SHORT:
+        case MYSQL_TYPE_INT24:
+        case MYSQL_TYPE_LONG:
+        case MYSQL_TYPE_LONGLONG:
+        case MYSQL_TYPE_YEAR:
+            bind.buffer_type = MYSQL_TYPE_LONGLONG;
+            bind.buffer = &column.int_value;
+            bind.is_unsigned = (fields[i].flags & UNSIGNED_FLAG) ? 1 : 0;
+            break;
+        case MYSQL_TYPE_FLOAT:
+        case MYSQL_TYPE_DOUBLE:
+            bind.buffer_type = MYSQL_TYPE_DOUBLE;
+            bind.buffer = &column.double_value;
+            break;
+        default:
+            column.buffer.resize(STMT_STRING_BUFFER_INIT);
+            bind.buffer_type = MYSQL_TYPE_STRING;
+            bind.buffer = column.buffer.data();
+            bind.buffer_length = column.buffer.size();
+            break;
+        }
+        bind.length = &column.length;
+        bind.is_null = &column.is_null;
+        bind.error = &column.error;
+    }
+    mysql_free_result(meta);
+
+    if (mysql_stmt_bind_result(stmt_, result_bind_.data())) {
+        LOG_ERROR << "mysql_stmt_bind_result failed: " << mysql_stmt_error(stmt_);
+        result_bind_.clear();
+        result_columns_.clear();
+        return false;
+    }
+    return true;
+}
+
+bool CPrepareStatement::ExecuteQuery() {
+    row_num_ = 0;
+    DBStatementTimer timer;
+    if (!Execute() || !BindResult()) {
+        timer.Finish(pool_name_, sql_, &fingerprint_, 0, 0, false);
+        return false;
+    }
+    if (mysql_stmt_store_result(stmt_)) {
+        LOG_ERROR << "mysql_stmt_store_result failed: " << mysql_stmt_error(stmt_);
+        timer.Finish(pool_name_, sql_, &fingerprint_, 0, 0, false);
+        return false;
+    }
+    has_result_ = true;
+    row_num_ = (int)mysql_stmt_num_rows(stmt_);
+    timer.Finish(pool_name_, sql_, &fingerprint_, row_num_, 0, true);
+    return true;
+}
+
+bool CPrepareStatement::Fetch() {
+    if (!has_result_) {
+        return false;
+    }
+    int ret = mysql_stmt_fetch(stmt_);
+    if (ret == MYSQL_NO_DATA) {
+        return false;
+    }
+    if (ret == 1) {
+        LOG_ERROR << "mysql_stmt_fetch failed: " << mysql_stmt_error(stmt_);
+        return false;
+    }
+    if (ret == MYSQL_DATA_TRUNCATED) {
+        // 字符串比缓冲区长：按实际长度扩大缓冲区，把这一列重新取一次，之后的行直接用大缓冲区
+        bool rebind = false;
+        for (size_t i = 0; i < result_columns_.size(); i++) {
+            ResultColumn &column = result_columns_[i];
+            MYSQL_BIND &bind = result_bind_[i];
+            if (!column.error || bind.buffer_type != MYSQL_TYPE_STRING) {
+                continue;
+            }
+            column.buffer.resize(column.length);
+            bind.buffer = column.buffer.data();
+            bind.buffer_length = column.buffer.size();
+            if (mysql_stmt_fetch_column(stmt_, &bind, i, 0)) {
+                LOG_ERROR << "mysql_stmt_fetch_column failed: " << mysql_stmt_error(stmt_);
+                return false;
+            }
+            rebind = true;
+        }
+        if (rebind && mysql_stmt_bind_result(stmt_, result_bind_.data())) {
+            LOG_ERROR << "mysql_stmt_bind_result failed: " << mysql_stmt_error(stmt_);
+            return false;
+        }
+    }
+    return true;
+}
+
+void CPrepareStatement::FreeResult() {
+    if (has_result_) {
+        mysql_stmt_free_result(stmt_);
+        has_result_ = false;
+    }
+}
+
+CPrepareStatement::ResultColumn *CPrepareStatement::GetColumn(uint32_t column) {
+    if (column >= result_columns_.size()) {
+        LOG_ERROR << "column too large: " << column << ", sql: " << sql_;
+        return NULL;
+    }
+    return &result_columns_[column];
+}
+
+bool CPrepareStatement::IsNull(uint32_t column) {
+    ResultColumn *col = GetColumn(column);
+    return !col || col->is_null;
+}
+
+int CPrepareStatement::GetInt(uint32_t column) {
+    return (int)GetInt64(column);
+}
+
+int64_t CPrepareStatement::GetInt64(uint32_t column) {
+    ResultColumn *col = GetColumn(column);
+    if (!col || col->is_null) {
+        return 0;
+    }
+    switch (result_bind_[column].buffer_type) {
+    case MYSQL_TYPE_LONGLONG: return col->int_value;
+    case MYSQL_TYPE_DOUBLE: return (int64_t)col->double_value;
+    default: return strtoll(GetString(column).c_str(), NULL, 10);
+    }
+}
+
+uint64_t CPrepareStatement::GetUInt64(uint32_t column) {
+    ResultColumn *col = GetColumn(column);
+    if (!col || col->is_null) {
+        return 0;
+    }
+    switch (result_bind_[column].buffer_type) {
+    case MYSQL_TYPE_LONGLONG: return (uint64_t)col->int_value;
+    case MYSQL_TYPE_DOUBLE: return (uint64_t)col->double_value;
+    default: return strtoull(GetString(column).c_str(), NULL, 10);
+    }
+}
+
+double CPrepareStatement::GetDouble(uint32_t column) {
+    ResultColumn *col = GetColumn(column);
+    if (!col || col->is_null) {
+        return 0;
+    }
+    switch (result_bind_[column].buffer_type) {
+    case MYSQL_TYPE_LONGLONG:
+        return result_bind_[column].is_unsigned ? (double)(uint64_t)col->int_value : (double)col->int_value;
+    case MYSQL_TYPE_DOUBLE: return col->double_value;
+    default: return strtod(GetString(column).c_str(), NULL);
+    }
+}
+
+string CPrepareStatement::GetString(uint32_t column) {
+    ResultColumn *col = GetColumn(column);
+    if (!col || col->is_null) {
+        return "";
+    }
+    switch (result_bind_[column].buffer_type) {
+    case MYSQL_TYPE_LONGLONG:
+        return result_bind_[column].is_unsigned ? std::to_string((uint64_t)col->int_value)
+                                                : std::to_string(col->int_value);
+    case MYSQL_TYPE_DOUBLE: return std::to_string(col->double_value);
+    default: return string(col->buffer.data(), std::min((size_t)col->length, col->buffer.size()));
+    }
+}
+
 /////////////////////
 CDBConn::CDBConn(CDBPool *pPool) {
     db_pool_ = pPool;
@@ -189,6 +651,11 @@ CDBConn::CDBConn(CDBPool *pPool) {
 }
 
 CDBConn::~CDBConn() {
+    for (auto &it : stmt_lru_) {
+        delete it.second;
+    }
+    stmt_lru_.clear();
+    stmt_cache_.clear();
     if (mysql_) {
         mysql_close(mysql_);
     }
@@ -202,8 +669,11 @@ int CDBConn::Init() {
         return 1;
     }
     
-    // mysql_options(mysql_, MYSQL_OPT_RECONNECT,  &reconnect); // 配合mysql_ping实现自动重连
+    // 不开 MYSQL_OPT_RECONNECT：断线的连接由连接池在取出时检查出来并重建，不会在事务中途被悄悄重连
     mysql_options(mysql_, MYSQL_SET_CHARSET_NAME, "utf8mb4"); // utf8mb4和utf8区别
+    // BulkInsert 的 LOAD DATA LOCAL 方式需要在连接时声明 CLIENT_LOCAL_FILES，只有配置了的连接池才打开
+    unsigned int local_infile = db_pool_->GetLocalInfile() ? 1 : 0;
+    mysql_options(mysql_, MYSQL_OPT_LOCAL_INFILE, &local_infile);
 
     // ip 端口 用户名 密码 数据库名
     if (!mysql_real_connect(mysql_, db_pool_->GetDBServerIP(),
@@ -213,14 +683,31 @@ int CDBConn::Init() {
         LOG_ERROR << "mysql_real_connect failed: " <<  mysql_error(mysql_);
         return 2;
     }
+    if (local_infile) {
+        // 客户端平时拒绝服务端发来的 LOCAL INFILE 请求，只在 BulkInsertLoadData 执行期间允许
+        local_infile = 0;
+        mysql_options(mysql_, MYSQL_OPT_LOCAL_INFILE, &local_infile);
+    }
 
     return 0;
 }
 
 const char *CDBConn::GetPoolName() { return db_pool_->GetPoolName(); }
 
+bool CDBConn::IsAlive(bool idle_expired) {
+    // 上一条语句因为断线失败的连接直接判定不可用，空闲太久的连接 ping 一次
+    unsigned int err = mysql_errno(mysql_);
+    if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST) {
+        return false;
+    }
+    if (idle_expired && mysql_ping(mysql_)) {
+        LOG_WARN << "mysql_ping failed: " << mysql_error(mysql_) << ", pool: " << GetPoolName();
+        return false;
+    }
+    return true;
+}
+
 bool CDBConn::ExecuteCreate(const char *sql_query) {
-    mysql_ping(mysql_);
     // mysql_real_query 实际就是执行了SQL
     if (mysql_real_query(mysql_, sql_query, strlen(sql_query))) {
         LOG_ERROR << "mysql_real_query failed: " <<  mysql_error(mysql_); 
@@ -231,7 +718,6 @@ bool CDBConn::ExecuteCreate(const char *sql_query) {
 }
 
 bool CDBConn::ExecutePassQuery(const char *sql_query) {
-    mysql_ping(mysql_);
     // mysql_real_query 实际就是执行了SQL
     if (mysql_real_query(mysql_, sql_query, strlen(sql_query))) {
         LOG_ERROR << "mysql_real_query failed: " <<  mysql_error(mysql_); 
@@ -242,8 +728,6 @@ bool CDBConn::ExecutePassQuery(const char *sql_query) {
 }
 
 bool CDBConn::ExecuteDrop(const char *sql_query) {
-    mysql_ping(mysql_); // 如果端开了，能够自动重连
-
     if (mysql_real_query(mysql_, sql_query, strlen(sql_query))) {
         LOG_ERROR << "mysql_real_query failed: " <<  mysql_error(mysql_); 
         return false;
@@ -253,10 +737,11 @@ bool CDBConn::ExecuteDrop(const char *sql_query) {
 }
 
 CResultSet *CDBConn::ExecuteQuery(const char *sql_query) {
-    mysql_ping(mysql_);
     row_num = 0;
+    DBStatementTimer timer;
     if (mysql_real_query(mysql_, sql_query, strlen(sql_query))) {
         LOG_ERROR << "mysql_real_query failed: " << mysql_error(mysql_) << ", sql:" << sql_query;
+        timer.Finish(GetPoolName(), sql_query, NULL, 0, 0, false);
         return NULL;
     }
     // 返回结果
@@ -264,14 +749,35 @@ CResultSet *CDBConn::ExecuteQuery(const char *sql_query) {
     if (!res) // 如果查询未返回结果集和读取结果集失败都会返回NULL
     {
         LOG_ERROR << "mysql_store_result failed: " <<  mysql_error(mysql_);
+        timer.Finish(GetPoolName(), sql_query, NULL, 0, 0, false);
         return NULL;
     }
     row_num = mysql_num_rows(res);
+    timer.Finish(GetPoolName(), sql_query, NULL, row_num, 0, true);
     // LOG_INFO << "row_num: " <<  row_num;
     CResultSet *result_set = new CResultSet(res); // 存储到CResultSet
     return result_set;
 }
 
+CResultSet *CDBConn::ExecuteQueryStream(const char *sql_query) {
+    row_num = 0;
+    DBStatementTimer timer;
+    if (mysql_real_query(mysql_, sql_query, strlen(sql_query))) {
+        LOG_ERROR << "mysql_real_query failed: " << mysql_error(mysql_) << ", sql:" << sql_query;
+        timer.Finish(GetPoolName(), sql_query, NULL, 0, 0, false);
+        return NULL;
+    }
+    // 只读取结果集的元数据，行在 Next 时才从服务端读取，总行数事先不知道
+    MYSQL_RES *res = mysql_use_result(mysql_);
+    if (!res) {
+        LOG_ERROR << "mysql_use_result failed: " << mysql_error(mysql_);
+        timer.Finish(GetPoolName(), sql_query, NULL, 0, 0, false);
+        return NULL;
+    }
+    timer.Finish(GetPoolName(), sql_query, NULL, 0, 0, true);
+    return new CResultSet(res, mysql_);
+}
+
 /*
 1.执行成功，则返回受影响的行的数目，如果最近一次查询失败的话，函数返回 -1
 
@@ -283,12 +789,13 @@ id=1; id=1该条记录原值就是10的话,则返回0。
 mysql_affected_rows返回的是实际更新的行数,而不是匹配到的行数。
 */
 bool CDBConn::ExecuteUpdate(const char *sql_query, bool care_affected_rows) {
-    mysql_ping(mysql_);
-
+    DBStatementTimer timer;
     if (mysql_real_query(mysql_, sql_query, strlen(sql_query))) {
         LOG_ERROR << "mysql_real_query failed: " << mysql_error(mysql_) << ", sql:" << sql_query;
+        timer.Finish(GetPoolName(), sql_query, NULL, 0, 0, false);
         return false;
     }
+    timer.Finish(GetPoolName(), sql_query, NULL, 0, mysql_affected_rows(mysql_), true);
 
     if (mysql_affected_rows(mysql_) > 0) {
         return true;
@@ -304,8 +811,6 @@ bool CDBConn::ExecuteUpdate(const char *sql_query, bool care_affected_rows) {
 }
 
 bool CDBConn::StartTransaction() {
-    mysql_ping(mysql_);
-
     if (mysql_real_query(mysql_, "start transaction\n", 17)) {
         LOG_ERROR << "mysql_real_query failed: " << mysql_error(mysql_) << " start transaction failed";
         return false;
@@ -315,8 +820,6 @@ bool CDBConn::StartTransaction() {
 }
 
 bool CDBConn::Rollback() {
-    mysql_ping(mysql_);
-
     if (mysql_real_query(mysql_, "rollback\n", 8)) {
         LOG_ERROR << "mysql_real_query failed: " << mysql_error(mysql_) << ", sql: rollback";
         return false;
@@ -326,9 +829,11 @@ bool CDBConn::Rollback() {
 }
 
 bool CDBConn::Commit() {
-    mysql_ping(mysql_);
-
-    if (mysql_real_query(mysql_, "commit\n", 6)) {
+    // 提交要等服务端刷日志，单独统计
+    DBStatementTimer timer;
+    bool ok = mysql_real_query(mysql_, "commit\n", 6) == 0;
+    timer.Finish(GetPoolName(), "commit", NULL, 0, 0, ok);
+    if (!ok) {
         LOG_ERROR << "mysql_real_query failed: " << mysql_error(mysql_) << ", sql: commit";
         return false;
     }
@@ -337,143 +842,333 @@ bool CDBConn::Commit() {
 }
 uint32_t CDBConn::GetInsertId() { return (uint32_t)mysql_insert_id(mysql_); }
 
-////////////////
-CDBPool::CDBPool(const char *pool_name, const char *db_server_ip,
-                 uint16_t db_server_port, const char *username,
-                 const char *password, const char *db_name, int max_conn_cnt) {
-    pool_name_ = pool_name;
-    db_server_ip_ = db_server_ip;
-    db_server_port_ = db_server_port;
-    username_ = username;
-    password_ = password;
-    db_name_ = db_name;
-    db_max_conn_cnt_ = max_conn_cnt;    //
-    db_cur_conn_cnt_ = MIN_DB_CONN_CNT; // 最小连接数量
+// 预处理语句按行数缓存，行数拆成2的幂（64、32、...、1），每种列组合最多缓存7条语句
+#define BULK_INSERT_MAX_ROWS_PER_STMT 64
+
+int CDBConn::BulkInsert(const string &table, const vector<string> &columns,
+                        const vector<vector<string>> &rows, BulkInsertMode mode,
+                        bool ignore_duplicates) {
+    if (columns.empty()) {
+        LOG_ERROR << "BulkInsert no columns, table: " << table;
+        return -1;
+    }
+    if (rows.empty()) {
+        return 0;
+    }
+    for (const vector<string> &row : rows) {
+        if (row.size() != columns.size()) {
+            LOG_ERROR << "BulkInsert row size " << row.size() << " != columns " << columns.size();
+            return -1;
+        }
+    }
+
+    if (mode == BULK_INSERT_LOAD_DATA) {
+        return BulkInsertLoadData(table, columns, rows, ignore_duplicates);
+    }
+    return BulkInsertPrepared(table, columns, rows, ignore_duplicates);
 }
 
-// 释放连接池
-CDBPool::~CDBPool() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    abort_request_ = true;
-    cond_var_.notify_all(); // 通知所有在等待的
+// 连接上缓存的预处理语句上限，超过时关掉最久没用的
+#define DB_STMT_CACHE_SIZE 64
 
-    for (list<CDBConn *>::iterator it = free_list_.begin();
-         it != free_list_.end(); it++) {
-        CDBConn *pConn = *it;
-        delete pConn;
+CPrepareStatement *CDBConn::GetStatement(const string &sql) {
+    auto it = stmt_cache_.find(sql);
+    if (it != stmt_cache_.end()) {
+        stmt_lru_.splice(stmt_lru_.begin(), stmt_lru_, it->second);
+        db_pool_->AddStmtLookup(false);
+        return it->second->second;
     }
 
-    free_list_.clear();
+    CPrepareStatement *stmt = new CPrepareStatement();
+    string stmt_sql = sql;
+    if (!stmt->Init(mysql_, stmt_sql, GetPoolName())) {
+        delete stmt;
+        return NULL;
+    }
+    db_pool_->AddStmtLookup(true);
+    if (stmt_lru_.size() >= DB_STMT_CACHE_SIZE) {
+        stmt_cache_.erase(stmt_lru_.back().first);
+        delete stmt_lru_.back().second;
+        stmt_lru_.pop_back();
+    }
+    stmt_lru_.emplace_front(sql, stmt);
+    stmt_cache_[sql] = stmt_lru_.begin();
+    return stmt;
 }
 
-int CDBPool::Init() {
-    // 创建固定最小的连接数量
-    for (int i = 0; i < db_cur_conn_cnt_; i++) {
-        CDBConn *db_conn = new CDBConn(this);
-        int ret = db_conn->Init();
-        if (ret) {
-            delete db_conn;
-            return ret;
+void CDBConn::EvictStatement(const string &sql) {
+    auto it = stmt_cache_.find(sql);
+    if (it == stmt_cache_.end()) {
+        return;
+    }
+    delete it->second->second;
+    stmt_lru_.erase(it->second);
+    stmt_cache_.erase(it);
+}
+
+int CDBConn::BulkInsertPrepared(const string &table, const vector<string> &columns,
+                                const vector<vector<string>> &rows, bool ignore_duplicates) {
+    string sql_prefix = ignore_duplicates ? "INSERT IGNORE INTO `" : "INSERT INTO `";
+    sql_prefix += table + "` (";
+    string row_placeholder = "(";
+    for (size_t i = 0; i < columns.size(); i++) {
+        if (i > 0) {
+            sql_prefix += ",";
+            row_placeholder += ",";
         }
+        sql_prefix += "`" + columns[i] + "`";
+        row_placeholder += "?";
+    }
+    sql_prefix += ") VALUES ";
+    row_placeholder += ")";
 
-        free_list_.push_back(db_conn);
+    // 多于一条语句时放在一个事务里，只提交一次
+    bool use_transaction = rows.size() > BULK_INSERT_MAX_ROWS_PER_STMT ||
+                           (rows.size() & (rows.size() - 1)) != 0;
+    if (use_transaction && !StartTransaction()) {
+        return -1;
     }
 
-    // log_info("db pool: %s, size: %d\n", m_pool_name.c_str(),
-    // (int)free_list_.size());
+    uint64_t inserted = 0;
+    size_t offset = 0;
+    while (offset < rows.size()) {
+        size_t chunk = BULK_INSERT_MAX_ROWS_PER_STMT;
+        while (chunk > rows.size() - offset) {
+            chunk >>= 1;
+        }
+
+        string sql = sql_prefix;
+        for (size_t i = 0; i < chunk; i++) {
+            if (i > 0) {
+                sql += ",";
+            }
+            sql += row_placeholder;
+        }
+        CPrepareStatement *stmt = GetStatement(sql);
+        if (!stmt) {
+            if (use_transaction) {
+                Rollback();
+            }
+            return -1;
+        }
+
+        uint32_t index = 0;
+        for (size_t i = offset; i < offset + chunk; i++) {
+            for (const string &value : rows[i]) {
+                stmt->SetParam(index++, value);
+            }
+        }
+        if (!stmt->ExecuteUpdate(false)) {
+            // 语句句柄可能已经失效，丢掉缓存下次重新 prepare
+            EvictStatement(sql);
+            if (use_transaction) {
+                Rollback();
+            }
+            return -1;
+        }
+        inserted += stmt->GetAffectedRows();
+        offset += chunk;
+    }
+
+    if (use_transaction && !Commit()) {
+        Rollback();
+        return -1;
+    }
+    return (int)inserted;
+}
+
+// LOAD DATA LOCAL INFILE 的数据源：从内存缓冲区按块交给客户端库发送
+struct BulkLoadSource {
+    const string *data;
+    size_t offset;
+};
+
+static int BulkLoadInit(void **ptr, const char *filename, void *userdata) {
+    BulkLoadSource *source = (BulkLoadSource *)userdata;
+    source->offset = 0;
+    *ptr = source;
     return 0;
 }
 
-/*
- *TODO:
- *增加保护机制，把分配的连接加入另一个队列，这样获取连接时，如果没有空闲连接，
- *TODO:
- *检查已经分配的连接多久没有返回，如果超过一定时间，则自动收回连接，放在用户忘了调用释放连接的接口
- * timeout_ms默认为 0死等
- * timeout_ms >0 则为等待的时间
- */
-CDBConn *CDBPool::GetDBConn(const int timeout_ms) {
-    std::unique_lock<std::mutex> lock(mutex_);
-    if (abort_request_) {
-        LOG_WARN << "have aboort"; 
-        return NULL;
+static int BulkLoadRead(void *ptr, char *buf, unsigned int buf_len) {
+    BulkLoadSource *source = (BulkLoadSource *)ptr;
+    size_t len = std::min((size_t)buf_len, source->data->size() - source->offset);
+    memcpy(buf, source->data->data() + source->offset, len);
+    source->offset += len;
+    return (int)len;
+}
+
+static void BulkLoadEnd(void *ptr) {
+}
+
+static int BulkLoadError(void *ptr, char *error_msg, unsigned int error_msg_len) {
+    snprintf(error_msg, error_msg_len, "bulk load read failed");
+    return 1;
+}
+
+// LOAD DATA 执行期间允许 LOCAL INFILE 并使用内存数据源，离开作用域时恢复：
+// 客户端重新拒绝 LOCAL INFILE 请求，处理函数恢复默认，连接上不会留下指向已经释放的数据源的指针
+class LocalInfileScope {
+  public:
+    LocalInfileScope(MYSQL *mysql, BulkLoadSource *source) : mysql_(mysql) {
+        unsigned int local_infile = 1;
+        mysql_options(mysql_, MYSQL_OPT_LOCAL_INFILE, &local_infile);
+        mysql_set_local_infile_handler(mysql_, BulkLoadInit, BulkLoadRead, BulkLoadEnd, BulkLoadError, source);
+    }
+    ~LocalInfileScope() {
+        mysql_set_local_infile_default(mysql_);
+        unsigned int local_infile = 0;
+        mysql_options(mysql_, MYSQL_OPT_LOCAL_INFILE, &local_infile);
     }
 
-    if (free_list_.empty()) // 2 当没有连接可以用时
-    {
-        // 第一步先检测 当前连接数量是否达到最大的连接数量
-        if (db_cur_conn_cnt_ >= db_max_conn_cnt_) // 等待的逻辑
-        {
-            // 如果已经到达了，看看是否需要超时等待
-            if (timeout_ms <= 0) // 死等，直到有连接可以用 或者 连接池要退出
-            {
-                cond_var_.wait(lock, [this] {
-                    // 当前连接数量小于最大连接数量 或者请求释放连接池时退出
-                    return (!free_list_.empty()) | abort_request_;
-                });
-            } else {
-                // return如果返回 false，继续wait(或者超时),
-                // 如果返回true退出wait 1.m_free_list不为空 2.超时退出
-                // 3. m_abort_request被置为true，要释放整个连接池
-                cond_var_.wait_for(
-                    lock, std::chrono::milliseconds(timeout_ms),
-                    [this] { return (!free_list_.empty()) | abort_request_; });
-                // 带超时功能时还要判断是否为空
-                if (free_list_.empty()) // 如果连接池还是没有空闲则退出
-                {
-                    return NULL;
-                }
+  private:
+    MYSQL *mysql_;
+};
+
+// 按 LOAD DATA 默认格式转义：字段用\t分隔，行用\n结束，转义符是反斜杠
+static void AppendLoadDataField(string &out, const string &value) {
+    for (char c : value) {
+        switch (c) {
+        case '\\': out += "\\\\"; break;
+        case '\t': out += "\\t"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\0': out += "\\0"; break;
+        default: out += c; break;
+        }
+    }
+}
+
+int CDBConn::BulkInsertLoadData(const string &table, const vector<string> &columns,
+                                const vector<vector<string>> &rows, bool ignore_duplicates) {
+    if (!db_pool_->GetLocalInfile()) {
+        LOG_ERROR << "LOAD DATA LOCAL not enabled for pool " << GetPoolName() << ", set "
+                  << GetPoolName() << "_local_infile=1";
+        return -1;
+    }
+
+    string data;
+    for (const vector<string> &row : rows) {
+        for (size_t i = 0; i < row.size(); i++) {
+            if (i > 0) {
+                data += '\t';
             }
+            AppendLoadDataField(data, row[i]);
+        }
+        data += '\n';
+    }
 
-            if (abort_request_) {
-                LOG_WARN << "have abort"; 
-                return NULL;
+    // LOCAL 方式下服务端不能中途停止接收，不写 IGNORE 也只是跳过重复行；
+    // 要求不能重复时放在事务里，有行被跳过就回滚，和预处理语句方式一样整批失败
+    string sql = "LOAD DATA LOCAL INFILE 'bulk_insert' ";
+    if (ignore_duplicates) {
+        sql += "IGNORE ";
+    }
+    sql += "INTO TABLE `" + table + "` CHARACTER SET utf8mb4 (";
+    for (size_t i = 0; i < columns.size(); i++) {
+        if (i > 0) {
+            sql += ",";
+        }
+        sql += "`" + columns[i] + "`";
+    }
+    sql += ")";
+
+    if (!ignore_duplicates && !StartTransaction()) {
+        return -1;
+    }
+    BulkLoadSource source = {&data, 0};
+    uint64_t affected_rows = 0;
+    {
+        LocalInfileScope local_infile_scope(mysql_, &source);
+        DBStatementTimer timer;
+        if (mysql_real_query(mysql_, sql.c_str(), sql.size())) {
+            LOG_ERROR << "LOAD DATA failed: " << mysql_error(mysql_) << ", rows: " << rows.size();
+            timer.Finish(GetPoolName(), sql, NULL, 0, 0, false);
+            if (!ignore_duplicates) {
+                Rollback();
             }
-        } else // 还没有到最大连接则创建连接
-        {
+            return -1;
+        }
+        affected_rows = mysql_affected_rows(mysql_);
+        timer.Finish(GetPoolName(), sql, NULL, 0, affected_rows, true);
+    }
+
+    if (!ignore_duplicates) {
+        if (affected_rows != rows.size()) {
+            LOG_ERROR << "LOAD DATA skipped " << rows.size() - affected_rows << " duplicate rows, rollback, table: "
+                      << table;
+            Rollback();
+            return -1;
+        }
+        if (!Commit()) {
+            Rollback();
+            return -1;
+        }
+    }
+    return (int)affected_rows;
+}
+
+////////////////
+CDBPool::CDBPool(const char *pool_name, const char *db_server_ip,
+                 uint16_t db_server_port, const char *username,
+                 const char *password, const char *db_name, int max_conn_cnt,
+                 const ConnPoolOptions &options) {
+    pool_name_ = pool_name;
+    db_server_ip_ = db_server_ip;
+    db_server_port_ = db_server_port;
+    username_ = username;
+    password_ = password;
+    db_name_ = db_name;
+
+    ConnPoolOptions pool_options = options;
+    pool_options.max_conn = max_conn_cnt; // 最大连接数量
+    pool_.reset(new ConnPool<CDBConn>(
+        pool_name_, pool_options,
+        [this]() -> CDBConn * {
             CDBConn *db_conn = new CDBConn(this); //新建连接
-            int ret = db_conn->Init();
-            if (ret) {
-                LOG_ERROR << "Init DBConnecton failed"; 
+            if (db_conn->Init()) {
+                LOG_ERROR << "Init DBConnecton failed, pool: " << pool_name_;
                 delete db_conn;
                 return NULL;
-            } else {
-                free_list_.push_back(db_conn);
-                db_cur_conn_cnt_++;
-                // log_info("new db connection: %s, conn_cnt: %d\n",
-                // m_pool_name.c_str(), m_db_cur_conn_cnt);
             }
-        }
-    }
-
-    CDBConn *pConn = free_list_.front(); // 获取连接
-    free_list_.pop_front(); // STL 吐出连接，从空闲队列删除
+            return db_conn;
+        },
+        [](CDBConn *db_conn, bool idle_expired) { return db_conn->IsAlive(idle_expired); }));
+}
 
-    return pConn;
+// 释放连接池
+CDBPool::~CDBPool() {}
+
+DBStmtStats CDBPool::GetStmtStats() {
+    DBStmtStats stats;
+    stats.name = pool_name_;
+    stats.lookups = stmt_lookups_.load();
+    stats.prepares = stmt_prepares_.load();
+    return stats;
 }
 
-void CDBPool::RelDBConn(CDBConn *pConn) {
-    std::lock_guard<std::mutex> lock(mutex_);
+int CDBPool::Init() {
+    // 创建固定最小的连接数量
+    return pool_->Init();
+}
 
-    list<CDBConn *>::iterator it = free_list_.begin();
-    for (; it != free_list_.end(); it++) // 避免重复归还
-    {
-        if (*it == pConn) {
-            break;
-        }
+/*
+ * timeout_ms 为 0 时按配置的默认超时（pool_acquire_timeout_ms）等待
+ * timeout_ms >0 则为等待的时间，超时返回NULL
+ */
+CDBConn *CDBPool::GetDBConn(const int timeout_ms) {
+    CDBConn *pConn = pool_->Acquire(timeout_ms);
+    if (!pConn) {
+        LOG_WARN << "get db conn failed, pool: " << pool_name_;
     }
+    return pConn;
+}
 
-    if (it == free_list_.end()) {
-        // used_list_.remove(pConn);
-        free_list_.push_back(pConn);
-        cond_var_.notify_one(); // 通知取队列
-    } else {
+void CDBPool::RelDBConn(CDBConn *pConn) {
+    if (!pool_->Release(pConn)) { // 避免重复归还
         LOG_WARN << "RelDBConn failed";  // 不再次回收连接
     }
 }
-// 遍历检测是否超时未归还
-// pConn->isTimeout(); // 当前时间 - 被请求的时间
-// 强制回收  从m_used_list 放回 free_list_
 
 /////////////////
 CDBManager::CDBManager() {}
@@ -507,6 +1202,21 @@ int CDBManager::Init() {
         return 1;
     }
 
+    // 所有 mysql 连接池共用的取连接参数
+    ConnPoolOptions options;
+    char *str_acquire_timeout = config_file.GetConfigName("pool_acquire_timeout_ms");
+    if (str_acquire_timeout) {
+        options.acquire_timeout_ms = atoi(str_acquire_timeout);
+    }
+    char *str_min_idle = config_file.GetConfigName("pool_min_idle");
+    if (str_min_idle) {
+        options.min_idle = atoi(str_min_idle);
+    }
+    char *str_idle_check = config_file.GetConfigName("pool_idle_check_seconds");
+    if (str_idle_check) {
+        options.idle_check_seconds = atoi(str_idle_check);
+    }
+
     char host[64];
     char port[64];
     char dbname[64];
@@ -544,7 +1254,12 @@ int CDBManager::Init() {
         int db_port = atoi(str_db_port);
         int db_maxconncnt = atoi(str_maxconncnt);
         CDBPool *pDBPool = new CDBPool(pool_name, db_host, db_port, db_username,
-                                       db_password, db_dbname, db_maxconncnt);
+                                       db_password, db_dbname, db_maxconncnt, options);
+        // 只给执行 LOAD DATA LOCAL 的连接池打开，其他连接池不接受服务端的 LOCAL INFILE 请求
+        char local_infile[64];
+        snprintf(local_infile, 64, "%s_local_infile", pool_name);
+        char *str_local_infile = config_file.GetConfigName(local_infile);
+        pDBPool->SetLocalInfile(str_local_infile && atoi(str_local_infile) == 1);
         if (pDBPool->Init()) {
             LOG_ERROR << "init db instance failed: " << pool_name;
             return 3;
@@ -564,6 +1279,11 @@ CDBConn *CDBManager::GetDBConn(const char *dbpool_name) {
     }
 }
 
+CDBPool *CDBManager::GetDBPool(const char *dbpool_name) {
+    map<string, CDBPool *>::iterator it = dbpool_map_.find(dbpool_name);
+    return it == dbpool_map_.end() ? NULL : it->second;
+}
+
 void CDBManager::RelDBConn(CDBConn *pConn) {
     if (!pConn) {
         return;
@@ -574,3 +1294,15 @@ void CDBManager::RelDBConn(CDBConn *pConn) {
         it->second->RelDBConn(pConn);
     }
 }
+
+void CDBManager::GetPoolStats(vector<ConnPoolStats> &stats) {
+    for (auto &pool_pair : dbpool_map_) {
+        stats.push_back(pool_pair.second->GetStats());
+    }
+}
+
+void CDBManager::GetStmtStats(vector<DBStmtStats> &stats) {
+    for (auto &pool_pair : dbpool_map_) {
+        stats.push_back(pool_pair.second->GetStmtStats());
+    }
+}
@@ -1,77 +1,267 @@
 #ifndef DBPOOL_H_
 #define DBPOOL_H_
 
-#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <iostream>
 #include <list>
 #include <map>
-#include <mutex>
+#include <memory>
 #include <stdint.h>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <variant>
+#include <vector>
 
 #include <mysql/mysql.h>
 
+#include "conn_pool.h"
+
 #define MAX_ESCAPE_STRING_LEN 10240
 
 using namespace std;
 
 // https://www.mysqlzh.com/api/66.html  学习mysql c接口使用
 
+// 每条语句执行结束时调用：池名、语句指纹、执行毫秒数、返回行数、影响行数、是否成功
+// 执行时间从发出语句到结果取回客户端，不包含从连接池取连接的等待（由 ConnPoolAcquireObserver 单独记录）
+typedef std::function<void(const string &pool_name, const string &fingerprint, double exec_ms,
+                           uint64_t rows_returned, uint64_t rows_affected, bool ok)>
+    DBStatementObserver;
+
+// 在启动连接池之前设置
+void SetDBStatementObserver(DBStatementObserver observer);
+
+// 语句指纹：字符串和数字字面量换成 ?，关键字转小写，去掉注释和多余空白，
+// IN (...) 和多行 VALUES 合并成 (?+)，参数不同、行数不同的同一类语句得到相同的指纹
+string FingerprintSql(std::string_view sql);
+
+// 记录一条语句的执行时间，没有设置 DBStatementObserver 时不计时也不计算指纹
+class DBStatementTimer {
+  public:
+    DBStatementTimer();
+    // fingerprint 不为空时作为指纹缓存：为空串时按 sql 计算并存进去，之后直接使用
+    void Finish(const char *pool_name, std::string_view sql, string *fingerprint, uint64_t rows_returned,
+                uint64_t rows_affected, bool ok);
+
+  private:
+    bool enabled_;
+    std::chrono::steady_clock::time_point start_;
+};
+
 // 返回结果 select的时候用
+// 按列名读取时每次在字段里线性查找，逐行循环里先用 GetIndex 解析下标，再按下标读取（或用 CRowBinder）
 class CResultSet {
   public:
-    CResultSet(MYSQL_RES *res);
+    // mysql 不为空表示流式结果集（mysql_use_result），用来在读完后判断是否出错
+    CResultSet(MYSQL_RES *res, MYSQL *mysql = NULL);
     virtual ~CResultSet();
 
     bool Next();
     int GetInt(const char *key);
     char *GetString(const char *key);
 
+    // 列名对应的下标，没有返回-1
+    int GetIndex(std::string_view key) const;
+    int GetNumFields() const { return num_fields_; }
+    // 以下按下标读取当前行，不分配内存；列为 NULL 或下标无效时返回空串/0
+    bool IsNull(int idx) const;
+    // 指向行缓冲区，下一次 Next 之后失效
+    std::string_view GetStringView(int idx) const;
+    int64_t GetInt64(int idx) const;
+    uint64_t GetUInt64(int idx) const;
+    // 流式结果集 Next 返回 false 时，区分是读完了还是连接出错
+    bool HasError() const;
+
   private:
-    int _GetIndex(const char *key);
     // 该结构代表返回行的查询结果（SELECT, SHOW, DESCRIBE, EXPLAIN）
     MYSQL_RES *res_;
+    MYSQL *mysql_;
     // 这是1行数据的“类型安全”表示。它目前是按照计数字节字符串的数组实施的。
     MYSQL_ROW row_;
-    map<string, int> key_map_;
+    unsigned long *lengths_;    // 当前行每列的长度
+    MYSQL_FIELD *fields_;
+    int num_fields_;
+};
+
+/**
+ *  把结果集的每一行解码到结构体
+ *  列下标在第一行按列名解析一次，之后每行按下标直接读；字符串字段是指向行缓冲区的 string_view，
+ *  整数字段直接从行缓冲区解析，逐行读取不分配内存
+ *
+ *  struct HistoryRow { uint64_t id; std::string_view content; };
+ *  CRowBinder<HistoryRow> binder;
+ *  binder.Bind("id", &HistoryRow::id).Bind("content", &HistoryRow::content);
+ *  HistoryRow row;
+ *  while (binder.Next(result_set, row)) { ... }   // row 中的 string_view 下一次 Next 之后失效
+ *
+ *  一个 binder 对应一种查询（同样的列），结果集中没有的列对应字段保持原值
+ */
+template <typename Row>
+class CRowBinder {
+  public:
+    CRowBinder &Bind(const char *column, std::string_view Row::*field) { return Add(column, field); }
+    CRowBinder &Bind(const char *column, int64_t Row::*field) { return Add(column, field); }
+    CRowBinder &Bind(const char *column, uint64_t Row::*field) { return Add(column, field); }
+    CRowBinder &Bind(const char *column, int32_t Row::*field) { return Add(column, field); }
+
+    // 取下一行并解码，没有更多行返回false
+    bool Next(CResultSet *result_set, Row &row) {
+        if (!result_set->Next()) {
+            return false;
+        }
+        if (result_set != resolved_for_) {
+            for (Column &column : columns_) {
+                column.index = result_set->GetIndex(column.name);
+            }
+            resolved_for_ = result_set;
+        }
+        for (const Column &column : columns_) {
+            if (column.index < 0) {
+                continue;
+            }
+            std::visit([&](auto field) { Decode(result_set, column.index, row.*field); }, column.field);
+        }
+        return true;
+    }
+
+  private:
+    typedef std::variant<std::string_view Row::*, int64_t Row::*, uint64_t Row::*, int32_t Row::*> Field;
+    struct Column {
+        const char *name;
+        Field field;
+        int index;
+    };
+
+    template <typename T>
+    CRowBinder &Add(const char *column, T Row::*field) {
+        columns_.push_back({column, Field(field), -1});
+        resolved_for_ = NULL;
+        return *this;
+    }
+
+    static void Decode(CResultSet *rs, int idx, std::string_view &value) { value = rs->GetStringView(idx); }
+    static void Decode(CResultSet *rs, int idx, int64_t &value) { value = rs->GetInt64(idx); }
+    static void Decode(CResultSet *rs, int idx, uint64_t &value) { value = rs->GetUInt64(idx); }
+    static void Decode(CResultSet *rs, int idx, int32_t &value) { value = (int32_t)rs->GetInt64(idx); }
+
+    vector<Column> columns_;
+    const CResultSet *resolved_for_ = NULL;
 };
 
-// 插入数据用
+// MYSQL_BIND 里 is_null/error 指向的类型：5.7 是 my_bool，8.0 是 bool
+typedef std::remove_pointer<decltype(MYSQL_BIND::is_null)>::type BindBool;
+
+// 预处理语句：参数二进制绑定，不拼 SQL、不用转义
+// 一般通过 CDBConn::GetStatement 取连接缓存的语句，只执行一次的语句也可以自己 Init
 class CPrepareStatement {
   public:
     CPrepareStatement();
     virtual ~CPrepareStatement();
 
-    bool Init(MYSQL *mysql, string &sql);
+    // pool_name 用于按语句统计耗时
+    bool Init(MYSQL *mysql, string &sql, const char *pool_name = "");
 
+    // 以下按引用绑定，执行前 value 必须一直有效
     void SetParam(uint32_t index, int &value);
     void SetParam(uint32_t index, uint32_t &value);
     void SetParam(uint32_t index, string &value);
     void SetParam(uint32_t index, const string &value);
+    // 以下按值绑定，值拷贝在语句里
+    void SetInt64(uint32_t index, int64_t value);
+    void SetUInt64(uint32_t index, uint64_t value);
+    void SetDouble(uint32_t index, double value);
+    void SetNull(uint32_t index);
 
-    bool ExecuteUpdate();
+    // care_affected_rows 为 false 时影响0行也算成功（比如 INSERT IGNORE 全部重复）
+    bool ExecuteUpdate(bool care_affected_rows = true);
     uint32_t GetInsertId();
+    uint64_t GetAffectedRows();
+
+    // 执行查询，结果全部取到客户端，之后用 Fetch 逐行读取；下次执行时自动释放上一次的结果
+    bool ExecuteQuery();
+    // 取下一行，没有更多行返回false
+    bool Fetch();
+    int GetRowNum() { return row_num_; }
+    // 以下按 SELECT 中列的顺序（从0开始）读取当前行
+    bool IsNull(uint32_t column);
+    int GetInt(uint32_t column);
+    int64_t GetInt64(uint32_t column);
+    uint64_t GetUInt64(uint32_t column);
+    double GetDouble(uint32_t column);
+    string GetString(uint32_t column);
 
   private:
+    // 按值绑定的参数
+    struct ParamValue {
+        union {
+            long long int_value;
+            double double_value;
+        };
+        BindBool is_null;
+    };
+    // 结果列的接收缓冲区，整数列收成 LONGLONG，浮点列收成 DOUBLE，其他列收成字符串
+    struct ResultColumn {
+        long long int_value = 0;
+        double double_value = 0;
+        vector<char> buffer;
+        unsigned long length = 0;
+        BindBool is_null = 0;
+        BindBool error = 0;
+    };
+
+    bool Prepare();
+    bool Execute();
+    bool BindResult();
+    void FreeResult();
+    MYSQL_BIND *GetParamBind(uint32_t index);
+    ResultColumn *GetColumn(uint32_t column);
+
+    MYSQL *mysql_;
+    string sql_;
+    const char *pool_name_ = "";
+    string fingerprint_;            // 第一次执行时计算
     MYSQL_STMT *stmt_;
     MYSQL_BIND *param_bind_;
     uint32_t param_cnt_;
+    vector<ParamValue> param_values_;
+
+    vector<MYSQL_BIND> result_bind_;
+    vector<ResultColumn> result_columns_;
+    bool has_result_ = false;       // 有未释放的结果
+    int row_num_ = 0;
 };
 
 class CDBPool;
 
-class CDBConn {
+// 批量插入方式
+enum BulkInsertMode {
+    BULK_INSERT_PREPARED = 0,   // 多行预处理语句，按连接缓存，参数二进制绑定，日常小批量用
+    BULK_INSERT_LOAD_DATA = 1,  // LOAD DATA LOCAL INFILE 流式导入，积压很多时用，需要服务端开启 local_infile，
+                                // 并且连接池配置了 <pool>_local_infile=1
+};
+
+class CDBConn : public PooledConn {
   public:
     CDBConn(CDBPool *pDBPool);
     virtual ~CDBConn();
     int Init();
+    // 连接池取出连接时检查：上一条语句断线失败，或空闲超时且 ping 不通时返回false
+    bool IsAlive(bool idle_expired);
 
     // 创建表
     bool ExecuteCreate(const char *sql_query);
     // 删除表
     bool ExecuteDrop(const char *sql_query);
-    // 查询
+    // 查询，结果全部取到客户端
     CResultSet *ExecuteQuery(const char *sql_query);
+    // 流式查询（mysql_use_result），边从服务端读边处理，大结果集不用一次放进内存
+    // 结果集 delete 之前这个连接不能执行其他语句；Next 返回 false 后用 HasError 判断是否读完
+    // 语句统计只记录到服务端开始返回行为止，行数记为0
+    CResultSet *ExecuteQueryStream(const char *sql_query);
 
     bool ExecutePassQuery(const char *sql_query);
     /**
@@ -84,6 +274,20 @@ class CDBConn {
      */
     bool ExecuteUpdate(const char *sql_query, bool care_affected_rows = true);
     uint32_t GetInsertId();
+    /**
+     *  批量插入，值不拼进SQL，不需要转义
+     *
+     *  @param table     表名
+     *  @param columns   列名
+     *  @param rows      每行的值，与 columns 一一对应
+     *  @param mode      批量插入方式
+     *  @param ignore_duplicates  true 时唯一键重复的行被跳过；false 时有重复行整批失败，什么也不插入（两种方式相同）
+     *
+     *  @return 成功返回实际插入的行数，失败返回-1
+     */
+    int BulkInsert(const string &table, const vector<string> &columns,
+                   const vector<vector<string>> &rows, BulkInsertMode mode,
+                   bool ignore_duplicates = true);
 
     // 开启事务
     bool StartTransaction();
@@ -91,30 +295,67 @@ class CDBConn {
     bool Commit();
     // 回滚事务
     bool Rollback();
+    /**
+     *  取连接缓存的预处理语句，没有则 prepare 并缓存（按 SQL 文本 LRU，最多 DB_STMT_CACHE_SIZE 条）
+     *  同一条 SQL 在这个连接上只解析一次，之后每次执行只发送参数
+     *
+     *  @param sql     带 ? 占位符的 SQL
+     *
+     *  @return 语句归连接所有，不要 delete，连接归还后不要再使用；prepare 失败返回NULL
+     */
+    CPrepareStatement *GetStatement(const string &sql);
+
     // 获取连接池名
     const char *GetPoolName();
     MYSQL *GetMysql() { return mysql_; }
     int GetRowNum() { return row_num; }
 
   private:
+    int BulkInsertPrepared(const string &table, const vector<string> &columns,
+                           const vector<vector<string>> &rows, bool ignore_duplicates);
+    int BulkInsertLoadData(const string &table, const vector<string> &columns,
+                           const vector<vector<string>> &rows, bool ignore_duplicates);
+    // 语句执行失败后从缓存中去掉，下次重新 prepare
+    void EvictStatement(const string &sql);
+
     int row_num = 0;
     CDBPool *db_pool_; // to get MySQL server information
     MYSQL *mysql_;     // 对应一个连接
     char escape_string_[MAX_ESCAPE_STRING_LEN + 1];
+    // 预处理语句缓存：SQL -> 语句，链表头是最近用过的
+    // 连接断开后连接池会新建 CDBConn，新连接的缓存是空的，语句在第一次使用时重新 prepare
+    typedef list<pair<string, CPrepareStatement *>> StmtList;
+    StmtList stmt_lru_;
+    unordered_map<string, StmtList::iterator> stmt_cache_;
+};
+
+// 预处理语句缓存统计，定时导出监控指标用
+struct DBStmtStats {
+    string name;
+    uint64_t lookups = 0;   // GetStatement 次数
+    uint64_t prepares = 0;  // 未命中缓存、向服务端发送 prepare 的次数
 };
 
 class CDBPool { // 只是负责管理连接CDBConn，真正干活的是CDBConn
   public:
-    CDBPool() {
-    } // 如果在构造函数做一些可能失败的操作，需要抛出异常，外部要捕获异常
     CDBPool(const char *pool_name, const char *db_server_ip,
             uint16_t db_server_port, const char *username, const char *password,
-            const char *db_name, int max_conn_cnt);
+            const char *db_name, int max_conn_cnt,
+            const ConnPoolOptions &options = ConnPoolOptions());
     virtual ~CDBPool();
 
     int Init(); // 连接数据库，创建连接
     CDBConn *GetDBConn(const int timeout_ms = 0); // 获取连接资源
     void RelDBConn(CDBConn *pConn);               // 归还连接资源
+    ConnPoolStats GetStats() { return pool_->GetStats(); }
+    DBStmtStats GetStmtStats();
+    // 以下由 CDBConn::GetStatement 调用
+    void AddStmtLookup(bool prepared) {
+        stmt_lookups_++;
+        if (prepared) {
+            stmt_prepares_++;
+        }
+    }
 
     const char *GetPoolName() { return pool_name_.c_str(); }
     const char *GetDBServerIP() { return db_server_ip_.c_str(); }
@@ -122,6 +363,9 @@ class CDBPool { // 只是负责管理连接CDBConn，真正干活的是CDBConn
     const char *GetUsername() { return username_.c_str(); }
     const char *GetPasswrod() { return password_.c_str(); }
     const char *GetDBName() { return db_name_.c_str(); }
+    // 允许这个池的连接执行 LOAD DATA LOCAL INFILE（连接时声明 CLIENT_LOCAL_FILES），需要在 Init 之前设置
+    void SetLocalInfile(bool local_infile) { local_infile_ = local_infile; }
+    bool GetLocalInfile() { return local_infile_; }
 
   private:
     string pool_name_;          // 连接池名称
@@ -130,14 +374,11 @@ class CDBPool { // 只是负责管理连接CDBConn，真正干活的是CDBConn
     string username_;           // 用户名
     string password_;           // 用户密码
     string db_name_;            // db名称
-    int db_cur_conn_cnt_;       // 当前启用的连接数量
-    int db_max_conn_cnt_;       // 最大连接数量
-    list<CDBConn *> free_list_; // 空闲的连接
-
-    list<CDBConn *> used_list_; // 记录已经被请求的连接
-    std::mutex mutex_;
-    std::condition_variable cond_var_;
-    bool abort_request_ = false;
+    bool local_infile_ = false;
+
+    std::unique_ptr<ConnPool<CDBConn>> pool_; // 线程缓存 + 共享空闲栈，见 conn_pool.h
+    std::atomic<uint64_t> stmt_lookups_{0};
+    std::atomic<uint64_t> stmt_prepares_{0};
 };
 
 // manage db pool (master for write and slave for read)
@@ -152,6 +393,12 @@ class CDBManager {
 
     CDBConn *GetDBConn(const char *dbpool_name);
     void RelDBConn(CDBConn *pConn);
+    // 没有这个连接池时返回NULL
+    CDBPool *GetDBPool(const char *dbpool_name);
+    // 各连接池的连接数、取连接统计，定时导出监控指标用
+    void GetPoolStats(vector<ConnPoolStats> &stats);
+    // 各连接池的预处理语句缓存统计
+    void GetStmtStats(vector<DBStmtStats> &stats);
 
   private:
     CDBManager();
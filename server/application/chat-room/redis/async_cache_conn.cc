@@ -0,0 +1,246 @@
+#include "async_cache_conn.h"
+
+#include <algorithm>
+
+#include "async_muduo_adapter.h"
+#include "muduo/base/Logging.h"
+
+static const double kMinReconnectDelaySeconds = 0.1;
+static const double kMaxReconnectDelaySeconds = 5.0;
+
+// Configure 设置的 Redis 地址，分片时每个分片一项，顺序和 CacheManager::GetShardPools 一致
+struct AsyncCacheEndpoint {
+    string host;
+    int port;
+    string password;
+    int db_index;
+};
+static string s_async_pool_name;
+static vector<AsyncCacheEndpoint> s_async_endpoints;
+
+static thread_local vector<AsyncCacheConn *> t_async_cache_conns;
+
+AsyncCacheConn::AsyncCacheConn(muduo::net::EventLoop *loop, const string &host, int port, const string &password,
+                               int db_index)
+    : loop_(loop), reconnect_delay_(kMinReconnectDelaySeconds), host_(host), port_(port), password_(password),
+      db_index_(db_index) {
+    loop_->runInLoop([this]() { Connect(); });
+}
+
+AsyncCacheConn::~AsyncCacheConn() {
+    if (ac_) {
+        ac_->data = nullptr;    // 释放时 hiredis 会回调 disconnect，不再访问本对象
+        redisAsyncFree(ac_);
+        ac_ = nullptr;
+    }
+}
+
+void AsyncCacheConn::Configure(const string &pool_name) {
+    vector<CachePool *> pools;
+    CacheManager::getInstance()->GetShardPools(pool_name.c_str(), pools);
+    s_async_endpoints.clear();
+    for (CachePool *pool : pools) {
+        s_async_endpoints.push_back({pool->GetServerIP(), pool->GetServerPort(), pool->GetPassword(),
+                                     pool->GetDBIndex()});
+    }
+    s_async_pool_name = pool_name;
+}
+
+void AsyncCacheConn::InitForLoop(muduo::net::EventLoop *loop) {
+    // 连接和 loop 一样存活到进程退出
+    for (const AsyncCacheEndpoint &endpoint : s_async_endpoints) {
+        t_async_cache_conns.push_back(
+            new AsyncCacheConn(loop, endpoint.host, endpoint.port, endpoint.password, endpoint.db_index));
+    }
+}
+
+AsyncCacheConn *AsyncCacheConn::ForCurrentLoop(std::string_view shard_key) {
+    if (t_async_cache_conns.empty()) {
+        return nullptr;
+    }
+    if (t_async_cache_conns.size() == 1) {
+        return t_async_cache_conns[0];
+    }
+    int index = CacheManager::getInstance()->GetShardIndex(s_async_pool_name.c_str(), shard_key);
+    return index >= 0 && static_cast<size_t>(index) < t_async_cache_conns.size() ? t_async_cache_conns[index]
+                                                                                 : nullptr;
+}
+
+void AsyncCacheConn::Connect() {
+    ac_ = redisAsyncConnect(host_.c_str(), port_);
+    if (!ac_ || ac_->err) {
+        LOG_ERROR << "async redis connect failed: " << (ac_ ? ac_->errstr : "alloc failed");
+        if (ac_) {
+            redisAsyncFree(ac_);
+            ac_ = nullptr;
+        }
+        ScheduleReconnect();
+        return;
+    }
+    ac_->data = this;
+    RedisMuduoAdapter::Attach(loop_, ac_);
+    redisAsyncSetConnectCallback(ac_, &AsyncCacheConn::OnConnect);
+    redisAsyncSetDisconnectCallback(ac_, &AsyncCacheConn::OnDisconnect);
+
+    // 认证和选库先写进输出缓冲，连上后和其他命令一起按顺序发出
+    auto log_error = [](const char *command) {
+        return [command](const redisReply *reply) {
+            if (reply && reply->type == REDIS_REPLY_ERROR) {
+                LOG_ERROR << "async redis " << command << " failed: " << reply->str;
+            }
+        };
+    };
+    if (!password_.empty()) {
+        SendCommand({"AUTH", password_}, log_error("AUTH"));
+    }
+    if (db_index_ != 0) {
+        SendCommand({"SELECT", std::to_string(db_index_)}, log_error("SELECT"));
+    }
+}
+
+void AsyncCacheConn::ScheduleReconnect() {
+    if (reconnect_pending_) {
+        return;
+    }
+    reconnect_pending_ = true;
+    double delay = reconnect_delay_;
+    reconnect_delay_ = std::min(reconnect_delay_ * 2, kMaxReconnectDelaySeconds);
+    loop_->runAfter(delay, [this]() {
+        reconnect_pending_ = false;
+        if (!ac_) {
+            Connect();
+        }
+    });
+}
+
+void AsyncCacheConn::OnConnect(const redisAsyncContext *ac, int status) {
+    AsyncCacheConn *conn = static_cast<AsyncCacheConn *>(ac->data);
+    if (!conn) {
+        return;
+    }
+    if (status != REDIS_OK) {
+        // 连接失败时 hiredis 会释放 context，不再回调 disconnect
+        LOG_ERROR << "async redis connect failed: " << ac->errstr;
+        conn->ac_ = nullptr;
+        conn->ScheduleReconnect();
+        return;
+    }
+    conn->connected_ = true;
+    conn->reconnect_delay_ = kMinReconnectDelaySeconds;
+    LOG_INFO << "async redis connected: " << conn->host_ << ":" << conn->port_;
+}
+
+void AsyncCacheConn::OnDisconnect(const redisAsyncContext *ac, int status) {
+    AsyncCacheConn *conn = static_cast<AsyncCacheConn *>(ac->data);
+    if (!conn) {
+        return;
+    }
+    LOG_WARN << "async redis disconnected: " << (status == REDIS_OK ? "by user" : ac->errstr);
+    conn->ac_ = nullptr;    // context 由 hiredis 释放，未完成的命令已经以 NULL 回复回调
+    conn->connected_ = false;
+    conn->ScheduleReconnect();
+}
+
+void AsyncCacheConn::OnReply(redisAsyncContext *ac, void *reply, void *privdata) {
+    (void)ac;
+    ReplyCallback *callback = static_cast<ReplyCallback *>(privdata);
+    (*callback)(static_cast<redisReply *>(reply));
+    delete callback;
+}
+
+void AsyncCacheConn::SendCommand(const vector<string> &args, ReplyCallback callback) {
+    if (!ac_) {
+        callback(nullptr);      // 等待重连，直接失败
+        return;
+    }
+    vector<const char *> argv;
+    vector<size_t> argvlen;
+    argv.reserve(args.size());
+    argvlen.reserve(args.size());
+    for (const string &arg : args) {
+        argv.push_back(arg.data());
+        argvlen.push_back(arg.size());
+    }
+    ReplyCallback *privdata = new ReplyCallback(std::move(callback));
+    if (redisAsyncCommandArgv(ac_, &AsyncCacheConn::OnReply, privdata, static_cast<int>(args.size()), argv.data(),
+                              argvlen.data()) != REDIS_OK) {
+        (*privdata)(nullptr);
+        delete privdata;
+    }
+}
+
+void AsyncCacheConn::CommandArgv(const vector<std::string_view> &args, ReplyCallback callback) {
+    vector<string> owned_args(args.begin(), args.end());
+    if (loop_->isInLoopThread()) {
+        SendCommand(owned_args, std::move(callback));
+    } else {
+        loop_->queueInLoop([this, owned_args = std::move(owned_args), callback = std::move(callback)]() mutable {
+            SendCommand(owned_args, std::move(callback));
+        });
+    }
+}
+
+void AsyncCacheConn::Get(std::string_view key, StringCallback callback) {
+    CommandArgv({"GET", key}, [callback = std::move(callback)](const redisReply *reply) {
+        if (!reply || reply->type == REDIS_REPLY_ERROR) {
+            callback(-1, "");
+        } else if (reply->type == REDIS_REPLY_NIL) {
+            callback(1, "");
+        } else {
+            callback(0, string(reply->str, reply->len));
+        }
+    });
+}
+
+void AsyncCacheConn::SetEx(std::string_view key, int timeout, std::string_view value, StringCallback callback) {
+    string timeout_str = std::to_string(timeout);
+    CommandArgv({"SETEX", key, timeout_str, value}, [callback = std::move(callback)](const redisReply *reply) {
+        if (!reply || reply->type == REDIS_REPLY_ERROR) {
+            callback(-1, "");
+        } else {
+            callback(0, string(reply->str, reply->len));
+        }
+    });
+}
+
+void AsyncCacheConn::Xadd(std::string_view key, std::string_view id,
+                          const vector<std::pair<std::string_view, std::string_view>> &field_value_pairs,
+                          StringCallback callback) {
+    vector<std::string_view> args = {"XADD", key, id};
+    for (const auto &pair : field_value_pairs) {
+        args.push_back(pair.first);
+        args.push_back(pair.second);
+    }
+    CommandArgv(args, [callback = std::move(callback)](const redisReply *reply) {
+        if (!reply || reply->type != REDIS_REPLY_STRING) {
+            if (reply && reply->type == REDIS_REPLY_ERROR) {
+                LOG_ERROR << "async XADD failed: " << reply->str;
+            }
+            callback(-1, "");
+        } else {
+            callback(0, string(reply->str, reply->len));
+        }
+    });
+}
+
+void AsyncCacheConn::Xrevrange(std::string_view key, std::string_view start, std::string_view end, int count,
+                               StreamCallback callback) {
+    string count_str = std::to_string(count);
+    vector<std::string_view> args = {"XREVRANGE", key, start, end};
+    if (count > 0) {
+        args.push_back("COUNT");
+        args.push_back(count_str);
+    }
+    CommandArgv(args, [callback = std::move(callback)](const redisReply *reply) {
+        vector<StreamEntry> entries;
+        if (!reply || reply->type != REDIS_REPLY_ARRAY) {
+            if (reply && reply->type == REDIS_REPLY_ERROR) {
+                LOG_ERROR << "async XREVRANGE failed: " << reply->str;
+            }
+            callback(-1, entries);
+            return;
+        }
+        ParseStreamEntries(reply, entries);
+        callback(0, entries);
+    });
+}
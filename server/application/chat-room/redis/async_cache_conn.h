@@ -0,0 +1,74 @@
+#ifndef ASYNC_CACHE_CONN_H_
+#define ASYNC_CACHE_CONN_H_
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "async.h"
+#include "cache_pool.h"
+#include "muduo/net/EventLoop.h"
+
+// 挂在 muduo EventLoop 上的 Redis 异步连接，每个 IO loop 一个：
+//  - loop 内所有请求复用同一个连接，命令写进输出缓冲后由 loop 一起发出，回复按顺序回调（多路复用 + 自动管道）
+//  - 命令只在 loop 线程发出，回调也在 loop 线程执行，不占用 loop 线程等待网络
+//  - 断线后按 0.1s、0.2s … 最长 5s 退避重连；断线期间的命令直接回调失败，调用方可以改走同步连接池
+// 连接挂在 RedisMuduoAdapter 上，和房间广播总线用的是同一个适配器
+class AsyncCacheConn {
+  public:
+    // reply 在回调返回后释放；出错、断线时为 NULL
+    typedef std::function<void(const redisReply *reply)> ReplyCallback;
+    // ret: 0 成功，1 key 不存在，-1 失败
+    typedef std::function<void(int ret, const string &value)> StringCallback;
+    typedef std::function<void(int ret, vector<StreamEntry> &entries)> StreamCallback;
+
+    AsyncCacheConn(muduo::net::EventLoop *loop, const string &host, int port, const string &password,
+                   int db_index);
+    ~AsyncCacheConn();
+
+    // 使用同步连接池 pool_name 的 Redis 地址（分片时每个分片一个连接）；设置后 InitForLoop 才会创建连接
+    static void Configure(const string &pool_name);
+    // 在 IO loop 线程启动时调用（TcpServer 的 threadInitCallback），为该 loop 创建连接
+    static void InitForLoop(muduo::net::EventLoop *loop);
+    // 当前 loop 线程上 shard_key（房间ID）所在分片的连接，和 CacheManager::GetCacheConn 选的分片一致
+    // 没有配置或不是 IO loop 线程时返回NULL
+    static AsyncCacheConn *ForCurrentLoop(std::string_view shard_key);
+
+    // 已经连上，可以发命令；只在 loop 线程调用
+    bool IsConnected() const { return connected_; }
+
+    // 以下可以在任意线程调用，不在 loop 线程时转到 loop 线程执行；参数在调用时拷贝
+    void CommandArgv(const vector<std::string_view> &args, ReplyCallback callback);
+    void Get(std::string_view key, StringCallback callback);
+    void SetEx(std::string_view key, int timeout, std::string_view value, StringCallback callback);
+    // id 为 "*" 时由 Redis 分配，回调的 value 为最终的消息ID
+    void Xadd(std::string_view key, std::string_view id,
+              const vector<std::pair<std::string_view, std::string_view>> &field_value_pairs,
+              StringCallback callback);
+    // entries 按从新到旧排列
+    void Xrevrange(std::string_view key, std::string_view start, std::string_view end, int count,
+                   StreamCallback callback);
+
+  private:
+    void Connect();
+    void ScheduleReconnect();
+    void SendCommand(const vector<string> &args, ReplyCallback callback);
+
+    static void OnConnect(const redisAsyncContext *ac, int status);
+    static void OnDisconnect(const redisAsyncContext *ac, int status);
+    static void OnReply(redisAsyncContext *ac, void *reply, void *privdata);
+
+    muduo::net::EventLoop *loop_;
+    redisAsyncContext *ac_ = nullptr;   // 断线后由 hiredis 释放，置空
+    bool connected_ = false;
+    double reconnect_delay_;            // 下次重连前等待的秒数，连上后复位
+    bool reconnect_pending_ = false;
+
+    string host_;
+    int port_;
+    string password_;
+    int db_index_;
+};
+
+#endif /* ASYNC_CACHE_CONN_H_ */
@@ -0,0 +1,76 @@
+#include "async_muduo_adapter.h"
+
+int RedisMuduoAdapter::Attach(muduo::net::EventLoop *loop, redisAsyncContext *ac) {
+    if (ac->ev.data != NULL) {
+        return -1;
+    }
+
+    RedisMuduoAdapter *adapter = new RedisMuduoAdapter(loop, ac);
+    ac->ev.addRead = RedisMuduoAdapter::AddRead;
+    ac->ev.delRead = RedisMuduoAdapter::DelRead;
+    ac->ev.addWrite = RedisMuduoAdapter::AddWrite;
+    ac->ev.delWrite = RedisMuduoAdapter::DelWrite;
+    ac->ev.cleanup = RedisMuduoAdapter::Cleanup;
+    ac->ev.data = adapter;
+    return 0;
+}
+
+RedisMuduoAdapter::RedisMuduoAdapter(muduo::net::EventLoop *loop, redisAsyncContext *ac)
+    : loop_(loop), ac_(ac), channel_(new muduo::net::Channel(loop, ac->c.fd)) {
+    channel_->setReadCallback(std::bind(&RedisMuduoAdapter::HandleRead, this));
+    channel_->setWriteCallback(std::bind(&RedisMuduoAdapter::HandleWrite, this));
+    // 对端关闭或出错时读一次，由 hiredis 自己发现连接断开并回调 disconnect
+    channel_->setCloseCallback(std::bind(&RedisMuduoAdapter::HandleRead, this));
+    channel_->setErrorCallback(std::bind(&RedisMuduoAdapter::HandleRead, this));
+}
+
+void RedisMuduoAdapter::AddRead(void *privdata) {
+    RedisMuduoAdapter *adapter = static_cast<RedisMuduoAdapter *>(privdata);
+    if (!adapter->channel_->isReading()) {
+        adapter->channel_->enableReading();
+    }
+}
+
+void RedisMuduoAdapter::DelRead(void *privdata) {
+    RedisMuduoAdapter *adapter = static_cast<RedisMuduoAdapter *>(privdata);
+    if (adapter->channel_->isReading()) {
+        adapter->channel_->disableReading();
+    }
+}
+
+void RedisMuduoAdapter::AddWrite(void *privdata) {
+    RedisMuduoAdapter *adapter = static_cast<RedisMuduoAdapter *>(privdata);
+    if (!adapter->channel_->isWriting()) {
+        adapter->channel_->enableWriting();
+    }
+}
+
+void RedisMuduoAdapter::DelWrite(void *privdata) {
+    RedisMuduoAdapter *adapter = static_cast<RedisMuduoAdapter *>(privdata);
+    if (adapter->channel_->isWriting()) {
+        adapter->channel_->disableWriting();
+    }
+}
+
+void RedisMuduoAdapter::Cleanup(void *privdata) {
+    RedisMuduoAdapter *adapter = static_cast<RedisMuduoAdapter *>(privdata);
+    adapter->ac_ = NULL;
+    if (!adapter->channel_->isNoneEvent()) {
+        adapter->channel_->disableAll();
+    }
+    adapter->channel_->remove();
+    // cleanup 可能发生在本 Channel 的事件回调里，延后到事件处理完再释放
+    adapter->loop_->queueInLoop([adapter]() { delete adapter; });
+}
+
+void RedisMuduoAdapter::HandleRead() {
+    if (ac_) {
+        redisAsyncHandleRead(ac_);
+    }
+}
+
+void RedisMuduoAdapter::HandleWrite() {
+    if (ac_) {
+        redisAsyncHandleWrite(ac_);
+    }
+}
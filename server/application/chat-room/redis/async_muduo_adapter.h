@@ -0,0 +1,37 @@
+#ifndef ASYNC_MUDUO_ADAPTER_H_
+#define ASYNC_MUDUO_ADAPTER_H_
+
+#include <memory>
+
+#include "async.h"
+#include "muduo/net/Channel.h"
+#include "muduo/net/EventLoop.h"
+
+// hiredis 异步连接的 muduo 适配器，作用和 hiredis 自带的 adapters/libevent.h 一样：
+// 用一个 Channel 监听 redis 连接的 fd，hiredis 需要读写时打开对应事件，事件到来时交给 redisAsyncHandleRead/Write
+// 只能在 loop 线程内使用；redisAsyncFree 时 hiredis 回调 cleanup，适配器随之销毁
+class RedisMuduoAdapter {
+  public:
+    // 成功返回0，该连接已经挂过事件库返回-1
+    static int Attach(muduo::net::EventLoop *loop, redisAsyncContext *ac);
+
+  private:
+    RedisMuduoAdapter(muduo::net::EventLoop *loop, redisAsyncContext *ac);
+    ~RedisMuduoAdapter() {}
+
+    // hiredis 的事件钩子
+    static void AddRead(void *privdata);
+    static void DelRead(void *privdata);
+    static void AddWrite(void *privdata);
+    static void DelWrite(void *privdata);
+    static void Cleanup(void *privdata);
+
+    void HandleRead();
+    void HandleWrite();
+
+    muduo::net::EventLoop *loop_;
+    redisAsyncContext *ac_;     // cleanup 之后为空
+    std::unique_ptr<muduo::net::Channel> channel_;
+};
+
+#endif /* ASYNC_MUDUO_ADAPTER_H_ */
@@ -3,11 +3,12 @@
 #include "util.h"
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
+#include <openssl/sha.h>
 #define log_error printf
 #define log_info printf
 #define log_warn printf
 // #define log printf
-#define MIN_CACHE_CONN_CNT 2
 #define MAX_CACHE_CONN_FAIL_NUM 10
 
 #include "muduo/base/Logging.h"
@@ -74,6 +75,7 @@ int CacheConn::Init() {
 
     // 1000ms超时
     struct timeval timeout = {0, 1000000};
+    conn_command_generation_ = 0; // 新连接上没有执行过连接级命令
     // 建立连接后使用 redisContext 来保存连接状态。
     // redisContext 在每次操作后会修改其中的 err 和  errstr
     // 字段来表示发生的错误码（大于0）和对应的描述。
@@ -829,6 +831,51 @@ END:
 
 
 
+redisReply *CacheConn::CommandArgv(const std::string_view *args, size_t argc) {
+    if (Init()) {
+        return NULL;
+    }
+    argv_.clear();
+    argvlen_.clear();
+    for (size_t i = 0; i < argc; i++) {
+        argv_.push_back(args[i].data());
+        argvlen_.push_back(args[i].size());
+    }
+    redisReply *reply = (redisReply *)redisCommandArgv(context_, static_cast<int>(argc), argv_.data(), argvlen_.data());
+    if (!reply) {
+        log_error("redisCommand failed:%s\n", context_->errstr);
+        redisFree(context_);
+        context_ = NULL;
+    }
+    return reply;
+}
+
+// 解析 stream 消息数组: [[id, [field, value, ...]], ...]
+void ParseStreamEntries(const redisReply *items, vector<StreamEntry> &entries) {
+    if (items->type != REDIS_REPLY_ARRAY) {
+        return;
+    }
+    entries.reserve(entries.size() + items->elements);
+    for (size_t j = 0; j < items->elements; j++) {
+        redisReply *item = items->element[j];
+        if (item->type != REDIS_REPLY_ARRAY || item->elements < 2) {
+            continue;
+        }
+        StreamEntry entry;
+        entry.id.assign(item->element[0]->str, item->element[0]->len);
+        redisReply *fields = item->element[1];
+        // 已经被删除（裁剪）的待确认消息，字段为 nil
+        if (fields->type == REDIS_REPLY_ARRAY) {
+            entry.fields.reserve(fields->elements / 2);
+            for (size_t k = 0; k + 1 < fields->elements; k += 2) {
+                entry.fields.emplace_back(string(fields->element[k]->str, fields->element[k]->len),
+                                          string(fields->element[k + 1]->str, fields->element[k + 1]->len));
+            }
+        }
+        entries.push_back(std::move(entry));
+    }
+}
+
 // 获取消息队列相关命令
 /**
  * key ：队列名
@@ -836,95 +883,354 @@ END:
     start ：开始值， - 表示最小值
     count ：数量
     */
-//    XREVRANGE mystream + -
-// XREVRANGE 程序员老廖2 + -
-// XREVRANGE 程序员老廖 + -
-bool  CacheConn::GetXrevrange(const string & key, 
-    const string start, const string end, int count, std::vector<std::pair<string, string>> &msgs) {
-    if (Init()) {
+//    XREVRANGE mystream + - COUNT 30
+bool CacheConn::GetXrevrange(std::string_view key, std::string_view start, std::string_view end, int count,
+                             vector<StreamEntry> &entries) {
+    string count_str = std::to_string(count);
+    redisReply *reply = count > 0 ? CommandArgv({"XREVRANGE", key, start, end, "COUNT", count_str})
+                                  : CommandArgv({"XREVRANGE", key, start, end});
+    if (!reply) {
         return false;
-    }    
-    // 构建 XREVRANGE 命令
-    string  command = "XREVRANGE " + key + " " + start  + " " + end;
-    if (count > 0) {
-        command += " COUNT " + std::to_string(count);
-    }
-    // 发送命令
-    redisReply* reply = (redisReply*)redisCommand(context_, command.c_str());
+    }
+    if (reply->type != REDIS_REPLY_ARRAY) {
+        log_error("XREVRANGE failed:%s\n", reply->type == REDIS_REPLY_ERROR ? reply->str : "unexpected reply");
+        freeReplyObject(reply);
+        return false;
+    }
+    ParseStreamEntries(reply, entries);
+    freeReplyObject(reply);
+    return true;
+}
+
+bool CacheConn::Xadd(std::string_view key, string &id,
+                     const vector<std::pair<std::string_view, std::string_view>> &field_value_pairs) {
+    // XADD key id field value ...
+    std::string_view args[64];
+    size_t argc = 0;
+    args[argc++] = "XADD";
+    args[argc++] = key;
+    args[argc++] = id;
+    for (const auto &pair : field_value_pairs) {
+        if (argc + 2 > sizeof(args) / sizeof(args[0])) {
+            log_error("XADD too many fields:%zu\n", field_value_pairs.size());
+            return false;
+        }
+        args[argc++] = pair.first;
+        args[argc++] = pair.second;
+    }
+    redisReply *reply = CommandArgv(args, argc);
     if (!reply) {
-        std::cerr << "Failed to execute XREVRANGE command" << std::endl;
         return false;
     }
+    if (reply->type != REDIS_REPLY_STRING) {
+        log_error("XADD failed:%s\n", reply->type == REDIS_REPLY_ERROR ? reply->str : "unexpected reply");
+        freeReplyObject(reply);
+        return false;
+    }
+    id.assign(reply->str, reply->len);
+    freeReplyObject(reply);
+    return true;
+}
+
+bool CacheConn::XreadGroup(const string &group, const string &consumer, const vector<string> &keys,
+                           const string &start_id, int count, map<string, vector<StreamEntry>> &entries) {
+    if (keys.empty()) {
+        return true;
+    }
 
-    // 检查回复类型
+    // XREADGROUP GROUP group consumer COUNT n STREAMS key1 key2 ... id1 id2 ...
+    string count_str = std::to_string(count);
+    vector<std::string_view> args = {"XREADGROUP", "GROUP", group, consumer, "COUNT", count_str, "STREAMS"};
+    args.insert(args.end(), keys.begin(), keys.end());
+    args.insert(args.end(), keys.size(), start_id);
+    redisReply *reply = CommandArgv(args.data(), args.size());
+    if (!reply) {
+        return false;
+    }
+    if (reply->type == REDIS_REPLY_NIL) {   // 没有新消息
+        freeReplyObject(reply);
+        return true;
+    }
     if (reply->type != REDIS_REPLY_ARRAY) {
-        std::cerr << "Unexpected reply type: " << reply->type << std::endl;
+        log_error("XREADGROUP failed:%s\n", reply->type == REDIS_REPLY_ERROR ? reply->str : "unexpected reply");
         freeReplyObject(reply);
         return false;
     }
 
-    // 解析回复
+    // 回复格式: [[key, [[id, [field, value, ...]], ...]], ...]
     for (size_t i = 0; i < reply->elements; i++) {
-        redisReply* entry = reply->element[i];
-        if (entry->type == REDIS_REPLY_ARRAY && entry->elements >= 2) {
-            // 第一个元素是消息 ID
-            string  message_id = entry->element[0]->str;
-            
-            // 第二个元素是消息内容（字段-值对）
-            redisReply* fields = entry->element[1];
-            if (fields->type == REDIS_REPLY_ARRAY) {
-                string  message_content;
-                 string  value;
-                for (size_t j = 0; j < fields->elements; j += 2) {
-                    string  field = fields->element[j]->str;
-                    value = fields->element[j + 1]->str;
-                     message_content += field + ": " + value + ", ";
-                }
-                // LOG_INFO << string( "key: " + key + ", ID: " + message_id + ", Content: " + message_content);
-                msgs.push_back({message_id, value});
-            }
+        redisReply *stream = reply->element[i];
+        if (stream->type != REDIS_REPLY_ARRAY || stream->elements < 2) {
+            continue;
         }
+        ParseStreamEntries(stream->element[1],
+                           entries[string(stream->element[0]->str, stream->element[0]->len)]);
     }
 
-    // 释放回复对象
     freeReplyObject(reply);
     return true;
 }
 
-bool CacheConn::Xadd(const string& key,   string& id, const std::vector<std::pair<string, string>>& field_value_pairs)
-{
+bool CacheConn::Spop(const string &key, int count, vector<string> &members) {
+    if (Init()) {
+        return false;
+    }
+
+    redisReply *reply = (redisReply *)redisCommand(context_, "SPOP %b %d", key.data(), key.size(), count);
+    if (!reply) {
+        log_error("redisCommand failed:%s\n", context_->errstr);
+        redisFree(context_);
+        context_ = NULL;
+        return false;
+    }
+
+    bool ret = reply->type == REDIS_REPLY_ARRAY;
+    if (ret) {
+        for (size_t i = 0; i < reply->elements; i++) {
+            members.push_back(string(reply->element[i]->str, reply->element[i]->len));
+        }
+    }
+    freeReplyObject(reply);
+    return ret;
+}
+
+long CacheConn::Scard(const string &key) {
+    if (Init()) {
+        return -1;
+    }
+
+    redisReply *reply = (redisReply *)redisCommand(context_, "SCARD %b", key.data(), key.size());
+    if (!reply) {
+        log_error("redisCommand failed:%s\n", context_->errstr);
+        redisFree(context_);
+        context_ = NULL;
+        return -1;
+    }
+
+    long ret_value = reply->type == REDIS_REPLY_INTEGER ? reply->integer : -1;
+    freeReplyObject(reply);
+    return ret_value;
+}
+
+bool CacheConn::Info(const string &section, map<string, string> &fields) {
     if (Init()) {
         return false;
     }
-    // 构建 XADD 命令
-    string  command = "XADD " + key + " " + id;
 
-    // 添加字段-值对
-    for (const auto& pair : field_value_pairs) {
-        command += " " + pair.first + " " + pair.second;
+    redisReply *reply = (redisReply *)redisCommand(context_, "INFO %b", section.data(), section.size());
+    if (!reply) {
+        log_error("redisCommand failed:%s\n", context_->errstr);
+        redisFree(context_);
+        context_ = NULL;
+        return false;
     }
-    LOG_DEBUG << "command: " << command;
-    // 发送命令
-    redisReply* reply = (redisReply*)redisCommand(context_, command.c_str());
+
+    bool ret = false;
+    if (reply->type == REDIS_REPLY_STRING) {
+        // 每行 "字段:值"，以 # 开头的是 section 标题
+        string text(reply->str, reply->len);
+        size_t pos = 0;
+        while (pos < text.size()) {
+            size_t end = text.find("\r\n", pos);
+            if (end == string::npos) {
+                end = text.size();
+            }
+            string line = text.substr(pos, end - pos);
+            size_t colon = line.find(':');
+            if (!line.empty() && line[0] != '#' && colon != string::npos) {
+                fields[line.substr(0, colon)] = line.substr(colon + 1);
+            }
+            pos = end + 2;
+        }
+        ret = true;
+    }
+    freeReplyObject(reply);
+    return ret;
+}
+
+bool CacheConn::Smembers(const string &key, vector<string> &members) {
+    if (Init()) {
+        return false;
+    }
+
+    redisReply *reply = (redisReply *)redisCommand(context_, "SMEMBERS %b", key.data(), key.size());
     if (!reply) {
-        std::cerr << "Failed to execute XADD command" << std::endl;
+        log_error("redisCommand failed:%s\n", context_->errstr);
+        redisFree(context_);
+        context_ = NULL;
         return false;
     }
 
-    // 检查回复类型
-    if (reply->type == REDIS_REPLY_ERROR) {
-        std::cerr << "Error: " << reply->str << std::endl;
-        freeReplyObject(reply);
+    bool ret = reply->type == REDIS_REPLY_ARRAY;
+    if (ret) {
+        for (size_t i = 0; i < reply->elements; i++) {
+            members.push_back(string(reply->element[i]->str, reply->element[i]->len));
+        }
+    }
+    freeReplyObject(reply);
+    return ret;
+}
+
+static void ConvertReply(const redisReply *reply, CacheReply &result) {
+    result.type = reply->type;
+    switch (reply->type) {
+    case REDIS_REPLY_STRING:
+    case REDIS_REPLY_STATUS:
+    case REDIS_REPLY_ERROR:
+        result.str.assign(reply->str, reply->len);
+        break;
+    case REDIS_REPLY_INTEGER:
+        result.integer = reply->integer;
+        break;
+    case REDIS_REPLY_ARRAY:
+        result.elements.resize(reply->elements);
+        for (size_t i = 0; i < reply->elements; i++) {
+            ConvertReply(reply->element[i], result.elements[i]);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+CacheScript::CacheScript(const char *script_source) : source(script_source) {
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    SHA1(reinterpret_cast<const unsigned char *>(source.data()), source.size(), digest);
+    static const char kHex[] = "0123456789abcdef";
+    sha.reserve(SHA_DIGEST_LENGTH * 2);
+    for (unsigned char c : digest) {
+        sha.push_back(kHex[c >> 4]);
+        sha.push_back(kHex[c & 0x0f]);
+    }
+}
+
+static bool IsNoScriptReply(const CacheReply &reply) {
+    return reply.type == REDIS_REPLY_ERROR && reply.str.compare(0, 8, "NOSCRIPT") == 0;
+}
+
+bool CacheConn::Execute(CacheBatch &batch) {
+    batch.replies_.clear();
+    if (batch.Empty()) {
+        return true;
+    }
+    if (Init()) {
         return false;
     }
 
-    // 打印成功消息
-    std::cout << "Message added with ID: " << reply->str << std::endl;
-    id = reply->str;
-    // 释放回复对象
+    // 先把所有命令追加到输出缓冲，参数指向 batch 的连续缓冲
+    size_t arg_index = 0;
+    for (size_t argc : batch.cmd_argc_) {
+        if (!AppendBatchCommand(batch, arg_index, argc)) {
+            return false;
+        }
+        arg_index += argc;
+    }
+
+    // 第一次 redisGetReply 会把缓冲里的命令一起写出，之后按顺序读回复
+    batch.replies_.reserve(batch.Size());
+    for (size_t i = 0; i < batch.Size(); i++) {
+        batch.replies_.emplace_back();
+        if (!ReadBatchReply(batch.replies_.back())) {
+            batch.replies_.pop_back();
+            return false;
+        }
+        const CacheReply &reply = batch.replies_.back();
+        if (reply.type == REDIS_REPLY_ERROR && !IsNoScriptReply(reply)) {
+            log_error("batch command %zu failed:%s\n", i, reply.str.c_str());
+        }
+    }
+    return batch.scripts_.empty() || RetryNoScript(batch);
+}
+
+bool CacheConn::AppendBatchCommand(const CacheBatch &batch, size_t arg_index, size_t argc) {
+    argv_.clear();
+    argvlen_.clear();
+    for (size_t i = 0; i < argc; i++, arg_index++) {
+        argv_.push_back(batch.buf_.data() + batch.arg_offsets_[arg_index]);
+        argvlen_.push_back(batch.arg_lens_[arg_index]);
+    }
+    if (redisAppendCommandArgv(context_, static_cast<int>(argc), argv_.data(), argvlen_.data()) != REDIS_OK) {
+        log_error("redisAppendCommandArgv failed:%s\n", context_->errstr);
+        redisFree(context_);
+        context_ = NULL;
+        return false;
+    }
+    return true;
+}
+
+bool CacheConn::ReadBatchReply(CacheReply &out) {
+    redisReply *reply = NULL;
+    if (redisGetReply(context_, (void **)&reply) != REDIS_OK || !reply) {
+        log_error("redisGetReply failed:%s\n", context_->errstr);
+        redisFree(context_);    // 连接状态已经不确定，剩下的回复丢弃，重建连接
+        context_ = NULL;
+        return false;
+    }
+    ConvertReply(reply, out);
     freeReplyObject(reply);
     return true;
 }
+
+bool CacheConn::RetryNoScript(CacheBatch &batch) {
+    // NOSCRIPT 说明脚本没有执行，重发是安全的
+    vector<size_t> retry_cmds;
+    vector<const CacheScript *> reload_scripts;
+    for (const auto &script : batch.scripts_) {
+        if (!IsNoScriptReply(batch.replies_[script.first])) {
+            continue;
+        }
+        retry_cmds.push_back(script.first);
+        if (std::find(reload_scripts.begin(), reload_scripts.end(), script.second) == reload_scripts.end()) {
+            reload_scripts.push_back(script.second);
+        }
+    }
+    if (retry_cmds.empty()) {
+        return true;
+    }
+
+    for (const CacheScript *script : reload_scripts) {
+        const char *argv[] = {"SCRIPT", "LOAD", script->source.c_str()};
+        size_t argvlen[] = {6, 4, script->source.size()};
+        if (redisAppendCommandArgv(context_, 3, argv, argvlen) != REDIS_OK) {
+            log_error("redisAppendCommandArgv failed:%s\n", context_->errstr);
+            redisFree(context_);
+            context_ = NULL;
+            return false;
+        }
+    }
+    // 命令的参数在 buf_ 中按顺序存放，算出每条命令第一个参数的下标
+    vector<size_t> cmd_arg_index(batch.cmd_argc_.size());
+    size_t arg_index = 0;
+    for (size_t i = 0; i < batch.cmd_argc_.size(); i++) {
+        cmd_arg_index[i] = arg_index;
+        arg_index += batch.cmd_argc_[i];
+    }
+    for (size_t cmd : retry_cmds) {
+        if (!AppendBatchCommand(batch, cmd_arg_index[cmd], batch.cmd_argc_[cmd])) {
+            return false;
+        }
+    }
+
+    for (const CacheScript *script : reload_scripts) {
+        CacheReply reply;
+        if (!ReadBatchReply(reply)) {
+            return false;
+        }
+        if (reply.type == REDIS_REPLY_ERROR) {
+            log_error("SCRIPT LOAD %s failed:%s\n", script->sha.c_str(), reply.str.c_str());
+        }
+    }
+    for (size_t cmd : retry_cmds) {
+        if (!ReadBatchReply(batch.replies_[cmd])) {
+            return false;
+        }
+        if (batch.replies_[cmd].type == REDIS_REPLY_ERROR) {
+            log_error("batch command %zu failed:%s\n", cmd, batch.replies_[cmd].str.c_str());
+        }
+    }
+    return true;
+}
+
 bool CacheConn::FlushDb() {
     bool ret = false;
     if (Init()) {
@@ -948,135 +1254,226 @@ bool CacheConn::FlushDb() {
 
     return ret;
 }
+
+bool CacheConn::Ping() {
+    redisReply *reply = CommandArgv({"PING"});
+    if (!reply) {
+        return false;
+    }
+    bool ret = reply->type == REDIS_REPLY_STATUS;
+    freeReplyObject(reply);
+    if (!ret) {
+        DeInit();
+    }
+    return ret;
+}
+size_t CacheBatch::Command(const std::string_view *args, size_t argc) {
+    for (size_t i = 0; i < argc; i++) {
+        arg_offsets_.push_back(buf_.size());
+        arg_lens_.push_back(args[i].size());
+        buf_.append(args[i].data(), args[i].size());
+    }
+    cmd_argc_.push_back(argc);
+    return cmd_argc_.size() - 1;
+}
+
+size_t CacheBatch::SetEx(std::string_view key, int timeout, std::string_view value) {
+    string timeout_str = std::to_string(timeout);
+    return Command({"SETEX", key, timeout_str, value});
+}
+
+size_t CacheBatch::Expire(std::string_view key, int timeout) {
+    string timeout_str = std::to_string(timeout);
+    return Command({"EXPIRE", key, timeout_str});
+}
+
+size_t CacheBatch::ZsetAdd(std::string_view key, long score, std::string_view member) {
+    string score_str = std::to_string(score);
+    return Command({"ZADD", key, score_str, member});
+}
+
+size_t CacheBatch::Spop(std::string_view key, int count) {
+    string count_str = std::to_string(count);
+    return Command({"SPOP", key, count_str});
+}
+
+size_t CacheBatch::Xadd(std::string_view key, std::string_view id,
+                        const vector<std::pair<std::string_view, std::string_view>> &field_value_pairs) {
+    vector<std::string_view> args = {"XADD", key, id};
+    for (const auto &pair : field_value_pairs) {
+        args.push_back(pair.first);
+        args.push_back(pair.second);
+    }
+    return Command(args);
+}
+
+size_t CacheBatch::EvalSha(const CacheScript &script, std::initializer_list<std::string_view> keys,
+                           std::initializer_list<std::string_view> args) {
+    string numkeys = std::to_string(keys.size());
+    vector<std::string_view> argv;
+    argv.reserve(3 + keys.size() + args.size());
+    argv.push_back("EVALSHA");
+    argv.push_back(script.sha);
+    argv.push_back(numkeys);
+    argv.insert(argv.end(), keys.begin(), keys.end());
+    argv.insert(argv.end(), args.begin(), args.end());
+    size_t index = Command(argv);
+    scripts_.push_back({index, &script});
+    return index;
+}
+
+void CacheBatch::Clear() {
+    buf_.clear();
+    arg_offsets_.clear();
+    arg_lens_.clear();
+    cmd_argc_.clear();
+    replies_.clear();
+    scripts_.clear();
+}
+
+string CacheBatch::GetString(size_t index) const {
+    if (index >= replies_.size()) {
+        return "";
+    }
+    const CacheReply &reply = replies_[index];
+    if (reply.type == REDIS_REPLY_STRING || reply.type == REDIS_REPLY_STATUS) {
+        return reply.str;
+    }
+    if (reply.type == REDIS_REPLY_INTEGER) {
+        return std::to_string(reply.integer);
+    }
+    return "";
+}
+
+long long CacheBatch::GetInteger(size_t index) const {
+    if (index >= replies_.size()) {
+        return 0;
+    }
+    const CacheReply &reply = replies_[index];
+    if (reply.type == REDIS_REPLY_INTEGER) {
+        return reply.integer;
+    }
+    if (reply.type == REDIS_REPLY_STRING) {
+        return atoll(reply.str.c_str());
+    }
+    return 0;
+}
+
+bool CacheBatch::GetArray(size_t index, vector<string> &values) const {
+    if (index >= replies_.size() || replies_[index].type != REDIS_REPLY_ARRAY) {
+        return false;
+    }
+    for (const CacheReply &element : replies_[index].elements) {
+        values.push_back(element.str);
+    }
+    return true;
+}
+
+bool CacheBatch::GetHash(size_t index, map<string, string> &values) const {
+    if (index >= replies_.size() || replies_[index].type != REDIS_REPLY_ARRAY) {
+        return false;
+    }
+    const vector<CacheReply> &elements = replies_[index].elements;
+    for (size_t i = 0; i + 1 < elements.size(); i += 2) {
+        values[elements[i].str] = elements[i + 1].str;
+    }
+    return true;
+}
+
 ///////////////
 CachePool::CachePool(const char *pool_name, const char *server_ip,
                      int server_port, int db_index, const char *password,
-                     int max_conn_cnt) {
+                     int max_conn_cnt, const ConnPoolOptions &options) {
     pool_name_ = pool_name;
     server_ip_ = server_ip;
     m_server_port = server_port;
     db_index_ = db_index;
     password_ = password;
-    max_conn_cnt_ = max_conn_cnt;
-    cur_conn_cnt_ = MIN_CACHE_CONN_CNT;
-}
 
-CachePool::~CachePool() {
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        abort_request_ = true;
-        cond_var_.notify_all(); // 通知所有在等待的
-    }
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
-        for (list<CacheConn *>::iterator it = free_list_.begin();
-             it != free_list_.end(); it++) {
-            CacheConn *pConn = *it;
-            delete pConn;
-        }
-    }
-
-    free_list_.clear();
-    cur_conn_cnt_ = 0;
+    ConnPoolOptions pool_options = options;
+    pool_options.max_conn = max_conn_cnt;
+    pool_.reset(new ConnPool<CacheConn>(
+        pool_name_, pool_options,
+        [this]() -> CacheConn * {
+            CacheConn *conn =
+                new CacheConn(server_ip_.c_str(), m_server_port, db_index_,
+                              password_.c_str(), pool_name_.c_str()); //新建连接
+            if (conn->Init()) {
+                log_error("Init CacheConn failed, pool: %s\n", pool_name_.c_str());
+                delete conn;
+                return NULL;
+            }
+            return conn;
+        },
+        [](CacheConn *conn, bool idle_expired) {
+            // 空闲太久的连接可能已被服务端或中间设备断开，PING 一次；命令出错时连接已关闭，这里重连
+            if (idle_expired && !conn->Ping()) {
+                return false;
+            }
+            return conn->Init() == 0;
+        }));
 }
 
-int CachePool::Init() {
-    for (int i = 0; i < cur_conn_cnt_; i++) {
-        CacheConn *pConn =
-            new CacheConn(server_ip_.c_str(), m_server_port, db_index_,
-                          password_.c_str(), pool_name_.c_str());
-        if (pConn->Init()) {
-            delete pConn;
-            return 1;
-        }
+CachePool::~CachePool() {}
 
-        free_list_.push_back(pConn);
+int CachePool::Init() {
+    if (pool_->Init()) {
+        return 1;
     }
 
-    log_info("cache pool: %s, list size: %lu\n", pool_name_.c_str(),
-             free_list_.size());
+    log_info("cache pool: %s, min idle: %d\n", pool_name_.c_str(),
+             pool_->GetOptions().min_idle);
     return 0;
 }
 
 CacheConn *CachePool::GetCacheConn(const int timeout_ms) {
-    std::unique_lock<std::mutex> lock(m_mutex);
-    if (abort_request_) {
-        log_info("have aboort\n");
+    CacheConn *conn = pool_->Acquire(timeout_ms);
+    if (!conn) {
+        log_warn("get cache conn failed, pool: %s\n", pool_name_.c_str());
         return NULL;
     }
 
-    if (free_list_.empty()) // 2 当没有连接可以用时
-    {
-        // 第一步先检测 当前连接数量是否达到最大的连接数量
-        if (cur_conn_cnt_ >= max_conn_cnt_) // 等待的逻辑
+    uint64_t generation = conn_command_generation_.load(std::memory_order_acquire);
+    if (conn->conn_command_generation_ != generation) {
+        vector<string> command;
         {
-            // 如果已经到达了，看看是否需要超时等待
-            if (timeout_ms <= 0) // 死等，直到有连接可以用 或者 连接池要退出
-            {
-                log_info("wait ms:%d\n", timeout_ms);
-                cond_var_.wait(lock, [this] {
-                    // 当前连接数量小于最大连接数量 或者请求释放连接池时退出
-                    return (!free_list_.empty()) | abort_request_;
-                });
-            } else {
-                // return如果返回 false，继续wait(或者超时),
-                // 如果返回true退出wait 1.m_free_list不为空 2.超时退出
-                // 3. m_abort_request被置为true，要释放整个连接池
-                cond_var_.wait_for(
-                    lock, std::chrono::milliseconds(timeout_ms),
-                    [this] { return (!free_list_.empty()) | abort_request_; });
-                // 带超时功能时还要判断是否为空
-                if (free_list_.empty()) // 如果连接池还是没有空闲则退出
-                {
-                    return NULL;
-                }
-            }
-
-            if (abort_request_) {
-                log_warn("have aboort\n");
-                return NULL;
+            std::lock_guard<std::mutex> lock(conn_command_mutex_);
+            command = conn_command_;
+        }
+        bool ok = true;
+        if (!command.empty()) {
+            vector<std::string_view> args(command.begin(), command.end());
+            redisReply *reply = conn->CommandArgv(args.data(), args.size());
+            ok = reply && reply->type != REDIS_REPLY_ERROR;
+            if (reply && !ok) {
+                log_error("conn command %s failed: %s\n", command[0].c_str(), reply->str);
             }
-        } else // 还没有到最大连接则创建连接
-        {
-            CacheConn *db_conn =
-                new CacheConn(server_ip_.c_str(), m_server_port, db_index_,
-                              password_.c_str(), pool_name_.c_str()); //新建连接
-            int ret = db_conn->Init();
-            if (ret) {
-                log_error("Init DBConnecton failed\n\n");
-                delete db_conn;
-                return NULL;
-            } else {
-                free_list_.push_back(db_conn);
-                cur_conn_cnt_++;
-                // log_info("new db connection: %s, conn_cnt: %d\n",
-                // m_pool_name.c_str(), m_cur_conn_cnt);
+            if (reply) {
+                freeReplyObject(reply);
             }
         }
+        // 命令执行期间断线重连过的连接仍然算没有执行
+        if (ok && conn->context_) {
+            conn->conn_command_generation_ = generation;
+        }
     }
+    return conn;
+}
 
-    CacheConn *pConn = free_list_.front();
-    free_list_.pop_front();
+void CachePool::SetConnCommand(const vector<string> &args) {
+    std::lock_guard<std::mutex> lock(conn_command_mutex_);
+    conn_command_ = args;
+    conn_command_generation_++;
+}
 
-    return pConn;
+bool CachePool::IsConnCommandApplied(CacheConn *cache_conn) {
+    return cache_conn->context_ &&
+           cache_conn->conn_command_generation_ == conn_command_generation_.load(std::memory_order_acquire);
 }
 
 void CachePool::RelCacheConn(CacheConn *p_cache_conn) {
-    std::lock_guard<std::mutex> lock(m_mutex);
-
-    list<CacheConn *>::iterator it = free_list_.begin();
-    for (; it != free_list_.end(); it++) {
-        if (*it == p_cache_conn) {
-            break;
-        }
-    }
-
-    if (it == free_list_.end()) {
-        // m_used_list.remove(pConn);
-        free_list_.push_back(p_cache_conn);
-        cond_var_.notify_one(); // 通知取队列
-    } else {
-        log_error("RelDBConn failed\n"); // 不再次回收连接
+    if (!pool_->Release(p_cache_conn)) {
+        log_error("RelCacheConn failed\n"); // 不再次回收连接
     }
 }
 
@@ -1111,10 +1508,26 @@ int CacheManager::Init() {
         return 1;
     }
 
+    // 所有 redis 连接池共用的取连接参数
+    ConnPoolOptions options;
+    char *str_acquire_timeout = config_file.GetConfigName("pool_acquire_timeout_ms");
+    if (str_acquire_timeout) {
+        options.acquire_timeout_ms = atoi(str_acquire_timeout);
+    }
+    char *str_min_idle = config_file.GetConfigName("pool_min_idle");
+    if (str_min_idle) {
+        options.min_idle = atoi(str_min_idle);
+    }
+    char *str_idle_check = config_file.GetConfigName("pool_idle_check_seconds");
+    if (str_idle_check) {
+        options.idle_check_seconds = atoi(str_idle_check);
+    }
+
     char host[64];
     char port[64];
     char db[64];
     char maxconncnt[64];
+    char shards[64];
     CStrExplode instances_name(cache_instances, ',');
     for (uint32_t i = 0; i < instances_name.GetItemCnt(); i++) {
         char *pool_name = instances_name.GetItem(i);
@@ -1123,16 +1536,20 @@ int CacheManager::Init() {
         snprintf(port, 64, "%s_port", pool_name);
         snprintf(db, 64, "%s_db", pool_name);
         snprintf(maxconncnt, 64, "%s_maxconncnt", pool_name);
+        snprintf(shards, 64, "%s_shards", pool_name);
 
         char *cache_host = config_file.GetConfigName(host);
         char *str_cache_port = config_file.GetConfigName(port);
         char *str_cache_db = config_file.GetConfigName(db);
         char *str_max_conn_cnt = config_file.GetConfigName(maxconncnt);
-        if (!cache_host || !str_cache_port || !str_cache_db ||
+        char *str_shards = config_file.GetConfigName(shards);
+        bool sharded = str_shards && strlen(str_shards) > 0;
+        // 配置了分片时不需要 _host/_port
+        if ((!sharded && (!cache_host || !str_cache_port)) || !str_cache_db ||
             !str_max_conn_cnt) {
-            if(!cache_host)
+            if(!sharded && !cache_host)
                 LOG_ERROR << "not configure cache instance: " <<  pool_name << ", cache_host is null";
-            if(!str_cache_port)
+            if(!sharded && !str_cache_port)
                 LOG_ERROR << "not configure cache instance: " << pool_name << ", str_cache_port is null";
             if(!str_cache_db)
                 LOG_ERROR << "not configure cache instance: " << pool_name << ", str_cache_db is null";
@@ -1141,9 +1558,17 @@ int CacheManager::Init() {
             return 2;
         }
 
+        if (sharded) {
+            if (InitShardPools(pool_name, str_shards, atoi(str_cache_db), atoi(str_max_conn_cnt), options)) {
+                LOG_ERROR << "Init cache shard pools failed: " << pool_name;
+                return 3;
+            }
+            continue;
+        }
+
         CachePool *pCachePool =
             new CachePool(pool_name, cache_host, atoi(str_cache_port),
-                          atoi(str_cache_db), "", atoi(str_max_conn_cnt));
+                          atoi(str_cache_db), "", atoi(str_max_conn_cnt), options);
         if (pCachePool->Init()) {
             LOG_ERROR << "Init cache pool failed";
             return 3;
@@ -1155,6 +1580,51 @@ int CacheManager::Init() {
     return 0;
 }
 
+// shards 形如 "host1:port1,host2:port2"，每个分片一个连接池，名为 "<pool>@host:port"
+// 分片在哈希环上的位置由 "host:port" 决定，增删分片时只有相邻区间的房间换分片
+int CacheManager::InitShardPools(const char *pool_name, char *shards, int db_index, int max_conn_cnt,
+                                 const ConnPoolOptions &options) {
+    HashRing ring(kShardVirtualNodes);
+    vector<CachePool *> pools;
+    CStrExplode shard_list(shards, ',');
+    for (uint32_t i = 0; i < shard_list.GetItemCnt(); i++) {
+        string shard = shard_list.GetItem(i);
+        size_t colon = shard.rfind(':');
+        if (colon == string::npos || colon == 0) {
+            LOG_ERROR << "invalid cache shard: " << shard << ", expect host:port";
+            return 1;
+        }
+        string shard_pool_name = string(pool_name) + "@" + shard;
+        if (m_cache_pool_map.count(shard_pool_name)) {
+            LOG_ERROR << "duplicate cache shard: " << shard;
+            return 1;
+        }
+        CachePool *pCachePool =
+            new CachePool(shard_pool_name.c_str(), shard.substr(0, colon).c_str(),
+                          atoi(shard.c_str() + colon + 1), db_index, "", max_conn_cnt, options);
+        if (pCachePool->Init()) {
+            LOG_ERROR << "Init cache pool failed: " << shard_pool_name;
+            return 2;
+        }
+        m_cache_pool_map.insert(make_pair(shard_pool_name, pCachePool));
+        ring.AddNode(shard);
+        pools.push_back(pCachePool);
+    }
+    if (pools.empty()) {
+        return 1;
+    }
+
+    LOG_INFO << "cache pool " << pool_name << " sharded over " << pools.size() << " redis nodes";
+    shard_rings_.insert(make_pair(string(pool_name), ring));
+    shard_pools_.insert(make_pair(string(pool_name), pools));
+    return 0;
+}
+
+CachePool *CacheManager::GetCachePool(const char *pool_name) {
+    map<string, CachePool *>::iterator it = m_cache_pool_map.find(pool_name);
+    return it != m_cache_pool_map.end() ? it->second : NULL;
+}
+
 CacheConn *CacheManager::GetCacheConn(const char *pool_name) {
     map<string, CachePool *>::iterator it = m_cache_pool_map.find(pool_name);
     if (it != m_cache_pool_map.end()) {
@@ -1164,6 +1634,36 @@ CacheConn *CacheManager::GetCacheConn(const char *pool_name) {
     }
 }
 
+CacheConn *CacheManager::GetCacheConn(const char *pool_name, std::string_view shard_key) {
+    int index = GetShardIndex(pool_name, shard_key);
+    map<string, vector<CachePool *>>::iterator it = shard_pools_.find(pool_name);
+    if (it == shard_pools_.end() || index < 0) {
+        return GetCacheConn(pool_name);
+    }
+    return it->second[index]->GetCacheConn();
+}
+
+void CacheManager::GetShardPools(const char *pool_name, vector<CachePool *> &pools) {
+    map<string, vector<CachePool *>>::iterator it = shard_pools_.find(pool_name);
+    if (it != shard_pools_.end()) {
+        pools = it->second;
+        return;
+    }
+    pools.clear();
+    CachePool *pool = GetCachePool(pool_name);
+    if (pool) {
+        pools.push_back(pool);
+    }
+}
+
+int CacheManager::GetShardIndex(const char *pool_name, std::string_view shard_key) {
+    map<string, HashRing>::iterator it = shard_rings_.find(pool_name);
+    if (it != shard_rings_.end()) {
+        return it->second.GetNode(shard_key);
+    }
+    return GetCachePool(pool_name) ? 0 : -1;
+}
+
 void CacheManager::RelCacheConn(CacheConn *cache_conn) {
     if (!cache_conn) {
         return;
@@ -1175,3 +1675,9 @@ void CacheManager::RelCacheConn(CacheConn *cache_conn) {
         return it->second->RelCacheConn(cache_conn);
     }
 }
+
+void CacheManager::GetPoolStats(vector<ConnPoolStats> &stats) {
+    for (auto &pool_pair : m_cache_pool_map) {
+        stats.push_back(pool_pair.second->GetStats());
+    }
+}
@@ -9,13 +9,18 @@
 #ifndef CACHEPOOL_H_
 #define CACHEPOOL_H_
 
-#include <condition_variable>
+#include <atomic>
+#include <initializer_list>
 #include <iostream>
 #include <list>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <string_view>
 #include <vector>
 
+#include "conn_pool.h"
+#include "hash_ring.h"
 #include "hiredis.h"
 
 using std::list;
@@ -35,7 +40,92 @@ typedef char (
 
 class CachePool;
 
-class CacheConn {
+// stream 中的一条消息
+struct StreamEntry {
+    string id;
+    vector<std::pair<string, string>> fields;
+};
+
+// 解析 XRANGE/XREVRANGE 这类 stream 消息数组回复，追加到 entries，同步和异步连接共用
+void ParseStreamEntries(const redisReply *items, vector<StreamEntry> &entries);
+
+// 一条命令的回复
+struct CacheReply {
+    int type = REDIS_REPLY_NIL;     // REDIS_REPLY_*
+    string str;                     // 字符串、状态、错误回复的内容
+    long long integer = 0;
+    vector<CacheReply> elements;    // 数组回复
+};
+
+// Lua 脚本：SHA1 在构造时本地算好，CacheBatch::EvalSha 只发送 SHA1，不用每次发送脚本全文
+// 一般和脚本源码一起定义成文件级静态对象
+struct CacheScript {
+    explicit CacheScript(const char *source);
+    string source;
+    string sha;     // 十六进制
+};
+
+// 管道批量命令：先排队，CacheConn::Execute 时用 redisAppendCommandArgv 一次写出、再按顺序读回，整批只有一次网络往返
+// 排队方法返回这条命令的回复下标，执行后按下标取结果；参数在排队时拷贝，调用方的字符串不需要保持到执行
+// 同一个 CacheBatch 可以 Clear 后复用，不重新分配缓冲
+class CacheBatch {
+  public:
+    size_t Command(const std::string_view *args, size_t argc);
+    size_t Command(std::initializer_list<std::string_view> args) { return Command(args.begin(), args.size()); }
+    size_t Command(const vector<std::string_view> &args) { return Command(args.data(), args.size()); }
+
+    size_t Get(std::string_view key) { return Command({"GET", key}); }
+    size_t Set(std::string_view key, std::string_view value) { return Command({"SET", key, value}); }
+    size_t SetEx(std::string_view key, int timeout, std::string_view value);
+    size_t Del(std::string_view key) { return Command({"DEL", key}); }
+    size_t Expire(std::string_view key, int timeout);
+    size_t Incr(std::string_view key) { return Command({"INCR", key}); }
+    size_t Hget(std::string_view key, std::string_view field) { return Command({"HGET", key, field}); }
+    size_t Hset(std::string_view key, std::string_view field, std::string_view value) {
+        return Command({"HSET", key, field, value});
+    }
+    size_t HgetAll(std::string_view key) { return Command({"HGETALL", key}); }
+    size_t Lpush(std::string_view key, std::string_view value) { return Command({"LPUSH", key, value}); }
+    size_t Rpush(std::string_view key, std::string_view value) { return Command({"RPUSH", key, value}); }
+    size_t ZsetAdd(std::string_view key, long score, std::string_view member);
+    size_t Sadd(std::string_view key, std::string_view member) { return Command({"SADD", key, member}); }
+    size_t Spop(std::string_view key, int count);
+    size_t Scard(std::string_view key) { return Command({"SCARD", key}); }
+    size_t Xadd(std::string_view key, std::string_view id,
+                const vector<std::pair<std::string_view, std::string_view>> &field_value_pairs);
+    // EVALSHA；Redis 重启或 SCRIPT FLUSH 后脚本缓存为空会返回 NOSCRIPT，Execute 先 SCRIPT LOAD 再重发这些命令
+    // script 要保持到 Execute 返回
+    size_t EvalSha(const CacheScript &script, std::initializer_list<std::string_view> keys,
+                   std::initializer_list<std::string_view> args);
+
+    size_t Size() const { return cmd_argc_.size(); }
+    bool Empty() const { return cmd_argc_.empty(); }
+    void Clear();
+
+    // 以下在 Execute 之后调用
+    const CacheReply &GetReply(size_t index) const { return replies_[index]; }
+    // 不是错误回复；连接中断没有读回的命令也返回false
+    bool Ok(size_t index) const { return index < replies_.size() && replies_[index].type != REDIS_REPLY_ERROR; }
+    bool IsNil(size_t index) const { return index >= replies_.size() || replies_[index].type == REDIS_REPLY_NIL; }
+    // 字符串和状态回复返回内容，整数回复转成字符串，其它为空
+    string GetString(size_t index) const;
+    long long GetInteger(size_t index) const;
+    // 数组回复中的字符串元素
+    bool GetArray(size_t index, vector<string> &values) const;
+    // HGETALL 这类 field/value 交替的数组回复
+    bool GetHash(size_t index, map<string, string> &values) const;
+
+  private:
+    friend class CacheConn;
+    string buf_;                    // 全部参数连续存放
+    vector<size_t> arg_offsets_;    // 每个参数在 buf_ 中的起始位置
+    vector<size_t> arg_lens_;
+    vector<size_t> cmd_argc_;       // 每条命令的参数个数
+    vector<CacheReply> replies_;
+    vector<std::pair<size_t, const CacheScript *>> scripts_;   // EVALSHA 命令的下标和脚本
+};
+
+class CacheConn : public PooledConn {
   public:
     CacheConn(const char *server_ip, int server_port, int db_index,
               const char *password, const char *pool_name = "");
@@ -91,6 +181,13 @@ class CacheConn {
                       int &get_num);
     int ZsetGetScore(string key, string member);
 
+    // 按参数数组执行命令：redisCommandArgv 按长度发送，二进制安全（内容可以有空格、换行），也不经过格式串解析
+    // 参数数组在连接内复用，不为每条命令分配；返回的回复由调用方 freeReplyObject，连接出错返回NULL并重置连接
+    redisReply *CommandArgv(const std::string_view *args, size_t argc);
+    redisReply *CommandArgv(std::initializer_list<std::string_view> args) {
+        return CommandArgv(args.begin(), args.size());
+    }
+
     // 获取消息队列相关命令
     /**
      * key ：队列名
@@ -98,15 +195,42 @@ class CacheConn {
         start ：开始值， - 表示最小值
         count ：数量
      */
-    bool  GetXrevrange(const string & key, 
-      const string start, const string end, int count, std::vector<std::pair<string, string>> &msgs);
-    // / 添加消息到流
-    bool Xadd(const string& key, string& id, const std::vector<std::pair<string, string>>& field_value_pairs);
+    // entries 按从新到旧保存消息ID和全部字段
+    bool GetXrevrange(std::string_view key, std::string_view start, std::string_view end, int count,
+                      vector<StreamEntry> &entries);
+    // 添加消息到流，id 为 "*" 时由 Redis 分配，成功后 id 为最终的消息ID
+    bool Xadd(std::string_view key, string &id,
+              const vector<std::pair<std::string_view, std::string_view>> &field_value_pairs);
+
+    // 以消费组方式读取多个 stream：start_id 为 ">" 读新消息，为 "0" 读本消费者已领取未确认的消息
+    // entries 按 stream 名保存读到的消息；没有消息时返回true且 entries 为空
+    bool XreadGroup(const string &group, const string &consumer, const vector<string> &keys,
+                    const string &start_id, int count, map<string, vector<StreamEntry>> &entries);
+    // 从集合中随机弹出最多 count 个成员
+    bool Spop(const string &key, int count, vector<string> &members);
+    long Scard(const string &key);
+    bool Smembers(const string &key, vector<string> &members);
+    // INFO 命令，fields 保存 section 中的 "字段:值"
+    bool Info(const string &section, map<string, string> &fields);
+    // PING，连接池检查空闲连接用；失败时关闭连接
+    bool Ping();
+
+    // 执行一批命令，所有命令一次写出，只有一次网络往返；每条命令的回复（包括错误回复）保存在 batch 中
+    // 全部回复都读回返回true，连接出错返回false（没有读回的命令 Ok() 为false）
+    bool Execute(CacheBatch &batch);
     
     
     bool FlushDb();
 
   private:
+    // 把 batch 中从 arg_index 开始的一条命令追加到输出缓冲
+    bool AppendBatchCommand(const CacheBatch &batch, size_t arg_index, size_t argc);
+    // 读回一条回复；连接出错时关闭连接返回false
+    bool ReadBatchReply(CacheReply &out);
+    // 重新加载返回 NOSCRIPT 的脚本并重发对应的 EVALSHA，加载和重发在同一次往返里
+    bool RetryNoScript(CacheBatch &batch);
+
+    friend class CachePool;
     CachePool *cache_pool_;
     redisContext *context_; // 每个redis连接 redisContext redis客户端编程的对象
     uint64_t last_connect_time_;
@@ -115,20 +239,31 @@ class CacheConn {
     string password_;
     uint16_t db_index_;
     string pool_name_;
+    // CommandArgv 复用的参数数组
+    vector<const char *> argv_;
+    vector<size_t> argvlen_;
+    uint64_t conn_command_generation_ = 0; // 已执行的连接级命令版本，重连后清零
 };
 
 class CachePool {
   public:
     // db_index和mysql不同的地方
     CachePool(const char *pool_name, const char *server_ip, int server_port,
-              int db_index, const char *password, int max_conn_cnt);
+              int db_index, const char *password, int max_conn_cnt,
+              const ConnPoolOptions &options = ConnPoolOptions());
     virtual ~CachePool();
 
     int Init();
-    // 获取空闲的连接资源
+    // 获取空闲的连接资源，timeout_ms 为0时按配置的默认超时等待，超时返回NULL
     CacheConn *GetCacheConn(const int timeout_ms = 0);
     // Pool回收连接资源
     void RelCacheConn(CacheConn *cache_conn);
+    ConnPoolStats GetStats() { return pool_->GetStats(); }
+    // 设置连接级命令（如 CLIENT TRACKING），每个连接在建立后和命令变化后第一次取出时执行一次；空表示不执行
+    // 执行失败不影响取连接，用 IsConnCommandApplied 判断
+    void SetConnCommand(const vector<string> &args);
+    // 连接已经执行过当前的连接级命令，并且之后没有重连过
+    bool IsConnCommandApplied(CacheConn *cache_conn);
 
     const char *GetPoolName() { return pool_name_.c_str(); }
     const char *GetServerIP() { return server_ip_.c_str(); }
@@ -143,13 +278,11 @@ class CachePool {
     int m_server_port;
     int db_index_; // mysql 数据库名字， redis db index
 
-    int cur_conn_cnt_;
-    int max_conn_cnt_;
-    list<CacheConn *> free_list_;
+    std::unique_ptr<ConnPool<CacheConn>> pool_;
 
-    std::mutex m_mutex;
-    std::condition_variable cond_var_;
-    bool abort_request_ = false;
+    std::mutex conn_command_mutex_;
+    vector<string> conn_command_;
+    std::atomic<uint64_t> conn_command_generation_{1};  // 每次 SetConnCommand 加一
 };
 
 class CacheManager {
@@ -161,15 +294,30 @@ class CacheManager {
     static CacheManager *getInstance();
 
     int Init();
+    // 连接池，取配置用；不存在或配置了分片时返回NULL
+    CachePool *GetCachePool(const char *pool_name);
     CacheConn *GetCacheConn(const char *pool_name);
+    // 按 shard_key（房间ID）取连接：配置了 <pool>_shards 时在一致性哈希环上选分片，否则就是 GetCacheConn(pool_name)
+    CacheConn *GetCacheConn(const char *pool_name, std::string_view shard_key);
+    // 分片连接池，没有分片时只有这个连接池本身；按分片遍历（持久化、采集内存）时用
+    void GetShardPools(const char *pool_name, vector<CachePool *> &pools);
+    // shard_key 所在的分片在 GetShardPools 结果中的下标，连接池不存在返回-1
+    int GetShardIndex(const char *pool_name, std::string_view shard_key);
     void RelCacheConn(CacheConn *cache_conn);
+    // 各连接池的连接数、取连接统计，定时导出监控指标用
+    void GetPoolStats(vector<ConnPoolStats> &stats);
 
   private:
     CacheManager();
+    int InitShardPools(const char *pool_name, char *shards, int db_index, int max_conn_cnt,
+                       const ConnPoolOptions &options);
 
   private:
+    static const int kShardVirtualNodes = 160; // 每个分片在哈希环上的虚拟节点数
     static CacheManager *s_cache_manager;
-    map<string, CachePool *> m_cache_pool_map;
+    map<string, CachePool *> m_cache_pool_map;    // 分片连接池以 "<pool>@host:port" 为名也放在这里
+    map<string, HashRing> shard_rings_;           // 配置了分片的连接池 -> 分片哈希环
+    map<string, vector<CachePool *>> shard_pools_; // 顺序和哈希环的节点下标一致
     static string conf_path_;
 };
 
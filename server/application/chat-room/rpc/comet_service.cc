@@ -6,13 +6,13 @@
 #include "muduo/base/Logging.h"
 #include "websocket_conn.h"
 #include "pub_sub_service.h"
+#include "loop_fanout.h"
+#include "room_bus.h"
+#include "monitoring/metrics_collector.h"
 
 // 前向声明 buildWebSocketFrame 函数
 extern std::string buildWebSocketFrame(const std::string& payload, uint8_t opcode = 0x01);
 
-extern std::unordered_map<string, CHttpConnPtr> s_user_ws_conn_map;
-extern std::mutex s_mtx_user_ws_conn_map_;
-
 namespace ChatRoom {
 
 grpc::Status CometServiceImpl::PushMsg(grpc::ServerContext* context, 
@@ -62,23 +62,18 @@ grpc::Status CometServiceImpl::BroadcastRoom(grpc::ServerContext* context,
         return grpc::Status(grpc::StatusCode::INTERNAL, "Failed to broadcast to room");
     }
 
+    // 跨节点总线开启时，其他节点的消息已经由总线实时推送过，Logic→Kafka→Job 这条路径只用于持久化和离线推送，
+    // 这里再推送一次订阅者会收到两遍
+    if (RoomBus::GetInstance().IsEnabled()) {
+        MetricsCollector::GetInstance().IncrementCounter("broadcast_room", "skipped_room_bus");
+        return grpc::Status::OK;
+    }
+
     std::string ws_frame = buildWebSocketFrame(proto.body());
-    auto callback = [&ws_frame, &room_id, this](const std::unordered_set<string> user_ids) {
-        LOG_INFO << "room_id:" << room_id << ", callback " <<  ", user_ids.size(): " << user_ids.size();
-        for (string userId: user_ids)
-        {
-             CHttpConnPtr ws_conn_ptr = nullptr;
-             {
-                std::lock_guard<std::mutex> ulock(s_mtx_user_ws_conn_map_); //自动释放
-                ws_conn_ptr =  s_user_ws_conn_map[userId];
-             }
-             if(ws_conn_ptr) {
-                ws_conn_ptr->send(ws_frame);
-             } else
-             {
-                LOG_WARN << "can't find userid: " << userId;
-             }
-        }
+    auto callback = [&ws_frame, &room_id](const RoomSubscribersPtr &subscribers) {
+        LOG_INFO << "room_id:" << room_id << ", callback " <<  ", subscribers.size(): " << subscribers->size();
+        // rpc 线程不直接写连接，按 loop 分片投递给各个 IO 线程
+        LoopFanout::GetInstance().Broadcast(subscribers, room_id, ws_frame, IdInterner::kInvalidHandle);
      };
 
     // 广播给所有人
@@ -0,0 +1,38 @@
+#include "history_loader.h"
+
+#include "api_msg.h"
+#include "muduo/base/Logging.h"
+
+void HistoryLoader::Start(int num_threads) {
+    if (num_threads > 0) {
+        loader_.start(num_threads);
+    }
+}
+
+void HistoryLoader::Stop() {
+    loader_.stop();
+}
+
+void HistoryLoader::LoadFromDb(const Room &room, MessageBatch message_batch, int msg_count,
+                               muduo::net::EventLoop *loop, HistoryCallback callback) {
+    if (message_batch.has_more) {
+        Room full_room = room;
+        callback(0, full_room, message_batch);
+        return;
+    }
+
+    // 没有启动线程池时 run 在当前线程内执行
+    loader_.run([room = room, message_batch, msg_count, loop, callback]() mutable {
+        int ret = ApiGetRoomHistoryFromDb(room, message_batch, msg_count);
+        if (ret != 0) {
+            LOG_ERROR << "Failed to load history from db for room " << room.room_id;
+        }
+        if (loop) {
+            loop->queueInLoop([ret, room, message_batch, callback]() mutable {
+                callback(ret, room, message_batch);
+            });
+        } else {
+            callback(ret, room, message_batch);
+        }
+    });
+}
@@ -0,0 +1,38 @@
+#ifndef __HISTORY_LOADER_H__
+#define __HISTORY_LOADER_H__
+
+#include <functional>
+
+#include "api_types.h"
+#include "muduo/base/ThreadPool.h"
+#include "muduo/net/EventLoop.h"
+
+// 历史消息 MySQL 层的读取线程池：Redis 层在 loop 线程里异步读取，不够一页时剩下的部分在这里查 MySQL，
+// 不阻塞 IO 线程；查完在发起读取的 loop 线程回调
+class HistoryLoader
+{
+public:
+    // ret 为 ApiGetRoomHistoryFromDb 的返回值，room 的游标已经随读取前进
+    typedef std::function<void(int ret, Room &room, MessageBatch &message_batch)> HistoryCallback;
+
+    static HistoryLoader &GetInstance() {
+        static HistoryLoader instance;
+        return instance;
+    }
+
+    // num_threads 为0时在调用线程内同步查库
+    void Start(int num_threads);
+    void Stop();
+    // 从 room 的游标接着读 MySQL，补到 message_batch（已有 Redis 读到的消息时只补差额）
+    // message_batch 已经读满一页（has_more）时不查库，直接在调用线程回调
+    void LoadFromDb(const Room &room, MessageBatch message_batch, int msg_count,
+                    muduo::net::EventLoop *loop, HistoryCallback callback);
+
+private:
+    HistoryLoader() : loader_("HistoryLoader") {}
+    ~HistoryLoader() {}
+
+    muduo::ThreadPool loader_;
+};
+
+#endif
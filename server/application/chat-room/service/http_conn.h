@@ -54,6 +54,8 @@ public:
     virtual ~CHttpConn();
 
     virtual void OnRead(muduo::net::Buffer *buf);
+    // 连接断开时由 HttpServer::onConnection 调用，子类在这里释放连接相关的状态
+    virtual void OnClose() {}
     virtual std::string getSubdirectoryFromHttpRequest(const std::string& httpRequest);
     virtual void setHeaders(std::unordered_map<std::string, std::string> &headers) {
         headers_ = headers;
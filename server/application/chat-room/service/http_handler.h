@@ -52,6 +52,12 @@ public:
         handler_->OnRead(buf);
     }
 
+    void OnClose(){
+        if(handler_) {
+            handler_->OnClose();
+        }
+    }
+
 private:
     std::unordered_map<std::string, std::string> parseHttpHeaders(const char *data, int size) {
         std::string request(data, size);
@@ -0,0 +1,74 @@
+#include "id_interner.h"
+
+#include <mutex>
+
+IdInterner &IdInterner::Users() {
+    static IdInterner instance;
+    return instance;
+}
+
+IdInterner &IdInterner::Rooms() {
+    static IdInterner instance;
+    return instance;
+}
+
+uint32_t IdInterner::Intern(const string &id) {
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = handle_map_.find(id);
+        if (it != handle_map_.end()) {
+            return it->second;
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto it = handle_map_.find(id);     // 加写锁期间可能已被其他线程插入
+    if (it != handle_map_.end()) {
+        return it->second;
+    }
+    uint32_t handle;
+    if (!free_handles_.empty()) {
+        handle = free_handles_.back();
+        free_handles_.pop_back();
+        id_list_[handle] = id;
+    } else {
+        handle = static_cast<uint32_t>(id_list_.size());
+        id_list_.push_back(id);
+    }
+    handle_map_.insert({id, handle});
+    return handle;
+}
+
+uint32_t IdInterner::Find(const string &id) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = handle_map_.find(id);
+    if (it == handle_map_.end()) {
+        return kInvalidHandle;
+    }
+    return it->second;
+}
+
+void IdInterner::Release(const string &id) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    auto it = handle_map_.find(id);
+    if (it == handle_map_.end()) {
+        return;
+    }
+    uint32_t handle = it->second;
+    handle_map_.erase(it);
+    string().swap(id_list_[handle]);
+    free_handles_.push_back(handle);
+}
+
+string IdInterner::GetString(uint32_t handle) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    if (handle >= id_list_.size()) {
+        return "";
+    }
+    return id_list_[handle];
+}
+
+size_t IdInterner::Size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return handle_map_.size();
+}
@@ -0,0 +1,49 @@
+#ifndef __ID_INTERNER_H__
+#define __ID_INTERNER_H__
+
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using std::string;
+
+// 外部字符串ID（userid / room_id）到稠密 uint32_t 句柄的映射表
+// 只在协议边界（握手、收到客户端消息、序列化输出）做字符串和句柄的转换，
+// 内部的订阅集合、连接表都用句柄做key，避免每次发布都对字符串做hash和比较
+// 句柄从0开始连续分配；Release 之后句柄会被重新分配给新的ID，只有确定没有人再用旧句柄时才能释放
+// （房间句柄只在 PubSubService 的锁内分配和释放，见 PubSubService::AddSubscriber/ReclaimIdleRoomTopics）
+class IdInterner
+{
+public:
+    static const uint32_t kInvalidHandle = UINT32_MAX;
+
+    static IdInterner &Users();     // userid 表
+    static IdInterner &Rooms();     // room_id 表
+
+    // 获取句柄，不存在则分配新句柄
+    uint32_t Intern(const string &id);
+    // 只查找不分配，不存在返回 kInvalidHandle（客户端传来的ID用这个，避免被任意ID撑大）
+    uint32_t Find(const string &id) const;
+    // 释放句柄，之后 Find 返回 kInvalidHandle，句柄留给下一次 Intern 复用
+    void Release(const string &id);
+    // 句柄转回字符串，只在序列化时使用
+    string GetString(uint32_t handle) const;
+    size_t Size() const;
+
+private:
+    IdInterner() {}
+    IdInterner(const IdInterner &) = delete;
+    IdInterner &operator=(const IdInterner &) = delete;
+
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<string, uint32_t> handle_map_;  // 字符串 -> 句柄
+    std::vector<string> id_list_;                       // 句柄 -> 字符串
+    std::vector<uint32_t> free_handles_;                // 已释放、等待复用的句柄
+};
+
+using UserHandle = uint32_t;
+using RoomHandle = uint32_t;
+
+#endif
@@ -0,0 +1,98 @@
+#include "loop_fanout.h"
+#include "muduo/base/Logging.h"
+
+int LoopFanout::RegisterLoop(muduo::net::EventLoop *loop) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = loop_index_map_.find(loop);
+    if (it != loop_index_map_.end()) {
+        return it->second;
+    }
+
+    int index = loop_count_.load(std::memory_order_relaxed);
+    if (index >= kMaxLoops) {
+        LOG_ERROR << "too many event loops for fanout, max: " << kMaxLoops;
+        return 0;
+    }
+    mailboxes_[index].reset(new Mailbox());
+    mailboxes_[index]->loop = loop;
+    loop_index_map_.insert({loop, index});
+    loop_count_.store(index + 1, std::memory_order_release);  // 邮箱创建完成后才对其他线程可见
+    LOG_INFO << "fanout register event loop, index: " << index;
+    return index;
+}
+
+int LoopFanout::GetLoopIndex(muduo::net::EventLoop *loop) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = loop_index_map_.find(loop);
+    if (it == loop_index_map_.end()) {
+        return 0;
+    }
+    return it->second;
+}
+
+bool LoopFanout::Post(Mailbox *mailbox, FanoutBatch *batch) {
+    FanoutBatch *old_head = mailbox->head.load(std::memory_order_relaxed);
+    do {
+        batch->next = old_head;
+    } while (!mailbox->head.compare_exchange_weak(old_head, batch,
+                 std::memory_order_release, std::memory_order_relaxed));
+    return old_head == nullptr;
+}
+
+void LoopFanout::DrainMailbox(int index) {
+    Mailbox *mailbox = mailboxes_[index].get();
+    FanoutBatch *head = mailbox->head.exchange(nullptr, std::memory_order_acquire);
+
+    // 栈是后进先出，先反转恢复投递顺序，保证同一个 loop 上消息有序
+    FanoutBatch *ordered = nullptr;
+    while (head) {
+        FanoutBatch *next = head->next;
+        head->next = ordered;
+        ordered = head;
+        head = next;
+    }
+
+    while (ordered) {
+        FanoutBatch *next = ordered->next;
+        if (deliver_cb_) {
+            deliver_cb_(*ordered);
+        }
+        delete ordered;
+        ordered = next;
+    }
+}
+
+void LoopFanout::Broadcast(const RoomSubscribersPtr &subscribers, const string &room_id,
+                           const string &frame, UserHandle skip_user) {
+    if (!subscribers) {
+        return;
+    }
+
+    auto shared_frame = std::make_shared<const string>(frame);
+    int loop_count = loop_count_.load(std::memory_order_acquire);
+
+    for (size_t i = 0; i < subscribers->shards.size(); i++) {
+        const SubscriberSetPtr &shard = subscribers->shards[i];
+        if (!shard || shard->empty()) {
+            continue;
+        }
+
+        FanoutBatch *batch = new FanoutBatch{shard, shared_frame, skip_user, room_id, nullptr};
+        if (static_cast<int>(i) >= loop_count) {
+            // 没有注册过的 loop（服务还没启动），直接在当前线程推送
+            if (deliver_cb_) {
+                deliver_cb_(*batch);
+            }
+            delete batch;
+            continue;
+        }
+
+        Mailbox *mailbox = mailboxes_[i].get();
+        bool was_empty = Post(mailbox, batch);
+        if (mailbox->loop->isInLoopThread()) {
+            DrainMailbox(static_cast<int>(i));   // 本来就在目标 loop 上，直接推送
+        } else if (was_empty) {
+            mailbox->loop->queueInLoop(std::bind(&LoopFanout::DrainMailbox, this, static_cast<int>(i)));
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef __LOOP_FANOUT_H__
+#define __LOOP_FANOUT_H__
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "muduo/net/EventLoop.h"
+#include "pub_sub_service.h"
+
+using std::string;
+
+// 一次广播投递给某个 IO 线程的批次：只包含该线程上的订阅者
+struct FanoutBatch {
+    SubscriberSetPtr user_ids;              // 该 loop 上的订阅者快照
+    std::shared_ptr<const string> frame;    // 所有 loop 共用同一份 websocket 帧
+    UserHandle skip_user;                   // 发送者自己，不推送
+    string room_id;                         // 用于指标
+    FanoutBatch *next;                      // 邮箱链表指针
+};
+
+// 按 EventLoop 分片的房间广播
+// 每个 IO loop 一个多生产者单消费者的无锁邮箱，一次广播给每个有订阅者的 loop 只投递一个批次，
+// 由 loop 线程自己写本地连接（TcpConnection::send 在本线程直接写，不再每个连接 runInLoop 拷贝一次帧）。
+// 邮箱从空变为非空时才 queueInLoop 唤醒一次，每条消息每个 loop 最多唤醒一次
+class LoopFanout
+{
+public:
+    using DeliverCallback = std::function<void(const FanoutBatch &batch)>;
+    static const int kMaxLoops = 64;
+
+    static LoopFanout &GetInstance() {
+        static LoopFanout instance;
+        return instance;
+    }
+
+    // 在 IO 线程初始化回调里注册，返回该 loop 的序号
+    int RegisterLoop(muduo::net::EventLoop *loop);
+    // 连接建立时查询所属 loop 的序号，未注册的 loop 返回0
+    int GetLoopIndex(muduo::net::EventLoop *loop);
+    // 设置 loop 线程内真正推送给连接的回调，需要在服务启动前设置
+    void SetDeliverCallback(const DeliverCallback &cb) { deliver_cb_ = cb; }
+
+    // 按 loop 分片广播，可以在任意线程调用
+    void Broadcast(const RoomSubscribersPtr &subscribers, const string &room_id,
+                   const string &frame, UserHandle skip_user);
+
+private:
+    struct Mailbox {
+        muduo::net::EventLoop *loop = nullptr;
+        std::atomic<FanoutBatch *> head{nullptr};   // 无锁栈，消费时整体取走再反转
+    };
+
+    LoopFanout() {}
+    ~LoopFanout() {}
+
+    // 任意线程投递，返回投递前邮箱是否为空
+    bool Post(Mailbox *mailbox, FanoutBatch *batch);
+    // 只在 loop 线程执行，按投递顺序推送邮箱里的全部批次
+    void DrainMailbox(int index);
+
+    std::mutex mutex_;  // 只保护注册
+    std::unordered_map<muduo::net::EventLoop *, int> loop_index_map_;
+    std::unique_ptr<Mailbox> mailboxes_[kMaxLoops];
+    std::atomic<int> loop_count_{0};
+    DeliverCallback deliver_cb_;
+};
+
+#endif
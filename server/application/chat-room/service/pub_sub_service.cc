@@ -1,18 +1,194 @@
 #include "pub_sub_service.h"
 #include "api_types.h"
+#include "monitoring/metrics_collector.h"
 
-static std::vector<Room> s_room_list = {
-    {"0001", "官方1群", 1, "", "", ""},
-    {"0002", "官方2群", 2, "", "", ""},
-    {"0003", "官方3群", 3, "", "", ""},
-    {"0004", "官方4群", 4, "", "", ""},
-    {"0005", "官方5群", 5, "", "", ""}
-};
-
-static std::mutex s_metux_room_list;
-
- std::vector<Room> &PubSubService::GetRoomList() {
-    //加锁
-    std::lock_guard<std::mutex> lock(s_metux_room_list);
-    return s_room_list;
- }
\ No newline at end of file
+bool PubSubService::AddRoomTopic(const string &room_id, const string &room_topic, string creator_id) {
+    std::lock_guard<std::mutex> lck(room_topic_map_mutex_);
+    RoomHandle room = IdInterner::Rooms().Intern(room_id);
+
+    if (room_topic_map_.find(room) != room_topic_map_.end()) {
+        return false;
+    }
+    RoomTopicPtr room_topic_ptr = std::make_shared<RoomTopic>(room_id, room_topic, creator_id);
+    room_topic_map_[room] = room_topic_ptr;
+    if (room_topic_listener_) {
+        room_topic_listener_(room_id, true);
+    }
+    OnSubscriberCountChanged(room, room_topic_ptr);   // 空房间，超时未被订阅会被回收
+    return true;
+}
+
+void PubSubService::DeleteRoomTopic(const string &room_id) {
+    {
+        std::lock_guard<std::mutex> lck(room_topic_map_mutex_);
+        RoomHandle room = IdInterner::Rooms().Find(room_id);
+        auto it = room_topic_map_.find(room);
+        if (it == room_topic_map_.end()) {
+            return;
+        }
+        it->second->forEachSubscriber([this, room](UserHandle userid) {
+            auto user_it = user_rooms_map_.find(userid);
+            if (user_it == user_rooms_map_.end()) {
+                return;
+            }
+            std::vector<RoomHandle> &user_rooms = user_it->second.rooms;
+            user_rooms.erase(std::remove(user_rooms.begin(), user_rooms.end(), room), user_rooms.end());
+            if (user_rooms.empty()) {
+                user_rooms_map_.erase(user_it);
+            }
+        });
+        room_topic_map_.erase(it);
+        idle_rooms_.erase(room);
+        IdInterner::Rooms().Release(room_id);
+        if (room_topic_listener_) {
+            room_topic_listener_(room_id, false);
+        }
+        // 房间指标的更新都在 room_topic_map_mutex_ 内，删除也放在锁内，避免删掉正在更新的 gauge
+        MetricsCollector::GetInstance().RemoveRoomSubscribers(room_id);
+        MetricsCollector::GetInstance().SetRoomTopics(room_topic_map_.size());
+    }
+}
+
+void PubSubService::OnSubscriberCountChanged(RoomHandle room, const RoomTopicPtr &room_topic) {
+    if (room_topic->getSubscriberCount() == 0) {
+        if (idle_rooms_.insert(room).second) {
+            room_topic->setIdleSince(time(NULL));
+        }
+    } else {
+        idle_rooms_.erase(room);
+    }
+    MetricsCollector::GetInstance().SetRoomSubscribers(room_topic->getRoomId(), room_topic->getSubscriberCount());
+}
+
+size_t PubSubService::ReclaimIdleRoomTopics(int grace_seconds, std::vector<string> *reclaimed_room_ids) {
+    std::lock_guard<std::mutex> lck(room_topic_map_mutex_);
+    size_t reclaimed_count = 0;
+    time_t now = time(NULL);
+    // 只扫描空房间，不遍历全部房间
+    for (auto idle_it = idle_rooms_.begin(); idle_it != idle_rooms_.end(); ) {
+        auto it = room_topic_map_.find(*idle_it);
+        if (it == room_topic_map_.end()) {
+            idle_it = idle_rooms_.erase(idle_it);
+            continue;
+        }
+        const RoomTopicPtr &room_topic = it->second;
+        if (room_topic->getSubscriberCount() == 0 && now - room_topic->getIdleSince() >= grace_seconds) {
+            // 同时删除该房间的订阅人数指标，避免回收的房间留下大量 room_id 标签
+            MetricsCollector::GetInstance().RemoveRoomSubscribers(room_topic->getRoomId());
+            if (room_topic_listener_) {
+                room_topic_listener_(room_topic->getRoomId(), false);
+            }
+            // 没有订阅者，反向索引里也不会再有这个句柄，可以释放给其他房间复用
+            IdInterner::Rooms().Release(room_topic->getRoomId());
+            if (reclaimed_room_ids) {
+                reclaimed_room_ids->push_back(room_topic->getRoomId());
+            }
+            room_topic_map_.erase(it);
+            idle_it = idle_rooms_.erase(idle_it);
+            reclaimed_count++;
+        } else {
+            ++idle_it;
+        }
+    }
+    MetricsCollector::GetInstance().SetRoomTopics(room_topic_map_.size());
+    return reclaimed_count;
+}
+
+size_t PubSubService::GetRoomTopicCount() {
+    std::lock_guard<std::mutex> lck(room_topic_map_mutex_);
+    return room_topic_map_.size();
+}
+
+RoomHandle PubSubService::AddSubscriber(const string &room_id, UserHandle userid, int loop_index) {
+    if (room_id.empty() || userid == IdInterner::kInvalidHandle) {
+        return IdInterner::kInvalidHandle;
+    }
+    std::lock_guard<std::mutex> lck(room_topic_map_mutex_);
+    RoomHandle room = IdInterner::Rooms().Intern(room_id);
+    auto it = room_topic_map_.find(room);
+    if (it == room_topic_map_.end()) {
+        // 第一次有人订阅时才创建 RoomTopic
+        RoomTopicPtr room_topic_ptr = std::make_shared<RoomTopic>(room_id, "", "");
+        it = room_topic_map_.insert({room, room_topic_ptr}).first;
+        if (room_topic_listener_) {
+            room_topic_listener_(room_topic_ptr->getRoomId(), true);
+        }
+        MetricsCollector::GetInstance().SetRoomTopics(room_topic_map_.size());
+    }
+
+    UserSubscription &subscription = user_rooms_map_[userid];
+    if (subscription.rooms.empty()) {
+        subscription.loop_index = loop_index;
+    } else if (subscription.loop_index != loop_index) {
+        // 同一用户的新连接落在了另一个 loop 上，把已订阅的房间迁移到新 loop 的分片
+        for (RoomHandle user_room : subscription.rooms) {
+            auto room_it = room_topic_map_.find(user_room);
+            if (room_it == room_topic_map_.end()) {
+                continue;
+            }
+            room_it->second->DeleteSubscriber(userid, subscription.loop_index);
+            room_it->second->AddSubscriber(userid, loop_index);
+        }
+        subscription.loop_index = loop_index;
+    }
+
+    it->second->AddSubscriber(userid, loop_index);
+    std::vector<RoomHandle> &user_rooms = subscription.rooms;
+    if (std::find(user_rooms.begin(), user_rooms.end(), room) == user_rooms.end()) {
+        user_rooms.push_back(room);
+    }
+    OnSubscriberCountChanged(room, it->second);
+    return room;
+}
+
+void PubSubService::DeleteSubscriber(RoomHandle room, UserHandle userid) {
+    std::lock_guard<std::mutex> lck(room_topic_map_mutex_);
+    auto user_it = user_rooms_map_.find(userid);
+    if (user_it == user_rooms_map_.end()) {
+        return;     // 没有订阅任何房间
+    }
+    int loop_index = user_it->second.loop_index;
+    std::vector<RoomHandle> &user_rooms = user_it->second.rooms;
+    user_rooms.erase(std::remove(user_rooms.begin(), user_rooms.end(), room), user_rooms.end());
+    if (user_rooms.empty()) {
+        user_rooms_map_.erase(user_it);
+    }
+
+    auto it = room_topic_map_.find(room);
+    if (it == room_topic_map_.end()) {
+        return;
+    }
+    it->second->DeleteSubscriber(userid, loop_index);
+    OnSubscriberCountChanged(room, it->second);
+}
+
+size_t PubSubService::DeleteSubscriberFromAllRooms(UserHandle userid) {
+    std::lock_guard<std::mutex> lck(room_topic_map_mutex_);
+    auto user_it = user_rooms_map_.find(userid);
+    if (user_it == user_rooms_map_.end()) {
+        return 0;
+    }
+
+    // 只遍历该用户加入过的房间，不扫描全部房间
+    size_t count = 0;
+    for (RoomHandle room : user_it->second.rooms) {
+        auto it = room_topic_map_.find(room);
+        if (it == room_topic_map_.end()) {
+            continue;
+        }
+        it->second->DeleteSubscriber(userid, user_it->second.loop_index);
+        OnSubscriberCountChanged(room, it->second);
+        count++;
+    }
+    user_rooms_map_.erase(user_it);
+    return count;
+}
+
+std::vector<RoomHandle> PubSubService::GetUserRooms(UserHandle userid) {
+    std::lock_guard<std::mutex> lck(room_topic_map_mutex_);
+    auto user_it = user_rooms_map_.find(userid);
+    if (user_it != user_rooms_map_.end()) {
+        return user_it->second.rooms;
+    }
+    return std::vector<RoomHandle>();
+}
@@ -2,12 +2,36 @@
 #ifndef __PUB_SUB_SERVICE_H__
 #define __PUB_SUB_SERVICE_H__
 #include "api_types.h"
+#include "id_interner.h"
 #include <vector>
 #include <mutex>
 #include <memory>
 #include <unordered_map>
 #include <unordered_set>
 #include <functional>
+#include <ctime>
+#include <algorithm>
+
+// 订阅者集合的只读快照，发布时只拷贝 shared_ptr（引用计数+1），不拷贝集合本身
+// 集合内是按句柄升序排列的 UserHandle，每个成员只占4字节
+using SubscriberSet = std::vector<UserHandle>;
+using SubscriberSetPtr = std::shared_ptr<const SubscriberSet>;
+
+// 房间订阅者按所属 IO 线程（EventLoop）分片，下标是 loop 序号，每个分片是独立的只读快照
+// 广播时每个 loop 只拿到自己的分片，在本线程内推送给本地连接
+struct RoomSubscribers {
+    std::vector<SubscriberSetPtr> shards;
+    size_t size() const {
+        size_t count = 0;
+        for (const SubscriberSetPtr &shard : shards) {
+            if (shard) {
+                count += shard->size();
+            }
+        }
+        return count;
+    }
+};
+using RoomSubscribersPtr = std::shared_ptr<const RoomSubscribers>;
 
 //房间管理
 class RoomTopic 
@@ -19,29 +43,97 @@ public:
         creator_id_ = creator_id;
     }
     ~RoomTopic() {
-        user_ids_.clear();
+        shards_.clear();
     }
 
-    void AddSubscriber(string userid) {
-        user_ids_.insert(userid);
+    // loop_index 是订阅者连接所属 EventLoop 的序号
+    void AddSubscriber(UserHandle userid, int loop_index) {
+        if (shards_.size() <= static_cast<size_t>(loop_index)) {
+            shards_.resize(loop_index + 1);
+            shard_dirty_.resize(loop_index + 1, true);
+        }
+        SubscriberSet &user_ids = shards_[loop_index];
+        auto it = std::lower_bound(user_ids.begin(), user_ids.end(), userid);
+        if (it == user_ids.end() || *it != userid) {
+            user_ids.insert(it, userid);
+            subscriber_count_++;
+            shard_dirty_[loop_index] = true;
+            dirty_ = true;
+        }
+    }
+    void DeleteSubscriber(UserHandle userid, int loop_index) {
+        if (shards_.size() <= static_cast<size_t>(loop_index)) {
+            return;
+        }
+        SubscriberSet &user_ids = shards_[loop_index];
+        auto it = std::lower_bound(user_ids.begin(), user_ids.end(), userid);
+        if (it != user_ids.end() && *it == userid) {
+            user_ids.erase(it);
+            subscriber_count_--;
+            shard_dirty_[loop_index] = true;
+            dirty_ = true;
+        }
+    }
+    // 获取订阅者快照（写时复制）：成员变化只打脏标记，下一次发布时才重建快照，
+    // 两次发布之间的一批 join/leave 只重建一次；只重建变化过的分片，其他分片复用旧快照
+    RoomSubscribersPtr getSubscribers() {
+        if (dirty_ || !snapshot_) {
+            auto subscribers = std::make_shared<RoomSubscribers>();
+            subscribers->shards.resize(shards_.size());
+            for (size_t i = 0; i < shards_.size(); i++) {
+                if (!shard_dirty_[i] && snapshot_ && i < snapshot_->shards.size()) {
+                    subscribers->shards[i] = snapshot_->shards[i];
+                } else {
+                    subscribers->shards[i] = std::make_shared<const SubscriberSet>(shards_[i]);
+                    shard_dirty_[i] = false;
+                }
+            }
+            snapshot_ = subscribers;
+            dirty_ = false;
+        }
+        return snapshot_;
+    }
+    size_t getSubscriberCount() const {
+        return subscriber_count_;
+    }
+    // 房间变空的时间，用于空闲回收
+    time_t getIdleSince() const {
+        return idle_since_;
     }
-    void DeleteSubscriber(string userid) {
-        user_ids_.erase(userid);
+    void setIdleSince(time_t idle_since) {
+        idle_since_ = idle_since;
     }
-    std::unordered_set<string> &getSubscribers() {
-        return user_ids_;
+    // 遍历当前所有订阅者
+    template <typename Func>
+    void forEachSubscriber(Func func) const {
+        for (const SubscriberSet &user_ids : shards_) {
+            for (UserHandle userid : user_ids) {
+                func(userid);
+            }
+        }
+    }
+    const string &getRoomId() const {
+        return room_id_;
     }
  private:
     string room_id_;
     string room_topic_;
     string creator_id_;
-    std::unordered_set<string> user_ids_;
+    std::vector<SubscriberSet> shards_; // 当前成员，按 loop 分片（分片内有序），只在 PubSubService 的锁内修改
+    std::vector<bool> shard_dirty_;     // 分片自上次快照后是否变化
+    size_t subscriber_count_ = 0;
+    RoomSubscribersPtr snapshot_;       // 最近一次发布出去的只读快照，回调持有期间不会被修改
+    bool dirty_ = true;
+    time_t idle_since_ = 0;
 };
 
 using RoomTopicPtr = std::shared_ptr<RoomTopic>;
 
-using PubSubCallback = std::function<void(const std::unordered_set<string> user_ids)>;
+using PubSubCallback = std::function<void(const RoomSubscribersPtr &subscribers)>;
+// 房间在本节点创建（created=true）或回收/删除（created=false）时的通知，在 PubSubService 的锁内调用，不能耗时
+using RoomTopicListener = std::function<void(const string &room_id, bool created)>;
 
+// 房间和用户在内部都用 IdInterner 分配的句柄表示，字符串ID只在协议边界转换
 class PubSubService
 {
 public:
@@ -52,57 +144,57 @@ public:
     }
     PubSubService(){}
     ~PubSubService(){}
-    bool AddRoomTopic(const string &room_id, const string &room_topic, string creator_id) {
-        std::lock_guard<std::mutex> lck(room_topic_map_mutex_);
-
-        if (room_topic_map_.find(room_id) != room_topic_map_.end()) {
-            return false;
-        }
-        RoomTopicPtr room_topic_ptr = std::make_shared<RoomTopic>(room_id, room_topic, creator_id);
-        room_topic_map_[room_id] = room_topic_ptr;
-        return true;
-    }
-    void DeleteRoomTopic(const string &room_id) {
-        std::lock_guard<std::mutex> lck(room_topic_map_mutex_);
-        if (room_topic_map_.find(room_id) != room_topic_map_.end()) {
-            return;
-        }
-        room_topic_map_.erase(room_id);
-    }
-    bool AddSubscriber(const string &room_id, string userid) {
-        std::lock_guard<std::mutex> lck(room_topic_map_mutex_);
-        if (room_topic_map_.find(room_id) == room_topic_map_.end()) {
-            return false;
-        }
-        room_topic_map_[room_id]->AddSubscriber(userid);
-        return true;
-    }
-    void DeleteSubscriber(const string &room_id, string userid) {
-        std::lock_guard<std::mutex> lck(room_topic_map_mutex_);
-        if (room_topic_map_.find(room_id) == room_topic_map_.end()) {
-            return;
-        }
-        room_topic_map_[room_id]->DeleteSubscriber(userid);
-    }
-    void PublishMessage(const string &room_id, PubSubCallback callback) {
-        std::unordered_set<string> user_ids;
+    // 显式创建房间；一般不需要调用，第一次订阅时会自动创建
+    bool AddRoomTopic(const string &room_id, const string &room_topic, string creator_id);
+    // 删除房间，同时清理订阅了该房间的用户的反向索引
+    void DeleteRoomTopic(const string &room_id);
+    //订阅房间，同时维护 userid -> 房间 的反向索引，loop_index 是用户连接所属 EventLoop 的序号
+    //房间不存在时创建 RoomTopic，调用方需要先在 RoomCatalog 中确认房间存在
+    //房间句柄在锁内分配，和回收时的释放互斥；返回房间句柄，失败返回 kInvalidHandle
+    RoomHandle AddSubscriber(const string &room_id, UserHandle userid, int loop_index = 0);
+    //退订房间
+    void DeleteSubscriber(RoomHandle room, UserHandle userid);
+    //连接关闭时调用，按反向索引退订该用户加入的所有房间，代价O(加入的房间数)，返回退订的房间数
+    size_t DeleteSubscriberFromAllRooms(UserHandle userid);
+    //获取用户当前订阅的房间
+    std::vector<RoomHandle> GetUserRooms(UserHandle userid);
+    //按 room_id 在锁内查句柄，避免查到句柄后房间被回收、句柄被其他房间复用
+    void PublishMessage(const string &room_id, const PubSubCallback &callback) {
+        RoomSubscribersPtr subscribers;
         {
             std::lock_guard<std::mutex> lck(room_topic_map_mutex_);
-            if (room_topic_map_.find(room_id) == room_topic_map_.end()) {
+            auto it = room_topic_map_.find(IdInterner::Rooms().Find(room_id));
+            if (it == room_topic_map_.end()) {
                 return;
             }
-            user_ids = room_topic_map_[room_id]->getSubscribers();
+            subscribers = it->second->getSubscribers();  // 只增加引用计数
         }
         
-        callback(user_ids);   //这里不能有太多耗时的工作
+        callback(subscribers);   //这里不能有太多耗时的工作
+    }
+    //回收空了超过 grace_seconds 秒的房间，同时释放房间句柄，返回回收的数量；由定时器周期调用
+    //reclaimed_room_ids 非空时带回回收的房间，调用方据此清理房间目录
+    size_t ReclaimIdleRoomTopics(int grace_seconds, std::vector<string> *reclaimed_room_ids = nullptr);
+    size_t GetRoomTopicCount();
+    //需要在服务启动前设置
+    void SetRoomTopicListener(const RoomTopicListener &listener) {
+        room_topic_listener_ = listener;
     }
-    static std::vector<Room> &GetRoomList();  //获取当前的房间列表
 private:
-    std::unordered_map<string, RoomTopicPtr> room_topic_map_;
-    std::mutex room_topic_map_mutex_;
-};
+    // 订阅者数变化后调用，维护空闲房间集合和指标，需要持有 room_topic_map_mutex_
+    void OnSubscriberCountChanged(RoomHandle room, const RoomTopicPtr &room_topic);
 
-//获取固定的房间
+    // 用户的订阅记录：连接所属的 loop 以及已订阅的房间
+    struct UserSubscription {
+        int loop_index = 0;
+        std::vector<RoomHandle> rooms;
+    };
 
+    std::unordered_map<RoomHandle, RoomTopicPtr> room_topic_map_;
+    std::unordered_map<UserHandle, UserSubscription> user_rooms_map_;  //反向索引 userid -> 已订阅的房间
+    std::unordered_set<RoomHandle> idle_rooms_;    //没有订阅者、等待回收的房间，回收时只扫描这里
+    std::mutex room_topic_map_mutex_;   //同时保护 room_topic_map_、user_rooms_map_ 和 idle_rooms_
+    RoomTopicListener room_topic_listener_;
+};
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,219 @@
+#include "room_bus.h"
+
+#include <unistd.h>
+#include <ctime>
+
+#include "hiredis.h"
+#include "async_muduo_adapter.h"
+#include "muduo/base/Logging.h"
+#include "pub_sub_service.h"
+#include "loop_fanout.h"
+#include "monitoring/metrics_collector.h"
+
+extern std::string buildWebSocketFrame(const std::string& payload, uint8_t opcode);
+
+static const string kRoomChannelPrefix = "chatroom:room:";
+static const double kReconnectDelaySeconds = 1.0;
+
+int RoomBus::Init(const string &host, int port) {
+    host_ = host;
+    port_ = port;
+
+    char hostname[64] = {0};
+    gethostname(hostname, sizeof(hostname) - 1);
+    node_id_ = string(hostname) + ":" + std::to_string(getpid()) + ":" + std::to_string(time(NULL));
+
+    loop_ = loop_thread_.startLoop();
+    loop_->runInLoop([this]() {
+        ConnectSubscriber();
+        ConnectPublisher();
+    });
+    enabled_.store(true, std::memory_order_release);
+    LOG_INFO << "room bus started, redis: " << host_ << ":" << port_ << ", node_id: " << node_id_;
+    return 0;
+}
+
+void RoomBus::ConnectSubscriber() {
+    sub_ctx_ = redisAsyncConnect(host_.c_str(), port_);
+    if (!sub_ctx_ || sub_ctx_->err) {
+        LOG_ERROR << "room bus connect subscriber failed: " << (sub_ctx_ ? sub_ctx_->errstr : "alloc failed");
+        if (sub_ctx_) {
+            redisAsyncFree(sub_ctx_);
+            sub_ctx_ = nullptr;
+        }
+        ScheduleReconnect();
+        return;
+    }
+    RedisMuduoAdapter::Attach(loop_, sub_ctx_);
+    redisAsyncSetConnectCallback(sub_ctx_, &RoomBus::OnSubscriberConnect);
+    redisAsyncSetDisconnectCallback(sub_ctx_, &RoomBus::OnSubscriberDisconnect);
+
+    // 重连后重新订阅本地有成员的房间，命令先写进输出缓冲，连上后一起发出
+    for (const string &room_id : subscribed_rooms_) {
+        SendSubscribe(room_id);
+    }
+}
+
+void RoomBus::ConnectPublisher() {
+    pub_ctx_ = redisAsyncConnect(host_.c_str(), port_);
+    if (!pub_ctx_ || pub_ctx_->err) {
+        LOG_ERROR << "room bus connect publisher failed: " << (pub_ctx_ ? pub_ctx_->errstr : "alloc failed");
+        if (pub_ctx_) {
+            redisAsyncFree(pub_ctx_);
+            pub_ctx_ = nullptr;
+        }
+        ScheduleReconnect();
+        return;
+    }
+    RedisMuduoAdapter::Attach(loop_, pub_ctx_);
+    redisAsyncSetConnectCallback(pub_ctx_, &RoomBus::OnPublisherConnect);
+    redisAsyncSetDisconnectCallback(pub_ctx_, &RoomBus::OnPublisherDisconnect);
+}
+
+void RoomBus::ScheduleReconnect() {
+    if (reconnect_pending_) {
+        return;
+    }
+    reconnect_pending_ = true;
+    loop_->runAfter(kReconnectDelaySeconds, [this]() {
+        reconnect_pending_ = false;
+        if (!sub_ctx_) {
+            ConnectSubscriber();
+        }
+        if (!pub_ctx_) {
+            ConnectPublisher();
+        }
+    });
+}
+
+void RoomBus::OnSubscriberConnect(const redisAsyncContext *ac, int status) {
+    if (status != REDIS_OK) {
+        // 连接失败时 hiredis 会释放 context，不再回调 disconnect
+        LOG_ERROR << "room bus subscriber connect failed: " << ac->errstr;
+        RoomBus &bus = RoomBus::GetInstance();
+        bus.sub_ctx_ = nullptr;
+        bus.ScheduleReconnect();
+        return;
+    }
+    LOG_INFO << "room bus subscriber connected";
+}
+
+void RoomBus::OnPublisherConnect(const redisAsyncContext *ac, int status) {
+    if (status != REDIS_OK) {
+        LOG_ERROR << "room bus publisher connect failed: " << ac->errstr;
+        RoomBus &bus = RoomBus::GetInstance();
+        bus.pub_ctx_ = nullptr;
+        bus.ScheduleReconnect();
+        return;
+    }
+    LOG_INFO << "room bus publisher connected";
+}
+
+void RoomBus::OnSubscriberDisconnect(const redisAsyncContext *ac, int status) {
+    LOG_WARN << "room bus subscriber disconnected: " << (status == REDIS_OK ? "by user" : ac->errstr);
+    RoomBus &bus = RoomBus::GetInstance();
+    bus.sub_ctx_ = nullptr;     // context 由 hiredis 释放
+    bus.ScheduleReconnect();
+}
+
+void RoomBus::OnPublisherDisconnect(const redisAsyncContext *ac, int status) {
+    LOG_WARN << "room bus publisher disconnected: " << (status == REDIS_OK ? "by user" : ac->errstr);
+    RoomBus &bus = RoomBus::GetInstance();
+    bus.pub_ctx_ = nullptr;
+    bus.ScheduleReconnect();
+}
+
+void RoomBus::SendSubscribe(const string &room_id) {
+    if (!sub_ctx_) {
+        return;     // 重连时会重新订阅
+    }
+    string channel = kRoomChannelPrefix + room_id;
+    redisAsyncCommand(sub_ctx_, &RoomBus::OnSubscribeReply, nullptr, "SUBSCRIBE %b",
+                      channel.data(), channel.size());
+}
+
+void RoomBus::SubscribeRoom(const string &room_id) {
+    if (!IsEnabled()) {
+        return;
+    }
+    loop_->runInLoop([this, room_id]() {
+        if (subscribed_rooms_.insert(room_id).second) {
+            SendSubscribe(room_id);
+        }
+    });
+}
+
+void RoomBus::UnsubscribeRoom(const string &room_id) {
+    if (!IsEnabled()) {
+        return;
+    }
+    loop_->runInLoop([this, room_id]() {
+        if (subscribed_rooms_.erase(room_id) == 0 || !sub_ctx_) {
+            return;
+        }
+        string channel = kRoomChannelPrefix + room_id;
+        redisAsyncCommand(sub_ctx_, nullptr, nullptr, "UNSUBSCRIBE %b", channel.data(), channel.size());
+    });
+}
+
+void RoomBus::Publish(const string &room_id, const string &sender_userid, const string &payload) {
+    if (!IsEnabled()) {
+        return;
+    }
+    // 消息格式: node_id|sender_userid|payload，在调用线程里拼好，loop 线程只负责发送
+    string channel = kRoomChannelPrefix + room_id;
+    string data;
+    data.reserve(node_id_.size() + sender_userid.size() + payload.size() + 2);
+    data.append(node_id_).append("|").append(sender_userid).append("|").append(payload);
+
+    loop_->runInLoop([this, channel = std::move(channel), data = std::move(data)]() {
+        if (!pub_ctx_) {
+            MetricsCollector::GetInstance().IncrementRedisOp("room_bus_publish", false);
+            return;
+        }
+        redisAsyncCommand(pub_ctx_, &RoomBus::OnPublishReply, nullptr, "PUBLISH %b %b",
+                          channel.data(), channel.size(), data.data(), data.size());
+    });
+}
+
+void RoomBus::OnPublishReply(redisAsyncContext *ac, void *reply, void *privdata) {
+    redisReply *r = static_cast<redisReply *>(reply);
+    bool success = r && r->type != REDIS_REPLY_ERROR;
+    MetricsCollector::GetInstance().IncrementRedisOp("room_bus_publish", success);
+}
+
+void RoomBus::OnSubscribeReply(redisAsyncContext *ac, void *reply, void *privdata) {
+    redisReply *r = static_cast<redisReply *>(reply);
+    if (!r || r->type != REDIS_REPLY_ARRAY || r->elements != 3) {
+        return;
+    }
+    // 订阅确认 ["subscribe", channel, count] 也会走这里，只处理 ["message", channel, data]
+    redisReply *type = r->element[0];
+    if (type->type != REDIS_REPLY_STRING || string(type->str, type->len) != "message") {
+        return;
+    }
+    RoomBus::GetInstance().HandleMessage(string(r->element[1]->str, r->element[1]->len),
+                                         string(r->element[2]->str, r->element[2]->len));
+}
+
+void RoomBus::HandleMessage(const string &channel, const string &data) {
+    size_t node_end = data.find('|');
+    size_t sender_end = node_end == string::npos ? string::npos : data.find('|', node_end + 1);
+    if (sender_end == string::npos || channel.compare(0, kRoomChannelPrefix.size(), kRoomChannelPrefix) != 0) {
+        MetricsCollector::GetInstance().IncrementRedisOp("room_bus_receive", false);
+        return;
+    }
+    if (data.compare(0, node_end, node_id_) == 0 && node_end == node_id_.size()) {
+        return;     // 自己发出的消息，本地已经推送过
+    }
+
+    string room_id = channel.substr(kRoomChannelPrefix.size());
+    UserHandle sender_handle = IdInterner::Users().Find(data.substr(node_end + 1, sender_end - node_end - 1));
+    MetricsCollector::GetInstance().IncrementRedisOp("room_bus_receive", true);
+
+    PubSubService::GetInstance().PublishMessage(room_id,
+        [&](const RoomSubscribersPtr &subscribers) {
+            LoopFanout::GetInstance().Broadcast(subscribers, room_id,
+                buildWebSocketFrame(data.substr(sender_end + 1), 0x01), sender_handle);
+        });
+}
@@ -0,0 +1,69 @@
+#ifndef __ROOM_BUS_H__
+#define __ROOM_BUS_H__
+
+#include <atomic>
+#include <string>
+#include <unordered_set>
+
+#include "async.h"
+#include "muduo/net/EventLoop.h"
+#include "muduo/net/EventLoopThread.h"
+
+using std::string;
+
+// 跨节点房间广播总线（可选，room_bus_enable=1 时启用）
+// 各 comet 节点通过 Redis Pub/Sub 互相转发房间消息，比 Logic→Kafka→Job→gRPC 路径少了几跳：
+//  - 每个节点只订阅本地有 RoomTopic 的房间（创建时订阅，空闲回收时退订）
+//  - 本地发出的消息只 PUBLISH 一次，消息里带上节点ID，收到自己发的消息直接丢弃
+//  - 收到其他节点的消息后走本地 PubSubService + LoopFanout 推送
+// 两个 hiredis 异步连接都挂在总线自己的 EventLoop 线程上；订阅状态的连接不能执行 PUBLISH，所以发布单独一个连接
+class RoomBus
+{
+public:
+    static RoomBus &GetInstance() {
+        static RoomBus instance;
+        return instance;
+    }
+
+    // 启动总线线程并连接 redis，成功返回0
+    int Init(const string &host, int port);
+    bool IsEnabled() const { return enabled_.load(std::memory_order_acquire); }
+
+    // 把本地发出的消息发布给其他节点，可以在任意线程调用
+    void Publish(const string &room_id, const string &sender_userid, const string &payload);
+    // 本地房间创建/回收时调用，可以在任意线程调用
+    void SubscribeRoom(const string &room_id);
+    void UnsubscribeRoom(const string &room_id);
+
+private:
+    RoomBus() {}
+    ~RoomBus() {}
+
+    // 以下只在总线 loop 线程执行
+    void ConnectSubscriber();
+    void ConnectPublisher();
+    void ScheduleReconnect();
+    void SendSubscribe(const string &room_id);
+    void HandleMessage(const string &channel, const string &data);
+
+    static void OnSubscriberConnect(const redisAsyncContext *ac, int status);
+    static void OnPublisherConnect(const redisAsyncContext *ac, int status);
+    static void OnSubscriberDisconnect(const redisAsyncContext *ac, int status);
+    static void OnPublisherDisconnect(const redisAsyncContext *ac, int status);
+    static void OnSubscribeReply(redisAsyncContext *ac, void *reply, void *privdata);
+    static void OnPublishReply(redisAsyncContext *ac, void *reply, void *privdata);
+
+    muduo::net::EventLoopThread loop_thread_;
+    muduo::net::EventLoop *loop_ = nullptr;
+    redisAsyncContext *sub_ctx_ = nullptr;
+    redisAsyncContext *pub_ctx_ = nullptr;
+    std::unordered_set<string> subscribed_rooms_;   // 本节点需要订阅的房间，断线重连后重新订阅
+    bool reconnect_pending_ = false;
+
+    string host_;
+    int port_ = 6379;
+    string node_id_;
+    std::atomic<bool> enabled_{false};
+};
+
+#endif
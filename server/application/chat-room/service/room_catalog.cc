@@ -0,0 +1,255 @@
+#include "room_catalog.h"
+
+#include <functional>
+
+#include "db_pool.h"
+#include "muduo/base/Logging.h"
+
+// 库里没有配置默认房间时使用的内置官方群
+static const std::vector<Room> s_builtin_rooms = {
+    {"0001", "官方1群", 1, "", "", ""},
+    {"0002", "官方2群", 2, "", "", ""},
+    {"0003", "官方3群", 3, "", "", ""},
+    {"0004", "官方4群", 4, "", "", ""},
+    {"0005", "官方5群", 5, "", "", ""}
+};
+
+static const size_t kMaxRoomIdLen = 64;
+
+static void FillRoom(CResultSet *result_set, Room &room) {
+    char *value = result_set->GetString("room_id");
+    room.room_id = value ? value : "";
+    value = result_set->GetString("room_name");
+    room.room_name = value ? value : "";
+    room.creator_id = result_set->GetInt("creator_id");
+    value = result_set->GetString("create_time");
+    room.create_time = value ? value : "";
+    value = result_set->GetString("update_time");
+    room.update_time = value ? value : "";
+}
+
+RoomCatalog::RoomCatalog() : loader_("RoomLoader") {
+    for (int i = 0; i < kShardCount; i++) {
+        shards_[i].rooms = std::make_shared<const RoomMap>();
+    }
+    default_rooms_ = std::make_shared<const std::vector<Room>>();
+}
+
+RoomCatalog::Shard &RoomCatalog::GetShard(const string &room_id) {
+    return shards_[std::hash<string>()(room_id) % kShardCount];
+}
+
+bool RoomCatalog::FindInSnapshot(const string &room_id, Room &room) {
+    RoomMapPtr rooms = std::atomic_load(&GetShard(room_id).rooms);
+    auto it = rooms->find(room_id);
+    if (it == rooms->end()) {
+        return false;
+    }
+    room = it->second;
+    return true;
+}
+
+void RoomCatalog::InsertRoom(const Room &room) {
+    Shard &shard = GetShard(room.room_id);
+    std::lock_guard<std::mutex> lock(shard.write_mutex);
+    RoomMapPtr old_rooms = std::atomic_load(&shard.rooms);
+    auto new_rooms = std::make_shared<RoomMap>(*old_rooms);
+    bool inserted = new_rooms->insert_or_assign(room.room_id, room).second;
+    std::atomic_store(&shard.rooms, RoomMapPtr(std::move(new_rooms)));
+    if (inserted) {
+        room_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+    version_.fetch_add(1, std::memory_order_release);
+}
+
+void RoomCatalog::RemoveRoom(const string &room_id) {
+    Shard &shard = GetShard(room_id);
+    std::lock_guard<std::mutex> lock(shard.write_mutex);
+    RoomMapPtr old_rooms = std::atomic_load(&shard.rooms);
+    if (old_rooms->find(room_id) == old_rooms->end()) {
+        return;
+    }
+    auto new_rooms = std::make_shared<RoomMap>(*old_rooms);
+    new_rooms->erase(room_id);
+    std::atomic_store(&shard.rooms, RoomMapPtr(std::move(new_rooms)));
+    room_count_.fetch_sub(1, std::memory_order_relaxed);
+    version_.fetch_add(1, std::memory_order_release);
+}
+
+void RoomCatalog::EvictRoom(const string &room_id) {
+    if (IsDefaultRoom(room_id)) {
+        return;
+    }
+    RemoveRoom(room_id);
+}
+
+bool RoomCatalog::IsDefaultRoom(const string &room_id) const {
+    std::shared_ptr<const std::vector<Room>> default_rooms = GetDefaultRooms();
+    for (const Room &room : *default_rooms) {
+        if (room.room_id == room_id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int RoomCatalog::LoadDefaultRooms() {
+    std::vector<Room> default_rooms;
+
+    CDBManager *db_manager = CDBManager::getInstance();
+    CDBConn *db_conn = db_manager->GetDBConn("chatroom_slave");
+    AUTO_REL_DBCONN(db_manager, db_conn);
+    if (db_conn) {
+        CResultSet *result_set = db_conn->ExecuteQuery(
+            "select room_id, room_name, creator_id, create_time, update_time from rooms where is_default=1");
+        while (result_set && result_set->Next()) {
+            Room room;
+            FillRoom(result_set, room);
+            room.history_last_message_id = "";
+            default_rooms.push_back(room);
+        }
+        delete result_set;
+    } else {
+        LOG_ERROR << "GetDBConn(chatroom_slave) failed";
+    }
+
+    if (default_rooms.empty()) {
+        LOG_WARN << "no default rooms in mysql, use builtin rooms";
+        default_rooms = s_builtin_rooms;
+    }
+
+    for (const Room &room : default_rooms) {
+        InsertRoom(room);
+        LOG_INFO << "default room: " << room.room_id << " - " << room.room_name;
+    }
+    std::atomic_store(&default_rooms_,
+                      std::shared_ptr<const std::vector<Room>>(
+                          std::make_shared<const std::vector<Room>>(std::move(default_rooms))));
+    version_.fetch_add(1, std::memory_order_release);
+    return 0;
+}
+
+std::shared_ptr<const std::vector<Room>> RoomCatalog::GetDefaultRooms() const {
+    return std::atomic_load(&default_rooms_);
+}
+
+void RoomCatalog::StartLoader(int num_threads) {
+    if (num_threads > 0) {
+        loader_.start(num_threads);
+    }
+}
+
+void RoomCatalog::StopLoader() {
+    loader_.stop();
+}
+
+void RoomCatalog::GetRoomAsync(const string &room_id, muduo::net::EventLoop *loop, RoomCallback callback) {
+    Room room;
+    if (room_id.empty() || room_id.size() > kMaxRoomIdLen) {
+        callback(false, room);
+        return;
+    }
+    if (FindInSnapshot(room_id, room)) {
+        callback(true, room);
+        return;
+    }
+    if (IsKnownMissing(room_id)) {
+        callback(false, room);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(loading_mutex_);
+        std::vector<PendingCallback> &pending = loading_rooms_[room_id];
+        pending.push_back({loop, std::move(callback)});
+        if (pending.size() > 1) {
+            return;     // 已经在查库，查完一起回调
+        }
+    }
+    // 没有启动线程池时 run 在当前线程内执行
+    loader_.run(std::bind(&RoomCatalog::LoadRoom, this, room_id));
+}
+
+void RoomCatalog::LoadRoom(const string &room_id) {
+    Room room;
+    bool found = FindInSnapshot(room_id, room);
+    if (!found) {
+        int ret = LoadRoomFromDB(room_id, room);
+        if (ret == 1) {
+            InsertRoom(room);
+            found = true;
+        } else if (ret == 0) {
+            MarkMissing(room_id);
+        }
+    }
+
+    std::vector<PendingCallback> pending;
+    {
+        std::lock_guard<std::mutex> lock(loading_mutex_);
+        auto it = loading_rooms_.find(room_id);
+        if (it != loading_rooms_.end()) {
+            pending.swap(it->second);
+            loading_rooms_.erase(it);
+        }
+    }
+    for (PendingCallback &pending_callback : pending) {
+        if (pending_callback.loop) {
+            pending_callback.loop->queueInLoop(
+                [callback = std::move(pending_callback.callback), found, room]() { callback(found, room); });
+        } else {
+            pending_callback.callback(found, room);
+        }
+    }
+}
+
+int RoomCatalog::LoadRoomFromDB(const string &room_id, Room &room) {
+    CDBManager *db_manager = CDBManager::getInstance();
+    CDBConn *db_conn = db_manager->GetDBConn("chatroom_slave");
+    AUTO_REL_DBCONN(db_manager, db_conn);
+    if (!db_conn) {
+        LOG_ERROR << "GetDBConn(chatroom_slave) failed";
+        return -1;
+    }
+
+    // room_id 来自客户端，先转义
+    char escaped_room_id[kMaxRoomIdLen * 2 + 1];
+    mysql_real_escape_string(db_conn->GetMysql(), escaped_room_id, room_id.c_str(), room_id.size());
+    string str_sql = FormatString(
+        "select room_id, room_name, creator_id, create_time, update_time from rooms where room_id='%s'",
+        escaped_room_id);
+    CResultSet *result_set = db_conn->ExecuteQuery(str_sql.c_str());
+    if (!result_set) {
+        LOG_ERROR << "load room failed, room_id: " << room_id;
+        return -1;
+    }
+
+    int ret = 0;
+    if (result_set->Next()) {
+        FillRoom(result_set, room);
+        room.history_last_message_id = "";
+        ret = 1;
+    }
+    delete result_set;
+    return ret;
+}
+
+bool RoomCatalog::IsKnownMissing(const string &room_id) {
+    std::lock_guard<std::mutex> lock(missing_mutex_);
+    auto it = missing_rooms_.find(room_id);
+    if (it == missing_rooms_.end()) {
+        return false;
+    }
+    if (time(NULL) - it->second >= kMissingRoomTtl) {
+        missing_rooms_.erase(it);
+        return false;
+    }
+    return true;
+}
+
+void RoomCatalog::MarkMissing(const string &room_id) {
+    std::lock_guard<std::mutex> lock(missing_mutex_);
+    if (missing_rooms_.size() >= kMaxMissingRooms) {
+        missing_rooms_.clear();     // 只是防止反复查库的缓存，满了直接清空
+    }
+    missing_rooms_[room_id] = time(NULL);
+}
@@ -0,0 +1,98 @@
+#ifndef __ROOM_CATALOG_H__
+#define __ROOM_CATALOG_H__
+
+#include <atomic>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "api_types.h"
+#include "muduo/base/ThreadPool.h"
+#include "muduo/net/EventLoop.h"
+
+using std::string;
+
+// 房间目录：room_id -> Room，数据来自 MySQL，按需加载
+// 目录按 room_id 哈希分片，每个分片是一个不可变的只读快照，读路径只原子加载一次 shared_ptr，不加全局锁；
+// 写路径（加载新房间、删除房间）只对所在分片写时复制，十万级房间时单次写入也只拷贝一个分片
+// 每次发布新快照时目录版本号加1
+// 快照未命中时在加载线程池里查库，不占用 IO 线程；按需加载的房间在 RoomTopic 被回收时从目录移除（默认房间常驻）
+class RoomCatalog
+{
+public:
+    // found 为false表示房间不存在或查询失败
+    typedef std::function<void(bool found, const Room &room)> RoomCallback;
+
+    static const int kShardCount = 64;
+    static const int kMissingRoomTtl = 30;      // 不存在的房间在这段时间（秒）内不重复查库
+    static const size_t kMaxMissingRooms = 10000;
+
+    static RoomCatalog &GetInstance() {
+        static RoomCatalog instance;
+        return instance;
+    }
+
+    // 启动时加载默认房间（握手时自动订阅），库里没有配置则使用内置的官方群
+    int LoadDefaultRooms();
+    // 启动按需加载的线程池，num_threads 为0时在调用线程内同步查库
+    void StartLoader(int num_threads);
+    void StopLoader();
+    // 查找房间：快照命中时在调用线程内直接回调；未命中时在加载线程查 MySQL，查完在 loop 线程回调
+    // （loop 为NULL时在加载线程回调），同一个房间同时只查一次库
+    void GetRoomAsync(const string &room_id, muduo::net::EventLoop *loop, RoomCallback callback);
+    // 默认房间列表的只读快照，调用方持有期间不会被修改
+    std::shared_ptr<const std::vector<Room>> GetDefaultRooms() const;
+    // 房间被删除时从目录移除
+    void RemoveRoom(const string &room_id);
+    // 本节点不再使用该房间（RoomTopic 被回收）时移除按需加载的条目，默认房间保留
+    void EvictRoom(const string &room_id);
+
+    uint64_t GetVersion() const { return version_.load(std::memory_order_acquire); }
+    size_t Size() const { return room_count_.load(std::memory_order_relaxed); }
+
+private:
+    using RoomMap = std::unordered_map<string, Room>;
+    using RoomMapPtr = std::shared_ptr<const RoomMap>;
+
+    struct Shard {
+        RoomMapPtr rooms;           // 只读快照，用 std::atomic_load/atomic_store 访问
+        std::mutex write_mutex;     // 只串行化同一分片的写
+    };
+
+    RoomCatalog();
+    ~RoomCatalog() {}
+
+    struct PendingCallback {
+        muduo::net::EventLoop *loop;
+        RoomCallback callback;
+    };
+
+    Shard &GetShard(const string &room_id);
+    bool FindInSnapshot(const string &room_id, Room &room);
+    // 在加载线程执行：查库、写入快照，然后回调所有等待这个房间的调用方
+    void LoadRoom(const string &room_id);
+    bool IsDefaultRoom(const string &room_id) const;
+    void InsertRoom(const Room &room);
+    // 从 MySQL 加载单个房间：1 存在，0 不存在，-1 查询失败
+    int LoadRoomFromDB(const string &room_id, Room &room);
+    bool IsKnownMissing(const string &room_id);
+    void MarkMissing(const string &room_id);
+
+    Shard shards_[kShardCount];
+    std::shared_ptr<const std::vector<Room>> default_rooms_;
+    std::atomic<uint64_t> version_{0};
+    std::atomic<size_t> room_count_{0};
+
+    std::mutex missing_mutex_;  // 只在快照未命中（要查库）时才会用到
+    std::unordered_map<string, time_t> missing_rooms_;
+
+    muduo::ThreadPool loader_;
+    std::mutex loading_mutex_;
+    std::unordered_map<string, std::vector<PendingCallback>> loading_rooms_;  // 正在查库的房间和等待的回调
+};
+
+#endif
@@ -0,0 +1,220 @@
+#include "session_cache.h"
+
+#include "hiredis.h"
+#include "async_muduo_adapter.h"
+#include "muduo/base/Logging.h"
+#include "monitoring/metrics_collector.h"
+
+static const char *kInvalidateChannel = "__redis__:invalidate";
+static const double kReconnectDelaySeconds = 1.0;
+static const int kTrackedTtlSeconds = 3600;    // 跟踪模式下的兜底有效期，防止漏掉的失效消息让缓存永久不更新
+
+int SessionCache::Init(CachePool *token_pool, const SessionCacheOptions &options) {
+    if (!token_pool) {
+        LOG_ERROR << "session cache needs the token cache pool";
+        return -1;
+    }
+    token_pool_ = token_pool;
+    options_ = options;
+
+    loop_ = loop_thread_.startLoop();
+    loop_->runInLoop([this]() { Connect(); });
+    enabled_.store(true, std::memory_order_release);
+    LOG_INFO << "session cache started, redis: " << token_pool_->GetServerIP() << ":" << token_pool_->GetServerPort()
+             << ", max_entries: " << options_.max_entries;
+    return 0;
+}
+
+bool SessionCache::Get(const string &token, SessionInfo &info) {
+    if (!IsEnabled() || mode_.load(std::memory_order_acquire) == MODE_OFF) {
+        return false;
+    }
+    Shard &shard = GetShard(token);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.entries.find(token);
+        if (it != shard.entries.end()) {
+            if (std::chrono::steady_clock::now() < it->second.expire_time) {
+                info = it->second.info;
+                MetricsCollector::GetInstance().IncrementCounter("token_cache", "hit");
+                return true;
+            }
+            shard.entries.erase(it);
+        }
+    }
+    MetricsCollector::GetInstance().IncrementCounter("token_cache", "miss");
+    return false;
+}
+
+void SessionCache::Put(const string &token, const SessionInfo &info, uint64_t epoch, CacheConn *cache_conn) {
+    int mode = mode_.load(std::memory_order_acquire);
+    if (!IsEnabled() || mode == MODE_OFF) {
+        return;
+    }
+    // 读 token 的连接没有开启跟踪，之后的修改收不到失效消息
+    if (mode == MODE_TRACKING && !token_pool_->IsConnCommandApplied(cache_conn)) {
+        return;
+    }
+    int ttl_seconds = mode == MODE_TRACKING ? kTrackedTtlSeconds : options_.fallback_ttl_seconds;
+    Shard &shard = GetShard(token);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    // 在锁内比较版本号：失效消息在同一把锁内删除，版本号没变说明读到的值之后没有被修改过
+    if (epoch != epoch_.load(std::memory_order_acquire)) {
+        return;
+    }
+    if (shard.entries.size() >= options_.max_entries / kShardCount + 1) {
+        shard.entries.erase(shard.entries.begin());
+    }
+    shard.entries[token] = {info, std::chrono::steady_clock::now() + std::chrono::seconds(ttl_seconds)};
+}
+
+void SessionCache::Invalidate(const string &token) {
+    Shard &shard = GetShard(token);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    epoch_++;
+    shard.entries.erase(token);
+}
+
+void SessionCache::Clear() {
+    for (Shard &shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        epoch_++;
+        shard.entries.clear();
+    }
+}
+
+void SessionCache::SetMode(Mode mode) {
+    Clear();
+    mode_.store(mode, std::memory_order_release);
+    epoch_++;
+}
+
+void SessionCache::Connect() {
+    ctx_ = redisAsyncConnect(token_pool_->GetServerIP(), token_pool_->GetServerPort());
+    if (!ctx_ || ctx_->err) {
+        LOG_ERROR << "session cache connect failed: " << (ctx_ ? ctx_->errstr : "alloc failed");
+        if (ctx_) {
+            redisAsyncFree(ctx_);
+            ctx_ = nullptr;
+        }
+        ScheduleReconnect();
+        return;
+    }
+    RedisMuduoAdapter::Attach(loop_, ctx_);
+    redisAsyncSetConnectCallback(ctx_, &SessionCache::OnConnect);
+    redisAsyncSetDisconnectCallback(ctx_, &SessionCache::OnDisconnect);
+
+    // 先取本连接的 ID，订阅成功后让 token 连接池的连接把失效消息重定向到这里
+    string password = token_pool_->GetPassword();
+    if (!password.empty()) {
+        redisAsyncCommand(ctx_, nullptr, nullptr, "AUTH %b", password.data(), password.size());
+    }
+    redisAsyncCommand(ctx_, &SessionCache::OnClientIdReply, nullptr, "CLIENT ID");
+}
+
+void SessionCache::ScheduleReconnect() {
+    if (reconnect_pending_) {
+        return;
+    }
+    reconnect_pending_ = true;
+    loop_->runAfter(kReconnectDelaySeconds, [this]() {
+        reconnect_pending_ = false;
+        if (!ctx_) {
+            Connect();
+        }
+    });
+}
+
+void SessionCache::OnConnect(const redisAsyncContext *ac, int status) {
+    if (status != REDIS_OK) {
+        // 连接失败时 hiredis 会释放 context，不再回调 disconnect
+        LOG_ERROR << "session cache connect failed: " << ac->errstr;
+        SessionCache &cache = SessionCache::GetInstance();
+        cache.ctx_ = nullptr;
+        cache.ScheduleReconnect();
+        return;
+    }
+    LOG_INFO << "session cache invalidation connection connected";
+}
+
+void SessionCache::OnDisconnect(const redisAsyncContext *ac, int status) {
+    LOG_WARN << "session cache disconnected: " << (status == REDIS_OK ? "by user" : ac->errstr);
+    SessionCache &cache = SessionCache::GetInstance();
+    cache.ctx_ = nullptr;     // context 由 hiredis 释放
+    // 断线期间的失效消息会丢失，重新订阅之前不再使用缓存
+    if (cache.mode_.load() == MODE_TRACKING) {
+        cache.SetMode(MODE_OFF);
+    }
+    cache.ScheduleReconnect();
+}
+
+void SessionCache::OnClientIdReply(redisAsyncContext *ac, void *reply, void *privdata) {
+    redisReply *r = static_cast<redisReply *>(reply);
+    SessionCache &cache = SessionCache::GetInstance();
+    if (!r) {
+        return;     // 断线，等待重连
+    }
+    if (r->type != REDIS_REPLY_INTEGER) {
+        LOG_WARN << "session cache: CLIENT ID not supported, fall back to "
+                 << cache.options_.fallback_ttl_seconds << "s ttl";
+        cache.SetMode(MODE_TTL);
+        return;
+    }
+    // 订阅确认和之后的失效消息都回调 OnInvalidateMessage，privdata 带着本连接的 ID
+    void *privdata_client_id = reinterpret_cast<void *>(static_cast<intptr_t>(r->integer));
+    redisAsyncCommand(ac, &SessionCache::OnInvalidateMessage, privdata_client_id, "SUBSCRIBE %s", kInvalidateChannel);
+}
+
+void SessionCache::EnableTracking(long long client_id) {
+    token_pool_->SetConnCommand({"CLIENT", "TRACKING", "on", "REDIRECT", std::to_string(client_id)});
+
+    // 取一个连接试一下，出错说明 Redis 不支持 CLIENT TRACKING
+    CacheConn *cache_conn = token_pool_->GetCacheConn();
+    if (!cache_conn) {
+        // 断开重连，重连后再试
+        LOG_ERROR << "session cache: get token conn failed";
+        if (ctx_) {
+            redisAsyncDisconnect(ctx_);
+        }
+        return;
+    }
+    bool tracking = token_pool_->IsConnCommandApplied(cache_conn);
+    token_pool_->RelCacheConn(cache_conn);
+    if (tracking) {
+        SetMode(MODE_TRACKING);
+        LOG_INFO << "session cache tracking enabled, redirect to client " << client_id;
+    } else {
+        token_pool_->SetConnCommand({});
+        SetMode(MODE_TTL);
+        LOG_WARN << "session cache: CLIENT TRACKING not supported, fall back to "
+                 << options_.fallback_ttl_seconds << "s ttl";
+    }
+}
+
+void SessionCache::OnInvalidateMessage(redisAsyncContext *ac, void *reply, void *privdata) {
+    redisReply *r = static_cast<redisReply *>(reply);
+    if (!r || r->type != REDIS_REPLY_ARRAY || r->elements != 3) {
+        return;
+    }
+    SessionCache &cache = SessionCache::GetInstance();
+    redisReply *type = r->element[0];
+    string type_str(type->str, type->len);
+    if (type_str == "subscribe") {
+        cache.EnableTracking(static_cast<long long>(reinterpret_cast<intptr_t>(privdata)));
+        return;
+    }
+    if (type_str != "message") {
+        return;
+    }
+    // 消息内容是失效的 key 数组；FLUSHDB/FLUSHALL 时为空
+    redisReply *keys = r->element[2];
+    if (keys->type != REDIS_REPLY_ARRAY) {
+        cache.Clear();
+        MetricsCollector::GetInstance().IncrementCounter("token_cache", "flush");
+        return;
+    }
+    for (size_t i = 0; i < keys->elements; i++) {
+        cache.Invalidate(string(keys->element[i]->str, keys->element[i]->len));
+    }
+    MetricsCollector::GetInstance().IncrementCounter("token_cache", "invalidate");
+}
@@ -0,0 +1,105 @@
+#ifndef __SESSION_CACHE_H__
+#define __SESSION_CACHE_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "async.h"
+#include "cache_pool.h"
+#include "muduo/net/EventLoop.h"
+#include "muduo/net/EventLoopThread.h"
+
+using std::string;
+
+// token 对应的用户信息
+struct SessionInfo {
+    string email;
+    string username;
+    int32_t userid = 0;
+};
+
+struct SessionCacheOptions {
+    size_t max_entries = 100000;        // 本地最多缓存的 token 数
+    int fallback_ttl_seconds = 5;       // Redis 不支持 CLIENT TRACKING 时本地缓存的有效期
+};
+
+// comet 本地的 token -> 用户信息缓存（可选，token_cache_enable=1 时启用）
+// 第一次校验 token 时查 Redis（GET token）和 MySQL（users），之后同一个 token 的校验不再有网络请求
+// 失效通过 Redis 6 的 CLIENT TRACKING（RESP2 重定向方式）：
+//  - 一个专用异步连接 SUBSCRIBE __redis__:invalidate，token 连接池的每个连接执行 CLIENT TRACKING on REDIRECT <id>
+//  - token 被删除、覆盖、过期或淘汰时 Redis 推送失效消息，本地立即删掉；FLUSHDB 时清空
+//  - 失效连接断开期间不读缓存，重连后清空重建（断线期间的失效消息已经丢失）
+// Redis 不支持 CLIENT TRACKING（6.0 以前）时退化为短有效期缓存，撤销最多延迟 fallback_ttl_seconds
+class SessionCache
+{
+public:
+    static SessionCache &GetInstance() {
+        static SessionCache instance;
+        return instance;
+    }
+
+    // token_pool 为 token 所在的连接池，成功返回0
+    int Init(CachePool *token_pool, const SessionCacheOptions &options);
+    bool IsEnabled() const { return enabled_.load(std::memory_order_acquire); }
+
+    // 命中返回true
+    bool Get(const string &token, SessionInfo &info);
+    // 查询开始前调用，取得的版本号传给 Put
+    uint64_t GetEpoch() const { return epoch_.load(std::memory_order_acquire); }
+    // 从 cache_conn（token 连接池的连接）读到 token 之后调用；查询期间发生过失效、或者这个连接没有开启跟踪时不缓存
+    void Put(const string &token, const SessionInfo &info, uint64_t epoch, CacheConn *cache_conn);
+
+private:
+    struct Entry {
+        SessionInfo info;
+        std::chrono::steady_clock::time_point expire_time;
+    };
+    // 按 token 哈希分段加锁，并发校验互不阻塞
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<string, Entry> entries;
+    };
+    static const int kShardCount = 16;
+
+    enum Mode {
+        MODE_OFF = 0,       // 失效连接还没就绪，不读写缓存
+        MODE_TRACKING,      // 依靠失效消息，缓存长期有效
+        MODE_TTL,           // 不支持 CLIENT TRACKING，短有效期
+    };
+
+    SessionCache() {}
+    ~SessionCache() {}
+
+    Shard &GetShard(const string &token) { return shards_[std::hash<string>()(token) % kShardCount]; }
+    void Invalidate(const string &token);
+    void Clear();
+    void SetMode(Mode mode);
+
+    // 以下只在失效连接的 loop 线程执行
+    void Connect();
+    void ScheduleReconnect();
+    void EnableTracking(long long client_id);
+
+    static void OnConnect(const redisAsyncContext *ac, int status);
+    static void OnDisconnect(const redisAsyncContext *ac, int status);
+    static void OnClientIdReply(redisAsyncContext *ac, void *reply, void *privdata);
+    static void OnInvalidateMessage(redisAsyncContext *ac, void *reply, void *privdata);
+
+    CachePool *token_pool_ = nullptr;
+    SessionCacheOptions options_;
+    Shard shards_[kShardCount];
+    std::atomic<int> mode_{MODE_OFF};
+    std::atomic<uint64_t> epoch_{0};        // 每次失效、清空、切换模式加一
+
+    muduo::net::EventLoopThread loop_thread_;
+    muduo::net::EventLoop *loop_ = nullptr;
+    redisAsyncContext *ctx_ = nullptr;
+    bool reconnect_pending_ = false;
+    std::atomic<bool> enabled_{false};
+};
+
+#endif
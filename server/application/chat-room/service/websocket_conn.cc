@@ -6,6 +6,12 @@
 #include <unordered_map>
 #include "api_types.h"
 #include "pub_sub_service.h"
+#include "loop_fanout.h"
+#include "room_catalog.h"
+#include "history_loader.h"
+#include "room_bus.h"
+#include "api_msg_commit.h"
+#include "msg_id_generator.h"
 #include "api_msg.h"
 #include <jsoncpp/json/json.h>
 #include "base64.h"
@@ -13,11 +19,12 @@
 #include "api_msg.h"
 #include "monitoring/metrics_collector.h"
 #include "http_client.h"
+#include "async_cache_conn.h"
 using namespace muduo;
 using namespace muduo::net;
 
-//key:userid,  value ：websocket的智能指针 基类
-std::unordered_map<string, CHttpConnPtr> s_user_ws_conn_map;
+//key:userid句柄,  value ：websocket的智能指针 基类
+std::unordered_map<UserHandle, CHttpConnPtr> s_user_ws_conn_map;
 std::mutex s_mtx_user_ws_conn_map_;
 
 struct WebSocketFrame {
@@ -138,6 +145,7 @@ CWebSocketConn::CWebSocketConn(const TcpConnectionPtr& conn)
         : CHttpConn(conn)
 {
     LOG_INFO << "构造CWebSocketConn";
+    loop_index_ = LoopFanout::GetInstance().GetLoopIndex(conn->getLoop());
     // 增加活跃 WebSocket 连接数
     MetricsCollector::GetInstance().IncrementActiveConnections();
 }
@@ -148,6 +156,39 @@ CWebSocketConn::~CWebSocketConn() {
     MetricsCollector::GetInstance().DecrementActiveConnections();
 }
 
+// 在 loop 线程内执行：把一个广播批次推送给本 loop 上的订阅者
+// 查连接表只加一次锁，推送在锁外进行，TcpConnection::send 在本线程直接写
+void CWebSocketConn::DeliverBatch(const FanoutBatch &batch) {
+    std::vector<CWebSocketConnPtr> ws_conns;
+    ws_conns.reserve(batch.user_ids->size());
+    {
+        std::lock_guard<std::mutex> lock(s_mtx_user_ws_conn_map_);
+        for (UserHandle user_id : *batch.user_ids) {
+            // 跳过发送者自己，避免重复发送
+            if (user_id == batch.skip_user) {
+                continue;
+            }
+            auto it = s_user_ws_conn_map.find(user_id);
+            if (it != s_user_ws_conn_map.end()) {
+                auto ws_conn = std::dynamic_pointer_cast<CWebSocketConn>(it->second);
+                if (ws_conn) {
+                    ws_conns.push_back(ws_conn);
+                }
+            }
+        }
+    }
+
+    int push_count = 0;  // 统计实际推送数量
+    for (const CWebSocketConnPtr &ws_conn : ws_conns) {
+        if (ws_conn->IsConnected()) {
+            ws_conn->SendMessage(*batch.frame);
+            push_count++;
+        }
+    }
+    // 记录 WebSocket 推送指标
+    MetricsCollector::GetInstance().IncrementWebSocketPush(batch.room_id, push_count);
+}
+
 // 构造 WebSocket 数据帧
 std::string buildWebSocketFrame(const std::string& payload, uint8_t opcode = 0x01) {
     std::string frame;
@@ -231,7 +272,7 @@ int CWebSocketConn::sendHelloMessage() {
         
         // 构造房间列表
         Json::Value rooms_array(Json::arrayValue);
-        for (const auto& room_pair : rooms_map_) {
+        for (auto& room_pair : rooms_map_) {
             Json::Value room_obj;
             room_obj["room_id"] = room_pair.second.room_id;
             room_obj["room_name"] = room_pair.second.room_name;
@@ -261,6 +302,74 @@ int CWebSocketConn::sendHelloMessage() {
     }
 }
 
+// ========== 混合模式：同时发送到 Logic → Kafka → Job ==========
+// 这部分用于离线推送、跨服务器同步和持久化；开启跨节点总线时 Job 回推的 BroadcastRoom 不再推送在线用户
+// 消息写入 Redis 之后在发送者所在的 loop 线程调用，带上最终的消息ID，异步发送，不阻塞 loop
+static void ForwardToLogic(EventLoop *loop, const string &room_id, const string &userid, const string &username,
+                           const Message &msg) {
+    try {
+        // 构造发送到 Logic 的请求
+        Json::Value logic_request;
+        logic_request["roomId"] = room_id;
+        logic_request["userId"] = std::stoi(userid);  // Logic 期望 int 类型
+        logic_request["userName"] = username;
+
+        Json::Value messages_array(Json::arrayValue);
+        Json::Value message_obj;
+        message_obj["id"] = msg.id;     // Logic/Job 使用和 Redis、MySQL 相同的消息ID
+        message_obj["content"] = msg.content;
+        messages_array.append(message_obj);
+        logic_request["messages"] = messages_array;
+
+        Json::StreamWriterBuilder logic_writer;
+        logic_writer.settings_["indentation"] = "";
+        std::string logic_json = Json::writeString(logic_writer, logic_request);
+
+        // 异步发送到 Logic 服务（不阻塞）
+        auto http_client = std::make_shared<HttpClient>(loop);
+        http_client->AsyncPost("localhost", 8090, "/logic/send", logic_json,
+            [room_id, userid](bool success, const std::string& response) {
+                if (success) {
+                    LOG_INFO << "Successfully sent message to Logic service for room " << room_id;
+                    MetricsCollector::GetInstance().IncrementCounter("logic_forward", "success");
+                } else {
+                    LOG_WARN << "Failed to send message to Logic service for room " << room_id 
+                             << ", user " << userid << ". Response: " << response;
+                    MetricsCollector::GetInstance().IncrementCounter("logic_forward", "failed");
+                }
+            });
+
+        LOG_DEBUG << "Async request to Logic service initiated";
+    } catch (const std::exception& e) {
+        LOG_ERROR << "Exception in ForwardToLogic: " << e.what();
+    }
+}
+// ========== 混合模式结束 ==========
+
+// 写入 Redis 时消息ID被重新分配（其他节点已经在同一房间写入了更大的ID）：消息已经按本地生成的ID广播过，
+// 通知房间内所有客户端（包括发送者和其他节点上的订阅者）改用 Redis 中的ID，和历史记录、Logic、Job 保持一致
+// 可以在任意线程调用
+static void BroadcastMessageIdChange(const string &room_id, const string &old_id, const string &new_id) {
+    Json::Value change_msg;
+    Json::Value change_payload;
+    change_payload["room_id"] = room_id;
+    change_payload["old_id"] = old_id;
+    change_payload["new_id"] = new_id;
+    change_msg["type"] = "messageIdChanged";
+    change_msg["payload"] = change_payload;
+
+    Json::StreamWriterBuilder writer_builder;
+    writer_builder.settings_["indentation"] = "";
+    std::string change_json = Json::writeString(writer_builder, change_msg);
+
+    PubSubService::GetInstance().PublishMessage(room_id,
+        [&change_json, &room_id](const RoomSubscribersPtr &subscribers) {
+            LoopFanout::GetInstance().Broadcast(subscribers, room_id,
+                buildWebSocketFrame(change_json), IdInterner::kInvalidHandle);
+        });
+    RoomBus::GetInstance().Publish(room_id, "", change_json);
+}
+
 int CWebSocketConn::handleClientMessages(Json::Value &root) {
     // 创建延迟计时器
     MetricsCollector::LatencyTimer timer(MetricsCollector::GetInstance(), "/ws/clientMessages");
@@ -296,163 +405,35 @@ int CWebSocketConn::handleClientMessages(Json::Value &root) {
             msg.user_id = userid_;
             msg.timestamp = static_cast<uint64_t>(time(nullptr)); // 使用服务器时间戳（秒）
             
-            // 存储消息到Redis（使用分级存储）
-            std::vector<Message> msgs;
-            msgs.push_back(msg);
-            
-            int store_result = ApiStoreMessageTiered(room_id, msgs);
-            if (store_result != 0) {
-                LOG_ERROR << "Failed to store message for room: " << room_id;
-                MetricsCollector::GetInstance().IncrementErrorCount("redis_store_failed", "/ws/clientMessages");
-                return -1;
-            }
-            
-            // 记录 Redis 操作成功
-            MetricsCollector::GetInstance().IncrementRedisOp("store_message", true);
-            
-            // 获取存储后的消息ID
-            msg.id = msgs[0].id;
-            LOG_INFO << "Message stored with ID: " << msg.id;
-            
-            // 通过PubSub广播消息给房间内的其他用户
-            Json::Value broadcast_msg;
-            Json::Value broadcast_payload;
-            
-            broadcast_payload["id"] = msg.id;
-            broadcast_payload["content"] = msg.content;
-            broadcast_payload["timestamp"] = (Json::UInt64)msg.timestamp;
-            broadcast_payload["room_id"] = room_id;
-            
-            // 构造完整的用户对象
-            Json::Value user_obj;
-            string broadcast_username;
-            string broadcast_avatar;
-            
-            // 查询当前用户信息
-            if (ApiGetUserInfoById(userid_, broadcast_username, broadcast_avatar) == 0) {
-                user_obj["id"] = userid_;
-                user_obj["username"] = broadcast_username;
-                user_obj["avatar"] = broadcast_avatar;
-            } else {
-                // 用户信息查询失败时的默认值
-                user_obj["id"] = userid_.empty() ? "0" : userid_;
-                user_obj["username"] = "未知用户";
-                user_obj["avatar"] = "/img/default.png";
-            }
-            
-            broadcast_payload["user"] = user_obj;
-            
-            broadcast_msg["type"] = "serverMessages";
-            broadcast_msg["payload"] = broadcast_payload;
-            
-            Json::StreamWriterBuilder writer_builder;
-            writer_builder.settings_["indentation"] = "";
-            std::string broadcast_json = Json::writeString(writer_builder, broadcast_msg);
-            
-            // 打印即将广播的消息内容
-            LOG_INFO << "准备广播的消息内容: " << broadcast_json;
-            
-            // 广播给房间内的所有用户
-            LOG_INFO << "开始广播消息，房间ID: " << room_id;
-            
-            PubSubService::GetInstance().PublishMessage(room_id, 
-                [broadcast_json, room_id, sender_userid = userid_](const std::unordered_set<string> user_ids) {
-                    LOG_INFO << "房间 " << room_id << " 中的订阅用户数量: " << user_ids.size();
-                    
-                    // 打印所有订阅用户的ID
-                    for (const auto& user_id : user_ids) {
-                        LOG_INFO << "房间订阅用户ID: " << user_id;
-                    }
-                    
-                    // 检查连接映射表中的用户
-                    LOG_INFO << "检查全局连接映射表...";
-                    {
-                        std::lock_guard<std::mutex> lock(s_mtx_user_ws_conn_map_);
-                        LOG_INFO << "全局连接映射表中的用户数量: " << s_user_ws_conn_map.size();
-                        for (const auto& conn_pair : s_user_ws_conn_map) {
-                            LOG_INFO << "连接映射表中的用户ID: " << conn_pair.first;
-                        }
-                    }
-                    
-                    // 构建WebSocket帧
-                    string frame = buildWebSocketFrame(broadcast_json);
-                    
-                    int push_count = 0;  // 统计实际推送数量
-                    // 向房间内的所有用户发送消息（除了发送者自己）
-                    for (const auto& user_id : user_ids) {
-                        // 跳过发送者自己，避免重复发送
-                        if (user_id == sender_userid) {
-                            LOG_INFO << "Skipping message sender: " << user_id;
-                            continue;
-                        }
-                        
-                        std::lock_guard<std::mutex> lock(s_mtx_user_ws_conn_map_);
-                        auto it = s_user_ws_conn_map.find(user_id);
-                        if (it != s_user_ws_conn_map.end()) {
-                            auto ws_conn = std::dynamic_pointer_cast<CWebSocketConn>(it->second);
-                            if (ws_conn && ws_conn->IsConnected()) {
-                                ws_conn->SendMessage(frame);
-                                LOG_INFO << "Sent message to user: " << user_id;
-                                push_count++;
-                            }
-                        }
-                    }
-                    
-                    // 记录 WebSocket 推送指标
-                    for (int i = 0; i < push_count; i++) {
-                        MetricsCollector::GetInstance().IncrementWebSocketPush(room_id);
-                    }
-                });
-            
-            LOG_INFO << "Message broadcast initiated for room " << room_id;
-            
-            // ========== 混合模式：同时发送到 Logic → Kafka → Job ==========
-            // 这部分用于离线推送、跨服务器同步和持久化
-            // 异步发送，不阻塞当前请求
-            
-            // 构造发送到 Logic 的请求
-            Json::Value logic_request;
-            logic_request["roomId"] = room_id;
-            logic_request["userId"] = std::stoi(userid_);  // Logic 期望 int 类型
-            logic_request["userName"] = broadcast_username.empty() ? username_ : broadcast_username;
-            
-            Json::Value messages_array(Json::arrayValue);
-            Json::Value message_obj;
-            message_obj["content"] = content;
-            messages_array.append(message_obj);
-            logic_request["messages"] = messages_array;
-            
-            Json::StreamWriterBuilder logic_writer;
-            logic_writer.settings_["indentation"] = "";
-            std::string logic_json = Json::writeString(logic_writer, logic_request);
-            
-            // 异步发送到 Logic 服务（不阻塞）
-            auto http_client = std::make_shared<HttpClient>(tcp_conn_->getLoop());
-            http_client->AsyncPost("localhost", 8090, "/logic/send", logic_json,
-                [room_id, userid = userid_](bool success, const std::string& response) {
-                    if (success) {
-                        LOG_INFO << "Successfully sent message to Logic service for room " << room_id;
-                        MetricsCollector::GetInstance().IncrementCounter("logic_forward", "success");
+            // 消息ID在本地生成，先广播，再带着这个ID异步写入 Redis（组提交，和其他连接的消息一起批量写入），
+            // 不等 Redis 往返；写入完成后再转发给 Logic，Logic/Job 拿到的是 Redis 中的最终ID
+            // 广播在入队之前完成，ID 被重新分配时 messageIdChanged 一定排在原消息之后（组提交没有启动时回调会在入队时直接执行）
+            msg.id = MsgIdGenerator::GetInstance().NextId();
+            deliverMessage(room_id, msg);
+            EventLoop *loop = tcp_conn_->getLoop();
+            MsgGroupCommit::GetInstance().StoreMessage(room_id, msg,
+                [loop, room_id, msg, userid = userid_, username = username_](int ret, const string &stored_id) {
+                    Message stored_msg = msg;
+                    if (ret != 0) {
+                        // 已经广播过，照样转发给 Logic 做离线推送
+                        LOG_ERROR << "Failed to store message " << msg.id << " for room: " << room_id;
+                        MetricsCollector::GetInstance().IncrementErrorCount("redis_store_failed", "/ws/clientMessages");
+                        MetricsCollector::GetInstance().IncrementRedisOp("store_message", false);
                     } else {
-                        LOG_WARN << "Failed to send message to Logic service for room " << room_id 
-                                 << ", user " << userid << ". Response: " << response;
-                        MetricsCollector::GetInstance().IncrementCounter("logic_forward", "failed");
+                        MetricsCollector::GetInstance().IncrementRedisOp("store_message", true);
+                        if (stored_id != msg.id) {
+                            LOG_WARN << "Message id " << msg.id << " reassigned by Redis to " << stored_id
+                                     << ", room: " << room_id;
+                            MetricsCollector::GetInstance().IncrementCounter("msg_id", "reassigned");
+                            BroadcastMessageIdChange(room_id, msg.id, stored_id);
+                            stored_msg.id = stored_id;
+                        }
                     }
+                    loop->runInLoop([loop, room_id, userid, username, stored_msg]() {
+                        ForwardToLogic(loop, room_id, userid, username, stored_msg);
+                    });
                 });
             
-            LOG_DEBUG << "Async request to Logic service initiated";
-            // ========== 混合模式结束 ==========
-            
-        } else if (type == "join_room") {
-            // 处理加入房间
-            Json::Value payload = root["payload"];
-            std::string room_id = payload["room_id"].asString();
-            
-            LOG_INFO << "User " << username_ << " joining room: " << room_id;
-            
-            // 订阅房间
-            PubSubService::GetInstance().AddSubscriber(room_id, userid_);
-            
         } else {
             LOG_WARN << "Unknown message type: " << type;
         }
@@ -464,32 +445,168 @@ int CWebSocketConn::handleClientMessages(Json::Value &root) {
     }
 }
 
+// 在本连接的 loop 线程广播消息给房间，消息ID已经在本地生成
+// 发送者信息用 hello 时缓存在连接上的用户名和头像，同步广播，同一个房间的消息按发送顺序推送；
+// hello 之前（或查询失败时）发送的消息按未知用户广播
+void CWebSocketConn::deliverMessage(const string &room_id, const Message &msg) {
+    LOG_INFO << "Deliver message with ID: " << msg.id;
+
+    // 通过PubSub广播消息给房间内的其他用户
+    Json::Value broadcast_msg;
+    Json::Value broadcast_payload;
+    
+    broadcast_payload["id"] = msg.id;
+    broadcast_payload["content"] = msg.content;
+    broadcast_payload["timestamp"] = (Json::UInt64)msg.timestamp;
+    broadcast_payload["room_id"] = room_id;
+    
+    // 构造完整的用户对象
+    Json::Value user_obj;
+    if (user_info_loaded_) {
+        user_obj["id"] = userid_;
+        user_obj["username"] = username_;
+        user_obj["avatar"] = avatar_;
+    } else {
+        // 用户信息查询失败时的默认值
+        user_obj["id"] = userid_.empty() ? "0" : userid_;
+        user_obj["username"] = "未知用户";
+        user_obj["avatar"] = "/img/default.png";
+    }
+    
+    broadcast_payload["user"] = user_obj;
+    
+    broadcast_msg["type"] = "serverMessages";
+    broadcast_msg["payload"] = broadcast_payload;
+    
+    Json::StreamWriterBuilder writer_builder;
+    writer_builder.settings_["indentation"] = "";
+    std::string broadcast_json = Json::writeString(writer_builder, broadcast_msg);
+    
+    // 打印即将广播的消息内容
+    LOG_INFO << "准备广播的消息内容: " << broadcast_json;
+    
+    // 广播给房间内的所有用户
+    LOG_INFO << "开始广播消息，房间ID: " << room_id;
+    
+    PubSubService::GetInstance().PublishMessage(room_id, 
+        [&broadcast_json, &room_id, sender_userid = user_handle_](const RoomSubscribersPtr &subscribers) {
+            LOG_INFO << "房间 " << room_id << " 中的订阅用户数量: " << subscribers->size();
+            // 帧只构建一次，按 loop 分片投递，由各个 loop 线程推送给本地连接（跳过发送者自己）
+            LoopFanout::GetInstance().Broadcast(subscribers, room_id,
+                buildWebSocketFrame(broadcast_json), sender_userid);
+        });
+    
+    // 跨节点总线启用时，发布一次给其他 comet 节点
+    RoomBus::GetInstance().Publish(room_id, userid_, broadcast_json);
+    
+    LOG_INFO << "Message broadcast initiated for room " << room_id;
+}
+
+// 收集一页历史消息的发送者，去重后追加到 userids，之后一起批量查询
+static void CollectUserIds(const std::vector<Message> &messages, std::vector<string> &userids) {
+    for (const auto& msg : messages) {
+        if (std::find(userids.begin(), userids.end(), msg.user_id) == userids.end()) {
+            userids.push_back(msg.user_id);
+        }
+    }
+}
+
 // 处理房间历史消息请求
+// 把历史消息按时间正序（最新消息在后面）转换为 JSON，附带发送者的用户信息（users 为批量查询的结果）
+static void AppendHistoryMessages(std::vector<Message> &messages, const UserInfoMap &users,
+                                  Json::Value &messages_array) {
+    std::sort(messages.begin(), messages.end(),
+        [](const Message& a, const Message& b) {
+            return a.timestamp < b.timestamp;
+        });
+
+    for (const auto& msg : messages) {
+        Json::Value msg_obj;
+        msg_obj["id"] = msg.id;
+        msg_obj["content"] = msg.content;
+        msg_obj["timestamp"] = (Json::UInt64)msg.timestamp;
+
+        // 构造完整的用户对象
+        Json::Value user_obj;
+        auto user_it = users.find(msg.user_id);
+        if (user_it != users.end()) {
+            user_obj["id"] = msg.user_id;
+            user_obj["username"] = user_it->second.username;
+            user_obj["avatar"] = user_it->second.avatar;
+        } else {
+            // 用户信息查询失败时的默认值
+            user_obj["id"] = std::stoi(msg.user_id.empty() ? "0" : msg.user_id);
+            user_obj["username"] = "未知用户";
+            user_obj["avatar"] = "/img/default.png";
+        }
+
+        msg_obj["user"] = user_obj;
+        messages_array.append(msg_obj);
+    }
+}
+
 int CWebSocketConn::handleRequestRoomHistory(Json::Value &root) {
     try {
         Json::Value payload = root["payload"];
         std::string room_id = payload["room_id"].asString();
         
         LOG_INFO << "Requesting room history for room: " << room_id;
-        
-        // 构造响应
-        Json::Value response;
-        Json::Value response_payload;
-        
-        response_payload["room_id"] = room_id;
-        response_payload["messages"] = Json::Value(Json::arrayValue);
-        
-        response["type"] = "room_history";
-        response["payload"] = response_payload;
-        
-        Json::FastWriter writer;
-        std::string json_msg = writer.write(response);
-        
-        // 发送WebSocket帧
-        std::string frame = buildWebSocketFrame(json_msg);
-        tcp_conn_->send(frame);
-        
-        LOG_INFO << "Sent room history for room: " << room_id;
+
+        // 只能读取已经加入的房间，翻页游标保存在 rooms_map_ 中
+        RoomHandle room_handle = IdInterner::Rooms().Find(room_id);
+        auto it = rooms_map_.find(room_handle);
+        // 房间句柄会在回收后复用，再按 room_id 核对一次
+        if (room_handle == IdInterner::kInvalidHandle || it == rooms_map_.end() || it->second.room_id != room_id) {
+            MessageBatch empty_batch;
+            sendRoomHistory(room_id, empty_batch);
+            return 0;
+        }
+
+        // Redis 层用本 loop 的异步连接读取，不阻塞 loop 线程；不够一页或读取失败时在历史加载线程池从游标接着读 MySQL，
+        // 不再同步重读 Redis，读完回到本 loop 线程更新游标并发送
+        // 异步连接不可用（断线、业务线程池中执行）或游标已经在 MySQL 层时走同步的分级读取
+        AsyncCacheConn *async_conn = AsyncCacheConn::ForCurrentLoop(room_id);
+        string stream_start;
+        if (async_conn && async_conn->IsConnected() && GetRoomHistoryStreamStart(it->second, stream_start)) {
+            std::weak_ptr<CHttpConn> weak_self = shared_from_this();
+            EventLoop *loop = tcp_conn_->getLoop();
+            async_conn->Xrevrange(room_id, stream_start, "-", k_message_batch_size,
+                [weak_self, loop, room_handle, room_id](int ret, std::vector<StreamEntry> &entries) {
+                    CHttpConnPtr self = weak_self.lock();
+                    if (!self) {
+                        return;     // 连接已经关闭
+                    }
+                    CWebSocketConn *conn = static_cast<CWebSocketConn *>(self.get());
+                    auto room_it = conn->rooms_map_.find(room_handle);
+                    if (room_it == conn->rooms_map_.end()) {
+                        return;     // 等待回复期间退出了房间
+                    }
+                    Room room = room_it->second;
+                    MessageBatch message_batch;
+                    if (ret != 0 || FillRoomHistoryFromStream(room, entries, message_batch, k_message_batch_size) != 0) {
+                        // 读取或解析失败，丢掉这次的结果，从原来的游标开始读 MySQL
+                        room = room_it->second;
+                        message_batch = MessageBatch();
+                    }
+                    HistoryLoader::GetInstance().LoadFromDb(room, std::move(message_batch), k_message_batch_size, loop,
+                        [weak_self, room_handle, room_id](int ret, Room &room, MessageBatch &message_batch) {
+                            CHttpConnPtr self = weak_self.lock();
+                            if (!self) {
+                                return;     // 查库期间连接已经关闭
+                            }
+                            CWebSocketConn *conn = static_cast<CWebSocketConn *>(self.get());
+                            auto room_it = conn->rooms_map_.find(room_handle);
+                            if (room_it == conn->rooms_map_.end() || room_it->second.room_id != room_id) {
+                                return;     // 查库期间退出了房间
+                            }
+                            room_it->second.history_last_message_id = room.history_last_message_id;
+                            conn->sendRoomHistory(room_id, message_batch);
+                        });
+                });
+            return 0;
+        }
+
+        sendRoomHistoryTiered(it->second);
         return 0;
     } catch (const std::exception& e) {
         LOG_ERROR << "Exception in handleRequestRoomHistory: " << e.what();
@@ -497,6 +614,141 @@ int CWebSocketConn::handleRequestRoomHistory(Json::Value &root) {
     }
 }
 
+// 同步分级读取一页历史（Redis + MySQL）并发送，room 的游标随之前进
+void CWebSocketConn::sendRoomHistoryTiered(Room &room) {
+    MessageBatch message_batch;
+    if (ApiGetRoomHistoryTiered(room, message_batch) != 0) {
+        LOG_ERROR << "Failed to load history for room " << room.room_id;
+    }
+    sendRoomHistory(room.room_id, message_batch);
+}
+
+// 这一页消息的发送者用一条 IN 查询取（本 loop 的 MySQL 非阻塞连接），查完再发送
+void CWebSocketConn::sendRoomHistory(const string &room_id, MessageBatch &message_batch) {
+    std::vector<string> userids;
+    CollectUserIds(message_batch.messages, userids);
+    std::weak_ptr<CHttpConn> weak_self = shared_from_this();
+    ApiGetUserInfosByIdsAsync(userid_, userids,
+        [weak_self, room_id, message_batch = std::move(message_batch)](int ret, const UserInfoMap &users) mutable {
+            CHttpConnPtr self = weak_self.lock();
+            if (!self) {
+                return;     // 查询期间连接已经关闭
+            }
+            // 查询失败时 users 为空，按未知用户发送
+            static_cast<CWebSocketConn *>(self.get())->writeRoomHistory(room_id, message_batch, users);
+        });
+}
+
+void CWebSocketConn::writeRoomHistory(const string &room_id, MessageBatch &message_batch, const UserInfoMap &users) {
+    // 构造响应
+    Json::Value response;
+    Json::Value response_payload;
+    Json::Value messages_array(Json::arrayValue);
+    AppendHistoryMessages(message_batch.messages, users, messages_array);
+
+    response_payload["room_id"] = room_id;
+    response_payload["messages"] = messages_array;
+    response_payload["has_more"] = message_batch.has_more;
+
+    response["type"] = "room_history";
+    response["payload"] = response_payload;
+
+    Json::FastWriter writer;
+    std::string json_msg = writer.write(response);
+
+    // 发送WebSocket帧
+    SendMessage(buildWebSocketFrame(json_msg));
+
+    LOG_INFO << "Sent room history for room: " << room_id << ", messages: " << message_batch.messages.size();
+}
+
+// 处理加入房间
+int CWebSocketConn::handleJoinRoom(Json::Value &root) {
+    Json::Value payload = root["payload"];
+    std::string room_id = payload["room_id"].asString();
+    if (room_id.empty()) {
+        LOG_ERROR << "join_room missing room_id";
+        return -1;
+    }
+
+    LOG_INFO << "User " << userid_ << " joining room: " << room_id;
+
+    // 先在房间目录里确认房间存在，确认后才分配句柄，避免被任意ID撑大
+    // 不在快照里的房间由加载线程查 MySQL，查完回到本连接的 loop 线程继续，loop 线程不等数据库
+    std::weak_ptr<CHttpConn> weak_self = shared_from_this();
+    RoomCatalog::GetInstance().GetRoomAsync(room_id, tcp_conn_->getLoop(),
+        [weak_self, room_id](bool found, const Room &room) {
+            CHttpConnPtr self = weak_self.lock();
+            if (!self) {
+                // 查库期间连接已经关闭，没有人订阅，按需加载的条目不留在目录里
+                RoomCatalog::GetInstance().EvictRoom(room_id);
+                return;
+            }
+            if (!found) {
+                LOG_WARN << "join_room failed, room not exist: " << room_id;
+                return;
+            }
+            static_cast<CWebSocketConn *>(self.get())->finishJoinRoom(room);
+        });
+    return 0;
+}
+
+void CWebSocketConn::finishJoinRoom(const Room &room) {
+    if (userid_.empty()) {
+        return;
+    }
+    RoomHandle room_handle = PubSubService::GetInstance().AddSubscriber(room.room_id, user_handle_, loop_index_);
+    if (room_handle == IdInterner::kInvalidHandle) {
+        LOG_WARN << "join_room failed, room_id: " << room.room_id;
+        return;
+    }
+    auto result = rooms_map_.insert({room_handle, room});
+    if (!result.second && result.first->second.room_id != room.room_id) {
+        result.first->second = room;    // 句柄复用前留下的旧房间
+    }
+}
+
+// 处理退出房间
+int CWebSocketConn::handleLeaveRoom(Json::Value &root) {
+    Json::Value payload = root["payload"];
+    std::string room_id = payload["room_id"].asString();
+    if (room_id.empty()) {
+        LOG_ERROR << "leave_room missing room_id";
+        return -1;
+    }
+
+    LOG_INFO << "User " << userid_ << " leaving room: " << room_id;
+
+    RoomHandle room_handle = IdInterner::Rooms().Find(room_id);
+    PubSubService::GetInstance().DeleteSubscriber(room_handle, user_handle_);
+    rooms_map_.erase(room_handle);
+    return 0;
+}
+
+// 连接断开：移出连接映射表并退订所有房间
+void CWebSocketConn::OnClose() {
+    if (userid_.empty()) {
+        return;
+    }
+
+    // 同一个userid可能已经有新连接顶替了，只有映射表里还是自己时才清理订阅
+    bool is_current_conn = false;
+    {
+        std::lock_guard<std::mutex> lock(s_mtx_user_ws_conn_map_);
+        auto it = s_user_ws_conn_map.find(user_handle_);
+        if (it != s_user_ws_conn_map.end() && it->second.get() == this) {
+            s_user_ws_conn_map.erase(it);
+            is_current_conn = true;
+        }
+    }
+
+    if (is_current_conn) {
+        size_t room_count = PubSubService::GetInstance().DeleteSubscriberFromAllRooms(user_handle_);
+        LOG_INFO << "用户 " << userid_ << " 断开连接，退订 " << room_count << " 个房间";
+    }
+    rooms_map_.clear();
+}
+
 // 检查连接是否有效
 bool CWebSocketConn::IsConnected() const {
     return tcp_conn_ && tcp_conn_->connected() && handshake_completed_;
@@ -511,21 +763,144 @@ void CWebSocketConn::SendMessage(const std::string& frame) {
     }
 }
 
+static const int kHelloHistoryCount = 20;   // hello 时每个房间发送的历史消息条数
+
+// hello 时各房间首页的读取状态，只在连接所属的 loop 线程内访问
+// 每个房间读完减一，全部读完后统一查发送者再发送
+struct HelloPages {
+    string username;
+    string avatar;
+    std::vector<RoomHandle> room_handles;
+    std::vector<std::pair<Room, MessageBatch>> room_pages;
+    size_t pending = 0;
+};
+
 // 处理前端发送的hello消息
+// 用户信息用本 loop 的 MySQL 非阻塞连接查询（没有开启时走同步连接池），查到后缓存在连接上，之后广播消息直接使用
 int CWebSocketConn::handleHelloMessage(Json::Value &root) {
     (void)root;
-    try {
-        LOG_INFO << "Handling hello message from client, userid_=" << userid_;
-        
-        // 从数据库查询用户信息
-        string username;
-        string avatar;
-        if (ApiGetUserInfoById(userid_, username, avatar) != 0) {
-            LOG_ERROR << "Failed to get user info for userid: " << userid_;
-            username = "未知编程侠";
-            avatar = "/img/a.png";
+    LOG_INFO << "Handling hello message from client, userid_=" << userid_;
+
+    std::weak_ptr<CHttpConn> weak_self = shared_from_this();
+    ApiGetUserInfoByIdAsync(userid_, [weak_self](int ret, const string &username, const string &avatar) {
+        CHttpConnPtr self = weak_self.lock();
+        if (!self) {
+            return;     // 查询期间连接已经关闭
         }
-        
+        static_cast<CWebSocketConn *>(self.get())->finishHello(ret == 0, username, avatar);
+    });
+    return 0;
+}
+
+void CWebSocketConn::finishHello(bool user_found, const string &db_username, const string &db_avatar) {
+    string username = db_username;
+    string avatar = db_avatar;
+    if (user_found) {
+        username_ = username;
+        avatar_ = avatar;
+        user_info_loaded_ = true;
+    } else {
+        LOG_ERROR << "Failed to get user info for userid: " << userid_;
+        username = "未知编程侠";
+        avatar = "/img/a.png";
+    }
+
+    // 获取每个房间最新20条历史消息，和 request_room_history 一样：Redis 层用本 loop 的异步连接读，
+    // 不够一页时在历史加载线程池补 MySQL；所有房间读完后，发送者用一条 IN 查询一起取
+    auto pages = std::make_shared<HelloPages>();
+    pages->username = username;
+    pages->avatar = avatar;
+    for (auto &room_pair : rooms_map_) {
+        pages->room_handles.push_back(room_pair.first);
+        pages->room_pages.push_back({room_pair.second, MessageBatch()});
+    }
+    // 多计一次，所有房间都发起读取后再减掉，同步读完的房间不会提前发送
+    pages->pending = pages->room_pages.size() + 1;
+    for (size_t i = 0; i < pages->room_pages.size(); i++) {
+        loadHelloPage(pages, i);
+    }
+    sendHelloPages(pages);
+}
+
+void CWebSocketConn::loadHelloPage(const std::shared_ptr<HelloPages> &pages, size_t index) {
+    std::weak_ptr<CHttpConn> weak_self = shared_from_this();
+    auto on_loaded = [weak_self, pages, index](int ret, Room &room, MessageBatch &message_batch) {
+        CHttpConnPtr self = weak_self.lock();
+        if (!self) {
+            return;     // 读取期间连接已经关闭
+        }
+        static_cast<CWebSocketConn *>(self.get())->finishHelloPage(pages, index, ret, room, message_batch);
+    };
+
+    Room room = pages->room_pages[index].first;
+    AsyncCacheConn *async_conn = AsyncCacheConn::ForCurrentLoop(room.room_id);
+    string stream_start;
+    if (async_conn && async_conn->IsConnected() && GetRoomHistoryStreamStart(room, stream_start)) {
+        EventLoop *loop = tcp_conn_->getLoop();
+        async_conn->Xrevrange(room.room_id, stream_start, "-", kHelloHistoryCount,
+            [weak_self, loop, pages, index, on_loaded](int ret, std::vector<StreamEntry> &entries) {
+                if (weak_self.expired()) {
+                    return;     // 连接已经关闭，不再查库
+                }
+                Room room = pages->room_pages[index].first;
+                MessageBatch message_batch;
+                if (ret != 0 || FillRoomHistoryFromStream(room, entries, message_batch, kHelloHistoryCount) != 0) {
+                    // 读取或解析失败，丢掉这次的结果，从原来的游标开始读 MySQL
+                    room = pages->room_pages[index].first;
+                    message_batch = MessageBatch();
+                }
+                HistoryLoader::GetInstance().LoadFromDb(room, std::move(message_batch), kHelloHistoryCount, loop, on_loaded);
+            });
+        return;
+    }
+
+    // 异步连接不可用时走同步的分级读取
+    MessageBatch message_batch;
+    int ret = ApiGetRoomHistoryTiered(room, message_batch, kHelloHistoryCount);
+    on_loaded(ret, room, message_batch);
+}
+
+void CWebSocketConn::finishHelloPage(const std::shared_ptr<HelloPages> &pages, size_t index, int ret,
+                                     Room &room, MessageBatch &message_batch) {
+    if (ret != 0 && message_batch.messages.empty()) {
+        LOG_ERROR << "Failed to load history for room " << room.room_id;
+    } else {
+        // 之后的 request_room_history 从这一页之后继续翻
+        auto room_it = rooms_map_.find(pages->room_handles[index]);
+        if (room_it != rooms_map_.end() && room_it->second.room_id == room.room_id) {
+            room_it->second.history_last_message_id = room.history_last_message_id;
+        }
+        pages->room_pages[index].second = std::move(message_batch);
+    }
+    sendHelloPages(pages);
+}
+
+// 所有房间都读完后查发送者并发送 hello 响应
+void CWebSocketConn::sendHelloPages(const std::shared_ptr<HelloPages> &pages) {
+    if (--pages->pending > 0) {
+        return;
+    }
+
+    std::vector<string> userids;
+    for (auto &room_page : pages->room_pages) {
+        CollectUserIds(room_page.second.messages, userids);
+    }
+    std::weak_ptr<CHttpConn> weak_self = shared_from_this();
+    ApiGetUserInfosByIdsAsync(userid_, userids, [weak_self, pages](int ret, const UserInfoMap &users) {
+        CHttpConnPtr self = weak_self.lock();
+        if (!self) {
+            return;     // 查询期间连接已经关闭
+        }
+        // 查询失败时 users 为空，历史消息按未知用户发送
+        static_cast<CWebSocketConn *>(self.get())->sendHelloResponse(pages->username, pages->avatar,
+                                                                     pages->room_pages, users);
+    });
+}
+
+void CWebSocketConn::sendHelloResponse(const string &username, const string &avatar,
+                                       std::vector<std::pair<Room, MessageBatch>> &room_pages,
+                                       const UserInfoMap &users) {
+    try {
         // 构造响应
         Json::Value response;
         Json::Value payload;
@@ -538,66 +913,14 @@ int CWebSocketConn::handleHelloMessage(Json::Value &root) {
         
         // 房间列表和历史消息
         Json::Value rooms_array(Json::arrayValue);
-        for (const auto& room_pair : rooms_map_) {
+        for (auto& room_page : room_pages) {
             Json::Value room_obj;
-            room_obj["id"] = room_pair.second.room_id;
-            room_obj["name"] = room_pair.second.room_name;
+            room_obj["id"] = room_page.first.room_id;
+            room_obj["name"] = room_page.first.room_name;
             room_obj["users"] = Json::Value(Json::arrayValue); // TODO: 可以后续添加在线用户列表
             
-            // 获取房间最新20条历史消息
             Json::Value messages_array(Json::arrayValue);
-            try {
-                Room temp_room = room_pair.second; // 创建副本
-                MessageBatch message_batch;
-                
-                // 使用分级存储获取历史消息
-                int history_result = ApiGetRoomHistoryTiered(temp_room, message_batch, 20);
-                
-                if (history_result == 0 && !message_batch.messages.empty()) {
-                    // LOG_INFO << "Loaded " << message_batch.messages.size() 
-                    //          << " history messages for room " << room_pair.second.room_id;
-                    
-                    // 将消息按时间正序排列（最新消息在后面）
-                    std::sort(message_batch.messages.begin(), message_batch.messages.end(),
-                        [](const Message& a, const Message& b) {
-                            return a.timestamp < b.timestamp;
-                        });
-                    
-                    // 转换为JSON格式
-                    for (const auto& msg : message_batch.messages) {
-                        Json::Value msg_obj;
-                        msg_obj["id"] = msg.id;
-                        msg_obj["content"] = msg.content;
-                        msg_obj["timestamp"] = (Json::UInt64)msg.timestamp;
-                        
-                        // 构造完整的用户对象
-                        Json::Value user_obj;
-                        string msg_username;
-                        string msg_avatar;
-                        
-                        // 查询用户信息
-                        if (ApiGetUserInfoById(msg.user_id, msg_username, msg_avatar) == 0) {
-                            user_obj["id"] = msg.user_id;
-                            user_obj["username"] = msg_username;
-                            user_obj["avatar"] = msg_avatar;
-                        } else {
-                            // 用户信息查询失败时的默认值
-                            user_obj["id"] = std::stoi(msg.user_id.empty() ? "0" : msg.user_id);
-                            user_obj["username"] = "未知用户";
-                            user_obj["avatar"] = "/img/default.png";
-                        }
-                        
-                        msg_obj["user"] = user_obj;
-                        messages_array.append(msg_obj);
-                    }
-                } else {
-                    LOG_INFO << "No history messages found for room " << room_pair.second.room_id;
-                }
-            } catch (const std::exception& e) {
-                LOG_ERROR << "Failed to load history for room " << room_pair.second.room_id 
-                          << ": " << e.what();
-            }
-            
+            AppendHistoryMessages(room_page.second.messages, users, messages_array);
             room_obj["messages"] = messages_array;
             rooms_array.append(room_obj);
         }
@@ -612,14 +935,11 @@ int CWebSocketConn::handleHelloMessage(Json::Value &root) {
         std::string json_msg = writer.write(response);
         
         // 发送WebSocket帧
-        std::string frame = buildWebSocketFrame(json_msg);
-        tcp_conn_->send(frame);
+        SendMessage(buildWebSocketFrame(json_msg));
         
         LOG_INFO << "Sent hello response to user: " << username;
-        return 0;
     } catch (const std::exception& e) {
-        LOG_ERROR << "Exception in handleHelloMessage: " << e.what();
-        return -1;
+        LOG_ERROR << "Exception in sendHelloResponse: " << e.what();
     }
 }
 
@@ -663,18 +983,21 @@ void CWebSocketConn::OnRead(Buffer* buf)
             }else {
                 // uid不为空，直接设置username为uid
                 userid_ = uid;  // 将uid字符串转换为整数后作为userId使用
+                user_handle_ = IdInterner::Users().Intern(userid_);  // 内部统一使用句柄
                 // 校验成功
                 // 把连接加入 s_user_ws_conn_map
                 LOG_INFO << "uid validation ok, username_=" << username_ << ", userid_=" << userid_;
                 s_mtx_user_ws_conn_map_.lock();
-                s_user_ws_conn_map.insert({userid_, shared_from_this()});  // 同样userid连接可能已经存在了
+                s_user_ws_conn_map[user_handle_] = shared_from_this();  // 同样userid连接可能已经存在了，以最新的连接为准
                 s_mtx_user_ws_conn_map_.unlock();
                 // 订阅房间
-                std::vector<Room> &room_list = PubSubService::GetRoomList(); 
+                std::shared_ptr<const std::vector<Room>> default_rooms = RoomCatalog::GetInstance().GetDefaultRooms();
+                const std::vector<Room> &room_list = *default_rooms;    // 持有快照期间不会被修改
                 LOG_INFO << "开始为用户 " << userid_ << " 订阅 " << room_list.size() << " 个房间";
                 for(size_t i = 0; i < room_list.size(); i++) {
-                    rooms_map_.insert({room_list[i].room_id, room_list[i]});
-                    PubSubService::GetInstance().AddSubscriber(room_list[i].room_id, userid_);// 订阅对应的聊天室
+                    RoomHandle room_handle = PubSubService::GetInstance().AddSubscriber(
+                        room_list[i].room_id, user_handle_, loop_index_);// 订阅对应的聊天室
+                    rooms_map_.insert({room_handle, room_list[i]});
                     // LOG_INFO << "用户 " << userid_ << " 已订阅房间: " << room_list[i].room_id << " (" << room_list[i].room_name << ")";
                 }
                 LOG_INFO << "用户 " << userid_ << " 房间订阅完成";
@@ -729,6 +1052,12 @@ void CWebSocketConn::OnRead(Buffer* buf)
             // 用户向上翻，触发hasMore时，前端发来requestRoomHistory，返回房间历史数据
             else if(type == "requestRoomHistory") {
                 handleRequestRoomHistory(root);
+            }
+            // 加入 / 退出房间
+            else if(type == "join_room") {
+                handleJoinRoom(root);
+            } else if(type == "leave_room") {
+                handleLeaveRoom(root);
             } else {
                 LOG_ERROR << "unknown type: " << type;
             }
@@ -8,13 +8,22 @@
 #include <openssl/sha.h>
 #include "muduo/base/Logging.h" // Logger日志头文件
 #include "api_types.h"
+#include "api_common.h"
+#include "id_interner.h"
+
+struct FanoutBatch;
+struct HelloPages;
 
 class CWebSocketConn: public CHttpConn {
 public:
     CWebSocketConn(const muduo::net::TcpConnectionPtr& conn);
     
     virtual void OnRead( muduo::net::Buffer* buf);
+    virtual void OnClose();
     virtual ~CWebSocketConn();
+
+    // 房间广播在 loop 线程内的投递回调，注册给 LoopFanout
+    static void DeliverBatch(const FanoutBatch &batch);
 private:
     void sendCloseFrame(uint16_t code, const std::string& reason);
     void sendPongFrame(); // 发送 Pong 帧
@@ -28,8 +37,22 @@ private:
 
     int sendHelloMessage();
     int handleClientMessages(Json::Value &root);
+    void deliverMessage(const string &room_id, const Message &msg);
     int handleRequestRoomHistory(Json::Value &root);
+    void sendRoomHistoryTiered(Room &room);
+    void sendRoomHistory(const string &room_id, MessageBatch &message_batch);
+    void writeRoomHistory(const string &room_id, MessageBatch &message_batch, const UserInfoMap &users);
     int handleHelloMessage(Json::Value &root);
+    void finishHello(bool user_found, const string &db_username, const string &db_avatar);
+    void loadHelloPage(const std::shared_ptr<HelloPages> &pages, size_t index);
+    void finishHelloPage(const std::shared_ptr<HelloPages> &pages, size_t index, int ret,
+                         Room &room, MessageBatch &message_batch);
+    void sendHelloPages(const std::shared_ptr<HelloPages> &pages);
+    void sendHelloResponse(const string &username, const string &avatar,
+                           std::vector<std::pair<Room, MessageBatch>> &room_pages, const UserInfoMap &users);
+    int handleJoinRoom(Json::Value &root);
+    void finishJoinRoom(const Room &room);
+    int handleLeaveRoom(Json::Value &root);
     
     // 辅助方法
     bool IsConnected() const;
@@ -37,10 +60,14 @@ private:
     
     bool  handshake_completed_ = false;
 
-    string username_;           //用户名
+    string username_;           //用户名，hello 时查询后缓存
+    string avatar_;             //头像，hello 时查询后缓存
+    bool user_info_loaded_ = false;
     string userid_;      //用户id
+    UserHandle user_handle_ = IdInterner::kInvalidHandle;  //用户id对应的句柄
+    int loop_index_ = 0;        //连接所属 EventLoop 的序号，订阅房间时按它分片
 
-    std::unordered_map<string, Room> rooms_map_;    //加入的房间
+    std::unordered_map<RoomHandle, Room> rooms_map_;    //加入的房间
 };
 
 using CWebSocketConnPtr = std::shared_ptr<CWebSocketConn>;
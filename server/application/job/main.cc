@@ -134,55 +134,37 @@ int main() {
                         
                         RouteService& route_service = RouteService::GetInstance();
                         
-                        // ========== 步骤1: 消息去重检查（防止重复推送）==========
-                        // TTL 60秒：同一条消息在60秒内不会重复处理
-                        if (!route_service.CheckAndMarkMessageProcessed(msg_id, room_id, 60)) {
+                        // ========== 步骤1~4: 去重、冷却、加锁、查询房间连接并按 Comet 分组 ==========
+                        // 一次 EVALSHA 完成：去重窗口 60 秒，同一房间 1 秒内只广播一次，锁 TTL 5 秒（防止死锁）
+                        string lock_key = "lock:broadcast:" + room_id;
+                        string lock_value = "consumer_" + std::to_string(i) + "_" + std::to_string(time(nullptr));
+                        map<string, vector<string>> comet_groups;
+                        int prepare_result = route_service.PrepareRoomBroadcast(msg_id, room_id, lock_value,
+                                                                                60, 1, 5, comet_groups);
+                        if (prepare_result == BROADCAST_DUPLICATE) {
                             LOG_WARN << "[Consumer " << i << "] Duplicate message skipped: " << msg_id;
                             continue; // 跳过重复消息
                         }
-                        
-                        // ========== 步骤2: 热点房间冷却检查（防止短时间内频繁广播）==========
-                        // 冷却时间 1秒：同一房间1秒内只广播一次
-                        if (route_service.IsRoomInCooldown(room_id, 1)) {
+                        if (prepare_result == BROADCAST_COOLDOWN) {
                             LOG_INFO << "[Consumer " << i << "] Room in cooldown, skipping: " << room_id;
                             continue; // 在冷却期内，跳过
                         }
-                        
-                        // ========== 步骤3: 分布式锁（防止并发处理同一房间）==========
-                        string lock_key = "lock:broadcast:" + room_id;
-                        string lock_value = "consumer_" + std::to_string(i) + "_" + std::to_string(time(nullptr));
-                        
-                        // 尝试获取锁，TTL 5秒（防止死锁）
-                        if (!route_service.AcquireLock(lock_key, lock_value, 5)) {
+                        if (prepare_result == BROADCAST_LOCKED) {
                             LOG_INFO << "[Consumer " << i << "] Another consumer is processing room: " << room_id;
                             continue; // 其他消费者正在处理，跳过
                         }
-                        
-                        // 获取锁成功，确保最后释放锁
-                        // 使用 RAII 自动释放（简化版，实际应使用智能指针）
-                        
-                        // ========== 步骤4: 查询房间内所有连接 ==========
-                        vector<string> conn_ids;
-                        if (!route_service.GetRoomConnections(room_id, conn_ids)) {
-                            LOG_ERROR << "[Consumer " << i << "] Failed to get room connections for: " << room_id;
-                            route_service.ReleaseLock(lock_key, lock_value); // 释放锁
-                            continue;
+                        if (prepare_result != BROADCAST_READY) {
+                            LOG_ERROR << "[Consumer " << i << "] Failed to prepare broadcast for: " << room_id;
+                            continue; // Redis 出错，保守处理：不推送
                         }
                         
-                        if (conn_ids.empty()) {
+                        // 获取锁成功，之后每条路径都要释放锁
+                        if (comet_groups.empty()) {
                             LOG_INFO << "[Consumer " << i << "] No connections in room: " << room_id;
                             route_service.ReleaseLock(lock_key, lock_value); // 释放锁
                             continue;
                         }
                         
-                        // 2. 按Comet节点分组
-                        map<string, vector<string>> comet_groups;
-                        if (!route_service.GroupConnectionsByComet(conn_ids, comet_groups)) {
-                            LOG_ERROR << "[Consumer " << i << "] Failed to group connections by comet";
-                            route_service.ReleaseLock(lock_key, lock_value); // 释放锁
-                            continue;
-                        }
-                        
                         // 3. 向每个Comet节点发送广播请求
                         int total_sent = 0;
                         int failed_count = 0;
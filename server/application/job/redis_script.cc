@@ -0,0 +1,167 @@
+#include "redis_script.h"
+#include <cstring>
+#include <muduo/base/Logging.h>
+
+int RedisScriptRegistry::Register(const string& name, const string& source) {
+    scripts_.push_back({name, source, ""});
+    return static_cast<int>(scripts_.size()) - 1;
+}
+
+bool RedisScriptRegistry::LoadAll(redisContext* ctx) {
+    for (auto& script : scripts_) {
+        const char* argv[3] = {"SCRIPT", "LOAD", script.source.c_str()};
+        size_t argvlen[3] = {6, 4, script.source.size()};
+        if (redisAppendCommandArgv(ctx, 3, argv, argvlen) != REDIS_OK) {
+            LOG_ERROR << "Redis append command failed: SCRIPT LOAD " << script.name;
+            return false;
+        }
+    }
+
+    bool success = true;
+    for (auto& script : scripts_) {
+        redisReply* reply = nullptr;
+        if (redisGetReply(ctx, (void**)&reply) != REDIS_OK || !reply) {
+            LOG_ERROR << "Redis command failed: SCRIPT LOAD " << script.name;
+            return false;
+        }
+        if (reply->type == REDIS_REPLY_STRING) {
+            script.sha.assign(reply->str, reply->len);
+            LOG_DEBUG << "Lua script loaded: " << script.name << " sha=" << script.sha;
+        } else {
+            // 脚本本身有错时记录下来，其他脚本照常加载
+            LOG_ERROR << "SCRIPT LOAD " << script.name << " failed: "
+                      << (reply->type == REDIS_REPLY_ERROR ? reply->str : "unexpected reply");
+            success = false;
+        }
+        freeReplyObject(reply);
+    }
+    return success;
+}
+
+bool RedisScriptRegistry::Load(redisContext* ctx, Script& script) {
+    redisReply* reply = (redisReply*)redisCommand(ctx, "SCRIPT LOAD %b", script.source.data(), script.source.size());
+    if (!reply) {
+        LOG_ERROR << "Redis command failed: SCRIPT LOAD " << script.name;
+        return false;
+    }
+    bool success = false;
+    if (reply->type == REDIS_REPLY_STRING) {
+        script.sha.assign(reply->str, reply->len);
+        success = true;
+    } else {
+        LOG_ERROR << "SCRIPT LOAD " << script.name << " failed: "
+                  << (reply->type == REDIS_REPLY_ERROR ? reply->str : "unexpected reply");
+    }
+    freeReplyObject(reply);
+    return success;
+}
+
+bool RedisScriptRegistry::AppendEvalSha(redisContext* ctx, const ScriptCall& call) {
+    // EVALSHA sha numkeys key1 key2 ... arg1 arg2 ...
+    const Script& script = scripts_[call.script];
+    string numkeys = std::to_string(call.keys.size());
+    vector<const char*> argv;
+    vector<size_t> argvlen;
+    argv.reserve(3 + call.keys.size() + call.args.size());
+    argvlen.reserve(argv.capacity());
+
+    argv.push_back("EVALSHA");
+    argvlen.push_back(7);
+    argv.push_back(script.sha.c_str());
+    argvlen.push_back(script.sha.size());
+    argv.push_back(numkeys.c_str());
+    argvlen.push_back(numkeys.size());
+    for (const auto& key : call.keys) {
+        argv.push_back(key.c_str());
+        argvlen.push_back(key.size());
+    }
+    for (const auto& arg : call.args) {
+        argv.push_back(arg.c_str());
+        argvlen.push_back(arg.size());
+    }
+    return redisAppendCommandArgv(ctx, argv.size(), &argv[0], &argvlen[0]) == REDIS_OK;
+}
+
+bool RedisScriptRegistry::IsNoScript(const redisReply* reply) {
+    return reply->type == REDIS_REPLY_ERROR && strncmp(reply->str, "NOSCRIPT", 8) == 0;
+}
+
+void RedisScriptRegistry::FreeReplies(vector<redisReply*>& replies) {
+    for (redisReply* reply : replies) {
+        if (reply) freeReplyObject(reply);
+    }
+    replies.clear();
+}
+
+redisReply* RedisScriptRegistry::Eval(redisContext* ctx, const ScriptCall& call) {
+    vector<ScriptCall> calls = {call};
+    vector<redisReply*> replies;
+    if (!EvalBatch(ctx, calls, replies)) {
+        return nullptr;
+    }
+    return replies[0];
+}
+
+bool RedisScriptRegistry::EvalBatch(redisContext* ctx, const vector<ScriptCall>& calls, vector<redisReply*>& replies) {
+    replies.assign(calls.size(), nullptr);
+
+    // 第一轮全部用 EVALSHA；第二轮只重发返回 NOSCRIPT 的调用，发之前先重新加载对应脚本
+    vector<size_t> pending(calls.size());
+    for (size_t i = 0; i < calls.size(); i++) {
+        pending[i] = i;
+        if (scripts_[calls[i].script].sha.empty() && !Load(ctx, scripts_[calls[i].script])) {
+            replies.clear();
+            return false;
+        }
+    }
+
+    for (int round = 0; round < 2 && !pending.empty(); round++) {
+        for (size_t index : pending) {
+            if (!AppendEvalSha(ctx, calls[index])) {
+                LOG_ERROR << "Redis append command failed: EVALSHA " << scripts_[calls[index].script].name;
+                FreeReplies(replies);
+                return false;
+            }
+        }
+
+        vector<size_t> missing;
+        bool failed = false;
+        for (size_t index : pending) {
+            redisReply* reply = nullptr;
+            if (failed || redisGetReply(ctx, (void**)&reply) != REDIS_OK || !reply) {
+                // 剩下的回复已经读不到了，连接交给调用方重连
+                failed = true;
+                continue;
+            }
+            if (round == 0 && IsNoScript(reply)) {
+                freeReplyObject(reply);
+                missing.push_back(index);
+                continue;
+            }
+            replies[index] = reply;
+        }
+        if (failed) {
+            LOG_ERROR << "Redis command failed: EVALSHA batch of " << pending.size();
+            FreeReplies(replies);
+            return false;
+        }
+
+        // 同一个脚本只重新加载一次
+        for (size_t index : missing) {
+            Script& script = scripts_[calls[index].script];
+            if (!script.sha.empty()) {
+                LOG_WARN << "Lua script " << script.name << " not cached on redis, reloading";
+                script.sha.clear();
+            }
+        }
+        for (size_t index : missing) {
+            Script& script = scripts_[calls[index].script];
+            if (script.sha.empty() && !Load(ctx, script)) {
+                FreeReplies(replies);
+                return false;
+            }
+        }
+        pending.swap(missing);
+    }
+    return true;
+}
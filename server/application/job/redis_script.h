@@ -0,0 +1,69 @@
+#ifndef __REDIS_SCRIPT_H__
+#define __REDIS_SCRIPT_H__
+
+#include <string>
+#include <vector>
+#include <hiredis/hiredis.h>
+
+using namespace std;
+
+// 一次脚本调用
+struct ScriptCall {
+    int script;             // RedisScriptRegistry::Register 返回的编号
+    vector<string> keys;
+    vector<string> args;
+};
+
+/**
+ * Lua 脚本注册表
+ *
+ * 脚本只在连接建立后用 SCRIPT LOAD 上传一次，之后按 SHA1 用 EVALSHA 调用，
+ * 每次调用不再发送脚本全文。Redis 重启、SCRIPT FLUSH 或切换到新实例后返回 NOSCRIPT，
+ * 此时重新 SCRIPT LOAD 并重发这次调用（NOSCRIPT 说明脚本没有执行，重发是安全的）。
+ *
+ * 不加锁，由使用方保证和 redisContext 在同一把锁下使用
+ */
+class RedisScriptRegistry {
+public:
+    /**
+     * 注册脚本，在连接 Redis 之前调用
+     * @return 脚本编号，ScriptCall::script 使用
+     */
+    int Register(const string& name, const string& source);
+
+    /**
+     * 把所有脚本 SCRIPT LOAD 到 ctx（流水线，一次往返），每次建立连接后调用
+     * @return 全部加载成功返回true
+     */
+    bool LoadAll(redisContext* ctx);
+
+    /**
+     * 执行一次脚本调用
+     * @return 回复由调用方 freeReplyObject，连接出错返回nullptr
+     */
+    redisReply* Eval(redisContext* ctx, const ScriptCall& call);
+
+    /**
+     * 多次脚本调用放在一个流水线里发送，replies 和 calls 一一对应（脚本错误时是 ERROR 回复）
+     * @return 连接出错返回false，此时 replies 为空、连接状态不确定，调用方应断开重连
+     */
+    bool EvalBatch(redisContext* ctx, const vector<ScriptCall>& calls, vector<redisReply*>& replies);
+
+    const string& GetName(int script) const { return scripts_[script].name; }
+
+private:
+    struct Script {
+        string name;
+        string source;
+        string sha;         // SCRIPT LOAD 返回，没加载过时为空
+    };
+
+    bool Load(redisContext* ctx, Script& script);
+    bool AppendEvalSha(redisContext* ctx, const ScriptCall& call);
+    static bool IsNoScript(const redisReply* reply);
+    static void FreeReplies(vector<redisReply*>& replies);
+
+    vector<Script> scripts_;
+};
+
+#endif // __REDIS_SCRIPT_H__
@@ -1,9 +1,38 @@
 #include "route_service.h"
 #include <cstring>
 
+// 只有持有锁的客户端才能释放（值匹配才删除）
+static const char* kReleaseLockScript =
+    "if redis.call('get', KEYS[1]) == ARGV[1] then "
+    "    return redis.call('del', KEYS[1]) "
+    "else "
+    "    return 0 "
+    "end";
+
+// 广播前的合并检查，顺序和失败时已经写入的 key 与逐条命令的实现一致
+// KEYS: 去重 key、冷却 key、锁 key、房间连接集合
+// ARGV: 去重 TTL、冷却秒数、锁的值、锁 TTL、连接信息 key 前缀
+// 返回 {状态} 或 {0, conn_id1, comet1, conn_id2, comet2, ...}
+// 连接信息 key 由脚本拼出，只适用于单个 Redis 实例（job 目前只连一个实例）
+static const char* kPrepareBroadcastScript =
+    "if not redis.call('set', KEYS[1], '1', 'NX', 'EX', ARGV[1]) then return {1} end "
+    "if not redis.call('set', KEYS[2], '1', 'NX', 'EX', ARGV[2]) then return {2} end "
+    "if not redis.call('set', KEYS[3], ARGV[3], 'NX', 'EX', ARGV[4]) then return {3} end "
+    "local result = {0} "
+    "for _, conn_id in ipairs(redis.call('smembers', KEYS[4])) do "
+    "    local comet = redis.call('hget', ARGV[5] .. conn_id, 'comet_id') "
+    "    if comet then "
+    "        result[#result + 1] = conn_id "
+    "        result[#result + 1] = comet "
+    "    end "
+    "end "
+    "return result";
+
 RouteService::RouteService() 
     : redis_context_(nullptr)
     , redis_port_(6379) {
+    release_lock_script_ = scripts_.Register("release_lock", kReleaseLockScript);
+    prepare_broadcast_script_ = scripts_.Register("prepare_broadcast", kPrepareBroadcastScript);
 }
 
 RouteService::~RouteService() {
@@ -11,6 +40,7 @@ RouteService::~RouteService() {
 }
 
 bool RouteService::Init(const string& redis_host, int redis_port, const string& redis_password) {
+    std::lock_guard<std::mutex> lock(mutex_);
     redis_host_ = redis_host;
     redis_port_ = redis_port;
     redis_password_ = redis_password;
@@ -19,6 +49,11 @@ bool RouteService::Init(const string& redis_host, int redis_port, const string&
 }
 
 void RouteService::Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Disconnect();
+}
+
+void RouteService::Disconnect() {
     if (redis_context_) {
         redisFree(redis_context_);
         redis_context_ = nullptr;
@@ -26,10 +61,7 @@ void RouteService::Close() {
 }
 
 bool RouteService::Reconnect() {
-    if (redis_context_) {
-        redisFree(redis_context_);
-        redis_context_ = nullptr;
-    }
+    Disconnect();
 
     // 连接Redis，设置超时时间
     struct timeval timeout = { 2, 0 }; // 2秒超时
@@ -52,12 +84,18 @@ bool RouteService::Reconnect() {
         if (!reply || reply->type == REDIS_REPLY_ERROR) {
             LOG_ERROR << "Redis AUTH failed";
             if (reply) freeReplyObject(reply);
-            Close();
+            Disconnect();
             return false;
         }
         freeReplyObject(reply);
     }
 
+    // 脚本只在建连时上传一次，之后按 SHA1 调用；个别脚本加载失败时调用时会再试
+    if (!scripts_.LoadAll(redis_context_) && redis_context_->err) {
+        Disconnect();
+        return false;
+    }
+
     LOG_INFO << "Connected to Redis: " << redis_host_ << ":" << redis_port_;
     return true;
 }
@@ -68,18 +106,16 @@ bool RouteService::CheckConnection() {
         return Reconnect();
     }
 
-    // 发送 PING 测试连接
-    redisReply* reply = (redisReply*)redisCommand(redis_context_, "PING");
-    if (!reply || reply->type == REDIS_REPLY_ERROR) {
-        LOG_WARN << "Redis connection lost, reconnecting...";
-        if (reply) freeReplyObject(reply);
+    // 不再每次命令前 PING：上一条命令遇到 I/O 错误时 hiredis 会设置 err，这里据此重连
+    if (redis_context_->err) {
+        LOG_WARN << "Redis connection lost (" << redis_context_->errstr << "), reconnecting...";
         return Reconnect();
     }
-    freeReplyObject(reply);
     return true;
 }
 
 bool RouteService::GetRoomConnections(const string& room_id, vector<string>& conn_ids) {
+    std::lock_guard<std::mutex> lock(mutex_);
     if (!CheckConnection()) {
         return false;
     }
@@ -111,6 +147,7 @@ bool RouteService::GetRoomConnections(const string& room_id, vector<string>& con
 }
 
 string RouteService::GetConnectionCometAddr(const string& conn_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
     if (!CheckConnection()) {
         return "";
     }
@@ -135,20 +172,36 @@ string RouteService::GetConnectionCometAddr(const string& conn_id) {
 
 bool RouteService::GetConnectionInfoBatch(const vector<string>& conn_ids, 
                                           vector<ConnectionInfo>& conn_infos) {
+    std::lock_guard<std::mutex> lock(mutex_);
     if (!CheckConnection()) {
         return false;
     }
 
     conn_infos.clear();
+    if (conn_ids.empty()) {
+        return false;
+    }
 
+    // 所有 HGETALL 先追加到输出缓冲，一次写出再按顺序读回，N 个连接只有一次网络往返
     for (const auto& conn_id : conn_ids) {
         // HGETALL connection:info:{conn_id}
         string key = "connection:info:" + conn_id;
-        redisReply* reply = (redisReply*)redisCommand(redis_context_, "HGETALL %s", key.c_str());
+        const char* argv[2] = {"HGETALL", key.c_str()};
+        size_t argvlen[2] = {7, key.size()};
+        if (redisAppendCommandArgv(redis_context_, 2, argv, argvlen) != REDIS_OK) {
+            LOG_ERROR << "Redis append command failed: HGETALL " << key;
+            Disconnect();
+            return false;
+        }
+    }
 
-        if (!reply) {
-            LOG_ERROR << "Redis command failed: HGETALL " << key;
-            continue;
+    for (const auto& conn_id : conn_ids) {
+        redisReply* reply = nullptr;
+        if (redisGetReply(redis_context_, (void**)&reply) != REDIS_OK || !reply) {
+            // 连接状态已经不确定，剩下的回复丢弃，下次调用时重连
+            LOG_ERROR << "Redis command failed: HGETALL connection:info:" << conn_id;
+            Disconnect();
+            return !conn_infos.empty();
         }
 
         if (reply->type == REDIS_REPLY_ARRAY && reply->elements > 0) {
@@ -159,8 +212,8 @@ bool RouteService::GetConnectionInfoBatch(const vector<string>& conn_ids,
             for (size_t i = 0; i < reply->elements; i += 2) {
                 if (i + 1 >= reply->elements) break;
 
-                string field = reply->element[i]->str;
-                string value = reply->element[i + 1]->str;
+                string field(reply->element[i]->str, reply->element[i]->len);
+                string value(reply->element[i + 1]->str, reply->element[i + 1]->len);
 
                 if (field == "comet_id") {
                     info.comet_addr = value;
@@ -184,13 +237,9 @@ bool RouteService::GetConnectionInfoBatch(const vector<string>& conn_ids,
 
 bool RouteService::GroupConnectionsByComet(const vector<string>& conn_ids, 
                                            map<string, vector<string>>& comet_groups) {
-    if (!CheckConnection()) {
-        return false;
-    }
-
     comet_groups.clear();
 
-    // 批量查询连接信息并分组
+    // 批量查询连接信息并分组（连接检查在 GetConnectionInfoBatch 中做）
     vector<ConnectionInfo> conn_infos;
     if (!GetConnectionInfoBatch(conn_ids, conn_infos)) {
         LOG_WARN << "Failed to get connection info for grouping";
@@ -209,6 +258,7 @@ bool RouteService::GroupConnectionsByComet(const vector<string>& conn_ids,
 }
 
 bool RouteService::IsUserOnline(const string& user_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
     if (!CheckConnection()) {
         return false;
     }
@@ -229,6 +279,7 @@ bool RouteService::IsUserOnline(const string& user_id) {
 }
 
 string RouteService::GetUserConnectionId(const string& user_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
     if (!CheckConnection()) {
         return "";
     }
@@ -254,6 +305,7 @@ string RouteService::GetUserConnectionId(const string& user_id) {
 // ==================== 分布式锁实现 ====================
 
 bool RouteService::AcquireLock(const string& lock_key, const string& lock_value, int ttl_seconds) {
+    std::lock_guard<std::mutex> lock(mutex_);
     if (!CheckConnection()) {
         return false;
     }
@@ -282,24 +334,18 @@ bool RouteService::AcquireLock(const string& lock_key, const string& lock_value,
 }
 
 bool RouteService::ReleaseLock(const string& lock_key, const string& lock_value) {
+    std::lock_guard<std::mutex> lock(mutex_);
     if (!CheckConnection()) {
         return false;
     }
 
     // Lua 脚本：确保只有持有锁的客户端才能释放（避免误删）
     // 原子操作：先检查值是否匹配，再删除
-    const char* lua_script = 
-        "if redis.call('get', KEYS[1]) == ARGV[1] then "
-        "    return redis.call('del', KEYS[1]) "
-        "else "
-        "    return 0 "
-        "end";
-
     vector<string> keys = {lock_key};
     vector<string> args = {lock_value};
     
     long long result = 0;
-    bool success = ExecuteLuaScript(lua_script, keys, args, &result);
+    bool success = ExecuteLuaScript(release_lock_script_, keys, args, &result);
     
     if (success && result == 1) {
         LOG_DEBUG << "Lock released: " << lock_key;
@@ -313,6 +359,7 @@ bool RouteService::ReleaseLock(const string& lock_key, const string& lock_value)
 // ==================== 消息去重实现 ====================
 
 bool RouteService::CheckAndMarkMessageProcessed(const string& msg_id, const string& room_id, int ttl_seconds) {
+    std::lock_guard<std::mutex> lock(mutex_);
     if (!CheckConnection()) {
         return false; // 连接失败，保守处理：认为未处理
     }
@@ -345,6 +392,7 @@ bool RouteService::CheckAndMarkMessageProcessed(const string& msg_id, const stri
 }
 
 bool RouteService::IsRoomInCooldown(const string& room_id, int cooldown_seconds) {
+    std::lock_guard<std::mutex> lock(mutex_);
     if (!CheckConnection()) {
         return false; // 连接失败，允许继续（避免阻塞）
     }
@@ -376,50 +424,72 @@ bool RouteService::IsRoomInCooldown(const string& room_id, int cooldown_seconds)
     return in_cooldown; // true=在冷却期（应该跳过），false=不在冷却期（可以广播）
 }
 
-// ==================== Lua 脚本执行 ====================
+// ==================== 广播前的合并检查 ====================
 
-bool RouteService::ExecuteLuaScript(const string& script, const vector<string>& keys, 
-                                     const vector<string>& args, long long* result) {
+int RouteService::PrepareRoomBroadcast(const string& msg_id, const string& room_id, const string& lock_value,
+                                       int dedup_ttl_seconds, int cooldown_seconds, int lock_ttl_seconds,
+                                       map<string, vector<string>>& comet_groups) {
+    comet_groups.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
     if (!CheckConnection()) {
-        return false;
+        return BROADCAST_ERROR;
     }
 
-    // 构建 EVAL 命令参数
-    // EVAL script numkeys key1 key2 ... arg1 arg2 ...
-    vector<const char*> argv;
-    vector<size_t> argvlen;
-
-    // 命令名
-    argv.push_back("EVAL");
-    argvlen.push_back(4);
-
-    // 脚本
-    argv.push_back(script.c_str());
-    argvlen.push_back(script.length());
+    ScriptCall call;
+    call.script = prepare_broadcast_script_;
+    call.keys = {"msg:processed:" + room_id + ":" + msg_id,
+                 "room:cooldown:" + room_id,
+                 "lock:broadcast:" + room_id,
+                 "room:connections:" + room_id};
+    call.args = {std::to_string(dedup_ttl_seconds), std::to_string(cooldown_seconds), lock_value,
+                 std::to_string(lock_ttl_seconds), "connection:info:"};
 
-    // key 数量
-    string numkeys = std::to_string(keys.size());
-    argv.push_back(numkeys.c_str());
-    argvlen.push_back(numkeys.length());
+    redisReply* reply = scripts_.Eval(redis_context_, call);
+    if (!reply) {
+        LOG_ERROR << "Lua script execution failed: prepare_broadcast " << room_id;
+        Disconnect();
+        return BROADCAST_ERROR;
+    }
+    if (reply->type != REDIS_REPLY_ARRAY || reply->elements == 0 ||
+        reply->element[0]->type != REDIS_REPLY_INTEGER) {
+        LOG_ERROR << "Unexpected prepare_broadcast reply: "
+                  << (reply->type == REDIS_REPLY_ERROR ? reply->str : std::to_string(reply->type));
+        freeReplyObject(reply);
+        return BROADCAST_ERROR;
+    }
 
-    // keys
-    for (const auto& key : keys) {
-        argv.push_back(key.c_str());
-        argvlen.push_back(key.length());
+    int status = static_cast<int>(reply->element[0]->integer);
+    if (status == BROADCAST_READY) {
+        for (size_t i = 1; i + 1 < reply->elements; i += 2) {
+            string conn_id(reply->element[i]->str, reply->element[i]->len);
+            string comet_addr(reply->element[i + 1]->str, reply->element[i + 1]->len);
+            comet_groups[comet_addr].push_back(conn_id);
+        }
+        LOG_DEBUG << "Room " << room_id << " ready to broadcast: " << (reply->elements - 1) / 2
+                  << " connections on " << comet_groups.size() << " comet nodes";
     }
+    freeReplyObject(reply);
+    return status;
+}
 
-    // args
-    for (const auto& arg : args) {
-        argv.push_back(arg.c_str());
-        argvlen.push_back(arg.length());
+// ==================== Lua 脚本执行 ====================
+
+bool RouteService::ExecuteLuaScript(int script, const vector<string>& keys, 
+                                     const vector<string>& args, long long* result) {
+    if (!CheckConnection()) {
+        return false;
     }
 
-    // 执行命令
-    redisReply* reply = (redisReply*)redisCommandArgv(redis_context_, 
-        argv.size(), &argv[0], &argvlen[0]);
+    // EVALSHA sha numkeys key1 key2 ... arg1 arg2 ...，脚本不在 Redis 缓存中时自动重新加载
+    ScriptCall call;
+    call.script = script;
+    call.keys = keys;
+    call.args = args;
+    redisReply* reply = scripts_.Eval(redis_context_, call);
 
     if (!reply) {
-        LOG_ERROR << "Lua script execution failed";
+        LOG_ERROR << "Lua script execution failed: " << scripts_.GetName(script);
+        Disconnect();
         return false;
     }
 
@@ -431,6 +501,8 @@ bool RouteService::ExecuteLuaScript(const string& script, const vector<string>&
         success = true;
     } else if (reply->type == REDIS_REPLY_STATUS || reply->type == REDIS_REPLY_STRING) {
         success = true;
+    } else if (reply->type == REDIS_REPLY_ERROR) {
+        LOG_ERROR << "Lua script " << scripts_.GetName(script) << " error: " << reply->str;
     } else {
         LOG_ERROR << "Unexpected Lua script reply type: " << reply->type;
     }
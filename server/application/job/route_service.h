@@ -6,8 +6,10 @@
 #include <map>
 #include <set>
 #include <memory>
+#include <mutex>
 #include <hiredis/hiredis.h>
 #include <muduo/base/Logging.h>
+#include "redis_script.h"
 
 using namespace std;
 
@@ -36,6 +38,15 @@ struct ConnectionInfo {
     string room_id;      // 房间ID
 };
 
+// PrepareRoomBroadcast 的结果
+enum BroadcastPrepareResult {
+    BROADCAST_READY = 0,        // 已加锁，comet_groups 为本次要推送的节点
+    BROADCAST_DUPLICATE = 1,    // 消息已处理过
+    BROADCAST_COOLDOWN = 2,     // 房间在冷却期
+    BROADCAST_LOCKED = 3,       // 其他消费者正在处理该房间
+    BROADCAST_ERROR = 4,        // Redis 出错
+};
+
 // 路由服务 - 负责管理连接和路由信息
 class RouteService {
 public:
@@ -144,20 +155,44 @@ public:
      */
     bool IsRoomInCooldown(const string& room_id, int cooldown_seconds = 1);
 
+    // ==================== 广播前的合并检查 ====================
+
+    /**
+     * 一次脚本调用完成 去重 -> 冷却 -> 加锁 -> 查询房间连接和所在 Comet，
+     * 语义与依次调用 CheckAndMarkMessageProcessed、IsRoomInCooldown、AcquireLock、
+     * GroupConnectionsByComet 相同，但只有一次网络往返
+     * @param lock_value 锁的值，返回 BROADCAST_READY 时需要用它 ReleaseLock
+     * @param comet_groups 返回 BROADCAST_READY 时为分组结果: comet_addr -> [conn_id1, ...]
+     * @return BroadcastPrepareResult
+     */
+    int PrepareRoomBroadcast(const string& msg_id, const string& room_id, const string& lock_value,
+                             int dedup_ttl_seconds, int cooldown_seconds, int lock_ttl_seconds,
+                             map<string, vector<string>>& comet_groups);
+
 private:
     redisContext* redis_context_;
     string redis_host_;
     int redis_port_;
     string redis_password_;
+    // 多个消费者线程共用一个连接，每次访问 redis_context_ 都要持有
+    std::mutex mutex_;
 
+    RedisScriptRegistry scripts_;
+    int release_lock_script_;
+    int prepare_broadcast_script_;
+
+    // 以下函数调用时已持有 mutex_
     // 重新连接Redis
     bool Reconnect();
 
+    // 断开连接
+    void Disconnect();
+
     // 检查Redis连接状态
     bool CheckConnection();
     
-    // 执行 Lua 脚本（用于原子操作）
-    bool ExecuteLuaScript(const string& script, const vector<string>& keys, 
+    // 执行注册过的 Lua 脚本（用于原子操作）
+    bool ExecuteLuaScript(int script, const vector<string>& keys, 
                           const vector<string>& args, long long* result = nullptr);
 };
 
@@ -9,6 +9,7 @@
 #include "kafka_producer.h"
 #include "ChatRoom.Job.pb.h"
 #include "http_parser.h"
+#include "application/chat-room/base/msg_id_generator.h"
 using namespace muduo;
 using namespace muduo::net;
 // 封装 JSON 字符串为 HTTP 响应
@@ -114,8 +115,12 @@ private:
             }
 
             Json::Value messageObj;
-            // 生成消息ID: 时间戳-索引
-            std::string messageId = std::to_string(Timestamp::now().microSecondsSinceEpoch() / 1000) + "-0";
+            // 沿用 comet 生成的消息ID，和广播、Redis、MySQL 中的是同一个；
+            // 直接调用 /logic/send 没有带ID时在本地生成（节点号 1023），不会和 comet 的ID冲突
+            std::string messageId = message.isMember("id") ? message["id"].asString() : "";
+            if (messageId.empty()) {
+                messageId = MsgIdGenerator::GetInstance().NextId();
+            }
             messageObj["id"] = messageId;
             messageObj["content"] = message["content"].asString();
             
@@ -188,6 +193,7 @@ private:
 int main() {
     // 创建producer实例
     KafkaProducer producer;
+    MsgIdGenerator::GetInstance().SetNodeId(MsgIdGenerator::kMaxNodeId);
 
     LOG_INFO << "HTTP server starting...";
     EventLoop loop;